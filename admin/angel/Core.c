@@ -19,6 +19,7 @@
 #include "admin/AuthorizedPasswords.h"
 #include "benc/Dict.h"
 #include "benc/Int.h"
+#include "benc/List.h"
 #include "benc/serialization/standard/BencMessageReader.h"
 #include "benc/serialization/standard/BencMessageWriter.h"
 #include "crypto/AddressCalc.h"
@@ -198,6 +199,8 @@ static Err_DEFUN initSocket2(String* socketFullPath, struct Context* ctx)
 static Err_DEFUN initTunnel2(String* desiredDeviceName,
                         struct Context* ctx,
                         uint8_t addressPrefix,
+                        int queues,
+                        bool offload,
                         struct Allocator* errAlloc)
 {
     Log_debug(ctx->logger, "Initializing TUN device [%s]",
@@ -213,10 +216,12 @@ static Err_DEFUN initTunnel2(String* desiredDeviceName,
         ctx->tun = NULL;
     }
     ctx->tunAlloc = Allocator_child(ctx->alloc);
-    Err(TUNInterface_new(
+    Err(TUNInterface_newWith(
         &ctx->tun,
         desiredName,
         assignedTunName,
+        queues,
+        offload,
         ctx->logger,
         ctx->tunAlloc));
 
@@ -297,6 +302,150 @@ static void stopTun(Gcc_UNUSED Dict* args, void* vcontext, String* txid, struct
     }
 }
 
+static void coreThread(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    int64_t* start = Dict_getIntC(args, "start");
+    int64_t* cpu = Dict_getIntC(args, "cpu");
+    if (start && *start) {
+        RTypes_Error_t* err = Rffi_startCoreThread((cpu) ? *cpu : -1, requestAlloc);
+        if (err) {
+            char* error = Rffi_printError(err, requestAlloc);
+            sendResponse(String_new(error, requestAlloc), ctx->admin, txid, requestAlloc);
+            return;
+        }
+    }
+    Dict* output = Dict_new(requestAlloc);
+    Dict_putStringCC(output, "error", "none", requestAlloc);
+    RTypes_CoreThread_Stats_t st;
+    bool running = Rffi_coreThreadStats(&st);
+    Dict_putIntC(output, "running", running, requestAlloc);
+    if (running) {
+        Dict_putIntC(output, "submitters", st.submitters, requestAlloc);
+        Dict_putIntC(output, "submitted", st.submitted, requestAlloc);
+        Dict_putIntC(output, "ringFull", st.ring_full, requestAlloc);
+        Dict_putIntC(output, "rounds", st.rounds, requestAlloc);
+        Dict_putIntC(output, "wakeups", st.wakeups, requestAlloc);
+    }
+    Admin_sendMessage(output, txid, ctx->admin);
+}
+
+static void runtime(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    int64_t* socketWorkers = Dict_getIntC(args, "socketWorkers");
+    int64_t* udpWorkers = Dict_getIntC(args, "udpWorkers");
+    int64_t* ioUring = Dict_getIntC(args, "ioUring");
+    int64_t* replayWindow = Dict_getIntC(args, "replayWindow");
+    int64_t* handshakeWorkers = Dict_getIntC(args, "handshakeWorkers");
+    if ((socketWorkers && (*socketWorkers < 0 || *socketWorkers > 256)) ||
+        (udpWorkers && (*udpWorkers < 0 || *udpWorkers > 256)))
+    {
+        sendResponse(String_CONST("workers must be between 0 (automatic) and 256"),
+            ctx->admin, txid, requestAlloc);
+        return;
+    }
+    if (replayWindow && (*replayWindow < 64 || *replayWindow > 8192)) {
+        sendResponse(String_CONST("replayWindow must be between 64 and 8192"),
+            ctx->admin, txid, requestAlloc);
+        return;
+    }
+    if (handshakeWorkers && (*handshakeWorkers < 0 || *handshakeWorkers > 64)) {
+        sendResponse(String_CONST("handshakeWorkers must be between 0 and 64"),
+            ctx->admin, txid, requestAlloc);
+        return;
+    }
+    if (handshakeWorkers) {
+        RTypes_Error_t* err = Rffi_CryptoAuth2_startHandshakeWorkers(*handshakeWorkers, requestAlloc);
+        if (err) {
+            char* error = Rffi_printError(err, requestAlloc);
+            sendResponse(String_new(error, requestAlloc), ctx->admin, txid, requestAlloc);
+            return;
+        }
+    }
+    Rffi_setInterfaceWorkers((socketWorkers) ? *socketWorkers : -1,
+                             (udpWorkers) ? *udpWorkers : -1,
+                             (ioUring) ? (*ioUring != 0) : -1);
+    uint32_t window = Ca_replayWindow(ctx->nc->ca, (replayWindow) ? *replayWindow : 0);
+    RTypes_RuntimeTopology_t t;
+    Rffi_runtimeTopology(&t);
+    Dict* output = Dict_new(requestAlloc);
+    Dict_putStringCC(output, "error", "none", requestAlloc);
+    Dict_putIntC(output, "threads", t.runtime_threads, requestAlloc);
+    Dict_putIntC(output, "pinThreads", t.pin_threads, requestAlloc);
+    Dict_putIntC(output, "numaNode", t.numa_node, requestAlloc);
+    Dict_putIntC(output, "cpus", t.cpus, requestAlloc);
+    Dict_putIntC(output, "socketWorkers", t.socket_workers, requestAlloc);
+    Dict_putIntC(output, "udpWorkers", t.udp_workers, requestAlloc);
+    Dict_putIntC(output, "ioUring", t.io_uring, requestAlloc);
+    Dict_putIntC(output, "replayWindow", window, requestAlloc);
+    RTypes_HandshakePool_Stats_t hs;
+    Rffi_CryptoAuth2_handshakeStats(&hs);
+    Dict_putIntC(output, "handshakeWorkers", hs.workers, requestAlloc);
+    Admin_sendMessage(output, txid, ctx->admin);
+}
+
+static void handshakes(Dict* Gcc_UNUSED args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    RTypes_HandshakePool_Stats_t hs;
+    Rffi_CryptoAuth2_handshakeStats(&hs);
+    Dict* output = Dict_new(requestAlloc);
+    Dict_putStringCC(output, "error", "none", requestAlloc);
+    Dict_putIntC(output, "workers", hs.workers, requestAlloc);
+    Dict_putIntC(output, "queued", hs.queued, requestAlloc);
+    Dict_putIntC(output, "completed", hs.completed, requestAlloc);
+    Dict_putIntC(output, "rateLimited", hs.rate_limited, requestAlloc);
+    Dict_putIntC(output, "retryRequired", hs.retry_required, requestAlloc);
+    Dict_putIntC(output, "queueFull", hs.queue_full, requestAlloc);
+    Admin_sendMessage(output, txid, ctx->admin);
+}
+
+static Dict* gclHistogram(RTypes_GclProfile_Histogram_t* h, struct Allocator* alloc)
+{
+    Dict* out = Dict_new(alloc);
+    Dict_putIntC(out, "count", h->count, alloc);
+    Dict_putIntC(out, "totalNs", h->total_ns, alloc);
+    Dict_putIntC(out, "maxNs", h->max_ns, alloc);
+    // Leave off the empty buckets at the end, bucket i is up to 2^i ns
+    int last = -1;
+    for (int i = 0; i < (int) (sizeof(h->buckets) / sizeof(h->buckets[0])); i++) {
+        if (h->buckets[i]) { last = i; }
+    }
+    List* buckets = List_new(alloc);
+    for (int i = 0; i <= last; i++) {
+        List_addInt(buckets, h->buckets[i], alloc);
+    }
+    Dict_putListC(out, "log2Buckets", buckets, alloc);
+    return out;
+}
+
+static void gclProfile(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    int64_t* enable = Dict_getIntC(args, "enable");
+    int64_t* reset = Dict_getIntC(args, "reset");
+    if (reset && *reset) {
+        Rffi_gclProfile_reset();
+    }
+    if (enable) {
+        Rffi_gclProfile_setEnabled(*enable != 0);
+    }
+    Dict* output = Dict_new(requestAlloc);
+    Dict_putStringCC(output, "error", "none", requestAlloc);
+    Dict_putIntC(output, "enabled", Rffi_gclProfile_enabled(), requestAlloc);
+    Dict* sites = Dict_new(requestAlloc);
+    RTypes_GclProfile_Site_t site;
+    for (uint32_t i = 0; Rffi_gclProfile_site(&site, i); i++) {
+        Dict* d = Dict_new(requestAlloc);
+        Dict_putDictC(d, "wait", gclHistogram(&site.wait, requestAlloc), requestAlloc);
+        Dict_putDictC(d, "hold", gclHistogram(&site.hold, requestAlloc), requestAlloc);
+        Dict_putDictC(sites, site.name, d, requestAlloc);
+    }
+    Dict_putDictC(output, "sites", sites, requestAlloc);
+    Admin_sendMessage(output, txid, ctx->admin);
+}
+
 static void tunWorkers(Dict* Gcc_UNUSED args, void* vcontext, String* txid, struct Allocator* requestAlloc)
 {
     struct Context* ctx = Identity_check((struct Context*) vcontext);
@@ -313,6 +462,7 @@ static void tunWorkers(Dict* Gcc_UNUSED args, void* vcontext, String* txid, stru
         } else {
             Dict* output = Dict_new(requestAlloc);
             Dict_putStringCC(output, "error", "none", requestAlloc);
+            Dict_putIntC(output, "queues", TUNInterface_queueCount(ctx->tun), requestAlloc);
             Dict_putObject(output, String_CONST("workers"), workers, requestAlloc);
             Admin_sendMessage(output, txid, ctx->admin);
         }
@@ -329,7 +479,17 @@ static void initTunnel(Dict* args, void* vcontext, String* txid, struct Allocato
 {
     struct Context* const ctx = Identity_check((struct Context*) vcontext);
     String* desiredName = Dict_getStringC(args, "desiredTunName");
-    RTypes_Error_t* err = initTunnel2(desiredName, ctx, AddressCalc_ADDRESS_PREFIX_BITS, requestAlloc);
+    int64_t* queuesP = Dict_getIntC(args, "queues");
+    if (queuesP && (*queuesP < 0 || *queuesP > 256)) {
+        sendResponse(String_CONST("queues must be between 0 (one per worker) and 256"),
+            ctx->admin, txid, requestAlloc);
+        return;
+    }
+    int queues = (queuesP) ? *queuesP : 1;
+    int64_t* offloadP = Dict_getIntC(args, "offload");
+    bool offload = (offloadP) ? *offloadP : false;
+    RTypes_Error_t* err = initTunnel2(
+        desiredName, ctx, AddressCalc_ADDRESS_PREFIX_BITS, queues, offload, requestAlloc);
     if (err) {
         String* error = String_printf(requestAlloc, "Failed to configure tunnel [%s]",
             Rffi_printError(err, requestAlloc));
@@ -457,7 +617,9 @@ Err_DEFUN Core_init(struct Allocator* alloc,
 
     Admin_registerFunction("Core_initTunnel", initTunnel, ctx, true,
         ((struct Admin_FunctionArg[]) {
-            { .name = "desiredTunName", .required = 0, .type = "String" }
+            { .name = "desiredTunName", .required = 0, .type = "String" },
+            { .name = "queues", .required = 0, .type = "Int" },
+            { .name = "offload", .required = 0, .type = "Int" }
         }), admin);
 
     Admin_registerFunction("Core_initTunfd", initTunfd, ctx, true,
@@ -477,6 +639,29 @@ Err_DEFUN Core_init(struct Allocator* alloc,
         }), admin);
 
     Admin_registerFunctionNoArgs("Core_tunWorkers", tunWorkers, ctx, true, admin);
+
+    Admin_registerFunction("Core_coreThread", coreThread, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "start", .required = 0, .type = "Int" },
+            { .name = "cpu", .required = 0, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunction("Core_runtime", runtime, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "socketWorkers", .required = 0, .type = "Int" },
+            { .name = "udpWorkers", .required = 0, .type = "Int" },
+            { .name = "ioUring", .required = 0, .type = "Int" },
+            { .name = "replayWindow", .required = 0, .type = "Int" },
+            { .name = "handshakeWorkers", .required = 0, .type = "Int" }
+        }), admin);
+
+    Admin_registerFunctionNoArgs("Core_handshakes", handshakes, ctx, true, admin);
+
+    Admin_registerFunction("Core_gclProfile", gclProfile, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "enable", .required = 0, .type = "Int" },
+            { .name = "reset", .required = 0, .type = "Int" }
+        }), admin);
     return NULL;
 }
 
@@ -205,6 +205,34 @@ static void udpInterfaceSetBeacon(
     rpcCall(String_CONST("UDPInterface_setBroadcastDevices"), d, ctx, ctx->alloc);
 }
 
+static void runtime(Dict* runtimeConf, struct Context* ctx)
+{
+    if (!runtimeConf) { return; }
+    int64_t* socketWorkers = Dict_getIntC(runtimeConf, "socketWorkers");
+    int64_t* udpWorkers = Dict_getIntC(runtimeConf, "udpWorkers");
+    int64_t* ioUring = Dict_getIntC(runtimeConf, "ioUring");
+    int64_t* replayWindow = Dict_getIntC(runtimeConf, "replayWindow");
+    int64_t* handshakeWorkers = Dict_getIntC(runtimeConf, "handshakeWorkers");
+    if (!socketWorkers && !udpWorkers && !ioUring && !replayWindow && !handshakeWorkers) { return; }
+    Dict* d = Dict_new(ctx->alloc);
+    if (socketWorkers) {
+        Dict_putIntC(d, "socketWorkers", *socketWorkers, ctx->alloc);
+    }
+    if (udpWorkers) {
+        Dict_putIntC(d, "udpWorkers", *udpWorkers, ctx->alloc);
+    }
+    if (ioUring) {
+        Dict_putIntC(d, "ioUring", *ioUring, ctx->alloc);
+    }
+    if (replayWindow) {
+        Dict_putIntC(d, "replayWindow", *replayWindow, ctx->alloc);
+    }
+    if (handshakeWorkers) {
+        Dict_putIntC(d, "handshakeWorkers", *handshakeWorkers, ctx->alloc);
+    }
+    rpcCall(String_CONST("Core_runtime"), d, ctx, ctx->alloc);
+}
+
 static void udpInterface(Dict* config, struct Context* ctx)
 {
     List* ifaces = Dict_getListC(config, "UDPInterface");
@@ -229,6 +257,10 @@ static void udpInterface(Dict* config, struct Context* ctx)
         if (dscp) {
             Dict_putIntC(d, "dscp", *dscp, ctx->alloc);
         }
+        int64_t* shards = Dict_getIntC(udp, "shards");
+        if (shards) {
+            Dict_putIntC(d, "shards", *shards, ctx->alloc);
+        }
         int64_t* beaconPort_p = Dict_getIntC(udp, "beaconPort");
         uint16_t beaconPort = (beaconPort_p) ? *beaconPort_p : 0;
         int64_t* beaconP = Dict_getIntC(udp, "beacon");
@@ -240,6 +272,31 @@ static void udpInterface(Dict* config, struct Context* ctx)
 
         udpInterfaceSetBeacon(udp, beacon, beaconPort, ifNum, ctx);
 
+        int64_t* gso = Dict_getIntC(udp, "gso");
+        int64_t* gro = Dict_getIntC(udp, "gro");
+        if (gso || gro) {
+            Dict* off = Dict_new(ctx->alloc);
+            Dict_putIntC(off, "interfaceNumber", ifNum, ctx->alloc);
+            if (gso) { Dict_putIntC(off, "gso", *gso, ctx->alloc); }
+            if (gro) { Dict_putIntC(off, "gro", *gro, ctx->alloc); }
+            // Not supported by the kernel is not a reason to stop
+            rpcCall0(String_CONST("UDPInterface_offload"), off, ctx, ctx->alloc, NULL, false);
+        }
+
+        int64_t* xdp = Dict_getIntC(udp, "xdp");
+        String* xdpDevice = Dict_getStringC(udp, "xdpDevice");
+        if (xdp && *xdp && !xdpDevice) {
+            Log_warn(ctx->logger, "interfaces.UDPInterface.xdp is set without xdpDevice, "
+                                  "not using AF_XDP");
+        } else if (xdp && *xdp) {
+            Dict* x = Dict_new(ctx->alloc);
+            Dict_putIntC(x, "interfaceNumber", ifNum, ctx->alloc);
+            Dict_putStringC(x, "device", xdpDevice, ctx->alloc);
+            Dict_putIntC(x, "mode", *xdp, ctx->alloc);
+            // If AF_XDP can not be used, the socket receives everything as usual
+            rpcCall0(String_CONST("UDPInterface_xdp"), x, ctx, ctx->alloc, NULL, false);
+        }
+
         // Make the connections.
         Dict* connectTo = Dict_getDictC(udp, "connectTo");
         if (connectTo) {
@@ -309,6 +366,14 @@ static void tunInterface(Dict* ifaceConf, struct Allocator* tempAlloc, struct Co
         if (device) {
             Dict_putStringC(args, "desiredTunName", device, tempAlloc);
         }
+        int64_t* queues = Dict_getIntC(ifaceConf, "queues");
+        if (queues) {
+            Dict_putIntC(args, "queues", *queues, tempAlloc);
+        }
+        int64_t* offload = Dict_getIntC(ifaceConf, "offload");
+        if (offload) {
+            Dict_putIntC(args, "offload", *offload, tempAlloc);
+        }
         rpcCall0(String_CONST("Core_initTunnel"), args, ctx, tempAlloc, NULL, false);
     }
 }
@@ -485,6 +550,14 @@ static void ethInterfaceSetBeacon(int ifNum, Dict* eth, struct Context* ctx)
     }
 }
 
+static void ethInterfaceSetXdp(Dict* args, Dict* eth, struct Context* ctx)
+{
+    int64_t* xdpP = Dict_getIntC(eth, "xdp");
+    if (xdpP) {
+        Dict_putIntC(args, "xdp", *xdpP, ctx->alloc);
+    }
+}
+
 static void ethInterface(Dict* config, struct Context* ctx)
 {
     List* ifaces = Dict_getListC(config, "ETHInterface");
@@ -515,6 +588,7 @@ static void ethInterface(Dict* config, struct Context* ctx)
             // skip loopback...
             if (String_equals(String_CONST("lo"), deviceName)) { continue; }
             Dict_putStringC(d, "bindDevice", deviceName, ctx->alloc);
+            ethInterfaceSetXdp(d, eth, ctx);
             Dict* resp;
             Log_info(ctx->logger, "Creating new ETHInterface [%s]", deviceName->bytes);
             if (rpcCall0(String_CONST("ETHInterface_new"), d, ctx, ctx->alloc, &resp, false)) {
@@ -538,6 +612,7 @@ static void ethInterface(Dict* config, struct Context* ctx)
             Log_info(ctx->logger, "Binding to device [%s].", deviceStr->bytes);
             Dict_putStringC(d, "bindDevice", deviceStr, ctx->alloc);
         }
+        ethInterfaceSetXdp(d, eth, ctx);
         Dict* resp = NULL;
         if (rpcCall0(String_CONST("ETHInterface_new"), d, ctx, ctx->alloc, &resp, false)) {
             Log_warn(ctx->logger, "Failed to create ETHInterface.");
@@ -758,6 +833,9 @@ void Configurator_config(Dict* config,
         authorizedPasswords(authedPasswords, &ctx);
     }
 
+    // Must come before the interfaces are created
+    runtime(Dict_getDictC(config, "runtime"), &ctx);
+
     Dict* ifaces = Dict_getDictC(config, "interfaces");
     udpInterface(ifaces, &ctx);
 
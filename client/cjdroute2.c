@@ -167,6 +167,23 @@ static int genconf(struct Allocator* alloc, struct Random* rand, bool eth, bool
     printf("                // Set the DSCP value for Qos. Default is 0.\n"
            "                // \"dscp\": 46,\n"
            "\n"
+           "                // Bind this many sockets to the port using SO_REUSEPORT, each peer\n"
+           "                // is kept on one of them. 0 means one per UDP worker. Default is 1.\n"
+           "                // \"shards\": 0,\n"
+           "\n"
+           "                // Let the kernel segment runs of packets to one peer (gso) and\n"
+           "                // coalesce runs of packets from one peer (gro), so each run costs\n"
+           "                // one syscall. Experimental, Linux only, default is 0.\n"
+           "                // \"gso\": 1,\n"
+           "                // \"gro\": 1,\n"
+           "\n"
+           "                // Take datagrams for this port from xdpDevice with AF_XDP instead of\n"
+           "                // the socket, sending still uses the socket. Linux only, needs\n"
+           "                // CAP_NET_ADMIN and CAP_BPF. xdp is as for ETHInterface below,\n"
+           "                // default is 0. If AF_XDP can not be used, the socket is used.\n"
+           "                // \"xdp\": 1,\n"
+           "                // \"xdpDevice\": \"eth0\",\n"
+           "\n"
            "                // Automatically connect to other nodes on the same LAN\n"
            "                // This works by binding a second port and sending beacons\n"
            "                // containing the main data port.\n"
@@ -237,6 +254,15 @@ static int genconf(struct Allocator* alloc, struct Random* rand, bool eth, bool
            "                //\n"
            "                \"beacon\": 2,\n"
            "\n"
+           "                // Use AF_XDP (Linux only), frames for cjdns are taken from the\n"
+           "                // device by an XDP program without a syscall for each one.\n"
+           "                // 0 -- Disabled, use a packet socket.\n"
+           "                // 1 -- Run XDP in the driver if it supports it, otherwise generic.\n"
+           "                // 2 -- Generic XDP, works on any device but is slower.\n"
+           "                // 3 -- Run XDP in the driver only.\n"
+           "                // If AF_XDP can not be used, the packet socket is used instead.\n"
+           "                //\"xdp\": 1,\n"
+           "\n"
            "                // Node(s) to connect to manually\n"
            "                // Note: does not work with \"all\" pseudo-device-name\n"
            "                \"connectTo\": {\n"
@@ -305,7 +331,17 @@ static int genconf(struct Allocator* alloc, struct Random* rand, bool eth, bool
            "            // The name of a persistent TUN device to use.\n"
            "            // This for starting cjdroute as its own user.\n"
            "            // *MOST USERS DON'T NEED THIS*\n"
-           "            //\"tunDevice\": \"" DEFAULT_TUN_DEV "\"\n");
+           "            //\"tunDevice\": \"" DEFAULT_TUN_DEV "\",\n"
+           "\n"
+           "            // Open the TUN device with this many queues so that traffic from\n"
+           "            // local applications is read on multiple cores, 0 means one per\n"
+           "            // socket worker. Linux only, default is 1.\n"
+           "            //\"queues\": 0,\n"
+           "\n"
+           "            // Let the kernel pass TCP packets of up to 64KiB which cjdns segments\n"
+           "            // itself, this speeds up bulk TCP from local applications.\n"
+           "            // Linux only, default is 0.\n"
+           "            //\"offload\": 1\n");
 #endif
     printf("        },\n"
            "\n"
@@ -431,6 +467,38 @@ static int genconf(struct Allocator* alloc, struct Random* rand, bool eth, bool
            "        // \"logTo\": \"stdout\"\n"
            "    },\n"
            "\n"
+           "    // Threads and workers, by default these are chosen from the number of CPUs.\n"
+           "    \"runtime\": {\n"
+           "        // Number of threads which process packets.\n"
+           "        // \"threads\": 4,\n"
+           "\n"
+           "        // Send and receive workers for each TUN/socket interface and for each\n"
+           "        // UDP interface.\n"
+           "        // \"socketWorkers\": 2,\n"
+           "        // \"udpWorkers\": 2,\n"
+           "\n"
+           "        // Have TUN/socket interface workers use io_uring rather than epoll\n"
+           "        // (Linux only), off by default. Interfaces fall back to epoll if the\n"
+           "        // kernel lacks it.\n"
+           "        // \"ioUring\": 1,\n"
+           "\n"
+           "        // How far out of order (in packets) traffic from a peer can arrive\n"
+           "        // before it is dropped, between 64 and 8192, default 1024. More workers\n"
+           "        // and faster links reorder more.\n"
+           "        // \"replayWindow\": 1024,\n"
+           "\n"
+           "        // Threads which do handshakes with new peers, so that a flood of them\n"
+           "        // does not hold up traffic. 0 (the default) does them inline.\n"
+           "        // \"handshakeWorkers\": 2,\n"
+           "\n"
+           "        // Pin each thread to one CPU (Linux only).\n"
+           "        // \"pinThreads\": 1,\n"
+           "\n"
+           "        // Keep the threads, and therefore their packet buffers, on the CPUs\n"
+           "        // of one NUMA node (Linux only).\n"
+           "        // \"numaNode\": 0\n"
+           "    },\n"
+           "\n"
            "    // If set to non-zero, cjdns will not fork to the background.\n"
            "    // Recommended for use in conjunction with \"logTo\":\"stdout\".\n");
     printf("    \"noBackground\": %d,\n", Defined(win32) ? 1 : 0);
@@ -735,6 +803,17 @@ int cjdroute2_main(int argc, char** argv)
     if (!privateKey) {
         Assert_failure("Need to specify privateKey.");
     }
+    // Runtime threads are set up before the core can be configured, so they go in its environment.
+    Dict* runtimeConf = Dict_getDictC(config, "runtime");
+    if (runtimeConf) {
+        int64_t* threads = Dict_getIntC(runtimeConf, "threads");
+        int64_t* pinThreads = Dict_getIntC(runtimeConf, "pinThreads");
+        int64_t* numaNode = Dict_getIntC(runtimeConf, "numaNode");
+        Rffi_setRuntimeEnv((threads && *threads > 0 && *threads <= 1024) ? *threads : -1,
+                           (pinThreads) ? (*pinThreads != 0) : -1,
+                           (numaNode && *numaNode >= 0 && *numaNode < 1024) ? *numaNode : -1);
+    }
+
     Process_spawn(corePath, args, allocator, onCoreExit);
 
     // --------------------- Wait for socket ------------------------- //
@@ -112,6 +112,10 @@ static inline int Ca_getSecret(const Ca_t* ca, const String_t* name, uint8_t sec
 {
     return Ca_IMPL(getSecret)(ca, name, secretOut);
 }
+static inline uint32_t Ca_replayWindow(const Ca_t* ca, uint32_t window)
+{
+    return Ca_IMPL(replayWindow)(ca, window);
+}
 
 
 enum Ca_DecryptErr {
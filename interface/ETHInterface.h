@@ -49,10 +49,24 @@ struct ETHInterface
     AddrIface_t generic;
 };
 
+/** Frames go through an AF_PACKET socket. */
+#define ETHInterface_XDP_OFF 0
+/** AF_XDP with the XDP program in the driver if it supports it, otherwise generic. */
+#define ETHInterface_XDP_AUTO 1
+/** AF_XDP with the XDP program run after the skb is made, works on any device. */
+#define ETHInterface_XDP_GENERIC 2
+/** AF_XDP with the XDP program in the driver. */
+#define ETHInterface_XDP_NATIVE 3
+
+/**
+ * @param xdp one of ETHInterface_XDP_*, if AF_XDP can not be used then the
+ *            AF_PACKET socket is used instead. Only supported on Linux.
+ */
 Err_DEFUN ETHInterface_new(
     struct ETHInterface** out,
     EventBase_t* eventBase,
     const char* bindDevice,
+    int xdp,
     struct Allocator* alloc,
     struct Log* logger);
 
@@ -88,10 +88,19 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
 {
     struct Context* const ctx = Identity_check((struct Context*) vcontext);
     String* const bindDevice = Dict_getStringC(args, "bindDevice");
+    int64_t* xdpP = Dict_getIntC(args, "xdp");
+    int64_t xdp = (xdpP) ? *xdpP : ETHInterface_XDP_OFF;
+    if (xdp < ETHInterface_XDP_OFF || xdp > ETHInterface_XDP_NATIVE) {
+        Dict* out = Dict_new(requestAlloc);
+        Dict_putStringCC(out, "error", "xdp must be 0, 1, 2 or 3", requestAlloc);
+        Admin_sendMessage(out, txid, ctx->admin);
+        return;
+    }
     struct Allocator* const alloc = Allocator_child(ctx->alloc);
 
     struct ETHInterface* ethIf = NULL;
-    RTypes_Error_t* er = ETHInterface_new(&ethIf, ctx->eventBase, bindDevice->bytes, alloc, ctx->logger);
+    RTypes_Error_t* er =
+        ETHInterface_new(&ethIf, ctx->eventBase, bindDevice->bytes, (int) xdp, alloc, ctx->logger);
     if (er) {
         Dict* out = Dict_new(requestAlloc);
         const char* emsg = Rffi_printError(er, requestAlloc);
@@ -189,7 +198,8 @@ void ETHInterface_admin_register(EventBase_t* base,
 
     Admin_registerFunction("ETHInterface_new", newInterface, ctx, true,
         ((struct Admin_FunctionArg[]) {
-            { .name = "bindDevice", .required = 1, .type = "String" }
+            { .name = "bindDevice", .required = 1, .type = "String" },
+            { .name = "xdp", .required = 0, .type = "Int" }
         }), admin);
 
     Admin_registerFunction("ETHInterface_beginConnection",
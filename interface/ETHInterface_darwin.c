@@ -261,6 +261,7 @@ Err_DEFUN ETHInterface_new(
     struct ETHInterface** out,
     EventBase_t* eventBase,
     const char* bindDevice,
+    int xdp,
     struct Allocator* alloc,
     struct Log* logger)
 {
@@ -271,6 +272,10 @@ Err_DEFUN ETHInterface_new(
     ctx->pub.generic.alloc = alloc;
     ctx->logger = logger;
 
+    if (xdp != ETHInterface_XDP_OFF) {
+        Log_debug(logger, "AF_XDP is not supported on this platform, ignoring");
+    }
+
     ctx->socket = -1;
     Err(openBPF(&ctx->socket, alloc));
     Err(macaddr(bindDevice, ctx->myMac, alloc));
@@ -24,6 +24,7 @@
 #include "util/events/Event.h"
 #include "util/Identity.h"
 #include "util/CString.h"
+#include "rust/cjdns_sys/Rffi.h"
 
 #include <string.h>
 #include <sys/socket.h>
@@ -61,9 +62,27 @@ struct ETHInterface_pvt
 
     String* ifName;
 
+    /**
+     * Connected to the AF_XDP sockets or the PACKET_MMAP ring, if neither could be set
+     * up then this is not plumbed and frames go through sendto() / recvfrom() instead.
+     */
+    Iface_t ringIface;
+    Rffi_EthIface_t* ring;
+    Rffi_XdpIface_t* xdp;
+
     Identity
 };
 
+/** Prefixed to frames going to and from the ring, see Rffi_ethIfaceNew(). */
+struct ETHInterface_RingHeader
+{
+    uint8_t mac[6];
+    uint8_t pkttype;
+    uint8_t pad;
+};
+#define ETHInterface_RingHeader_SIZE 8
+Assert_compileTime(sizeof(struct ETHInterface_RingHeader) == ETHInterface_RingHeader_SIZE);
+
 static void sendMessageInternal(Message_t* message,
                                 struct sockaddr_ll* addr,
                                 struct ETHInterface_pvt* context)
@@ -120,44 +139,32 @@ static Iface_DEFUN sendMessage(Message_t* msg, struct Iface* iface)
         .fc00_be = Endian_hostToBigEndian16(0xfc00)
     };
     Err(Message_epush(msg, &hdr, ETHInterface_Header_SIZE));
+    if (ctx->ringIface.connectedIf) {
+        struct ETHInterface_RingHeader rh = { .pkttype = 0 };
+        Bits_memcpy(rh.mac, addr.sll_addr, 6);
+        Err(Message_epush(msg, &rh, ETHInterface_RingHeader_SIZE));
+        return Iface_next(&ctx->ringIface, msg);
+    }
     sendMessageInternal(msg, &addr, ctx);
     return NULL;
 }
 
-static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* messageAlloc)
+/**
+ * Check the ETHInterface_Header and replace it with the sender's Sockaddr.
+ * @return true if the frame should be dropped.
+ */
+static bool parseFrame(struct ETHInterface_pvt* context,
+                       Message_t* msg,
+                       const uint8_t* mac,
+                       uint8_t pkttype)
 {
-    Message_t* msg = Message_new(MAX_PACKET_SIZE, PADDING, messageAlloc);
-
-    struct sockaddr_ll addr;
-    uint32_t addrLen = sizeof(struct sockaddr_ll);
-
-    // Knock it out of alignment by 2 bytes so that it will be
-    // aligned when the idAndPadding is shifted off.
-    Err_assert(Message_eshift(msg, 2));
-
-    int rc = recvfrom(context->socket,
-                      Message_bytes(msg),
-                      Message_getLength(msg),
-                      0,
-                      (struct sockaddr*) &addr,
-                      &addrLen);
-
-    if (rc < ETHInterface_Header_SIZE) {
-        Log_debug(context->logger, "Failed to receive eth frame");
-        return;
-    }
-
-    Err_assert(Message_truncate(msg, rc));
-
-    //Assert_true(addrLen == SOCKADDR_LL_LEN);
-
     struct ETHInterface_Header hdr;
     Err_assert(Message_epop(msg, &hdr, ETHInterface_Header_SIZE));
 
     // here we could put a switch statement to handle different versions differently.
     if (hdr.version != ETHInterface_CURRENT_VERSION) {
         Log_debug(context->logger, "DROP unknown version");
-        return;
+        return true;
     }
 
     uint16_t reportedLength = Endian_bigEndianToHost16(hdr.length_be);
@@ -165,24 +172,73 @@ static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* mes
     if (Message_getLength(msg) != reportedLength) {
         if (Message_getLength(msg) < reportedLength) {
             Log_debug(context->logger, "DROP size field is larger than frame");
-            return;
+            return true;
         }
         Err_assert(Message_truncate(msg, reportedLength));
     }
     if (hdr.fc00_be != Endian_hostToBigEndian16(0xfc00)) {
         Log_debug(context->logger, "DROP bad magic");
-        return;
+        return true;
     }
 
     struct Sockaddr_storage ss;
-    Sockaddr_initFromEth(&ss, addr.sll_addr);
-    if (addr.sll_pkttype == PACKET_BROADCAST) {
+    Sockaddr_initFromEth(&ss, mac);
+    if (pkttype == PACKET_BROADCAST) {
         ss.addr.flags |= Sockaddr_flags_BCAST;
     }
 
     Err_assert(Sockaddr_write(&ss.addr, msg));
 
     Assert_true(!((uintptr_t)Message_bytes(msg) % 4) && "Alignment fault");
+    return false;
+}
+
+static Iface_DEFUN ringRecv(Message_t* msg, struct Iface* iface)
+{
+    struct ETHInterface_pvt* ctx =
+        Identity_containerOf(iface, struct ETHInterface_pvt, ringIface);
+    if (Message_getLength(msg) < ETHInterface_RingHeader_SIZE + ETHInterface_Header_SIZE) {
+        Log_debug(ctx->logger, "DROP runt frame");
+        return NULL;
+    }
+    struct ETHInterface_RingHeader rh;
+    Err(Message_epop(msg, &rh, ETHInterface_RingHeader_SIZE));
+    if (parseFrame(ctx, msg, rh.mac, rh.pkttype)) {
+        return NULL;
+    }
+    return Iface_next(ctx->pub.generic.iface, msg);
+}
+
+static void handleEvent2(struct ETHInterface_pvt* context, struct Allocator* messageAlloc)
+{
+    Message_t* msg = Message_newPooled(MAX_PACKET_SIZE, PADDING, messageAlloc);
+
+    struct sockaddr_ll addr;
+    uint32_t addrLen = sizeof(struct sockaddr_ll);
+
+    // Knock it out of alignment by 2 bytes so that it will be
+    // aligned when the idAndPadding is shifted off.
+    Err_assert(Message_eshift(msg, 2));
+
+    int rc = recvfrom(context->socket,
+                      Message_bytes(msg),
+                      Message_getLength(msg),
+                      0,
+                      (struct sockaddr*) &addr,
+                      &addrLen);
+
+    if (rc < ETHInterface_Header_SIZE) {
+        Log_debug(context->logger, "Failed to receive eth frame");
+        return;
+    }
+
+    Err_assert(Message_truncate(msg, rc));
+
+    //Assert_true(addrLen == SOCKADDR_LL_LEN);
+
+    if (parseFrame(context, msg, addr.sll_addr, addr.sll_pkttype)) {
+        return;
+    }
 
     Iface_send(context->pub.generic.iface, msg);
 }
@@ -215,33 +271,21 @@ Err_DEFUN ETHInterface_listDevices(List** outP, struct Allocator* alloc)
 static void closeSocket(struct Allocator_OnFreeJob* j)
 {
     struct ETHInterface_pvt* ctx = Identity_check((struct ETHInterface_pvt*) j->userData);
-    close(ctx->socket);
+    if (ctx->socket != -1) {
+        close(ctx->socket);
+    }
 }
 
-Err_DEFUN ETHInterface_new(
-    struct ETHInterface** out,
-    EventBase_t* eventBase,
-    const char* bindDevice,
-    struct Allocator* alloc,
-    struct Log* logger)
+static Err_DEFUN openSocket(struct ETHInterface_pvt* ctx, int type, struct Allocator* alloc)
 {
-    struct ETHInterface_pvt* ctx = Allocator_calloc(alloc, sizeof(struct ETHInterface_pvt), 1);
-    Identity_set(ctx);
-    ctx->iface.send = sendMessage;
-    ctx->pub.generic.iface = &ctx->iface;
-    ctx->pub.generic.alloc = alloc;
-    ctx->logger = logger;
-
     struct ifreq ifr = { .ifr_ifindex = 0 };
 
-    ctx->socket = socket(AF_PACKET, SOCK_DGRAM, Ethernet_TYPE_CJDNS);
+    ctx->socket = socket(AF_PACKET, type, Ethernet_TYPE_CJDNS);
     if (ctx->socket == -1) {
         Err_raise(alloc, "call to socket() failed. [%s]", strerror(errno));
     }
-    Allocator_onFree(alloc, closeSocket, ctx);
 
-    CString_safeStrncpy(ifr.ifr_name, bindDevice, IFNAMSIZ);
-    ctx->ifName = String_new(bindDevice, alloc);
+    CString_safeStrncpy(ifr.ifr_name, ctx->ifName->bytes, IFNAMSIZ);
 
     if (ioctl(ctx->socket, SIOCGIFINDEX, &ifr) == -1) {
         Err_raise(alloc, "failed to find interface index [%s]", strerror(errno));
@@ -252,7 +296,7 @@ Err_DEFUN ETHInterface_new(
         Err_raise(alloc, "ioctl(SIOCGIFFLAGS) [%s]", strerror(errno));
     }
     if (!((ifr.ifr_flags & IFF_UP) && (ifr.ifr_flags & IFF_RUNNING))) {
-        Log_info(logger, "Bringing up interface [%s]", ifr.ifr_name);
+        Log_info(ctx->logger, "Bringing up interface [%s]", ifr.ifr_name);
         ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
         if (ioctl(ctx->socket, SIOCSIFFLAGS, &ifr) < 0) {
             Err_raise(alloc, "ioctl(SIOCSIFFLAGS) [%s]", strerror(errno));
@@ -271,6 +315,106 @@ Err_DEFUN ETHInterface_new(
     if (bind(ctx->socket, (struct sockaddr*) &ctx->addrBase, sizeof(struct sockaddr_ll))) {
         Err_raise(alloc, "call to bind() failed [%s]", strerror(errno));
     }
+    return NULL;
+}
+
+/**
+ * Open a SOCK_RAW socket and give it to PACKET_MMAP rings which are serviced by the
+ * rust event loop. On failure ctx->socket may still be open and must be closed.
+ */
+static Err_DEFUN openRing(struct ETHInterface_pvt* ctx, struct Allocator* alloc)
+{
+    Err(openSocket(ctx, SOCK_RAW, alloc));
+
+    struct ifreq ifr = { .ifr_ifindex = 0 };
+    CString_safeStrncpy(ifr.ifr_name, ctx->ifName->bytes, IFNAMSIZ);
+    if (ioctl(ctx->socket, SIOCGIFHWADDR, &ifr) < 0) {
+        Err_raise(alloc, "ioctl(SIOCGIFHWADDR) [%s]", strerror(errno));
+    }
+
+    // The ring takes the socket over, even if it fails.
+    int fd = ctx->socket;
+    ctx->socket = -1;
+    Iface_t* ringIf = NULL;
+    Err(Rffi_ethIfaceNew(&ringIf, &ctx->ring, fd, (const uint8_t*) ifr.ifr_hwaddr.sa_data, alloc));
+    ctx->ringIface.send = ringRecv;
+    Iface_plumb(&ctx->ringIface, ringIf);
+    return NULL;
+}
+
+/**
+ * Attach an XDP program which sends our frames to AF_XDP sockets, the AF_PACKET
+ * socket is only used to bring up the device and find its MAC.
+ */
+static Err_DEFUN openXdp(struct ETHInterface_pvt* ctx, int mode, struct Allocator* alloc)
+{
+    Err(openSocket(ctx, SOCK_DGRAM, alloc));
+
+    struct ifreq ifr = { .ifr_ifindex = 0 };
+    CString_safeStrncpy(ifr.ifr_name, ctx->ifName->bytes, IFNAMSIZ);
+    if (ioctl(ctx->socket, SIOCGIFHWADDR, &ifr) < 0) {
+        Err_raise(alloc, "ioctl(SIOCGIFHWADDR) [%s]", strerror(errno));
+    }
+    close(ctx->socket);
+    ctx->socket = -1;
+
+    Iface_t* xdpIf = NULL;
+    Err(Rffi_xdpIfaceNew(&xdpIf, &ctx->xdp, ctx->ifName->bytes,
+        (const uint8_t*) ifr.ifr_hwaddr.sa_data, mode, alloc));
+    ctx->ringIface.send = ringRecv;
+    Iface_plumb(&ctx->ringIface, xdpIf);
+    return NULL;
+}
+
+static void closeCurrentSocket(struct ETHInterface_pvt* ctx)
+{
+    if (ctx->socket != -1) {
+        close(ctx->socket);
+        ctx->socket = -1;
+    }
+}
+
+Err_DEFUN ETHInterface_new(
+    struct ETHInterface** out,
+    EventBase_t* eventBase,
+    const char* bindDevice,
+    int xdp,
+    struct Allocator* alloc,
+    struct Log* logger)
+{
+    struct ETHInterface_pvt* ctx = Allocator_calloc(alloc, sizeof(struct ETHInterface_pvt), 1);
+    Identity_set(ctx);
+    ctx->iface.send = sendMessage;
+    ctx->pub.generic.iface = &ctx->iface;
+    ctx->pub.generic.alloc = alloc;
+    ctx->logger = logger;
+    ctx->ifName = String_new(bindDevice, alloc);
+    ctx->socket = -1;
+    Allocator_onFree(alloc, closeSocket, ctx);
+
+    RTypes_Error_t* err = NULL;
+    if (xdp != ETHInterface_XDP_OFF) {
+        err = openXdp(ctx, xdp, alloc);
+        if (!err) {
+            *out = &ctx->pub;
+            return NULL;
+        }
+        Log_warn(logger, "[%s] AF_XDP not available, falling back to packet ring [%s]",
+            bindDevice, Rffi_printError(err, alloc));
+        closeCurrentSocket(ctx);
+    }
+
+    err = openRing(ctx, alloc);
+    if (!err) {
+        *out = &ctx->pub;
+        return NULL;
+    }
+    Log_info(logger, "[%s] Packet ring not available, falling back to recvfrom() [%s]",
+        bindDevice, Rffi_printError(err, alloc));
+    ctx->ring = NULL;
+    closeCurrentSocket(ctx);
+
+    Err(openSocket(ctx, SOCK_DGRAM, alloc));
 
     Socket_makeNonBlocking(ctx->socket);
 
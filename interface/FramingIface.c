@@ -21,12 +21,6 @@
 
 #define REQUIRED_PADDING 512
 
-struct MessageList;
-struct MessageList {
-    Message_t* msg;
-    struct MessageList* next;
-};
-
 struct FramingIface_pvt {
     struct Iface messageIf;
     struct Iface streamIf;
@@ -35,8 +29,10 @@ struct FramingIface_pvt {
 
     // fields specific to this frame.
     uint32_t bytesRemaining;
+
+    // A frame which straddles reads is assembled here, NULL otherwise.
     struct Allocator* frameAlloc;
-    struct MessageList* frameParts;
+    Message_t* frame;
 
     union {
         uint32_t length_be;
@@ -47,63 +43,36 @@ struct FramingIface_pvt {
     Identity
 };
 
-static Message_t* mergeMessage(struct FramingIface_pvt* fi, Message_t* last)
-{
-    int length = Message_getLength(last);
-
-    // The only accurate way to get the full length because this last might contain
-    // the beginning of the next frame.
-    struct MessageList* part = fi->frameParts;
-    for (part = fi->frameParts; part; part = part->next) {
-        length += Message_getLength(part->msg);
-    }
-
-    Message_t* out = Message_new(0, length + REQUIRED_PADDING, fi->frameAlloc);
-    Err_assert(Message_epush(out, Message_bytes(last), Message_getLength(last)));
-    int fd = Message_getAssociatedFd(last);
-    for (part = fi->frameParts; part; part = part->next) {
-        Err_assert(Message_epush(out, Message_bytes(part->msg), Message_getLength(part->msg)));
-        if (fd == -1) {
-            fd = Message_getAssociatedFd(part->msg);
-        }
-    }
-    if (fd > -1) {
-        Message_setAssociatedFd(out, fd);
-    }
-    Assert_true(length <= Message_getLength(out));
-    return out;
-}
-
+/**
+ * Frames which are entirely in one read are handed on as slices of it, only a frame
+ * which straddles reads is copied, once, into a buffer of its own. Every frame has at
+ * least REQUIRED_PADDING, frames of a read which has less in front of it are copied.
+ */
 static Iface_DEFUN receiveMessage(Message_t* msg, struct Iface* streamIf)
 {
     struct FramingIface_pvt* fi = Identity_containerOf(streamIf, struct FramingIface_pvt, streamIf);
 
-    if (fi->bytesRemaining > fi->maxMessageSize) {
-        // Oversize message
-        Assert_ifTesting(0);
-        return Error(msg, "OVERSIZE_MESSAGE");
-    }
-
-    if (fi->frameParts) {
-        if (fi->bytesRemaining <= (uint32_t)Message_getLength(msg)) {
-            Message_t* wholeMessage = mergeMessage(fi, msg);
-            fi->bytesRemaining = 0;
-            fi->frameParts = NULL;
-            Assert_true(fi->headerIndex == 0);
-            struct Allocator* frameAlloc = fi->frameAlloc;
-            fi->frameAlloc = NULL;
-            // Run the message through again since it's almost certainly not perfect size.
-            Iface_CALL(receiveMessage, wholeMessage, streamIf);
-            Allocator_free(frameAlloc);
+    if (fi->frame) {
+        uint32_t length = (uint32_t)Message_getLength(msg);
+        if (length > fi->bytesRemaining) {
+            length = fi->bytesRemaining;
+        }
+        uint32_t offset = Message_getLength(fi->frame) - fi->bytesRemaining;
+        Bits_memcpy(&Message_bytes(fi->frame)[offset], Message_bytes(msg), length);
+        Err(Message_eshift(msg, -length));
+        if (Message_getAssociatedFd(fi->frame) == -1) {
+            Message_setAssociatedFd(fi->frame, Message_getAssociatedFd(msg));
+        }
+        fi->bytesRemaining -= length;
+        if (fi->bytesRemaining) {
             return NULL;
         }
-        fi->bytesRemaining -= Message_getLength(msg);
-        Allocator_adopt(fi->frameAlloc, Message_getAlloc(msg));
-        struct MessageList* parts = Allocator_calloc(fi->frameAlloc, sizeof(struct MessageList), 1);
-        parts->msg = msg;
-        parts->next = fi->frameParts;
-        fi->frameParts = parts;
-        return NULL;
+        Message_t* frame = fi->frame;
+        struct Allocator* frameAlloc = fi->frameAlloc;
+        fi->frame = NULL;
+        fi->frameAlloc = NULL;
+        Iface_send(&fi->messageIf, frame);
+        Allocator_free(frameAlloc);
     }
 
     for (;;) {
@@ -124,32 +93,36 @@ static Iface_DEFUN receiveMessage(Message_t* msg, struct Iface* streamIf)
             return Error(msg, "OVERSIZE_MESSAGE");
         }
 
-        if (fi->bytesRemaining == (uint32_t)Message_getLength(msg)) {
+        if (fi->bytesRemaining == (uint32_t)Message_getLength(msg) &&
+            Message_getPadding(msg) >= REQUIRED_PADDING)
+        {
             fi->bytesRemaining = 0;
             return Iface_next(&fi->messageIf, msg);
 
-        } else if (fi->bytesRemaining < (uint32_t)Message_getLength(msg)) {
+        } else if (fi->bytesRemaining <= (uint32_t)Message_getLength(msg)) {
             struct Allocator* alloc = Allocator_child(Message_getAlloc(msg));
-            Message_t* m = Message_new(fi->bytesRemaining, REQUIRED_PADDING, alloc);
+            Message_t* m;
+            if (Message_getPadding(msg) >= REQUIRED_PADDING) {
+                m = Message_slice(msg, fi->bytesRemaining, alloc);
+            } else {
+                // Not enough room in front of the frame for whatever the receiver pushes.
+                m = Message_new(fi->bytesRemaining, REQUIRED_PADDING, alloc);
+                Bits_memcpy(Message_bytes(m), Message_bytes(msg), fi->bytesRemaining);
+            }
             Message_setAssociatedFd(m, Message_getAssociatedFd(msg));
-            Bits_memcpy(Message_bytes(m), Message_bytes(msg), fi->bytesRemaining);
-            Err(Message_eshift(msg, -fi->bytesRemaining));
-            fi->bytesRemaining = 0;
             Iface_send(&fi->messageIf, m);
             Allocator_free(alloc);
+            Err(Message_eshift(msg, -fi->bytesRemaining));
+            fi->bytesRemaining = 0;
             continue;
 
         } else {
             fi->frameAlloc = Allocator_child(fi->alloc);
-            Message_t* m = Message_new(0, Message_getLength(msg) + 4, fi->frameAlloc);
-            Message_setAssociatedFd(m, Message_getAssociatedFd(msg));
-            Err(Message_epush(m, Message_bytes(msg), Message_getLength(msg)));
-            Err(Message_epush(m, fi->header.bytes, 4));
-
+            fi->frame = Message_new(fi->bytesRemaining, REQUIRED_PADDING, fi->frameAlloc);
+            Message_setAssociatedFd(fi->frame, Message_getAssociatedFd(msg));
+            Bits_memcpy(Message_bytes(fi->frame), Message_bytes(msg), Message_getLength(msg));
             fi->bytesRemaining -= Message_getLength(msg);
-            fi->frameParts = Allocator_calloc(fi->frameAlloc, sizeof(struct MessageList), 1);
-            fi->frameParts->msg = m;
-            fi->frameParts->next = NULL;
+            Err(Message_eshift(msg, -Message_getLength(msg)));
         }
         return NULL;
     }
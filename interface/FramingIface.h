@@ -26,6 +26,10 @@ Linker_require("interface/FramingIface.c")
  * The length is of only the content, not including the beginning 4 bytes
  * which represents the length itself.
  *
+ * Frames which arrive within one read from the stream share its buffer (see
+ * Message_slice()), so a frame which is kept after the call returns must be
+ * copied with Message_clone().
+ *
  * @param maxMessageSize how large of a framed message to allow
  * @param wrappedIface the stream interface which will be used to
  *                     communicate framed messages to a peer.
@@ -210,6 +210,7 @@ Err_DEFUN UDPInterface_new(
     EventBase_t* eventBase,
     struct Sockaddr* bindAddr,
     uint16_t beaconPort,
+    int shards,
     struct Allocator* alloc,
     struct Log* logger,
     struct GlobalConfig* globalConf)
@@ -222,7 +223,7 @@ Err_DEFUN UDPInterface_new(
     }
 
     struct UDPAddrIface* uai = NULL;
-    Err(UDPAddrIface_new(&uai, bindAddr, alloc));
+    Err(UDPAddrIface_newShards(&uai, bindAddr, shards, alloc));
 
     uint16_t commPort = Sockaddr_getPort(uai->generic.addr);
 
@@ -309,6 +310,28 @@ List* UDPInterface_getBroadcastAddrs(struct UDPInterface* udpif, struct Allocato
     return out;
 }
 
+Err_DEFUN UDPInterface_offload(
+    Object_t** out,
+    struct UDPInterface* udpif,
+    int gso,
+    int gro,
+    Allocator_t* alloc)
+{
+    struct UDPInterface_pvt* ctx = Identity_check((struct UDPInterface_pvt*) udpif);
+    return UDPAddrIface_offload(out, ctx->commIf, gso, gro, alloc);
+}
+
+Err_DEFUN UDPInterface_xdp(
+    Object_t** out,
+    struct UDPInterface* udpif,
+    const char* device,
+    int mode,
+    Allocator_t* alloc)
+{
+    struct UDPInterface_pvt* ctx = Identity_check((struct UDPInterface_pvt*) udpif);
+    return UDPAddrIface_xdp(out, ctx->commIf, device, mode, alloc);
+}
+
 Err_DEFUN UDPInterface_workerStates(
     Object_t** out,
     struct UDPInterface* udpif,
@@ -327,8 +350,29 @@ int UDPInterface_setDSCP(struct UDPInterface* udpif, uint8_t dscp)
     return 0;
 }
 
-int UDPInterface_getFd(struct UDPInterface* udpif)
+void UDPInterface_setFastPath(struct UDPInterface* udpif, Rffi_SwitchFastPath_t* fp, int ifNum)
+{
+    struct UDPInterface_pvt* ctx = Identity_check((struct UDPInterface_pvt*) udpif);
+    UDPAddrIface_setFastPath(ctx->commIf, fp, ifNum);
+}
+
+int UDPInterface_getFd(struct UDPInterface* udpif, int shard)
+{
+    struct UDPInterface_pvt* ctx = Identity_check((struct UDPInterface_pvt*) udpif);
+    return UDPAddrIface_getFd(ctx->commIf, shard);
+}
+
+int UDPInterface_shardCount(struct UDPInterface* udpif)
+{
+    struct UDPInterface_pvt* ctx = Identity_check((struct UDPInterface_pvt*) udpif);
+    return UDPAddrIface_shardCount(ctx->commIf);
+}
+
+Err_DEFUN UDPInterface_shardStats(
+    Object_t** out,
+    struct UDPInterface* udpif,
+    Allocator_t* alloc)
 {
     struct UDPInterface_pvt* ctx = Identity_check((struct UDPInterface_pvt*) udpif);
-    return UDPAddrIface_getFd(ctx->commIf);
+    return UDPAddrIface_shardStats(out, ctx->commIf, alloc);
 }
@@ -22,6 +22,7 @@
 #include "util/log/Log.h"
 #include "util/GlobalConfig.h"
 #include "memory/Allocator.h"
+#include "rust/cjdns_sys/Rffi.h"
 #include "util/Linker.h"
 Linker_require("interface/UDPInterface.c")
 
@@ -58,6 +59,8 @@ struct UDPInterface
  * @param bindAddr the address and port to bind the socket to
  * @param bcastPort (optional) if specifed, another socket will be created for beacon messages
  *                  if zero then no other socket will be created.
+ * @param shards number of SO_REUSEPORT sockets to bind for data, 1 for a single socket,
+ *               0 for one per receive worker, see UDPAddrIface_newShards().
  * @param alloc allocator which will be used to create the interface
  * @param logger
  * @param globalConf for getting the name of the TUN device to avoid bcasting to it
@@ -67,6 +70,7 @@ Err_DEFUN UDPInterface_new(
     EventBase_t* eventBase,
     struct Sockaddr* bindAddr,
     uint16_t beaconPort,
+    int shards,
     struct Allocator* alloc,
     struct Log* logger,
     struct GlobalConfig* globalConf);
@@ -110,7 +114,43 @@ List* UDPInterface_getBroadcastAddrs(struct UDPInterface* udpif, struct Allocato
  */
 int UDPInterface_setDSCP(struct UDPInterface* udpif, uint8_t dscp);
 
-int UDPInterface_getFd(struct UDPInterface* udpif);
+/** The fd of one of the data socket's shards, -1 if there is no such shard. */
+int UDPInterface_getFd(struct UDPInterface* udpif, int shard);
+
+int UDPInterface_shardCount(struct UDPInterface* udpif);
+
+/** Output a list with a dict of counters for each shard of the data socket. */
+Err_DEFUN UDPInterface_shardStats(
+    Object_t** out,
+    struct UDPInterface* udpif,
+    Allocator_t* alloc);
+
+/**
+ * Allow transit traffic on the data socket to be switched without entering the
+ * InterfaceController, the beacon socket is unaffected.
+ */
+void UDPInterface_setFastPath(struct UDPInterface* udpif, Rffi_SwitchFastPath_t* fp, int ifNum);
+
+/**
+ * Turn UDP segmentation and receive offload on or off for the data socket,
+ * see UDPAddrIface_offload().
+ */
+Err_DEFUN UDPInterface_offload(
+    Object_t** out,
+    struct UDPInterface* udpif,
+    int gso,
+    int gro,
+    Allocator_t* alloc);
+
+/**
+ * Receive on the data socket using AF_XDP, see UDPAddrIface_xdp().
+ */
+Err_DEFUN UDPInterface_xdp(
+    Object_t** out,
+    struct UDPInterface* udpif,
+    const char* device,
+    int mode,
+    Allocator_t* alloc);
 
 Err_DEFUN UDPInterface_workerStates(
     Object_t** out,
@@ -14,6 +14,7 @@
  */
 #include "benc/Dict.h"
 #include "benc/Int.h"
+#include "benc/List.h"
 #include "admin/Admin.h"
 #include "memory/Allocator.h"
 #include "net/InterfaceController.h"
@@ -152,6 +153,7 @@ static void beginConnection(Dict* args,
 static struct UDPInterface* setupLibuvUDP(struct Context* ctx,
                                        struct Sockaddr* addr,
                                        uint16_t beaconPort,
+                                       int shards,
                                        uint8_t dscp,
                                        String* txid,
                                        struct Allocator* alloc)
@@ -162,6 +164,7 @@ static struct UDPInterface* setupLibuvUDP(struct Context* ctx,
         ctx->eventBase,
         addr,
         beaconPort,
+        shards,
         alloc,
         ctx->logger,
         ctx->globalConf);
@@ -185,10 +188,11 @@ static void newInterface2(struct Context* ctx,
                           uint8_t dscp,
                           String* txid,
                           struct Allocator* requestAlloc,
-                          uint16_t beaconPort)
+                          uint16_t beaconPort,
+                          int shards)
 {
     struct Allocator* const alloc = Allocator_child(ctx->alloc);
-    struct UDPInterface* udpif = setupLibuvUDP(ctx, addr, beaconPort, dscp, txid, alloc);
+    struct UDPInterface* udpif = setupLibuvUDP(ctx, addr, beaconPort, shards, dscp, txid, alloc);
     if (!udpif) { return; }
 
     int af = Sockaddr_getFamily(addr);
@@ -200,6 +204,7 @@ static void newInterface2(struct Context* ctx,
         InterfaceController_newIface(ctx->ic, name, alloc);
     ici->af = af;
     Iface_plumb(&ici->addrIf, udpif->generic.iface);
+    UDPInterface_setFastPath(udpif, InterfaceController_getFastPath(ctx->ic), ici->ifNum);
     ArrayList_UDPInterface_put(ctx->ifaces, ici->ifNum, udpif);
 
     Dict* out = Dict_new(requestAlloc);
@@ -222,6 +227,17 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
     uint8_t dscp = dscpValue ? ((uint8_t) *dscpValue) : 0;
     int64_t* beaconPort_p = Dict_getIntC(args, "beaconPort");
     uint16_t beaconPort = beaconPort_p ? ((uint16_t) *beaconPort_p) : 0;
+    int64_t* shardsP = Dict_getIntC(args, "shards");
+    if (shardsP && (*shardsP < 0 || *shardsP > 256)) {
+        Dict out = Dict_CONST(
+            String_CONST("error"),
+            String_OBJ(String_CONST("shards must be between 0 (one per worker) and 256")),
+            NULL
+        );
+        Admin_sendMessage(&out, txid, ctx->admin);
+        return;
+    }
+    int shards = (shardsP) ? *shardsP : 1;
     struct Sockaddr_storage addr;
     if (Sockaddr_parse((bindAddress) ? bindAddress->bytes : "0.0.0.0", &addr)) {
         Dict out = Dict_CONST(
@@ -230,7 +246,7 @@ static void newInterface(Dict* args, void* vcontext, String* txid, struct Alloca
         Admin_sendMessage(&out, txid, ctx->admin);
         return;
     }
-    newInterface2(ctx, &addr.addr, dscp, txid, requestAlloc, beaconPort);
+    newInterface2(ctx, &addr.addr, dscp, txid, requestAlloc, beaconPort, shards);
 }
 
 static void listDevices(Gcc_UNUSED Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
@@ -333,9 +349,14 @@ static void getFd(Dict* args, void* vcontext, String* txid, struct Allocator* re
     if (!udpif) {
         return;
     }
-    int fd = UDPInterface_getFd(udpif);
+    int fd = UDPInterface_getFd(udpif, 0);
+    List* fds = List_new(requestAlloc);
+    for (int i = 0; i < UDPInterface_shardCount(udpif); i++) {
+        List_addInt(fds, UDPInterface_getFd(udpif, i), requestAlloc);
+    }
     Dict* out = Dict_new(requestAlloc);
     Dict_putIntC(out, "fd", fd, requestAlloc);
+    Dict_putListC(out, "fds", fds, requestAlloc);
     Dict_putStringCC(out, "error", "none", requestAlloc);
     Admin_sendMessage(out, txid, ctx->admin);
 }
@@ -356,6 +377,79 @@ static void workerStates(Dict* args, void* vcontext, String* txid, struct Alloca
     Admin_sendMessage(out, txid, ctx->admin);
 }
 
+static void shardStats(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    struct UDPInterface* udpif = getIface(ctx, args, txid, requestAlloc, NULL);
+    if (!udpif) { return; }
+    Object_t* shards = NULL;
+    RTypes_Error_t* err = UDPInterface_shardStats(&shards, udpif, requestAlloc);
+    Dict* out = Dict_new(requestAlloc);
+    if (err) {
+        char* ers = Rffi_printError(err, requestAlloc);
+        Dict_putStringCC(out, "error", ers, requestAlloc);
+    } else {
+        Dict_putStringCC(out, "error", "none", requestAlloc);
+        Dict_putObject(out, String_CONST("shards"), shards, requestAlloc);
+    }
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
+static void offload(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    struct UDPInterface* udpif = getIface(ctx, args, txid, requestAlloc, NULL);
+    if (!udpif) { return; }
+    int64_t* gsoP = Dict_getIntC(args, "gso");
+    int64_t* groP = Dict_getIntC(args, "gro");
+    Object_t* off = NULL;
+    RTypes_Error_t* err = UDPInterface_offload(&off,
+                                               udpif,
+                                               (gsoP) ? (*gsoP != 0) : -1,
+                                               (groP) ? (*groP != 0) : -1,
+                                               requestAlloc);
+    Dict* out = Dict_new(requestAlloc);
+    if (err) {
+        char* ers = Rffi_printError(err, requestAlloc);
+        Dict_putStringCC(out, "error", ers, requestAlloc);
+    } else {
+        Dict_putStringCC(out, "error", "none", requestAlloc);
+        Dict_putObject(out, String_CONST("offload"), off, requestAlloc);
+    }
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
+static void xdp(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Context* ctx = Identity_check((struct Context*) vcontext);
+    struct UDPInterface* udpif = getIface(ctx, args, txid, requestAlloc, NULL);
+    if (!udpif) { return; }
+    String* device = Dict_getStringC(args, "device");
+    // Same as the ETHInterface_XDP_* modes, 0 is off and 1 is native falling back to generic
+    int64_t* modeP = Dict_getIntC(args, "mode");
+    int mode = (modeP) ? *modeP : 1;
+    Dict* out = Dict_new(requestAlloc);
+    if (mode && !device) {
+        Dict_putStringCC(out, "error", "device is required", requestAlloc);
+        Admin_sendMessage(out, txid, ctx->admin);
+        return;
+    }
+    Object_t* x = NULL;
+    RTypes_Error_t* err = UDPInterface_xdp(&x,
+                                           udpif,
+                                           (device) ? device->bytes : NULL,
+                                           mode,
+                                           requestAlloc);
+    if (err) {
+        char* ers = Rffi_printError(err, requestAlloc);
+        Dict_putStringCC(out, "error", ers, requestAlloc);
+    } else {
+        Dict_putStringCC(out, "error", "none", requestAlloc);
+        Dict_putObject(out, String_CONST("xdp"), x, requestAlloc);
+    }
+    Admin_sendMessage(out, txid, ctx->admin);
+}
+
 void UDPInterface_admin_register(EventBase_t* base,
                                  struct Allocator* alloc,
                                  struct Log* logger,
@@ -378,7 +472,8 @@ void UDPInterface_admin_register(EventBase_t* base,
         ((struct Admin_FunctionArg[]) {
             { .name = "bindAddress", .required = 0, .type = "String" },
             { .name = "dscp", .required = 0, .type = "Int" },
-            { .name = "beaconPort", .required = 0, .type = "Int" }
+            { .name = "beaconPort", .required = 0, .type = "Int" },
+            { .name = "shards", .required = 0, .type = "Int" }
         }), admin);
 
     Admin_registerFunction("UDPInterface_beginConnection", beginConnection, ctx, true,
@@ -421,6 +516,25 @@ void UDPInterface_admin_register(EventBase_t* base,
             { .name = "interfaceNumber", .required = 0, .type = "Int" },
         }), admin);
 
+    Admin_registerFunction("UDPInterface_shardStats", shardStats, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "interfaceNumber", .required = 0, .type = "Int" },
+        }), admin);
+
+    Admin_registerFunction("UDPInterface_offload", offload, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "interfaceNumber", .required = 0, .type = "Int" },
+            { .name = "gso", .required = 0, .type = "Int" },
+            { .name = "gro", .required = 0, .type = "Int" },
+        }), admin);
+
+    Admin_registerFunction("UDPInterface_xdp", xdp, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "interfaceNumber", .required = 0, .type = "Int" },
+            { .name = "device", .required = 0, .type = "String" },
+            { .name = "mode", .required = 0, .type = "Int" },
+        }), admin);
+
     Admin_registerFunction("UDPInterface_workerStates", workerStates, ctx, true,
         ((struct Admin_FunctionArg[]) {
             { .name = "interfaceNumber", .required = 0, .type = "Int" },
@@ -19,27 +19,34 @@
 #include "util/Identity.h"
 
 #define BUF_SZ 1024
+#define FRAMES 3
+
+// Same as in FramingIface.c
+#define REQUIRED_PADDING 512
 
 struct Context {
     struct Iface iface;
     struct Iface* fi;
     struct Iface outer;
-    int success;
+    int received;
     struct Allocator* alloc;
     int messageLen;
     Message_t* buf;
     uint8_t* bufPtr;
+    Message_t* stream;
     Identity
 } ctx;
 
 static Iface_DEFUN ifaceRecvMsg(Message_t* message, struct Iface* thisInterface)
 {
     struct Context* ctx = Identity_containerOf(thisInterface, struct Context, iface);
-    Assert_true(!ctx->success);
+    Assert_true(ctx->received < FRAMES);
     Assert_true(Message_getLength(message) == ctx->messageLen);
-    Assert_true(Message_getLength(ctx->buf) == 0);
     Assert_true(!Bits_memcmp(ctx->bufPtr, Message_bytes(message), ctx->messageLen));
-    ctx->success = 1;
+    // Frames may share a buffer, scribbling in front of this one must not damage the next.
+    Assert_true(Message_getPadding(message) >= REQUIRED_PADDING);
+    Err_assert(Message_epush32be(message, 0xdeadbeef));
+    ctx->received++;
     return NULL;
 }
 
@@ -50,19 +57,25 @@ void CJDNS_FUZZ_MAIN(void* vctx, Message_t* fuzz)
     uint16_t len16 = 0;
     Err_assert(Message_epop16be(&len16, fuzz));
     ctx->messageLen = len16 % BUF_SZ;
-    Err_assert(Message_truncate(ctx->buf, ctx->messageLen));
-    Err_assert(Message_epush32be(ctx->buf, ctx->messageLen));
+    // The same frame repeatedly, so that some frames straddle reads and some share them
+    for (int i = 0; i < FRAMES; i++) {
+        Err_assert(Message_epush(ctx->stream, ctx->bufPtr, ctx->messageLen));
+        Err_assert(Message_epush32be(ctx->stream, ctx->messageLen));
+    }
     for (int i = 0; ; i++) {
         uint8_t len = Message_bytes(fuzz)[i % Message_getLength(fuzz)] + 1;
-        if (len > Message_getLength(ctx->buf)) {
-            len = Message_getLength(ctx->buf);
+        if (len > Message_getLength(ctx->stream)) {
+            len = Message_getLength(ctx->stream);
         }
+        // Some reads have room in front of them to slice frames from, some must be copied
+        uint32_t padding = (len & 1) ? REQUIRED_PADDING : 0;
         struct Allocator* a = Allocator_child(ctx->alloc);
-        Message_t* m = Message_new(len, 0, a);
-        Err_assert(Message_epop(ctx->buf, Message_bytes(m), len));
+        Message_t* m = Message_new(len, padding, a);
+        Err_assert(Message_epop(ctx->stream, Message_bytes(m), len));
         Iface_send(&ctx->outer, m);
         Allocator_free(a);
-        if (ctx->success) {
+        if (ctx->received == FRAMES) {
+            Assert_true(Message_getLength(ctx->stream) == 0);
             return;
         }
     }
@@ -75,7 +88,8 @@ void* CJDNS_FUZZ_INIT(struct Allocator* alloc, struct Random* rand)
     ctx->fi = FramingIface_new(BUF_SZ, &ctx->outer, alloc);
     Iface_plumb(&ctx->iface, ctx->fi);
     ctx->alloc = alloc;
-    ctx->buf = Message_new(BUF_SZ, 4, alloc);
+    ctx->buf = Message_new(BUF_SZ, 0, alloc);
+    ctx->stream = Message_new(0, FRAMES * (BUF_SZ + 4), alloc);
     Random_bytes(rand, Message_bytes(ctx->buf), BUF_SZ);
     ctx->bufPtr = Message_bytes(ctx->buf);
     Identity_set(ctx);
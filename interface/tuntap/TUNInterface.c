@@ -39,10 +39,12 @@ Err_DEFUN TUNInterface_forFd(
     return NULL;
 }
 
-Err_DEFUN TUNInterface_new(
+Err_DEFUN TUNInterface_newWith(
     TUNInterface_t** out,
     const char* interfaceName,
     char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
     struct Log* logger,
     struct Allocator* alloc)
 {
@@ -53,12 +55,31 @@ Err_DEFUN TUNInterface_new(
         &pvt->pub.iface,
         interfaceName,
         assignedInterfaceName,
+        queues,
+        offload,
         logger,
         alloc));
     *out = &pvt->pub;
     return NULL;
 }
 
+Err_DEFUN TUNInterface_new(
+    TUNInterface_t** out,
+    const char* interfaceName,
+    char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    struct Log* logger,
+    struct Allocator* alloc)
+{
+    return TUNInterface_newWith(
+        out, interfaceName, assignedInterfaceName, 1, false, logger, alloc);
+}
+
+int TUNInterface_queueCount(TUNInterface_t* tt)
+{
+    TUNInterface_pvt_t* pvt = Identity_check((TUNInterface_pvt_t*)tt);
+    return Rffi_socketFdCount(pvt->si);
+}
+
 Err_DEFUN TUNInterface_workerStates(
     Object_t** out,
     TUNInterface_t* tt,
@@ -53,6 +53,30 @@ Err_DEFUN TUNInterface_new(
     struct Log* logger,
     struct Allocator* alloc);
 
+/**
+ * Like TUNInterface_new() but with options which are only supported on Linux,
+ * elsewhere they are ignored.
+ *
+ * @param queues number of queues to open, 0 for one per socket worker. With more than one
+ *               the device is opened with IFF_MULTI_QUEUE and the socket workers are spread
+ *               over the queues so that local traffic is read on multiple cores.
+ * @param offload open the device with IFF_VNET_HDR and enable checksum and TCP segmentation
+ *                offloads so that the kernel passes TCP super-packets of up to 64KiB,
+ *                these are segmented when they are read and runs of segments are coalesced
+ *                when they are written.
+ */
+Err_DEFUN TUNInterface_newWith(
+    TUNInterface_t** out,
+    const char* interfaceName,
+    char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
+    struct Log* logger,
+    struct Allocator* alloc);
+
+/** Number of queues which were actually opened, this may be fewer than requested. */
+int TUNInterface_queueCount(TUNInterface_t* tt);
+
 Err_DEFUN TUNInterface_workerStates(
     Object_t** out,
     TUNInterface_t* tt,
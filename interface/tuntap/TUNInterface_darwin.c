@@ -45,9 +45,14 @@ Err_DEFUN TUNInterface_newImpl(
     struct Iface** out,
     const char* interfaceName,
     char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
     struct Log* logger,
     struct Allocator* alloc)
 {
+    if (queues != 1 || offload) {
+        Log_debug(logger, "TUN queues and offloads are only supported on Linux, ignored");
+    }
     int maxNameSize = (IFNAMSIZ < TUNInterface_IFNAMSIZ) ? IFNAMSIZ : TUNInterface_IFNAMSIZ;
     int tunUnit = 0; /* allocate dynamically by default */
 
@@ -41,9 +41,14 @@ Err_DEFUN TUNInterface_newImpl(
     struct Iface** out,
     const char* interfaceName,
     char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
     struct Log* logger,
     struct Allocator* alloc)
 {
+    if (queues != 1 || offload) {
+        Log_debug(logger, "TUN queues and offloads are only supported on Linux, ignored");
+    }
     char deviceFile[TUNInterface_IFNAMSIZ];
 
     // We are on FreeBSD so we just need to read /dev/tunxx to create the tun interface
@@ -40,40 +40,94 @@
 
 #include <stdio.h>
 
+// Linux refuses to attach more queues than this to one device (MAX_TAP_QUEUES).
+#define MAX_QUEUES 256
+
+static int openQueue(struct ifreq* ifRequest)
+{
+    int tunFd = open(DEVICE_PATH, O_RDWR);
+    if (tunFd < 0) {
+        return -1;
+    }
+    if (ioctl(tunFd, TUNSETIFF, ifRequest) < 0) {
+        int err = errno;
+        close(tunFd);
+        errno = err;
+        return -1;
+    }
+    Socket_makeNonBlocking(tunFd);
+    return tunFd;
+}
+
 Err_DEFUN TUNInterface_newImpl(
     Rffi_SocketIface_t** sout,
     struct Iface** out,
     const char* interfaceName,
     char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
     struct Log* logger,
     struct Allocator* alloc)
 {
     uint32_t maxNameSize = (IFNAMSIZ < TUNInterface_IFNAMSIZ) ? IFNAMSIZ : TUNInterface_IFNAMSIZ;
     Log_info(logger, "Initializing tun device [%s]", ((interfaceName) ? interfaceName : "auto"));
 
+    if (queues <= 0) {
+        RTypes_RuntimeTopology_t topo;
+        Rffi_runtimeTopology(&topo);
+        queues = topo.socket_workers;
+    }
+    if (queues > MAX_QUEUES) {
+        queues = MAX_QUEUES;
+    }
+
     struct ifreq ifRequest = { .ifr_flags = IFF_TUN };
+    if (queues > 1) {
+        ifRequest.ifr_flags |= IFF_MULTI_QUEUE;
+    }
+    if (offload) {
+        ifRequest.ifr_flags |= IFF_VNET_HDR;
+    }
     if (interfaceName) {
         if (strlen(interfaceName) > maxNameSize) {
             Err_raise(alloc, "tunnel name too big, limit is [%d] characters", maxNameSize);
         }
         CString_safeStrncpy(ifRequest.ifr_name, interfaceName, maxNameSize);
     }
-    int tunFd = open(DEVICE_PATH, O_RDWR);
 
-    if (tunFd < 0) {
-        Err_raise(alloc, "open(\"%s\") [%s]", DEVICE_PATH, strerror(errno));
+    int* fds = Allocator_calloc(alloc, sizeof(int), queues);
+    fds[0] = openQueue(&ifRequest);
+    if (fds[0] < 0 && errno == EINVAL && queues > 1) {
+        // Kernel without multi-queue support or a persistent device created without it.
+        Log_info(logger, "Multi-queue TUN not available, using one queue");
+        queues = 1;
+        ifRequest.ifr_flags &= ~IFF_MULTI_QUEUE;
+        fds[0] = openQueue(&ifRequest);
     }
-
-    if (ioctl(tunFd, TUNSETIFF, &ifRequest) < 0) {
-        int err = errno;
-        close(tunFd);
-        Err_raise(alloc, "ioctl(TUNSETIFF) [%s]", strerror(err));
+    if (fds[0] < 0) {
+        Err_raise(alloc, "open(\"%s\") / ioctl(TUNSETIFF) [%s]", DEVICE_PATH, strerror(errno));
     }
     if (assignedInterfaceName) {
         CString_safeStrncpy(assignedInterfaceName, ifRequest.ifr_name, maxNameSize);
     }
+    // Without this the kernel still accepts super-packets, but never sends them.
+    if (offload && ioctl(fds[0], TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) < 0) {
+        Log_warn(logger, "ioctl(TUNSETOFFLOAD) [%s], kernel will segment locally", strerror(errno));
+    }
 
-    Socket_makeNonBlocking(tunFd);
+    // The kernel filled in the name, so further queues attach to the same device.
+    int opened = 1;
+    for (; opened < queues; opened++) {
+        fds[opened] = openQueue(&ifRequest);
+        if (fds[opened] < 0) {
+            Log_warn(logger, "Only [%d] of [%d] TUN queues opened [%s]",
+                opened, queues, strerror(errno));
+            break;
+        }
+    }
+    if (opened > 1) {
+        Log_info(logger, "Opened [%d] TUN queues on [%s]", opened, ifRequest.ifr_name);
+    }
 
-    return Rffi_socketForFd(out, sout, tunFd, RTypes_SocketType_ReadFrames, alloc);
+    return Rffi_socketForFds(out, sout, fds, opened, RTypes_SocketType_ReadFrames, offload, alloc);
 }
@@ -42,9 +42,14 @@ Err_DEFUN TUNInterface_newImpl(
     struct Iface** out,
     const char* interfaceName,
     char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
     struct Log* logger,
     struct Allocator* alloc)
 {
+    if (queues != 1 || offload) {
+        Log_debug(logger, "TUN queues and offloads are only supported on Linux, ignored");
+    }
     int err;
     char file[TUNInterface_IFNAMSIZ];
     int ppa = -1; // to store the tunnel device index
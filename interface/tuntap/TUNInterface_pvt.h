@@ -25,6 +25,8 @@ Err_DEFUN TUNInterface_newImpl(
     struct Iface** out,
     const char* interfaceName,
     char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
     struct Log* logger,
     struct Allocator* alloc);
 
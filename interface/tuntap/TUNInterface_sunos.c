@@ -92,9 +92,14 @@ Err_DEFUN TUNInterface_newImpl(
     struct Iface** out,
     const char* interfaceName,
     char assignedInterfaceName[TUNInterface_IFNAMSIZ],
+    int queues,
+    bool offload,
     struct Log* logger,
     struct Allocator* alloc)
 {
+    if (queues != 1 || offload) {
+        Log_debug(logger, "TUN queues and offloads are only supported on Linux, ignored");
+    }
     // Extract the number eg: 0 from tun0
     int ppa = 0;
     if (interfaceName) {
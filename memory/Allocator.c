@@ -31,7 +31,15 @@ void* Allocator__malloc(struct Allocator* allocator,
                         const char* fileName,
                         int lineNum)
 {
-    return (void*) Rffi_allocator_malloc(allocator, length);
+    return (void*) Rffi_allocator_malloc(allocator, length, fileName, (uintptr_t) lineNum);
+}
+
+void* Allocator__mallocPooled(struct Allocator* allocator,
+                              unsigned long length,
+                              const char* fileName,
+                              int lineNum)
+{
+    return (void*) Rffi_allocator_mallocPooled(allocator, length, fileName, (uintptr_t) lineNum);
 }
 
 void* Allocator__calloc(struct Allocator* alloc,
@@ -51,7 +59,8 @@ void* Allocator__realloc(struct Allocator* allocator,
                          const char* fileName,
                          int lineNum)
 {
-    return (void*) Rffi_allocator_realloc(allocator, (uint8_t*) original, size);
+    return (void*) Rffi_allocator_realloc(
+        allocator, (uint8_t*) original, size, fileName, (uintptr_t) lineNum);
 }
 
 void* Allocator__clone(struct Allocator* allocator,
@@ -137,6 +137,23 @@ void* Allocator__calloc(struct Allocator* alloc,
                         int lineNum);
 #define Allocator_calloc(a, b, c) Allocator__calloc((a),(b),(c),Gcc_SHORT_FILE,Gcc_LINE)
 
+/**
+ * Allocate a packet buffer, this is the same as Allocator_malloc() except that the memory
+ * is taken from a per-thread pool of recycled buffers and returned to that pool when the
+ * allocator is freed, whichever thread frees it. The memory is not initialized. Like other
+ * allocations, it is poisoned before it goes back to the pool if CJDNS_ALLOCATOR_POISON=1.
+ *
+ * @param alloc the memory allocator.
+ * @param size the number of bytes to allocate.
+ * @return a pointer to the newly allocated memory.
+ */
+Gcc_ALLOC_SIZE(2)
+void* Allocator__mallocPooled(struct Allocator* allocator,
+                              unsigned long length,
+                              const char* fileName,
+                              int lineNum);
+#define Allocator_mallocPooled(a, b) Allocator__mallocPooled((a),(b),Gcc_SHORT_FILE,Gcc_LINE)
+
 /**
  * Re-allocate memory so that an allocation can be expanded.
  * The allocation will be aligned on the size of a pointer, if you need further alignment then
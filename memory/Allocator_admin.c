@@ -15,8 +15,10 @@
 #include "admin/Admin.h"
 #include "benc/String.h"
 #include "benc/Dict.h"
+#include "benc/List.h"
 #include "memory/Allocator.h"
 #include "memory/Allocator_admin.h"
+#include "rust/cjdns_sys/Rffi.h"
 #include "util/Identity.h"
 
 struct Allocator_admin_pvt
@@ -43,6 +45,75 @@ static void bytesAllocated(Dict* in, void* vcontext, String* txid, struct Alloca
     Admin_sendMessage(d, txid, ctx->admin);
 }
 
+static void bufferPool(Dict* in, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Allocator_admin_pvt* ctx = Identity_check((struct Allocator_admin_pvt*)vcontext);
+    RTypes_BufPool_Stats_t stats = { .hits = 0 };
+    Rffi_allocator_bufPoolStats(&stats);
+    Dict* d = Dict_new(requestAlloc);
+    Dict_putIntC(d, "hits", stats.hits, requestAlloc);
+    Dict_putIntC(d, "misses", stats.misses, requestAlloc);
+    Dict_putIntC(d, "oversize", stats.oversize, requestAlloc);
+    Dict_putIntC(d, "returned", stats.returned, requestAlloc);
+    Dict_putIntC(d, "returnedRemote", stats.returned_remote, requestAlloc);
+    Dict_putIntC(d, "released", stats.released, requestAlloc);
+    Admin_sendMessage(d, txid, ctx->admin);
+}
+
+// Stacks are long, a page of them must fit in Admin_MAX_RESPONSE_SIZE
+#define PROFILE_ENTRIES_PER_PAGE 16
+
+static void profile(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
+{
+    struct Allocator_admin_pvt* ctx = Identity_check((struct Allocator_admin_pvt*)vcontext);
+    int64_t* enable = Dict_getIntC(args, "enable");
+    int64_t* reset = Dict_getIntC(args, "reset");
+    int64_t* sampleBytes = Dict_getIntC(args, "sampleBytes");
+    int64_t* page = Dict_getIntC(args, "page");
+    // Negative pages are taken as page 0, pages past this would overflow first
+    if (page && *page > 0 && (uint64_t) *page > UINTPTR_MAX / PROFILE_ENTRIES_PER_PAGE) {
+        Dict* out = Dict_new(requestAlloc);
+        Dict_putStringCC(out, "error", "page out of range", requestAlloc);
+        Admin_sendMessage(out, txid, ctx->admin);
+        return;
+    }
+    if (sampleBytes && *sampleBytes >= 0) {
+        Rffi_allocator_profileSetSampleBytes((uint64_t) *sampleBytes);
+    }
+    if (reset && *reset) {
+        Rffi_allocator_profileReset();
+    }
+    if (enable) {
+        Rffi_allocator_profileSetEnabled(*enable != 0);
+    }
+    // Page 0 takes a new snapshot, the pages after it read the same one
+    uintptr_t first = (page && *page > 0) ? (uintptr_t) *page * PROFILE_ENTRIES_PER_PAGE : 0;
+    RTypes_AllocProfile_t* prof =
+        Rffi_allocator_profile(first, PROFILE_ENTRIES_PER_PAGE, first == 0, requestAlloc);
+
+    List* stacks = List_new(requestAlloc);
+    for (uintptr_t i = 0; i < prof->count; i++) {
+        const RTypes_AllocProfile_Entry_t* e = &prof->entries[i];
+        Dict* d = Dict_new(requestAlloc);
+        Dict_putStringCC(d, "stack", e->stack, requestAlloc);
+        Dict_putIntC(d, "liveBytes", e->live_bytes, requestAlloc);
+        Dict_putIntC(d, "liveAllocs", e->live_allocs, requestAlloc);
+        Dict_putIntC(d, "totalBytes", e->total_bytes, requestAlloc);
+        Dict_putIntC(d, "totalAllocs", e->total_allocs, requestAlloc);
+        List_addDict(stacks, d, requestAlloc);
+    }
+
+    Dict* output = Dict_new(requestAlloc);
+    Dict_putStringCC(output, "error", "none", requestAlloc);
+    Dict_putIntC(output, "enabled", prof->enabled, requestAlloc);
+    Dict_putIntC(output, "sampleBytes", prof->sample_bytes, requestAlloc);
+    Dict_putIntC(output, "elapsedMs", prof->elapsed_ms, requestAlloc);
+    Dict_putListC(output, "stacks", stacks, requestAlloc);
+    Dict_putIntC(output, "total", prof->total, requestAlloc);
+    if (first + prof->count < prof->total) { Dict_putIntC(output, "more", 1, requestAlloc); }
+    Admin_sendMessage(output, txid, ctx->admin);
+}
+
 void Allocator_admin_register(struct Allocator* alloc, struct Admin* admin)
 {
     struct Allocator_admin_pvt* ctx = Allocator_clone(alloc, (&(struct Allocator_admin_pvt) {
@@ -55,4 +126,12 @@ void Allocator_admin_register(struct Allocator* alloc, struct Admin* admin)
             { .name = "includeAllocations", .required = 0, .type = "Int" }
         }), admin);
     Admin_registerFunction("Allocator_bytesAllocated", bytesAllocated, ctx, true, NULL, admin);
+    Admin_registerFunction("Allocator_bufferPool", bufferPool, ctx, true, NULL, admin);
+    Admin_registerFunction("Allocator_profile", profile, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "enable", .required = 0, .type = "Int" },
+            { .name = "reset", .required = 0, .type = "Int" },
+            { .name = "sampleBytes", .required = 0, .type = "Int" },
+            { .name = "page", .required = 0, .type = "Int" }
+        }), admin);
 }
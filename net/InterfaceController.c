@@ -99,6 +99,11 @@ struct InterfaceController_Iface_pvt
     uint32_t lastPeerPinged;
     struct InterfaceController_pvt* ic;
     struct Allocator* alloc;
+
+    /** Handshakes come back here once a handshake worker has run them. */
+    struct Iface handshakeIf;
+    RTypes_CryptoAuth2_HandshakeIface_t* handshakes;
+
     Identity
 };
 
@@ -229,6 +234,9 @@ struct InterfaceController_pvt
 
     uint8_t ourPubKey[32];
 
+    /** Switches transit traffic between established peers without entering C. */
+    Rffi_SwitchFastPath_t* fastPath;
+
     Identity
 };
 
@@ -248,6 +256,11 @@ static void sendPeer(uint32_t pathfinderId,
                      struct Peer* peer,
                      uint16_t latency)
 {
+    if (ev == PFChan_Core_PEER_GONE) {
+        // Nothing may be fast switched to or from a peer which the pathfinder has been
+        // told is gone, handleIncomingFromWire() adds it back if the session comes back.
+        Rffi_SwitchFastPath_removePeer(peer->ici->ic->fastPath, peer->addr.path, peer->caSession);
+    }
     if (!peer->addr.protocolVersion || knownIncompatibleVersion(peer->addr.protocolVersion)) {
         // Don't know the protocol version, never add them
         return;
@@ -300,6 +313,7 @@ static void onPingResponse(struct SwitchPinger_Response* resp, void* onResponseC
 
     if (knownIncompatibleVersion(resp->version) || ep->addr.path != resp->label) {
         ep->state = InterfaceController_PeerState_INCOMPATIBLE;
+        Rffi_SwitchFastPath_removePeer(ic->fastPath, ep->addr.path, ep->caSession);
         return;
     }
 
@@ -349,6 +363,31 @@ static void sendPing(struct Peer* ep)
     }
 }
 
+/**
+ * Traffic which was switched by the fast path never reached this peer's counters,
+ * take it from the fast path so that stats and liveness are correct.
+ */
+static void syncFastPath(struct Peer* ep)
+{
+    struct InterfaceController_pvt* ic = Identity_check(ep->ici->ic);
+    RTypes_SwitchFastPath_PeerStats_t st;
+    if (!Rffi_SwitchFastPath_takePeerStats(&st, ic->fastPath, ep->addr.path, ep->caSession)) {
+        return;
+    }
+    uint64_t now = Time_currentTimeMilliseconds();
+    if (st.bytes_in) {
+        ep->bytesIn += st.bytes_in;
+        Kbps_accumulate(&ep->recvBw, now, st.bytes_in);
+    }
+    if (st.bytes_out) {
+        ep->bytesOut += st.bytes_out;
+        Kbps_accumulate(&ep->sendBw, now, st.bytes_out);
+    }
+    if (st.last_recv_ms > ep->timeOfLastMessage) {
+        ep->timeOfLastMessage = st.last_recv_ms;
+    }
+}
+
 static void linkState(void* vic)
 {
     struct InterfaceController_pvt* ic = Identity_check((struct InterfaceController_pvt*) vic);
@@ -364,6 +403,7 @@ static void linkState(void* vic)
         struct InterfaceController_Iface_pvt* ici = ArrayList_OfIfaces_get(ic->icis, i);
         for (uint32_t i = 0; i < ici->peerMap.count; i++) {
             struct Peer* ep = ici->peerMap.values[i];
+            syncFastPath(ep);
 
             RTypes_CryptoStats_t stats;
             Ca_stats(ep->caSession, &stats);
@@ -418,9 +458,12 @@ static void iciPing(struct InterfaceController_Iface_pvt* ici, struct InterfaceC
             // but we keep the session in INCOMPATIBLE state to keep track of the
             // fact that we don't want to talk to it.
             ep->state = InterfaceController_PeerState_INCOMPATIBLE;
+            Rffi_SwitchFastPath_removePeer(ic->fastPath, ep->addr.path, ep->caSession);
             continue;
         }
 
+        syncFastPath(ep);
+
         uint8_t ipIfDebug[40];
         if (Defined(Log_DEBUG)) {
             Address_printIp(ipIfDebug, &ep->addr);
@@ -813,6 +856,94 @@ static Iface_DEFUN handleBeacon(
     return NULL;
 }
 
+// Set up the peer, reply or deliver the packet, as the handshake with a new peer says
+static Iface_DEFUN afterHandshake(Message_t* msg,
+                                  struct InterfaceController_Iface_pvt* ici,
+                                  struct Sockaddr* lladdr,
+                                  RTypes_CryptoAuth2_TryHandshake_Ret_t* ret)
+{
+    if (ret->sess) {
+        // We have a new session, setup the endpoint
+        struct Peer* ep = epFromSess(lladdr, ici, ret->sess, ret->alloc);
+        if (SwitchCore_addInterface(ici->ic->switchCore, &ep->switchIf, ep->alloc, &ep->addr.path)) {
+            Log_debug(ici->ic->logger, "handleUnexpectedIncoming() SwitchCore out of space");
+            Allocator_free(ep->alloc);
+            return Error(msg, "UNHANDLED");
+        }
+        Assert_true(Map_EndpointsBySockaddr_indexForKey(&ep->lladdr, &ici->peerMap) == -1);
+        int index = Map_EndpointsBySockaddr_put(&ep->lladdr, &ep, &ici->peerMap);
+        Assert_true(index >= 0);
+        ep->handle = ici->peerMap.handles[index];
+
+        // We want the node to immedietly be pinged but we don't want it to appear unresponsive because
+        // the pinger will only ping every (PING_INTERVAL * 8) so we set timeOfLastMessage to
+        // (now - pingAfterMilliseconds - 1) so it will be considered a "lazy node".
+        ep->timeOfLastMessage =
+            Time_currentTimeMilliseconds() - ici->ic->pingAfterMilliseconds - 1;
+
+        Log_info(ici->ic->logger, "Added peer [%s] from incoming message",
+            Address_toString(&ep->addr, Message_getAlloc(msg))->bytes);
+
+        if (ep->addr.protocolVersion) {
+            // This will only work if the other end sent us their version (WG mode)
+            sendPeer(0xffffffff, PFChan_Core_PEER, ep, 0xffff);
+        } else {
+            // We don't know their version, ping them to find out
+            sendPing(ep);
+        }
+
+        if (ret->code == RTypes_CryptoAuth2_TryHandshake_Code_t_RecvPlaintext) {
+            // receive the packet
+            return afterDecrypt(msg, &ep->plaintext);
+        }
+    }
+
+    if (ret->code == RTypes_CryptoAuth2_TryHandshake_Code_t_ReplyToPeer) {
+        // Send back a reply to the node who sent us this packet
+        Err(Message_epush(msg, lladdr, lladdr->addrLen));
+        return Iface_next(&ici->pub.addrIf, msg);
+    }
+
+    if (ret->code == RTypes_CryptoAuth2_TryHandshake_Code_t_Error) {
+        Log_debug(ici->ic->logger, "Error on unexpected packet from [%s]: [%d]",
+            Sockaddr_print(lladdr, Message_getAlloc(msg)), ret->err);
+        return Error(msg, "DECRYPT");
+    }
+
+    if (ret->code == RTypes_CryptoAuth2_TryHandshake_Code_t_Done) {
+        // Nothing to do
+        return NULL;
+    }
+
+    Assert_failure("Rffi_CryptoAuth2_tryHandshake() replied [%d]", ret->code);
+}
+
+// A handshake which a handshake worker has run, see Rffi_CryptoAuth2_submitHandshake()
+static Iface_DEFUN handshakeDone(Message_t* msg, struct Iface* handshakeIf)
+{
+    struct InterfaceController_Iface_pvt* ici =
+        Identity_containerOf(handshakeIf, struct InterfaceController_Iface_pvt, handshakeIf);
+
+    RTypes_CryptoAuth2_TryHandshake_Ret_t ret = { .code = 0 };
+    Rffi_CryptoAuth2_handshakeDone(msg, ici->alloc, &ret);
+
+    struct Sockaddr_storage lladdrStore;
+    struct Sockaddr* lladdr = (struct Sockaddr*) &lladdrStore;
+    {
+        struct Sockaddr* lladdr0 = (struct Sockaddr*) Message_bytes(msg);
+        Err(Message_epop(msg, lladdr, lladdr0->addrLen));
+    }
+
+    if (Map_EndpointsBySockaddr_indexForKey(&lladdr, &ici->peerMap) != -1) {
+        // Another handshake from the same address got there first
+        if (ret.alloc) {
+            Allocator_free(ret.alloc);
+        }
+        return NULL;
+    }
+    return afterHandshake(msg, ici, lladdr, &ret);
+}
+
 static Iface_DEFUN handleIncomingFromWire(Message_t* msg, struct Iface* addrIf)
 {
     struct InterfaceController_Iface_pvt* ici =
@@ -853,63 +984,20 @@ static Iface_DEFUN handleIncomingFromWire(Message_t* msg, struct Iface* addrIf)
         Err(Message_epush(msg, NULL, 16));
         Sockaddr_asIp6(Message_bytes(msg), lladdr);
 
-        RTypes_CryptoAuth2_TryHandshake_Ret_t ret = { .code = 0 };
-        Rffi_CryptoAuth2_tryHandshake(ici->ic->ca, msg, ici->alloc, true, &ret);
-
-        if (ret.sess) {
-            // We have a new session, setup the endpoint
-            struct Peer* ep = epFromSess(lladdr, ici, ret.sess, ret.alloc);
-            if (SwitchCore_addInterface(ici->ic->switchCore, &ep->switchIf, ep->alloc, &ep->addr.path)) {
-                Log_debug(ici->ic->logger, "handleUnexpectedIncoming() SwitchCore out of space");
-                Allocator_free(ep->alloc);
-                return Error(msg, "UNHANDLED");
-            }
-            Assert_true(Map_EndpointsBySockaddr_indexForKey(&ep->lladdr, &ici->peerMap) == -1);
-            int index = Map_EndpointsBySockaddr_put(&ep->lladdr, &ep, &ici->peerMap);
-            Assert_true(index >= 0);
-            ep->handle = ici->peerMap.handles[index];
-
-            // We want the node to immedietly be pinged but we don't want it to appear unresponsive because
-            // the pinger will only ping every (PING_INTERVAL * 8) so we set timeOfLastMessage to
-            // (now - pingAfterMilliseconds - 1) so it will be considered a "lazy node".
-            ep->timeOfLastMessage =
-                Time_currentTimeMilliseconds() - ici->ic->pingAfterMilliseconds - 1;
-
-            Log_info(ici->ic->logger, "Added peer [%s] from incoming message",
-                Address_toString(&ep->addr, Message_getAlloc(msg))->bytes);
-
-            if (ep->addr.protocolVersion) {
-                // This will only work if the other end sent us their version (WG mode)
-                sendPeer(0xffffffff, PFChan_Core_PEER, ep, 0xffff);
-            } else {
-                // We don't know their version, ping them to find out
-                sendPing(ep);
-            }
-
-            if (ret.code == RTypes_CryptoAuth2_TryHandshake_Code_t_RecvPlaintext) {
-                // receive the packet
-                return afterDecrypt(msg, &ep->plaintext);
-            }
-        }
-
-        if (ret.code == RTypes_CryptoAuth2_TryHandshake_Code_t_ReplyToPeer) {
-            // Send back a reply to the node who sent us this packet
-            Err(Message_epush(msg, lladdr, lladdr->addrLen));
-            return Iface_next(&ici->pub.addrIf, msg);
-        }
-
-        if (ret.code == RTypes_CryptoAuth2_TryHandshake_Code_t_Error) {
-            Log_debug(ici->ic->logger, "Error on unexpected packet from [%s]: [%d]",
-                printedAddr, ret.err);
-            return Error(msg, "DECRYPT");
-        }
-
-        if (ret.code == RTypes_CryptoAuth2_TryHandshake_Code_t_Done) {
-            // Nothing to do
+        RTypes_CryptoAuth2_Handshake_Submit_t sub = Rffi_CryptoAuth2_submitHandshake(
+            ici->ic->ca, msg, (uint8_t*) lladdr, lladdr->addrLen, true, ici->handshakes);
+        if (sub == RTypes_CryptoAuth2_Handshake_Submit_t_Queued) {
+            // Continues in handshakeDone()
+            return NULL;
+        } else if (sub == RTypes_CryptoAuth2_Handshake_Submit_t_Refused) {
+            Log_debug(ici->ic->logger, "DROP handshake from [%s], over rate or under load",
+                printedAddr);
             return NULL;
         }
 
-        Assert_failure("Rffi_CryptoAuth2_tryHandshake() replied [%d]", ret.code);
+        RTypes_CryptoAuth2_TryHandshake_Ret_t ret = { .code = 0 };
+        Rffi_CryptoAuth2_tryHandshake(ici->ic->ca, msg, ici->alloc, true, &ret);
+        return afterHandshake(msg, ici, lladdr, &ret);
     }
 
     struct Peer* ep = Identity_check((struct Peer*) ici->peerMap.values[epIndex]);
@@ -974,6 +1062,13 @@ static Iface_DEFUN afterDecrypt(Message_t* msg, struct Iface* plaintext)
     } else {
         if (ep->state != caState) {
             sendPeer(0xffffffff, PFChan_Core_PEER, ep, 0xffff);
+            RTypes_Error_t* er = Rffi_SwitchFastPath_addPeer(ic->fastPath,
+                ici->pub.ifNum, ep->lladdr, ep->addr.path, ep->caSession, Message_getAlloc(msg));
+            if (er && Defined(Log_DEBUG)) {
+                Log_debug(ic->logger, "Peer [%s] not switched by fast path: [%s]",
+                    Address_toString(&ep->addr, Message_getAlloc(msg))->bytes,
+                    Rffi_printError(er, Message_getAlloc(msg)));
+            }
         }
         ep->timeOfLastMessage = Time_currentTimeMilliseconds();
     }
@@ -1012,6 +1107,9 @@ struct InterfaceController_Iface* InterfaceController_newIface(struct InterfaceC
     ici->pub.addrIf.send = handleIncomingFromWire;
     ici->pub.ifNum = ArrayList_OfIfaces_add(ic->icis, ici);
     ici->pub.af = -1;
+    ici->handshakes = Rffi_CryptoAuth2_handshakeIface(alloc);
+    ici->handshakeIf.send = handshakeDone;
+    Iface_plumb(&ici->handshakeIf, ici->handshakes->iface);
 
     Identity_set(ici);
 
@@ -1216,6 +1314,7 @@ int InterfaceController_getPeerStats(struct InterfaceController* ifController,
         struct InterfaceController_Iface_pvt* ici = ArrayList_OfIfaces_get(ic->icis, j);
         for (int i = 0; i < (int)ici->peerMap.count; i++) {
             struct Peer* peer = Identity_check((struct Peer*) ici->peerMap.values[i]);
+            syncFastPath(peer);
             struct InterfaceController_PeerStats* s = &stats[xcount];
             xcount++;
             s->ifNum = ici->pub.ifNum;
@@ -1310,6 +1409,12 @@ static Iface_DEFUN incomingFromEventEmitterIf(Message_t* msg, struct Iface* even
     return NULL;
 }
 
+Rffi_SwitchFastPath_t* InterfaceController_getFastPath(struct InterfaceController* ifc)
+{
+    struct InterfaceController_pvt* ic = Identity_check((struct InterfaceController_pvt*) ifc);
+    return ic->fastPath;
+}
+
 struct InterfaceController* InterfaceController_new(Ca_t* ca,
                                                     struct SwitchCore* switchCore,
                                                     struct Log* logger,
@@ -1363,6 +1468,7 @@ struct InterfaceController* InterfaceController_new(Ca_t* ca,
     Identity_set(out);
 
     out->icis = ArrayList_OfIfaces_new(alloc);
+    out->fastPath = Rffi_SwitchFastPath_new(alloc);
 
     out->eventEmitterIf.send = incomingFromEventEmitterIf;
     EventEmitter_regCore(ee, &out->eventEmitterIf, PFChan_Pathfinder_PEERS);
@@ -22,6 +22,7 @@
 #include "switch/SwitchCore.h"
 #include "net/SwitchPinger.h"
 #include "net/EventEmitter.h"
+#include "rust/cjdns_sys/Rffi.h"
 #include "util/platform/Sockaddr.h"
 #include "util/log/Log.h"
 #include "util/Linker.h"
@@ -237,6 +238,13 @@ int InterfaceController_getPeerStats(struct InterfaceController* ic,
                               struct Allocator* alloc,
                               struct InterfaceController_PeerStats** statsOut);
 
+/**
+ * Get the switch fast path which interfaces can attach to so that transit traffic between
+ * established peers is switched without taking the global lock, see Rffi_SwitchFastPath_new().
+ * It is disabled until Rffi_SwitchFastPath_setEnabled() is called.
+ */
+Rffi_SwitchFastPath_t* InterfaceController_getFastPath(struct InterfaceController* ifc);
+
 struct InterfaceController* InterfaceController_new(Ca_t* ca,
                                       struct SwitchCore* switchCore,
                                       struct Log* logger,
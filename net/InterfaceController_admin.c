@@ -189,6 +189,28 @@ static void adminResetPeering(Dict* args,
     Admin_sendMessage(response, txid, context->admin);
 }
 
+static void adminFastPath(Dict* args, void* vcontext, String* txid, struct Allocator* alloc)
+{
+    struct Context* context = Identity_check((struct Context*)vcontext);
+    Rffi_SwitchFastPath_t* fp = InterfaceController_getFastPath(context->ic);
+
+    int64_t* enable = Dict_getIntC(args, "enable");
+    if (enable) {
+        Rffi_SwitchFastPath_setEnabled(fp, *enable != 0);
+    }
+
+    RTypes_SwitchFastPath_Stats_t st;
+    Rffi_SwitchFastPath_stats(&st, fp);
+
+    Dict* resp = Dict_new(alloc);
+    Dict_putIntC(resp, "enabled", st.enabled, alloc);
+    Dict_putIntC(resp, "peers", st.peers, alloc);
+    Dict_putIntC(resp, "forwarded", st.forwarded, alloc);
+    Dict_putIntC(resp, "toCore", st.to_core, alloc);
+    Dict_putIntC(resp, "dropped", st.dropped, alloc);
+    Admin_sendMessage(resp, txid, context->admin);
+}
+
 /*
 static resetSession(Dict* args, void* vcontext, String* txid, struct Allocator* requestAlloc)
 {
@@ -252,4 +274,8 @@ void InterfaceController_admin_register(struct InterfaceController* ic,
             { .name = "pubkey", .required = 1, .type = "String" }
         }), admin);
 
+    Admin_registerFunction("InterfaceController_fastPath", adminFastPath, ctx, true,
+        ((struct Admin_FunctionArg[]) {
+            { .name = "enable", .required = 0, .type = "Int" }
+        }), admin);
 }
@@ -87,6 +87,8 @@ static void outputSession(struct Context* context,
     Dict_putIntC(r, "lostPackets", stats.lost_packets, alloc);
     Dict_putIntC(r, "receivedOutOfRange", stats.received_unexpected, alloc);
     Dict_putIntC(r, "noiseProto", stats.noise_proto, alloc);
+    Dict_putIntC(r, "secretCacheHits", stats.secret_cache_hits, alloc);
+    Dict_putIntC(r, "secretCacheMisses", stats.secret_cache_misses, alloc);
 
 
     addr.path = session->paths[0].label;
@@ -5,6 +5,21 @@
 
 #include "RTypesPrefix.h"
 
+typedef enum {
+  /**
+   * Admitted but there are no handshake workers, run it with Rffi_CryptoAuth2_tryHandshake()
+   */
+  RTypes_CryptoAuth2_Handshake_Submit_t_Inline,
+  /**
+   * It will come back through the handshake iface when it has run
+   */
+  RTypes_CryptoAuth2_Handshake_Submit_t_Queued,
+  /**
+   * Dropped, the source is over its rate or must retry
+   */
+  RTypes_CryptoAuth2_Handshake_Submit_t_Refused,
+} RTypes_CryptoAuth2_Handshake_Submit_t;
+
 typedef enum {
   RTypes_CryptoAuth2_TryHandshake_Code_t_ReplyToPeer,
   RTypes_CryptoAuth2_TryHandshake_Code_t_RecvPlaintext,
@@ -83,8 +98,246 @@ typedef struct {
    * True if the session is using the Noise protocol
    */
   bool noise_proto;
+  /**
+   * Hellos, sent or received by any session of this CryptoAuth, whose secret
+   * came from the cache of secrets shared with peers' permanent keys
+   */
+  uint64_t secret_cache_hits;
+  /**
+   * Hellos whose secret had to be made, with a scalar multiplication
+   */
+  uint64_t secret_cache_misses;
 } RTypes_CryptoStats_t;
 
+/**
+ * Traffic which the switch fast path handled without C, since the last time it was asked.
+ */
+typedef struct {
+  /**
+   * Plaintext bytes received from the peer and switched by the fast path
+   */
+  uint64_t bytes_in;
+  /**
+   * Plaintext bytes sent to the peer by the fast path
+   */
+  uint64_t bytes_out;
+  /**
+   * Time (Rffi_now_ms) of the last packet switched from this peer, 0 if none
+   */
+  uint64_t last_recv_ms;
+} RTypes_SwitchFastPath_PeerStats_t;
+
+typedef struct {
+  bool enabled;
+  /**
+   * Number of peers registered with the fast path
+   */
+  uint32_t peers;
+  /**
+   * Packets switched without going through C
+   */
+  uint64_t forwarded;
+  /**
+   * Packets from registered peers which had to be given to C
+   */
+  uint64_t to_core;
+  /**
+   * Packets from registered peers which failed to decrypt or encrypt
+   */
+  uint64_t dropped;
+} RTypes_SwitchFastPath_Stats_t;
+
+typedef struct {
+  /**
+   * Threads which have handed messages to the core thread
+   */
+  uint64_t submitters;
+  /**
+   * Messages queued for the core thread
+   */
+  uint64_t submitted;
+  /**
+   * Messages dropped because the submitting thread's queue was full
+   */
+  uint64_t ring_full;
+  /**
+   * Times the core thread took the GCL to run queued messages
+   */
+  uint64_t rounds;
+  /**
+   * Times the core thread had to be woken up
+   */
+  uint64_t wakeups;
+} RTypes_CoreThread_Stats_t;
+
+typedef struct {
+  /**
+   * Number of times recorded
+   */
+  uint64_t count;
+  /**
+   * Sum of all recorded times, in nanoseconds
+   */
+  uint64_t total_ns;
+  /**
+   * Longest recorded time, in nanoseconds
+   */
+  uint64_t max_ns;
+  /**
+   * Bucket 0 counts times of 0ns, bucket i counts times from 2^(i-1) up to
+   * 2^i nanoseconds and the last bucket counts anything longer.
+   */
+  uint64_t buckets[32];
+} RTypes_GclProfile_Histogram_t;
+
+typedef struct {
+  /**
+   * Name of the code which takes the GCL, static nul terminated string
+   */
+  const char *name;
+  /**
+   * Time spent waiting for the GCL
+   */
+  RTypes_GclProfile_Histogram_t wait;
+  /**
+   * Time the GCL was held for
+   */
+  RTypes_GclProfile_Histogram_t hold;
+} RTypes_GclProfile_Site_t;
+
+typedef struct {
+  /**
+   * Number of tokio worker threads
+   */
+  uint32_t runtime_threads;
+  /**
+   * Whether each runtime thread is pinned to one CPU
+   */
+  bool pin_threads;
+  /**
+   * NUMA node which runtime threads are kept on, -1 if none
+   */
+  int32_t numa_node;
+  /**
+   * Number of CPUs which runtime threads may run on
+   */
+  uint32_t cpus;
+  /**
+   * Send and receive workers for each new socket interface (e.g. TUN)
+   */
+  uint32_t socket_workers;
+  /**
+   * Send and receive workers for each new UDP interface
+   */
+  uint32_t udp_workers;
+  /**
+   * Whether new socket interfaces use io_uring where the kernel supports it
+   */
+  bool io_uring;
+} RTypes_RuntimeTopology_t;
+
+typedef struct {
+  /**
+   * Pooled allocations which reused a free buffer
+   */
+  uint64_t hits;
+  /**
+   * Pooled allocations which had to allocate a new buffer
+   */
+  uint64_t misses;
+  /**
+   * Allocations too large to be pooled
+   */
+  uint64_t oversize;
+  /**
+   * Buffers returned to the pool when freed
+   */
+  uint64_t returned;
+  /**
+   * Of those returned, buffers freed on another thread than the one which took them
+   */
+  uint64_t returned_remote;
+  /**
+   * Buffers released when freed because the pool was full
+   */
+  uint64_t released;
+} RTypes_BufPool_Stats_t;
+
+typedef struct {
+  /**
+   * Where each allocator from the root down was created, then where the
+   * memory was allocated, separated by ';'
+   */
+  const char *stack;
+  /**
+   * Estimated memory which is still allocated
+   */
+  uint64_t live_bytes;
+  /**
+   * Estimated number of allocations which are still allocated
+   */
+  uint64_t live_allocs;
+  /**
+   * Estimated memory allocated since the profile was started or reset
+   */
+  uint64_t total_bytes;
+  /**
+   * Estimated number of allocations since the profile was started or reset
+   */
+  uint64_t total_allocs;
+} RTypes_AllocProfile_Entry_t;
+
+typedef struct {
+  bool enabled;
+  /**
+   * Average number of bytes allocated between samples
+   */
+  uint64_t sample_bytes;
+  /**
+   * Milliseconds since the profile was started or reset
+   */
+  uint64_t elapsed_ms;
+  /**
+   * Entries in this page
+   */
+  uintptr_t count;
+  /**
+   * Entries in the whole profile
+   */
+  uintptr_t total;
+  /**
+   * Sorted by live_bytes, largest first
+   */
+  const RTypes_AllocProfile_Entry_t *entries;
+} RTypes_AllocProfile_t;
+
+typedef struct {
+  /**
+   * Handshake worker threads, 0 if handshakes are run inline
+   */
+  uint32_t workers;
+  /**
+   * Handshakes waiting for a worker
+   */
+  uint32_t queued;
+  /**
+   * Handshakes run by the workers
+   */
+  uint64_t completed;
+  /**
+   * Handshakes refused because the source was over its rate
+   */
+  uint64_t rate_limited;
+  /**
+   * Handshakes refused under load because the source had to retry
+   */
+  uint64_t retry_required;
+  /**
+   * Handshakes refused because the queue was full
+   */
+  uint64_t queue_full;
+} RTypes_HandshakePool_Stats_t;
+
 typedef struct {
   Iface_t *plaintext;
   Iface_t *ciphertext;
@@ -97,6 +350,13 @@ typedef struct {
   Allocator_t *alloc;
 } RTypes_CryptoAuth2_TryHandshake_Ret_t;
 
+/**
+ * Where handshakes come back from the handshake workers.
+ */
+typedef struct {
+  Iface_t *iface;
+} RTypes_CryptoAuth2_HandshakeIface_t;
+
 typedef struct {
   char *seed;
   bool snode_trusted;
@@ -118,6 +378,16 @@ typedef struct {
   RTypes_Seeder_DnsSeeds_t h;
   RTypes_EventLoop_t *i;
   RTypes_SocketType j;
+  RTypes_SwitchFastPath_PeerStats_t k;
+  RTypes_SwitchFastPath_Stats_t l;
+  RTypes_CoreThread_Stats_t m;
+  RTypes_GclProfile_Site_t n;
+  RTypes_RuntimeTopology_t o;
+  RTypes_BufPool_Stats_t p;
+  RTypes_AllocProfile_t q;
+  RTypes_CryptoAuth2_Handshake_Submit_t r;
+  RTypes_CryptoAuth2_HandshakeIface_t s;
+  RTypes_HandshakePool_Stats_t t;
 } RTypes_ExportMe;
 
 #endif /* RTypes_H */
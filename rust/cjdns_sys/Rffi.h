@@ -7,6 +7,8 @@
 
 typedef struct RTypes_CryptoAuth2_t RTypes_CryptoAuth2_t;
 
+typedef struct Rffi_EthIface_t Rffi_EthIface_t;
+
 typedef struct Rffi_FdReadableTx Rffi_FdReadableTx;
 
 typedef struct Rffi_Seeder Rffi_Seeder;
@@ -15,6 +17,8 @@ typedef struct Rffi_SocketIface_t Rffi_SocketIface_t;
 
 typedef struct Rffi_SocketServer Rffi_SocketServer;
 
+typedef struct Rffi_SwitchFastPath_t Rffi_SwitchFastPath_t;
+
 /**
  * The handle returned to C, used to talk to the timer task.
  */
@@ -22,6 +26,8 @@ typedef struct Rffi_TimerTx Rffi_TimerTx;
 
 typedef struct Rffi_UDPIface_pvt Rffi_UDPIface_pvt;
 
+typedef struct Rffi_XdpIface_t Rffi_XdpIface_t;
+
 typedef struct {
   Rffi_UDPIface_pvt *pvt;
   Iface_t *iface;
@@ -64,6 +70,40 @@ void Rffi_CryptoAuth2_tryHandshake(const RTypes_CryptoAuth2_t *ca,
                                    bool requireAuth,
                                    RTypes_CryptoAuth2_TryHandshake_Ret_t *ret);
 
+/**
+ * Make the iface which handshakes submitted with it come back from, one per
+ * interface since the sources of handshakes are admitted per interface.
+ */
+RTypes_CryptoAuth2_HandshakeIface_t *Rffi_CryptoAuth2_handshakeIface(Allocator_t *alloc);
+
+/**
+ * Admit a handshake and, if there are handshake workers, queue it to be run,
+ * otherwise it is to be run inline. The message starts with the 16 byte address of the source as it does for
+ * Rffi_CryptoAuth2_tryHandshake() and is left alone, a copy is queued.
+ */
+RTypes_CryptoAuth2_Handshake_Submit_t Rffi_CryptoAuth2_submitHandshake(const RTypes_CryptoAuth2_t *ca,
+                                                                       Message_t *c_msg,
+                                                                       const uint8_t *lladdr,
+                                                                       uint32_t lladdrLen,
+                                                                       bool requireAuth,
+                                                                       const RTypes_CryptoAuth2_HandshakeIface_t *hs);
+
+/**
+ * Take the outcome off of a handshake which came back from the handshake iface,
+ * filling in `ret` as Rffi_CryptoAuth2_tryHandshake() would have.
+ */
+void Rffi_CryptoAuth2_handshakeDone(Message_t *c_msg,
+                                    Allocator_t *alloc,
+                                    RTypes_CryptoAuth2_TryHandshake_Ret_t *ret);
+
+/**
+ * Start running handshakes on `workers` threads rather than inline, 0 does nothing.
+ * Once started, they run until the process exits.
+ */
+RTypes_Error_t *Rffi_CryptoAuth2_startHandshakeWorkers(uint32_t workers, Allocator_t *errAlloc);
+
+void Rffi_CryptoAuth2_handshakeStats(RTypes_HandshakePool_Stats_t *statsOut);
+
 RTypes_CryptoAuth2_Session_t *Rffi_CryptoAuth2_newSession(const RTypes_CryptoAuth2_t *ca,
                                                           Allocator_t *alloc,
                                                           const uint8_t *herPublicKey,
@@ -100,6 +140,12 @@ int Rffi_CryptoAuth2_getSecret(const RTypes_CryptoAuth2_t *ca,
                                const String_t *name,
                                uint8_t *secretOut);
 
+/**
+ * Set the replay window, in nonces, of sessions created from now on, 0 leaves it
+ * alone. Returns the window as it is after clamping and rounding.
+ */
+uint32_t Rffi_CryptoAuth2_replayWindow(const RTypes_CryptoAuth2_t *ca, uint32_t window);
+
 int Rffi_crypto_hash_sha512(unsigned char *out,
                             const unsigned char *input,
                             unsigned long long inlen);
@@ -168,7 +214,19 @@ RTypes_Error_t *Rffi_pollFdReadable(Rffi_FdReadableTx **out,
                                     int fd,
                                     Allocator_t *alloc);
 
-int32_t Rffi_udpIfaceGetFd(Rffi_UDPIface_pvt *iface);
+/**
+ * The fd of one of the SO_REUSEPORT shards of the socket, -1 if there is no such shard.
+ */
+int32_t Rffi_udpIfaceGetFd(Rffi_UDPIface_pvt *iface, uint32_t shard);
+
+uint32_t Rffi_udpIfaceShardCount(Rffi_UDPIface_pvt *iface);
+
+/**
+ * Outputs a list with a dict of counters for each shard of the socket.
+ */
+RTypes_Error_t *Rffi_udpIfaceShardStats(Object_t **outP,
+                                        Rffi_UDPIface_pvt *iface,
+                                        Allocator_t *alloc);
 
 int32_t Rffi_udpIfaceSetBroadcast(Rffi_UDPIface_pvt *iface, bool broadcast);
 
@@ -176,12 +234,68 @@ RTypes_Error_t *Rffi_udpIface_worker_states(Object_t **outP,
                                             Rffi_UDPIface_pvt *iface,
                                             Allocator_t *alloc);
 
+/**
+ * Turn UDP segmentation offload (GSO) and receive offload (GRO) on (1) or off (0),
+ * -1 leaves it as it is. Outputs a dict of what is supported and what is on.
+ */
+RTypes_Error_t *Rffi_udpIfaceOffload(Object_t **outP,
+                                     Rffi_UDPIface_pvt *iface,
+                                     int32_t gso,
+                                     int32_t gro,
+                                     Allocator_t *alloc);
+
+/**
+ * Take the socket's datagrams from device ifName on AF_XDP sockets, mode is as for
+ * Rffi_xdpIfaceNew(), 0 goes back to receiving everything on the socket.
+ * Outputs a dict of xdp, native and queues.
+ */
+RTypes_Error_t *Rffi_udpIfaceXdp(Object_t **outP,
+                                 Rffi_UDPIface_pvt *iface,
+                                 const char *ifName,
+                                 int32_t mode,
+                                 Allocator_t *alloc);
+
+/**
+ * Switch transit traffic from this socket using fp, as interface number ifNum.
+ */
+void Rffi_udpIfaceSetFastPath(Rffi_UDPIface_pvt *iface, Rffi_SwitchFastPath_t *fp, uint32_t ifNum);
+
 int32_t Rffi_udpIfaceSetDscp(Rffi_UDPIface_pvt *iface, uint8_t dscp);
 
+/**
+ * Bind a UDP socket, if shards is more than 1 then that many sockets share the
+ * address using SO_REUSEPORT, 0 means one for each receive worker.
+ */
 RTypes_Error_t *Rffi_udpIfaceNew(Rffi_UDPIface **outp,
                                  const Sockaddr_t *bind_addr,
+                                 uint32_t shards,
                                  Allocator_t *c_alloc);
 
+/**
+ * Set up PACKET_MMAP rings on a bound AF_PACKET / SOCK_RAW socket, the fd is taken
+ * over and closed once the ring is freed, or right away if this fails. Messages to
+ * and from ifOut begin with the 6 byte MAC of the peer and 2 more bytes, the first
+ * of which is the sll_pkttype of a received frame.
+ */
+RTypes_Error_t *Rffi_ethIfaceNew(Iface_t **ifOut,
+                                 Rffi_EthIface_t **eth_out,
+                                 int fd,
+                                 const uint8_t *srcMac,
+                                 Allocator_t *alloc);
+
+/**
+ * Attach an XDP program to the device and open an AF_XDP socket for each of its
+ * receive queues. mode is 1 to use native XDP if the driver supports it and generic
+ * otherwise, 2 for generic only and 3 for native only. Messages to and from ifOut
+ * are the same as those of Rffi_ethIfaceNew().
+ */
+RTypes_Error_t *Rffi_xdpIfaceNew(Iface_t **ifOut,
+                                 Rffi_XdpIface_t **xdp_out,
+                                 const char *ifName,
+                                 const uint8_t *srcMac,
+                                 int mode,
+                                 Allocator_t *alloc);
+
 RTypes_Error_t *Rffi_fileExists(bool *existsOut, const char *path, Allocator_t *errorAlloc);
 
 RTypes_Error_t *Rffi_socketWorkerStates(Object_t **outP,
@@ -194,6 +308,21 @@ RTypes_Error_t *Rffi_socketForFd(Iface_t **ifOut,
                                  RTypes_SocketType st,
                                  Allocator_t *alloc);
 
+/**
+ * Like Rffi_socketForFd() but the workers are spread over a number of fds which
+ * all belong to the same device, e.g. the queues of a multi-queue TUN device.
+ * If vnetHdr is set then the fds are TUN queues opened with IFF_VNET_HDR and st is ignored.
+ */
+RTypes_Error_t *Rffi_socketForFds(Iface_t **ifOut,
+                                  Rffi_SocketIface_t **so_out,
+                                  const int *fds,
+                                  uint32_t count,
+                                  RTypes_SocketType st,
+                                  bool vnetHdr,
+                                  Allocator_t *alloc);
+
+uint32_t Rffi_socketFdCount(const Rffi_SocketIface_t *si);
+
 RTypes_Error_t *Rffi_unixSocketConnect(Iface_t **ifOut, const char *path, Allocator_t *alloc);
 
 void Rffi_unixSocketServerOnConnect(Rffi_SocketServer *rss,
@@ -246,10 +375,53 @@ RTypes_Error_t *Rffi_error_fl(const char *msg, const char *file, int line, Alloc
 
 char *Rffi_printError(RTypes_Error_t *e, Allocator_t *alloc);
 
+/**
+ * Set the environment which the runtime topology of a child process is read
+ * from, this must be called before the core is spawned. A negative value
+ * leaves that setting alone.
+ */
+void Rffi_setRuntimeEnv(int32_t threads, int32_t pinThreads, int32_t numaNode);
+
+/**
+ * Set the number of send and receive workers for interfaces which are created
+ * from now on, 0 for automatic, and whether socket interfaces use io_uring
+ * (non-zero) or epoll (0). A negative value leaves that setting alone.
+ */
+void Rffi_setInterfaceWorkers(int32_t socketWorkers, int32_t udpWorkers, int32_t ioUring);
+
+void Rffi_runtimeTopology(RTypes_RuntimeTopology_t *out);
+
 void Rffi_glock(void);
 
 void Rffi_gunlock(void);
 
+/**
+ * Run every message from Rust into C on one dedicated thread instead of on
+ * whichever thread received it. If cpu is not negative, the thread is pinned
+ * to that CPU. Once started, the core thread runs until the process exits.
+ */
+RTypes_Error_t *Rffi_startCoreThread(int32_t cpu, Allocator_t *errAlloc);
+
+/**
+ * Get the core thread counters, false if the core thread is not running.
+ */
+bool Rffi_coreThreadStats(RTypes_CoreThread_Stats_t *statsOut);
+
+/**
+ * Start or stop recording how long the GCL is waited for and held, per call site.
+ */
+void Rffi_gclProfile_setEnabled(bool enabled);
+
+bool Rffi_gclProfile_enabled(void);
+
+void Rffi_gclProfile_reset(void);
+
+/**
+ * Get the GCL profile of call site number `site`, false if there is no such site.
+ * Sites are numbered from zero.
+ */
+bool Rffi_gclProfile_site(RTypes_GclProfile_Site_t *statsOut, uint32_t site);
+
 int Rffi_parseBase10(const uint8_t *buf, uint32_t max_len, int64_t *num_out, uint32_t *bytes);
 
 /**
@@ -263,11 +435,47 @@ int Rffi_allocator_isFreeing(Allocator_t *a);
 
 Allocator_t *Rffi_allocator_child(Allocator_t *a, const char *file, uintptr_t line);
 
-uint8_t *Rffi_allocator_malloc(Allocator_t *a, uintptr_t size);
+uint8_t *Rffi_allocator_malloc(Allocator_t *a, uintptr_t size, const char *file, uintptr_t line);
 
-uint8_t *Rffi_allocator_calloc(Allocator_t *a, uintptr_t size);
+/**
+ * Allocate a packet buffer from the buffer pool, see Allocator_mallocPooled()
+ */
+uint8_t *Rffi_allocator_mallocPooled(Allocator_t *a,
+                                     uintptr_t size,
+                                     const char *file,
+                                     uintptr_t line);
 
-uint8_t *Rffi_allocator_realloc(Allocator_t *a, uint8_t *ptr, uintptr_t new_size);
+void Rffi_allocator_bufPoolStats(RTypes_BufPool_Stats_t *statsOut);
+
+/**
+ * Turn the allocation profiler on or off, see Allocator_profile()
+ */
+void Rffi_allocator_profileSetEnabled(bool enabled);
+
+/**
+ * Average number of bytes allocated between samples, 0 for the default
+ */
+void Rffi_allocator_profileSetSampleBytes(uint64_t sampleBytes);
+
+void Rffi_allocator_profileReset(void);
+
+/**
+ * Get up to `count` entries of the allocation profile starting at `first`, the
+ * result is allocated in alloc. If `fresh` then a new snapshot of the profile is
+ * taken, otherwise the entries are from the same snapshot as the last call.
+ */
+RTypes_AllocProfile_t *Rffi_allocator_profile(uintptr_t first,
+                                              uintptr_t count,
+                                              bool fresh,
+                                              Allocator_t *alloc);
+
+uint8_t *Rffi_allocator_calloc(Allocator_t *a, uintptr_t size, const char *file, uintptr_t line);
+
+uint8_t *Rffi_allocator_realloc(Allocator_t *a,
+                                uint8_t *ptr,
+                                uintptr_t new_size,
+                                const char *file,
+                                uintptr_t line);
 
 void Rffi_allocator_onFree(Allocator_t *a,
                            OnFreeFun fun,
@@ -330,4 +538,37 @@ RTypes_Error_t *Rffi_Benc_read(Dict_t **out, Message_t *c_msg, Allocator_t *allo
 
 RTypes_Error_t *Rffi_Benc_write(Dict_t *benc, Message_t *c_msg, Allocator_t *alloc);
 
+/**
+ * Create a switch fast path, it is disabled until Rffi_SwitchFastPath_setEnabled().
+ */
+Rffi_SwitchFastPath_t *Rffi_SwitchFastPath_new(Allocator_t *alloc);
+
+void Rffi_SwitchFastPath_setEnabled(Rffi_SwitchFastPath_t *fp, bool enabled);
+
+/**
+ * Register an established peer so that transit traffic from and to it can be
+ * switched without C. Fails if interface ifNum has no fast path port.
+ */
+RTypes_Error_t *Rffi_SwitchFastPath_addPeer(Rffi_SwitchFastPath_t *fp,
+                                            uint32_t ifNum,
+                                            const Sockaddr_t *lladdr,
+                                            uint64_t label,
+                                            const RTypes_CryptoAuth2_Session_t *caSession,
+                                            Allocator_t *errAlloc);
+
+void Rffi_SwitchFastPath_removePeer(Rffi_SwitchFastPath_t *fp,
+                                    uint64_t label,
+                                    const RTypes_CryptoAuth2_Session_t *caSession);
+
+/**
+ * Get (and reset) the traffic counters of a registered peer, false if not registered.
+ */
+bool Rffi_SwitchFastPath_takePeerStats(RTypes_SwitchFastPath_PeerStats_t *statsOut,
+                                       const Rffi_SwitchFastPath_t *fp,
+                                       uint64_t label,
+                                       const RTypes_CryptoAuth2_Session_t *caSession);
+
+void Rffi_SwitchFastPath_stats(RTypes_SwitchFastPath_Stats_t *statsOut,
+                               const Rffi_SwitchFastPath_t *fp);
+
 #endif /* rffi_H */
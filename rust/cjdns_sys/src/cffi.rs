@@ -273,6 +273,13 @@ extern "C" {
         alloc: *mut Allocator,
     ) -> *mut Message;
 }
+extern "C" {
+    pub fn Message_newPooled_fromRust(
+        messageLength: u32,
+        amountOfPadding: u32,
+        alloc: *mut Allocator,
+    ) -> *mut Message;
+}
 pub type Iface_Callback = ::std::option::Option<
     unsafe extern "C" fn(message: *mut Message_t, thisInterface: *mut Iface) -> *mut RTypes_Error_t,
 >;
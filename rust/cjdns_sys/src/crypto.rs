@@ -6,9 +6,11 @@ pub mod cnoise;
 pub mod crypto_auth;
 pub mod crypto_header;
 pub mod crypto_noise;
+pub mod handshake_pool;
 pub mod keys;
 pub mod random;
 pub mod replay_protector;
+pub mod secret_cache;
 pub mod session;
 
 mod utils {
@@ -31,6 +33,53 @@ mod utils {
         let sha256::Digest(digest) = sha256::hash(data);
         digest
     }
+
+    // libsodium is linked in by sodiumoxide, which has no binding for these.
+    extern "C" {
+        fn crypto_box_detached_afternm(
+            c: *mut u8,
+            mac: *mut u8,
+            m: *const u8,
+            mlen: u64,
+            n: *const u8,
+            k: *const u8,
+        ) -> std::os::raw::c_int;
+        fn crypto_box_open_detached_afternm(
+            m: *mut u8,
+            c: *const u8,
+            mac: *const u8,
+            clen: u64,
+            n: *const u8,
+            k: *const u8,
+        ) -> std::os::raw::c_int;
+    }
+
+    /// Same output as box_::seal_precomputed() but without allocating or copying:
+    /// `buf` is 16 bytes of room for the authenticator followed by the plaintext,
+    /// which is encrypted where it is.
+    #[inline(always)]
+    pub fn crypto_box_seal_in_place(buf: &mut [u8], nonce: &[u8; 24], key: &[u8; 32]) {
+        let (mac, data) = buf.split_at_mut(16);
+        let p = data.as_mut_ptr();
+        unsafe {
+            crypto_box_detached_afternm(p, mac.as_mut_ptr(), p, data.len() as u64, nonce.as_ptr(), key.as_ptr());
+        }
+    }
+
+    /// The reverse of crypto_box_seal_in_place(), `buf` is left as it was if it
+    /// does not authenticate.
+    #[inline(always)]
+    pub fn crypto_box_open_in_place(buf: &mut [u8], nonce: &[u8; 24], key: &[u8; 32]) -> Result<(), ()> {
+        if buf.len() < 16 {
+            return Err(());
+        }
+        let (mac, data) = buf.split_at_mut(16);
+        let p = data.as_mut_ptr();
+        let ret = unsafe {
+            crypto_box_open_detached_afternm(p, p, mac.as_ptr(), data.len() as u64, nonce.as_ptr(), key.as_ptr())
+        };
+        if ret == 0 { Ok(()) } else { Err(()) }
+    }
 }
 
 mod wipe {
@@ -87,6 +136,16 @@ mod wipe {
         }
     }
 
+    impl Wipe for &mut [u8; 32] {
+        #[inline(always)]
+        fn wipe(self) {
+            // Prevent this write from being optimized away
+            volatile_write(self, [0; 32]);
+            // Prevent reordering
+            atomic_fence();
+        }
+    }
+
     impl Wipe for CryptoHeader {
         #[inline(always)]
         fn wipe(mut self) {
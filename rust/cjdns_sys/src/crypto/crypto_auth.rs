@@ -1,6 +1,7 @@
 //! CryptoAuth
 
 use std::sync::Arc;
+use std::sync::atomic::{AtomicU32, Ordering};
 use std::net::Ipv6Addr;
 
 use eyre::Result;
@@ -13,7 +14,10 @@ use crate::crypto::crypto_header::{AuthType, Challenge, CryptoHeader};
 use crate::crypto::keys::{PrivateKey, PublicKey};
 use crate::crypto::random::Random;
 use crate::crypto::replay_protector::ReplayProtector;
-use crate::crypto::utils::{crypto_hash_sha256, crypto_scalarmult_curve25519_base};
+use crate::crypto::secret_cache::SecretCache;
+use crate::crypto::utils::{
+    crypto_box_open_in_place, crypto_box_seal_in_place, crypto_hash_sha256, crypto_scalarmult_curve25519_base,
+};
 use crate::crypto::wipe::Wipe;
 use crate::crypto::zero::IsZero;
 use crate::external::interface::iface::{self, IfRecv, Iface, IfacePvt};
@@ -41,6 +45,12 @@ pub struct CryptoAuth {
     event_base: EventBase,
     rand: Random,
     noise: Arc<crypto_noise::CryptoNoise>,
+
+    /// Replay window for sessions created from now on, see ReplayProtector::new().
+    replay_window: AtomicU32,
+
+    /// Secrets shared by our permanent key and peers', see static_secret().
+    secret_cache: Mutex<SecretCache>,
 }
 
 #[derive(Default, Clone)]
@@ -85,7 +95,8 @@ pub struct SessionMut {
     next_nonce: u32,
 
     /// Used to reset the connection if it's in a bad state (no traffic coming in).
-    time_of_last_packet: u32,
+    /// Atomic so that decrypting threads can update it under a read() lock.
+    time_of_last_packet: AtomicU32,
 
     /// The method to use for trying to auth with the server.
     auth_type: AuthType,
@@ -102,9 +113,9 @@ pub struct SessionMut {
 pub struct SessionInner {
     session_mut: RwLock<SessionMut>,
 
-    // This has to be briefly locked every packet, it should not contaminate the write lock
-    // of the SessionMut so that multiple threads can decrypt at the same time...
-    replay_protector: Mutex<ReplayProtector>,
+    // Checked every packet, it is lock-free and kept out of the SessionMut so that
+    // multiple threads can decrypt at the same time under a read() lock.
+    replay_protector: ReplayProtector,
 
     /// A pointer back to the main CryptoAuth context.
     context: Arc<CryptoAuth>,
@@ -278,9 +289,35 @@ impl CryptoAuth {
             event_base,
             rand,
             noise,
+            replay_window: AtomicU32::new(ReplayProtector::DEFAULT_WINDOW),
+            secret_cache: Mutex::new(SecretCache::default()),
         }
     }
 
+    /// The secret shared by our permanent key and `her_public_key`, made once and
+    /// then taken from the cache for as long as the peer keeps coming back.
+    /// The cache is not locked while it is being made.
+    fn static_secret(&self, her_public_key: [u8; 32], password_hash: Option<[u8; 32]>) -> [u8; 32] {
+        if let Some(secret) = self.secret_cache.lock().get(&her_public_key, &password_hash) {
+            return secret;
+        }
+        let secret = get_shared_secret(*self.private_key.raw(), her_public_key, password_hash);
+        self.secret_cache.lock().insert(her_public_key, password_hash, secret);
+        secret
+    }
+
+    /// Set how many nonces out of order a packet can arrive and not be dropped, for
+    /// sessions created after this. Returns the window as it was clamped and rounded.
+    pub fn set_replay_window(&self, window: u32) -> u32 {
+        let window = ReplayProtector::new(window).window();
+        self.replay_window.store(window, Ordering::Relaxed);
+        window
+    }
+
+    pub fn replay_window(&self) -> u32 {
+        self.replay_window.load(Ordering::Relaxed)
+    }
+
     /// Associate a password with a user.
     ///
     /// If `ipv6` is not `None`, only allow connections to this CryptoAuth from
@@ -469,6 +506,13 @@ pub fn try_handshake(
     }
 }
 
+/// Encrypt `msg` as the hello of a new session from `ca` to `her_pub_key`,
+/// for testing whatever receives it with try_handshake().
+#[cfg(test)]
+pub fn mk_hello(ca: &Arc<CryptoAuth>, her_pub_key: PublicKey, msg: &mut Message) -> Result<()> {
+    Session::new(Arc::clone(ca), her_pub_key, false, None)?.encrypt_msg(msg)
+}
+
 
 impl SessionMut {
     fn set_auth(&mut self, password: Option<ByteString>, login: Option<ByteString>) {
@@ -525,7 +569,7 @@ impl SessionMut {
         }
 
         let now_secs = event_base.current_time_seconds() as i64;
-        let time_of_last_packet = self.time_of_last_packet as i64;
+        let time_of_last_packet = self.time_of_last_packet.load(Ordering::Relaxed) as i64;
         let delta = now_secs - time_of_last_packet;
         if delta < self.setup_reset_after_inactivity_seconds as i64 {
             return;
@@ -536,7 +580,7 @@ impl SessionMut {
         debug::log(self, || {
             format!("No traffic in [{}] seconds, resetting connection.", delta)
         });
-        self.time_of_last_packet = now_secs as u32;
+        self.time_of_last_packet.store(now_secs as u32, Ordering::Relaxed);
         self.reset();
     }
 
@@ -557,6 +601,10 @@ impl SessionMut {
     }
 
     fn encrypt(sess: &SessionInner, msg: &mut Message) -> Result<()> {
+        if Self::encrypt_run(sess, msg)? {
+            return Ok(());
+        }
+
         let mut session = sess.session_mut.write();
 
         // If there has been no incoming traffic for a while, reset the connection to state 0.
@@ -614,6 +662,10 @@ impl SessionMut {
     }
 
     fn decrypt(sess: &SessionInner, msg: &mut Message) -> Result<()> {
+        if Self::decrypt_run(sess, msg)? {
+            return Ok(());
+        }
+
         let session = sess.session_mut.upgradable_read();
 
         if msg.len() < 20 {
@@ -658,7 +710,7 @@ impl SessionMut {
                 let ret = session.decrypt_message(nonce, msg, secret, sess);
 
                 // This prevents a few "ghost" dropped packets at the beginning of a session.
-                sess.replay_protector.lock().init(nonce + 1);
+                sess.replay_protector.init(nonce + 1);
 
                 if ret.is_ok() {
                     let mut session = RwLockUpgradableReadGuard::upgrade(session);
@@ -669,7 +721,7 @@ impl SessionMut {
                     // Now we're in run mode, no more handshake packets will be accepted
                     session.established = true;
                     session.next_nonce += 3;
-                    session.update_time(msg, sess.context.clone());
+                    session.update_time(msg, &sess.context);
                     return Ok(());
                 }
                 debug::log(&session, || "DROP Final handshake step failed");
@@ -690,9 +742,7 @@ impl SessionMut {
             let ret = session.decrypt_message(nonce, msg, session.shared_secret, sess);
             match ret {
                 Ok(_) => {
-                    let mut session = RwLockUpgradableReadGuard::upgrade(session);
-
-                    session.update_time(msg, sess.context.clone());
+                    session.update_time(msg, &sess.context);
                     Ok(())
                 }
                 Err(err) => {
@@ -823,11 +873,7 @@ impl SessionMut {
 
         let shared_secret;
         if self.next_nonce < State::ReceivedHello as u32 {
-            shared_secret = get_shared_secret(
-                *context.private_key.raw(),
-                *self.her_public_key.raw(),
-                password_hash,
-            );
+            shared_secret = context.static_secret(*self.her_public_key.raw(), password_hash);
 
             self.is_initiator = true;
 
@@ -972,11 +1018,7 @@ impl SessionMut {
                 )
             });
 
-            shared_secret = get_shared_secret(
-                *sess.context.private_key.raw(),
-                *self.her_public_key.raw(),
-                password_hash,
-            );
+            shared_secret = sess.context.static_secret(*self.her_public_key.raw(), password_hash);
 
             next_nonce = State::ReceivedHello as u32;
         } else {
@@ -1148,7 +1190,7 @@ impl SessionMut {
                                 "Incoming hello from node with lower key, resetting"
                             });
                             self.reset();
-                            sess.replay_protector.lock().reset();
+                            sess.replay_protector.reset();
                             self.her_temp_pub_key = header.encrypted_temp_key;
                         } else {
                             // We are the initiator and thus we are sending HELLO packets, however they
@@ -1167,7 +1209,7 @@ impl SessionMut {
                     _ => {
                         debug::log(self, || "Incoming hello packet resetting session");
                         self.reset();
-                        sess.replay_protector.lock().reset();
+                        sess.replay_protector.reset();
                         self.her_temp_pub_key = header.encrypted_temp_key;
                     }
                 }
@@ -1200,11 +1242,73 @@ impl SessionMut {
         );
         self.next_nonce = next_nonce;
 
-        sess.replay_protector.lock().reset();
+        sess.replay_protector.reset();
 
         Ok(())
     }
 
+    /// True if reset_if_timeout() would reset this session if it were called now.
+    fn run_timed_out(&self, event_base: &EventBase) -> bool {
+        let delta = event_base.current_time_seconds() as i64
+            - self.time_of_last_packet.load(Ordering::Relaxed) as i64;
+        delta >= self.reset_after_inactivity_seconds as i64
+    }
+
+    /// Run-mode only part of encrypt(), see SessionTrait::encrypt_run().
+    fn encrypt_run(sess: &SessionInner, msg: &mut Message) -> Result<bool> {
+        const MAX_NONCE: u32 = u32::MAX - 0xF;
+
+        // Only take the nonce under the write lock and encrypt after letting go of it,
+        // so threads decrypting under read() are held up for a moment rather than
+        // for a whole packet.
+        let (nonce, secret, is_initiator) = {
+            let mut session = sess.session_mut.write();
+            if !session.established
+                || session.next_nonce <= State::ReceivedKey as u32
+                || session.next_nonce >= MAX_NONCE
+                || session.run_timed_out(&sess.context.event_base)
+                || msg.len() == 0
+                || msg.pad() < 36
+                || !msg.is_aligned_to(4)
+            {
+                return Ok(false);
+            }
+            session.next_nonce += 1;
+            (session.next_nonce - 1, session.shared_secret, session.is_initiator)
+        };
+
+        encrypt(nonce, msg, secret, is_initiator);
+
+        let r = msg.push(nonce.to_be()); // Big-endian push
+        ensure!(r.is_ok(), EncryptError, "push nonce failed");
+        Ok(true)
+    }
+
+    /// Run-mode only part of decrypt(), see SessionTrait::decrypt_run().
+    /// Only needs read() so any number of threads can be decrypting packets
+    /// of one session at the same time.
+    fn decrypt_run(sess: &SessionInner, msg: &mut Message) -> Result<bool> {
+        let session = sess.session_mut.read();
+        if !session.established
+            || msg.len() < 20
+            || !msg.is_aligned_to(4)
+            || msg.cap() % 4 != 0
+            || session.run_timed_out(&sess.context.event_base)
+        {
+            return Ok(false);
+        }
+        let nonce = u32::from_be(*msg.peek::<u32>()?);
+        if nonce < Nonce::FirstTrafficPacket as u32 {
+            return Ok(false);
+        }
+        msg.discard_bytes(4)?;
+
+        debug_assert!(!session.shared_secret.is_zero());
+        session.decrypt_message(nonce, msg, session.shared_secret, sess)?;
+        session.update_time(msg, &sess.context);
+        Ok(true)
+    }
+
     #[inline]
     fn decrypt_message(
         &self,
@@ -1220,7 +1324,7 @@ impl SessionMut {
             return Err(DecryptError::DecryptErr(DecryptErr::Decrypt).into());
         }
 
-        if !sess.replay_protector.lock().check_nonce(nonce) {
+        if !sess.replay_protector.check_nonce(nonce) {
             debug::log(self, || {
                 format!("DROP nonce checking failed nonce=[{}]", nonce)
             });
@@ -1231,8 +1335,9 @@ impl SessionMut {
     }
 
     #[inline]
-    fn update_time(&mut self, _msg: &Message, context: Arc<CryptoAuth>) {
-        self.time_of_last_packet = context.event_base.current_time_seconds();
+    fn update_time(&self, _msg: &Message, context: &CryptoAuth) {
+        let now = context.event_base.current_time_seconds();
+        self.time_of_last_packet.store(now, Ordering::Relaxed);
     }
 }
 
@@ -1330,13 +1435,13 @@ impl Session {
                 password: None,
                 login: None,
                 next_nonce: State::Init as u32,
-                time_of_last_packet: now,
+                time_of_last_packet: AtomicU32::new(now),
                 auth_type: AuthType::Zero,
                 is_initiator: false,
                 require_auth,
                 established: false,
             }),
-            replay_protector: Mutex::new(ReplayProtector::new()),
+            replay_protector: ReplayProtector::new(context.replay_window()),
             context,
             her_ip6,
             plain_pvt,
@@ -1389,14 +1494,16 @@ impl SessionTrait for Session {
 
     fn stats(&self) -> CryptoStats {
         // Stats come from the replay protector
-        let rp = self.inner.replay_protector.lock();
-        let stats = rp.stats();
+        let stats = self.inner.replay_protector.stats();
+        let cache = self.inner.context.secret_cache.lock().stats();
         CryptoStats {
             lost_packets: stats.lost_packets as u64,
             received_unexpected: stats.received_unexpected as u64,
             received_packets: stats.received_packets as u64,
             duplicate_packets: stats.duplicate_packets as u64,
             noise_proto: false,
+            secret_cache_hits: cache.hits,
+            secret_cache_misses: cache.misses,
         }
     }
 
@@ -1410,8 +1517,7 @@ impl SessionTrait for Session {
         // Make sure we're write() session_mut when we do the replay because
         // decrypt threads will read() session_mut
         let mut session_mut = self.inner.session_mut.write();
-        let mut replay_protector = self.inner.replay_protector.lock();
-        replay_protector.reset();
+        self.inner.replay_protector.reset();
         session_mut.reset();
     }
 
@@ -1430,6 +1536,20 @@ impl SessionTrait for Session {
     fn cjdns_ver(&self) -> u32 {
         0
     }
+
+    fn decrypt_run(&self, msg: &mut Message) -> Result<bool> {
+        SessionMut::decrypt_run(&self.inner, msg)
+    }
+
+    fn encrypt_run(&self, msg: &mut Message) -> Result<bool> {
+        SessionMut::encrypt_run(&self.inner, msg)
+    }
+
+    fn deliver_plaintext(&self, mut msg: Message) -> Result<()> {
+        // Same as CiphertextRecv after a successful decrypt
+        msg.push(0_u32)?;
+        self.inner.plain_pvt.send(msg)
+    }
 }
 
 /// Get a shared secret.
@@ -1561,53 +1681,19 @@ fn decrypt(nonce: u32, msg: &mut Message, secret: [u8; 32], is_initiator: bool)
 }
 
 /// Encrypt and authenticate.
-/// Grows the message by 16 bytes.
+/// Grows the message by 16 bytes, the authenticator goes in the padding.
 #[inline]
 fn encrypt_rnd_nonce(nonce: [u8; 24], msg: &mut Message, secret: [u8; 32]) {
-    //msg.push_bytes(&[0; 32]).expect("pad >= 32");
-
-    {
-        use cjdns::sodiumoxide::crypto::box_::curve25519xsalsa20poly1305::*;
-        let bytes = msg.bytes_mut();
-        let nonce = Nonce(nonce);
-        let key = PrecomputedKey(secret);
-        //TODO this data copying is suboptimal. Need proper fn binding.
-        let encrypted = seal_precomputed(bytes, &nonce, &key); // adds 16 bytes
-        msg.push_bytes(&[0; 16]).expect("pad >= 16"); // also grow orig msg
-        let dest = msg.bytes_mut();
-        assert_eq!(dest.len(), encrypted.len());
-        dest.copy_from_slice(&encrypted);
-    }
-
-    // Pop 16 bytes despite we pushed 32
-    //msg.discard_bytes(16).expect("discard");
+    msg.push_bytes(&[0; 16]).expect("pad >= 16");
+    crypto_box_seal_in_place(msg.bytes_mut(), &nonce, &secret);
 }
 
 /// Decrypt and authenticate.
 /// Shrinks the message by 16 bytes.
 #[inline]
 fn decrypt_rnd_nonce(nonce: [u8; 24], msg: &mut Message, secret: [u8; 32]) -> Result<(), ()> {
-    if msg.len() < 16 {
-        return Err(());
-    }
-
-    //msg.push_bytes(&[0; 16]).expect("pad >= 16");
-
-    {
-        use cjdns::sodiumoxide::crypto::box_::curve25519xsalsa20poly1305::*;
-        let bytes = msg.bytes_mut();
-        let nonce = Nonce(nonce);
-        let key = PrecomputedKey(secret);
-        //TODO this data copying is suboptimal. Need proper fn binding.
-        let decrypted = open_precomputed(bytes, &nonce, &key)?; // 16 bytes less
-        msg.discard_bytes(16).expect("discard 16 bytes"); // Also shrink msg
-        let dest = msg.bytes_mut();
-        assert_eq!(dest.len(), decrypted.len());
-        dest.copy_from_slice(&decrypted);
-    }
-
-    //msg.discard_bytes(16).expect("discard");
-
+    crypto_box_open_in_place(msg.bytes_mut(), &nonce, &secret)?;
+    msg.discard_bytes(16).expect("discard 16 bytes");
     Ok(())
 }
 
@@ -2002,4 +2088,164 @@ mod tests {
         assert_eq!(bob_received_text.lock().as_slice(), b"Goodbye Universe");
         assert_eq!(alice_received_text.lock().as_slice(), b"Hello World"); // still unchanged
     }
+
+    fn sealed_precomputed(nonce: [u8; 24], secret: [u8; 32], plain: &[u8]) -> Vec<u8> {
+        use cjdns::sodiumoxide::crypto::box_::curve25519xsalsa20poly1305::*;
+        seal_precomputed(plain, &Nonce(nonce), &PrecomputedKey(secret))
+    }
+
+    #[test]
+    fn test_secret_cache() {
+        let keys_api = CJDNSKeysApi::new().unwrap();
+        let alice_keys = keys_api.key_pair();
+        let bob_keys = keys_api.key_pair();
+        let mut alloc = allocator::new!();
+        let alice_ca = Arc::new(super::CryptoAuth::new(Some(alice_keys.private_key), EventBase {}, Random::Fake));
+        let bob_ca = Arc::new(super::CryptoAuth::new(Some(bob_keys.private_key), EventBase {}, Random::Fake));
+
+        // Each new session, as after a reset, starts over with a hello
+        let mut sessions = Vec::new();
+        for _ in 0..3 {
+            let alice =
+                super::Session::new(Arc::clone(&alice_ca), bob_keys.public_key.clone(), false, None).unwrap();
+            let bob =
+                super::Session::new(Arc::clone(&bob_ca), alice_keys.public_key.clone(), false, None).unwrap();
+            let mut msg = mk_msg(512, &mut alloc);
+            msg.push_bytes(b"HelloWorld012345").unwrap();
+            alice.encrypt_msg(&mut msg).unwrap();
+            bob.decrypt_msg(&mut msg).unwrap();
+            assert_eq!(msg.bytes(), b"HelloWorld012345");
+            sessions.push((alice, bob));
+        }
+        let (alice, bob) = sessions.last().unwrap();
+        for st in [alice.stats(), bob.stats()] {
+            assert_eq!((st.secret_cache_hits, st.secret_cache_misses), (2, 1));
+        }
+    }
+
+    #[test]
+    fn test_encrypt_rnd_nonce_in_place() {
+        let mut alloc = allocator::new!();
+        let (nonce, secret) = ([7_u8; 24], [9_u8; 32]);
+        for len in [0, 1, 15, 16, 17, 63, 64, 65, 576, 1024, 1500, 2000] {
+            let plain = (0..len).map(|i| (i * 31 + 5) as u8).collect::<Vec<_>>();
+            let mut msg = mk_msg(len + 64, &mut alloc);
+            msg.push_bytes(&plain).unwrap();
+
+            super::encrypt_rnd_nonce(nonce, &mut msg, secret);
+            assert_eq!(msg.bytes(), sealed_precomputed(nonce, secret, &plain).as_slice());
+
+            // A flipped bit anywhere must fail and leave the message untouched
+            let sealed = msg.bytes().to_vec();
+            msg.bytes_mut()[len / 2] ^= 1;
+            assert!(super::decrypt_rnd_nonce(nonce, &mut msg, secret).is_err());
+            msg.bytes_mut()[len / 2] ^= 1;
+            assert_eq!(msg.bytes(), sealed.as_slice());
+
+            assert!(super::decrypt_rnd_nonce(nonce, &mut msg, secret).is_ok());
+            assert_eq!(msg.bytes(), plain.as_slice());
+        }
+
+        let mut msg = mk_msg(64, &mut alloc);
+        msg.push_bytes(&[0; 15]).unwrap();
+        assert!(super::decrypt_rnd_nonce(nonce, &mut msg, secret).is_err());
+    }
+
+    #[test]
+    #[ignore]
+    fn bench_encrypt_rnd_nonce() {
+        // cargo test --release -- --ignored --nocapture bench_encrypt_rnd_nonce
+        const ROUNDS: u32 = 200_000;
+        let mut alloc = allocator::new!();
+        let (nonce, secret) = ([7_u8; 24], [9_u8; 32]);
+        for len in [64, 256, 576, 1024, 1500] {
+            let mut msg = mk_msg(len + 64, &mut alloc);
+            msg.push_bytes(&vec![0x55; len]).unwrap();
+
+            // What encrypt_rnd_nonce() used to do: seal into a new Vec, then copy it back
+            let start = std::time::Instant::now();
+            for _ in 0..ROUNDS {
+                let sealed = sealed_precomputed(nonce, secret, msg.bytes());
+                msg.push_bytes(&[0; 16]).unwrap();
+                msg.bytes_mut().copy_from_slice(&sealed);
+                msg.discard_bytes(16).unwrap();
+            }
+            let copied = start.elapsed() / ROUNDS;
+
+            let start = std::time::Instant::now();
+            for _ in 0..ROUNDS {
+                super::encrypt_rnd_nonce(nonce, &mut msg, secret);
+                msg.discard_bytes(16).unwrap();
+            }
+            let in_place = start.elapsed() / ROUNDS;
+
+            println!("{:>5} bytes: copied {:?}/packet, in place {:?}/packet", len, copied, in_place);
+        }
+    }
+
+    #[test]
+    #[ignore]
+    fn bench_decrypt_run_threads() {
+        // cargo test --release -- --ignored --nocapture bench_decrypt_run_threads
+        const PACKETS: usize = 50_000;
+        let keys_api = CJDNSKeysApi::new().unwrap();
+        let alice_keys = keys_api.key_pair();
+        let bob_keys = keys_api.key_pair();
+        let mut alloc = allocator::new!();
+
+        fn mk_sess(my_priv_key: PrivateKey, her_pub_key: PublicKey) -> super::Session {
+            let ca = super::CryptoAuth::new(Some(my_priv_key), EventBase {}, Random::Fake);
+            super::Session::new(Arc::new(ca), her_pub_key, false, None).unwrap()
+        }
+        let alice = mk_sess(alice_keys.private_key, bob_keys.public_key);
+        let bob = mk_sess(bob_keys.private_key, alice_keys.public_key);
+
+        // Hello, key, then the first data packet gets Bob to established
+        for (from, to) in [(&alice, &bob), (&bob, &alice), (&alice, &bob)] {
+            let mut msg = mk_msg(512, &mut alloc);
+            msg.push_bytes(b"HelloWorld012345").unwrap();
+            from.encrypt_msg(&mut msg).unwrap();
+            to.decrypt_msg(&mut msg).unwrap();
+        }
+        assert_eq!(bob.get_state(), super::State::Established);
+
+        // Sessions are used from whichever thread holds the GCL, see switch_fastpath.rs
+        struct Shared(super::Session);
+        unsafe impl Send for Shared {}
+        unsafe impl Sync for Shared {}
+        let bob = Arc::new(Shared(bob));
+
+        for threads in [1, 2, 4, 8] {
+            let mut round_alloc = allocator::new!();
+            let mut queues = (0..threads).map(|_| Vec::new()).collect::<Vec<_>>();
+            for i in 0..PACKETS {
+                let mut msg = mk_msg(1024 + 64, &mut round_alloc);
+                msg.push_bytes(&[0x55; 1024]).unwrap();
+                alice.encrypt_msg(&mut msg).unwrap();
+                queues[i % threads].push(msg);
+            }
+
+            let start = std::time::Instant::now();
+            let handles = queues
+                .into_iter()
+                .map(|mut queue| {
+                    let bob = Arc::clone(&bob);
+                    std::thread::spawn(move || {
+                        queue.iter_mut().map(|m| bob.0.decrypt_run(m)).filter(|r| matches!(r, Ok(true))).count()
+                    })
+                })
+                .collect::<Vec<_>>();
+            let decrypted = handles.into_iter().map(|h| h.join().unwrap()).sum::<usize>();
+            let elapsed = start.elapsed();
+
+            // Drops are the replay window being outrun, not the locking
+            println!(
+                "{} threads: {:.0} packets/s, {} of {} accepted",
+                threads,
+                decrypted as f64 / elapsed.as_secs_f64(),
+                decrypted,
+                PACKETS,
+            );
+        }
+    }
 }
@@ -477,6 +477,9 @@ impl SessionTrait for Session {
             received_packets: st.cum_session_stats.received_cnt,
             duplicate_packets: st.cum_session_stats.duplicate_cnt,
             noise_proto: true,
+            // Noise handshakes don't use the CryptoAuth secret cache
+            secret_cache_hits: 0,
+            secret_cache_misses: 0,
         }
     }
 
@@ -538,6 +541,20 @@ impl SessionTrait for Session {
     fn cjdns_ver(&self) -> u32 {
         self.inner.cjdns_ver.load(atomic::Ordering::Relaxed) as u32
     }
+
+    // The WireGuard tunnel owns its own timers and keepalives, so noise sessions
+    // always take the normal path.
+    fn decrypt_run(&self, _msg: &mut Message) -> Result<bool> {
+        Ok(false)
+    }
+
+    fn encrypt_run(&self, _msg: &mut Message) -> Result<bool> {
+        Ok(false)
+    }
+
+    fn deliver_plaintext(&self, _msg: Message) -> Result<()> {
+        bail!("deliver_plaintext() is not supported by noise sessions");
+    }
 }
 
 fn compute_auth(
@@ -0,0 +1,642 @@
+//! Handshakes from peers we have no session with, run off of the GCL.
+//!
+//! A hello from an unknown address costs a curve25519 scalar multiplication and
+//! some hashing. InterfaceController used to do that inline, holding the GCL, so
+//! a burst of them (everybody reconnecting after a restart, or somebody flooding
+//! us) stalled every other packet. Now each one is first admitted, by the
+//! HandshakeIface of the interface it came in on:
+//!
+//! * Every source address has a token bucket, a source which sends more than
+//!   BURST handshakes, then more than RATE per second, is refused.
+//! * When the workers' queue is more than half full, a source which we have not
+//!   heard from before is refused once and let in when it tries again. Peers resend
+//!   hellos until they get an answer so a real one gets in on its next attempt,
+//!   while a flood from spoofed addresses, each used once, does no work at all.
+//! * Sources are forgotten after FORGET_AFTER, or sooner if MAX_SOURCES are
+//!   known, least recently heard from first.
+//!
+//! If workers have been started, it is then copied and queued. The workers run
+//! try_handshake() and send the message back into C through the HandshakeIface,
+//! with a Done header saying how it went, which C takes off with
+//! Rffi_CryptoAuth2_handshakeDone(). Without workers the caller runs the
+//! handshake inline, as before.
+//!
+//! Only handshakes from addresses which have no session go through here. A new
+//! handshake on an existing session, such as when a peer restarts, is still run
+//! inline by that session's decrypt.
+
+use std::collections::{BTreeSet, HashMap, VecDeque};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::thread::JoinHandle;
+use std::time::{Duration, Instant};
+
+use eyre::{bail, Result};
+use once_cell::sync::{Lazy, OnceCell};
+use parking_lot::{Condvar, Mutex};
+
+use crate::crypto::crypto_auth::{self, CryptoAuth, DecryptErr, DecryptError};
+use crate::crypto::session::SessionTrait;
+use crate::external::interface::iface::IfacePvt;
+use crate::interface::wire::message::Message;
+use crate::rffi::allocator;
+use crate::rtypes::RTypes_CryptoAuth2_TryHandshake_Code_t as TryHandshakeCode;
+use crate::rtypes::RTypes_CryptoAuth2_Handshake_Submit_t as Submit;
+use crate::rtypes::RTypes_HandshakePool_Stats_t as HandshakeStats;
+
+/// Handshakes waiting for a worker, beyond this they are refused.
+const QUEUE: usize = 256;
+
+/// Room in front of a copied handshake for the reply, the lladdr and the Done header.
+const PADDING: usize = 512;
+
+pub const MAX_WORKERS: u32 = 64;
+
+/// The DecryptErr behind a handshake error, as C knows it.
+pub fn err_code(e: &eyre::Report) -> u32 {
+    match e.downcast_ref::<DecryptError>() {
+        Some(DecryptError::DecryptErr(ee)) => ee.clone() as u32,
+        _ => DecryptErr::Internal as u32,
+    }
+}
+
+/// The session a worker made, until C takes it in Rffi_CryptoAuth2_handshakeDone().
+/// It is adopted by the message's allocator so it goes away with the message if not.
+pub struct Pending(pub Option<Arc<dyn SessionTrait>>);
+
+/// Pushed in front of a handshake which a worker has run.
+#[repr(C)]
+pub struct Done {
+    pub code: TryHandshakeCode,
+    pub err: u32,
+    pub sess: *mut Pending,
+}
+
+impl Default for Done {
+    fn default() -> Self {
+        Self { code: TryHandshakeCode::Done, err: 0, sess: std::ptr::null_mut() }
+    }
+}
+
+#[derive(Debug, Copy, Clone, PartialEq, Eq)]
+pub enum Verdict {
+    Admit,
+    /// Over its rate.
+    RateLimited,
+    /// Unknown source while we are under load, it will be let in next time.
+    Retry,
+}
+
+struct Bucket {
+    tokens: f64,
+    last: Instant,
+}
+
+/// Per-source admission, see the module doc.
+#[derive(Default)]
+pub struct Admission {
+    sources: HashMap<[u8; 16], Bucket>,
+    /// The same sources, least recently heard from first.
+    by_last: BTreeSet<(Instant, [u8; 16])>,
+}
+
+impl Admission {
+    pub const BURST: f64 = 8.0;
+    pub const RATE: f64 = 2.0;
+    pub const MAX_SOURCES: usize = 8192;
+
+    /// Long enough that a source told to retry is still known when it does.
+    pub const FORGET_AFTER: Duration = Duration::from_secs(30);
+
+    pub fn check(&mut self, source: [u8; 16], now: Instant, loaded: bool) -> Verdict {
+        self.forget(now);
+        if let Some(b) = self.sources.get_mut(&source) {
+            let elapsed = now.saturating_duration_since(b.last).as_secs_f64();
+            b.tokens = (b.tokens + elapsed * Self::RATE).min(Self::BURST);
+            self.by_last.remove(&(b.last, source));
+            self.by_last.insert((now, source));
+            b.last = now;
+            if b.tokens < 1.0 {
+                return Verdict::RateLimited;
+            }
+            b.tokens -= 1.0;
+            return Verdict::Admit;
+        }
+        if self.sources.len() >= Self::MAX_SOURCES {
+            if let Some(&(last, old)) = self.by_last.iter().next() {
+                self.by_last.remove(&(last, old));
+                self.sources.remove(&old);
+            }
+        }
+        let tokens = if loaded { Self::BURST } else { Self::BURST - 1.0 };
+        self.sources.insert(source, Bucket { tokens, last: now });
+        self.by_last.insert((now, source));
+        if loaded {
+            Verdict::Retry
+        } else {
+            Verdict::Admit
+        }
+    }
+
+    /// Drop the sources which have been quiet for FORGET_AFTER.
+    fn forget(&mut self, now: Instant) {
+        while let Some(&(last, source)) = self.by_last.iter().next() {
+            if now.saturating_duration_since(last) < Self::FORGET_AFTER {
+                break;
+            }
+            self.by_last.remove(&(last, source));
+            self.sources.remove(&source);
+        }
+    }
+}
+
+/// Where handshakes from one interface come back to once a worker has run them,
+/// along with the admission of the sources on that interface. Addresses are only
+/// meaningful within an interface, and a flood on one interface cannot push the
+/// sources of another out of the table.
+pub struct HandshakeIface {
+    pub done: Arc<IfacePvt>,
+    admission: Mutex<Admission>,
+}
+
+impl HandshakeIface {
+    pub fn new(done: IfacePvt) -> Self {
+        Self { done: Arc::new(done), admission: Mutex::new(Admission::default()) }
+    }
+}
+
+struct Job {
+    ca: Arc<CryptoAuth>,
+    msg: Message,
+    lladdr: Vec<u8>,
+    require_auth: bool,
+    done: Arc<IfacePvt>,
+}
+// CryptoAuth is only used through its own locks, as decrypt_run() is from many threads.
+unsafe impl Send for Job {}
+
+impl Job {
+    fn run(self) -> Result<()> {
+        let Job { ca, mut msg, lladdr, require_auth, done } = self;
+        let c_msg = msg.as_c_message();
+        let (code, err, sess) =
+            match crypto_auth::try_handshake(&ca, Message::from_c_message(c_msg), require_auth) {
+                Ok((code, sess)) => (code, 0, sess),
+                Err(e) => (TryHandshakeCode::Error, err_code(&e), None),
+            };
+        let sess = allocator::adopt(unsafe { (*c_msg)._alloc }, Pending(sess));
+        msg.push_bytes(&lladdr)?;
+        msg.push(Done { code, err, sess })?;
+        done.send(msg)
+    }
+}
+
+struct Shared {
+    queue: Mutex<VecDeque<Job>>,
+    ready: Condvar,
+    stop: AtomicBool,
+    completed: AtomicU64,
+}
+
+impl Shared {
+    fn work(&self) {
+        loop {
+            let job = {
+                let mut q = self.queue.lock();
+                loop {
+                    if self.stop.load(Ordering::Relaxed) {
+                        return;
+                    }
+                    if let Some(job) = q.pop_front() {
+                        break job;
+                    }
+                    self.ready.wait(&mut q);
+                }
+            };
+            if let Err(e) = job.run() {
+                log::debug!("Error completing handshake: {}", e);
+            }
+            self.completed.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+struct Pool {
+    shared: Arc<Shared>,
+    handles: Vec<JoinHandle<()>>,
+}
+
+impl Pool {
+    fn new(workers: u32) -> Result<Self> {
+        let shared = Arc::new(Shared {
+            queue: Mutex::new(VecDeque::with_capacity(QUEUE)),
+            ready: Condvar::new(),
+            stop: AtomicBool::new(false),
+            completed: AtomicU64::new(0),
+        });
+        let mut pool = Self { shared, handles: Vec::new() };
+        for i in 0..workers {
+            let shared = Arc::clone(&pool.shared);
+            pool.handles.push(
+                std::thread::Builder::new()
+                    .name(format!("cjdns-handshake-{}", i))
+                    .spawn(move || shared.work())?,
+            );
+        }
+        Ok(pool)
+    }
+
+    fn queued(&self) -> usize {
+        self.shared.queue.lock().len()
+    }
+}
+
+impl Drop for Pool {
+    fn drop(&mut self) {
+        self.shared.stop.store(true, Ordering::Relaxed);
+        {
+            let _q = self.shared.queue.lock();
+            self.shared.ready.notify_all();
+        }
+        for h in self.handles.drain(..) {
+            let _ = h.join();
+        }
+    }
+}
+
+#[derive(Default)]
+pub struct Handshakes {
+    pool: OnceCell<Pool>,
+    rate_limited: AtomicU64,
+    retry_required: AtomicU64,
+    queue_full: AtomicU64,
+}
+
+static HANDSHAKES: Lazy<Handshakes> = Lazy::new(Handshakes::default);
+
+/// The one which InterfaceController uses.
+pub fn global() -> &'static Handshakes {
+    &HANDSHAKES
+}
+
+impl Handshakes {
+    /// Start running handshakes on `workers` threads, this cannot be undone or
+    /// changed afterward. Returns the number of workers which are running.
+    pub fn start(&self, workers: u32) -> Result<u32> {
+        if workers > MAX_WORKERS {
+            bail!("Handshake workers must be at most {}", MAX_WORKERS);
+        }
+        if workers > 0 {
+            self.pool.get_or_try_init(|| Pool::new(workers))?;
+        }
+        Ok(self.workers())
+    }
+
+    pub fn workers(&self) -> u32 {
+        self.pool.get().map_or(0, |p| p.handles.len() as u32)
+    }
+
+    /// Admit a handshake and, if there are workers, queue it, otherwise it is to be
+    /// run inline. `msg` starts with the 16 byte address of the source, as
+    /// try_handshake() expects, it is copied if queued and not touched otherwise.
+    /// When the handshake has run, it comes out of `hs` with `lladdr` and a Done
+    /// header pushed in front of it.
+    pub fn submit(
+        &self,
+        ca: &Arc<CryptoAuth>,
+        msg: &Message,
+        lladdr: &[u8],
+        require_auth: bool,
+        hs: &HandshakeIface,
+    ) -> Submit {
+        if msg.len() < 16 {
+            // try_handshake() will say it's a runt
+            return Submit::Inline;
+        }
+        let mut source = [0_u8; 16];
+        source.copy_from_slice(&msg.bytes()[..16]);
+        let pool = self.pool.get();
+        let loaded = pool.map_or(false, |p| p.queued() >= QUEUE / 2);
+        match hs.admission.lock().check(source, Instant::now(), loaded) {
+            Verdict::Admit => (),
+            Verdict::RateLimited => {
+                self.rate_limited.fetch_add(1, Ordering::Relaxed);
+                return Submit::Refused;
+            }
+            Verdict::Retry => {
+                self.retry_required.fetch_add(1, Ordering::Relaxed);
+                return Submit::Refused;
+            }
+        }
+        let pool = match pool {
+            Some(p) => p,
+            None => return Submit::Inline,
+        };
+
+        // Keep the packet 4 byte aligned, as it was when it came in.
+        let mut copy = Message::new(PADDING + msg.len());
+        if copy.push_bytes(msg.bytes()).is_err() {
+            return Submit::Inline;
+        }
+        let job = Job {
+            ca: Arc::clone(ca),
+            msg: copy,
+            lladdr: lladdr.to_vec(),
+            require_auth,
+            done: Arc::clone(&hs.done),
+        };
+        {
+            let mut q = pool.shared.queue.lock();
+            if q.len() >= QUEUE {
+                drop(q);
+                self.queue_full.fetch_add(1, Ordering::Relaxed);
+                return Submit::Refused;
+            }
+            q.push_back(job);
+        }
+        pool.shared.ready.notify_one();
+        Submit::Queued
+    }
+
+    pub fn stats(&self) -> HandshakeStats {
+        let pool = self.pool.get();
+        HandshakeStats {
+            workers: self.workers(),
+            queued: pool.map_or(0, |p| p.queued() as u32),
+            completed: pool.map_or(0, |p| p.shared.completed.load(Ordering::Relaxed)),
+            rate_limited: self.rate_limited.load(Ordering::Relaxed),
+            retry_required: self.retry_required.load(Ordering::Relaxed),
+            queue_full: self.queue_full.load(Ordering::Relaxed),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+    use std::time::{Duration, Instant};
+
+    use cjdns::keys::CJDNSKeysApi;
+
+    use super::{Admission, Done, HandshakeIface, Handshakes, Submit, Verdict};
+    use crate::crypto::crypto_auth::{self, CryptoAuth};
+    use crate::crypto::random::Random;
+    use crate::external::interface::iface;
+    use crate::gcl::{self, Site};
+    use crate::interface::wire::message::Message;
+    use crate::util::events::EventBase;
+
+    #[test]
+    fn test_token_bucket() {
+        let mut a = Admission::default();
+        let t0 = Instant::now();
+        let src = [1_u8; 16];
+        for _ in 0..Admission::BURST as usize {
+            assert_eq!(a.check(src, t0, false), Verdict::Admit);
+        }
+        assert_eq!(a.check(src, t0, false), Verdict::RateLimited);
+        // Another source is not affected
+        assert_eq!(a.check([2; 16], t0, false), Verdict::Admit);
+        // One token comes back every 1/RATE seconds
+        let t1 = t0 + Duration::from_secs_f64(1.0 / Admission::RATE);
+        assert_eq!(a.check(src, t1, false), Verdict::Admit);
+        assert_eq!(a.check(src, t1, false), Verdict::RateLimited);
+        let t2 = t1 + Duration::from_secs(60);
+        for _ in 0..Admission::BURST as usize {
+            assert_eq!(a.check(src, t2, false), Verdict::Admit);
+        }
+        assert_eq!(a.check(src, t2, false), Verdict::RateLimited);
+    }
+
+    #[test]
+    fn test_retry_under_load() {
+        let mut a = Admission::default();
+        let t0 = Instant::now();
+        // Known sources are let in under load, unknown ones must come back
+        assert_eq!(a.check([1; 16], t0, false), Verdict::Admit);
+        assert_eq!(a.check([1; 16], t0, true), Verdict::Admit);
+        assert_eq!(a.check([2; 16], t0, true), Verdict::Retry);
+        assert_eq!(a.check([2; 16], t0, true), Verdict::Admit);
+    }
+
+    #[test]
+    fn test_source_table_is_bounded() {
+        let mut a = Admission::default();
+        let t0 = Instant::now();
+        let src = |i: u32| {
+            let mut src = [0_u8; 16];
+            src[..4].copy_from_slice(&i.to_be_bytes());
+            src
+        };
+        for i in 0..Admission::MAX_SOURCES as u32 {
+            let t = t0 + Duration::from_millis(i as u64);
+            assert_eq!(a.check(src(i), t, false), Verdict::Admit);
+        }
+        // Source 0 is heard from again so 1 is now the least recent
+        let t1 = t0 + Duration::from_secs(10);
+        assert_eq!(a.check(src(0), t1, false), Verdict::Admit);
+        // A new source takes its place rather than being refused
+        assert_eq!(a.check([0xff; 16], t1, false), Verdict::Admit);
+        assert_eq!(a.sources.len(), Admission::MAX_SOURCES);
+        assert!(!a.sources.contains_key(&src(1)));
+        assert!(a.sources.contains_key(&src(0)) && a.sources.contains_key(&src(2)));
+        // Under load it has to come back, and is still known when it does
+        assert_eq!(a.check(src(1), t1, true), Verdict::Retry);
+        assert_eq!(a.check(src(1), t1, true), Verdict::Admit);
+        // Once the others have gone quiet they are forgotten
+        let t2 = t1 + Admission::FORGET_AFTER;
+        assert_eq!(a.check(src(1), t2 - Duration::from_millis(1), false), Verdict::Admit);
+        assert_eq!(a.check([0xfe; 16], t2, false), Verdict::Admit);
+        assert_eq!(a.sources.len(), 2);
+        assert_eq!(a.by_last.len(), 2);
+    }
+
+    /// A server and hellos to it, each from a different client and source address.
+    fn mk_hellos(count: usize) -> (Arc<CryptoAuth>, Vec<Vec<u8>>) {
+        let keys_api = CJDNSKeysApi::new().unwrap();
+        let server_keys = keys_api.key_pair();
+        let server = Arc::new(CryptoAuth::new(Some(server_keys.private_key), EventBase {}, Random::Fake));
+        let hellos = (0..count)
+            .map(|i| {
+                let client_keys = keys_api.key_pair();
+                let client = Arc::new(CryptoAuth::new(Some(client_keys.private_key), EventBase {}, Random::Fake));
+                let mut msg = Message::new(512);
+                msg.push_bytes(b"HelloWorld012345").unwrap();
+                crypto_auth::mk_hello(&client, server_keys.public_key.clone(), &mut msg).unwrap();
+                let mut source = [0xfc_u8; 16];
+                source[12..].copy_from_slice(&(i as u32).to_be_bytes());
+                msg.push_bytes(&source).unwrap();
+                msg.bytes().to_vec()
+            })
+            .collect();
+        (server, hellos)
+    }
+
+    fn mk_msg(bytes: &[u8]) -> Message {
+        let mut msg = Message::new(512 + bytes.len());
+        msg.push_bytes(bytes).unwrap();
+        msg
+    }
+
+    /// Returns the handshake iface and the number of handshakes which came out of it
+    /// with a session.
+    fn mk_done_iface() -> (HandshakeIface, Arc<AtomicUsize>) {
+        let (mut done, done_pvt) = iface::new("handshake done");
+        let (mut sink, _sink_pvt) = iface::new("test sink");
+        let sessions = Arc::new(AtomicUsize::new(0));
+        sink.set_receiver_f(
+            |sessions: &Arc<AtomicUsize>, mut m: Message| {
+                let d = m.pop::<Done>()?;
+                let pending = unsafe { &mut *d.sess };
+                if pending.0.take().is_some() {
+                    sessions.fetch_add(1, Ordering::Relaxed);
+                }
+                Ok(())
+            },
+            Arc::clone(&sessions),
+        );
+        done.plumb(&mut sink).unwrap();
+        (HandshakeIface::new(done_pvt), sessions)
+    }
+
+    #[test]
+    fn test_pool_completes_handshakes() {
+        const HELLOS: usize = 20;
+        let (server, hellos) = mk_hellos(HELLOS);
+        let (done, sessions) = mk_done_iface();
+        let hs = Handshakes::default();
+        assert_eq!(hs.start(2).unwrap(), 2);
+        for hello in &hellos {
+            let r = hs.submit(&server, &mk_msg(hello), &[0; 8], false, &done);
+            assert_eq!(r, Submit::Queued);
+        }
+        let t0 = Instant::now();
+        while sessions.load(Ordering::Relaxed) < HELLOS {
+            assert!(t0.elapsed() < Duration::from_secs(10), "handshakes did not complete");
+            std::thread::sleep(Duration::from_millis(1));
+        }
+        let st = hs.stats();
+        assert_eq!(st.completed, HELLOS as u64);
+        assert_eq!(st.rate_limited + st.retry_required + st.queue_full, 0);
+    }
+
+    #[test]
+    fn test_admission_per_iface() {
+        let (server, hellos) = mk_hellos(1);
+        let (done, _) = mk_done_iface();
+        let (other, _) = mk_done_iface();
+        let msg = mk_msg(&hellos[0]);
+
+        // Without workers the caller runs the handshakes, but only as many as the
+        // source's rate allows
+        let hs = Handshakes::default();
+        for _ in 0..Admission::BURST as usize {
+            assert_eq!(hs.submit(&server, &msg, &[0; 8], false, &done), Submit::Inline);
+        }
+        assert_eq!(hs.submit(&server, &msg, &[0; 8], false, &done), Submit::Refused);
+        assert_eq!(hs.stats().rate_limited, 1);
+
+        assert_eq!(hs.start(1).unwrap(), 1);
+        assert_eq!(hs.submit(&server, &msg, &[0; 8], false, &done), Submit::Refused);
+        // The same address on another interface has a bucket of its own
+        for _ in 0..Admission::BURST as usize {
+            assert_eq!(hs.submit(&server, &msg, &[0; 8], false, &other), Submit::Queued);
+        }
+        assert_eq!(hs.submit(&server, &msg, &[0; 8], false, &other), Submit::Refused);
+        assert_eq!(hs.stats().rate_limited, 3);
+    }
+
+    #[test]
+    #[ignore]
+    fn bench_data_plane_during_flood() {
+        // cargo test --release -- --ignored --nocapture bench_data_plane_during_flood
+        const HELLOS: usize = 2000;
+        const CALIBRATE: usize = 50;
+        let (server, hellos) = mk_hellos(CALIBRATE + HELLOS);
+        let (calibrate, hellos) = hellos.split_at(CALIBRATE);
+
+        // Every case gets the same flood: hellos at half the rate which one core can
+        // run them inline, so the inline case keeps up, and a refused hello is sent
+        // again at the end of the flood, as a peer resends until it gets an answer.
+        // So in every case all of the handshakes are done.
+        let t0 = Instant::now();
+        for hello in calibrate {
+            let _ = crypto_auth::try_handshake(&server, mk_msg(hello), false);
+        }
+        let interval = t0.elapsed() * 2 / CALIBRATE as u32;
+        println!("one handshake every {:?}", interval);
+
+        for workers in [0, 1, 2, 4] {
+            let (done, sessions) = mk_done_iface();
+            let hs = Handshakes::default();
+            hs.start(workers).unwrap();
+
+            // Stands in for the data plane: takes the GCL for a moment every 100us
+            // and records how long it had to wait for it.
+            let stop = Arc::new(std::sync::atomic::AtomicBool::new(false));
+            let data_plane = {
+                let stop = Arc::clone(&stop);
+                std::thread::spawn(move || {
+                    let mut waits = Vec::new();
+                    while !stop.load(Ordering::Relaxed) {
+                        let t0 = Instant::now();
+                        let _g = gcl::lock(Site::Other);
+                        waits.push(t0.elapsed());
+                        drop(_g);
+                        std::thread::sleep(Duration::from_micros(100));
+                    }
+                    waits
+                })
+            };
+
+            let start = Instant::now();
+            let mut next = start;
+            let mut offer = hellos.iter().collect::<std::collections::VecDeque<_>>();
+            let (mut inline, mut inline_sessions) = (0, 0);
+            let mut refused = 0;
+            while let Some(hello) = offer.pop_front() {
+                let now = Instant::now();
+                if next > now {
+                    std::thread::sleep(next - now);
+                }
+                next += interval;
+                // As handleIncomingFromWire() does it, holding the GCL
+                let _g = gcl::lock(Site::Other);
+                let msg = mk_msg(hello);
+                match hs.submit(&server, &msg, &[0; 8], false, &done) {
+                    Submit::Inline => {
+                        inline += 1;
+                        if let Ok((_, Some(_))) = crypto_auth::try_handshake(&server, msg, false) {
+                            inline_sessions += 1;
+                        }
+                    }
+                    Submit::Queued => (),
+                    Submit::Refused => {
+                        refused += 1;
+                        offer.push_back(hello);
+                    }
+                }
+            }
+            while inline + hs.stats().completed < HELLOS as u64 {
+                std::thread::sleep(Duration::from_millis(1));
+            }
+            let elapsed = start.elapsed();
+            stop.store(true, Ordering::Relaxed);
+            let mut waits = data_plane.join().unwrap();
+            waits.sort();
+            let pct = |p: usize| waits[(waits.len() - 1) * p / 100];
+
+            println!(
+                "{} workers: {} sessions in {:?} ({} refused and resent), GCL wait p50 {:?} p99 {:?} max {:?}",
+                workers,
+                inline_sessions + sessions.load(Ordering::Relaxed),
+                elapsed,
+                refused,
+                pct(50),
+                pct(99),
+                waits[waits.len() - 1],
+            );
+        }
+    }
+}
@@ -5,7 +5,7 @@ pub use cjdns::crypto::random::Random as Rand;
 
 use crate::cffi::Random_t;
 use crate::cffi::Random_bytes_fromRust;
-use crate::gcl::Protected;
+use crate::gcl::{Protected, Site};
 
 pub enum Random {
     Sodium(SodiumRandom),
@@ -22,7 +22,7 @@ impl Random {
 
     #[inline]
     pub fn wrap_legacy(c_random: *mut Random_t) -> Self {
-        Random::Legacy(Protected::new(c_random))
+        Random::Legacy(Protected::new(c_random, Site::Random))
     }
 
     #[inline]
@@ -1,23 +1,45 @@
 //! Replay attack protector
 
-#[derive(Default)]
+use std::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+
+/// Nonces are filed in blocks of 32, one block per slot of the window.
+const BLOCK_BITS: u32 = 32;
+
+/// Lock-free so that packets of one session can be decrypted by many threads at once.
+///
+/// Each slot of the window holds the bits of one block in its low half and the number
+/// of that block (plus one, zero is an empty slot) in its high half. A nonce is only
+/// accepted by the compare-and-swap which sets its bit in a slot carrying its own block
+/// number, and once a newer block has taken the slot the older one can not come back,
+/// so a nonce can never be accepted twice however the threads interleave.
+///
+/// Moving the window ahead only ever touches the one slot which the new block lands
+/// on, so however wide the window is there is no shifting of the bitmap.
 pub struct ReplayProtector {
-    /// Internal bitfield.
-    bitfield: u64,
+    window: Box<[AtomicU64]>,
+
+    /// See window().
+    window_nonces: u32,
 
-    /// Internal offset.
-    base_offset: u32,
+    /// Highest block number seen.
+    top: AtomicU32,
+
+    /// Lowest acceptable nonce.
+    base_offset: AtomicU32,
+
+    /// Number of packets accepted.
+    received_packets: AtomicU32,
 
     /// Number of definite duplicate packets.
-    duplicates: u32,
+    duplicates: AtomicU32,
 
     /// Number of lost packets.
-    lost_packets: u32,
+    lost_packets: AtomicU32,
 
     /// Number of packets which could not be verified because they were out of range.
     /// Growing `lost_packets` and `received_out_of_range` together indicate severe packet reordering issues.
     /// Just `received_out_of_range` growing along indicates duplicate packets.
-    received_out_of_range: u32,
+    received_out_of_range: AtomicU32,
 }
 
 #[derive(Clone, Default, PartialEq, Eq, Debug)]
@@ -28,26 +50,79 @@ pub struct ReplayProtectorStats {
     pub duplicate_packets: u32,
 }
 
+impl Default for ReplayProtector {
+    fn default() -> Self {
+        Self::new(Self::DEFAULT_WINDOW)
+    }
+}
+
 impl ReplayProtector {
-    pub fn new() -> Self {
-        Self::default()
+    pub const MIN_WINDOW: u32 = 64;
+    pub const DEFAULT_WINDOW: u32 = 1024;
+    pub const MAX_WINDOW: u32 = 8192;
+
+    /// Nonces further than `window` behind the highest one seen are out of range.
+    /// It is clamped to MIN_WINDOW..=MAX_WINDOW and rounded up to a multiple of 32.
+    pub fn new(window: u32) -> Self {
+        let window = (window.clamp(Self::MIN_WINDOW, Self::MAX_WINDOW) + BLOCK_BITS - 1) & !(BLOCK_BITS - 1);
+        // One more block than the window spans because the newest is only partly used.
+        let blocks = window / BLOCK_BITS + 1;
+        Self {
+            window: (0..blocks).map(|_| AtomicU64::new(0)).collect(),
+            window_nonces: window,
+            top: AtomicU32::new(0),
+            base_offset: AtomicU32::new(0),
+            received_packets: AtomicU32::new(0),
+            duplicates: AtomicU32::new(0),
+            lost_packets: AtomicU32::new(0),
+            received_out_of_range: AtomicU32::new(0),
+        }
     }
 
-    pub fn reset(&mut self) {
-        *self = Self::default();
+    /// How far behind the highest nonce seen a packet can be and still be accepted,
+    /// depending on where the nonces fall in their blocks it may be up to 31 more.
+    pub fn window(&self) -> u32 {
+        self.window_nonces
     }
 
-    pub fn init(&mut self, first_nonce: u32) {
-        self.base_offset = first_nonce;
-        self.bitfield = 0;
+    #[inline]
+    fn blocks(&self) -> u32 {
+        self.window.len() as u32
+    }
+
+    #[inline]
+    fn slot(&self, block: u32) -> &AtomicU64 {
+        &self.window[(block % self.blocks()) as usize]
+    }
+
+    /// Not atomic as a whole, the caller must make sure nobody is checking nonces.
+    pub fn reset(&self) {
+        self.init(0);
+        self.received_packets.store(0, Ordering::Relaxed);
+        self.duplicates.store(0, Ordering::Relaxed);
+        self.lost_packets.store(0, Ordering::Relaxed);
+        self.received_out_of_range.store(0, Ordering::Relaxed);
+    }
+
+    /// Not atomic as a whole, the caller must make sure nobody is checking nonces.
+    pub fn init(&self, first_nonce: u32) {
+        for slot in self.window.iter() {
+            slot.store(0, Ordering::Relaxed);
+        }
+        // Nonces below first_nonce are not lost, they were never going to come.
+        let block = first_nonce / BLOCK_BITS + 1;
+        let below = (1_u64 << (first_nonce % BLOCK_BITS)) - 1;
+        self.slot(block).store((block as u64) << 32 | below, Ordering::Release);
+        self.top.store(block, Ordering::Relaxed);
+        self.base_offset.store(first_nonce, Ordering::Relaxed);
     }
 
     pub fn stats(&self) -> ReplayProtectorStats {
         ReplayProtectorStats {
-            received_packets: self.base_offset + self.bitfield.count_ones(),
-            lost_packets: self.lost_packets,
-            received_unexpected: self.received_out_of_range,
-            duplicate_packets: self.duplicates,
+            received_packets: self.received_packets.load(Ordering::Relaxed),
+            lost_packets: self.lost_packets.load(Ordering::Relaxed),
+            received_unexpected: self.received_out_of_range.load(Ordering::Relaxed),
+            duplicate_packets: self.duplicates.load(Ordering::Relaxed),
         }
     }
 
@@ -57,60 +132,172 @@ impl ReplayProtector {
     /// or else forged packets will make legit ones appear to be duplicates.
     ///
     /// Arg `nonce` is the number to check, this should be a counter nonce
-    /// as numbers less than 32 minus the highest seen nonce will be dropped
-    /// erroneously.
+    /// as numbers more than a window behind the highest seen nonce will be
+    /// dropped erroneously.
     ///
     /// Returns `true` if the packet is provably not a replay, otherwise `false`.
-    pub fn check_nonce(&mut self, nonce: u32) -> bool {
-        if nonce < self.base_offset {
-            self.received_out_of_range += 1;
-            return false;
+    pub fn check_nonce(&self, nonce: u32) -> bool {
+        if nonce < self.base_offset.load(Ordering::Relaxed) {
+            return self.out_of_range();
         }
 
-        let mut offset = nonce - self.base_offset;
-        while offset > 63 {
-            if self.bitfield & 0xFFFF_FFFF == 0xFFFF_FFFF {
-                // Happy path, low 32 bits are checked in, rotate and continue.
-                offset = self.do_shift(offset, 32);
+        let block = nonce / BLOCK_BITS + 1;
+        let bit = 1_u64 << (nonce % BLOCK_BITS);
+        let mut top = self.top.load(Ordering::Relaxed);
+        if block > top {
+            top = self.top.fetch_max(block, Ordering::Relaxed).max(block);
+        }
+        if top - block >= self.blocks() {
+            return self.out_of_range();
+        }
+
+        let slot = self.slot(block);
+        let mut cur = slot.load(Ordering::Acquire);
+        loop {
+            let cur_block = (cur >> 32) as u32;
+            let next = if cur_block == block {
+                if cur & bit != 0 {
+                    self.duplicates.fetch_add(1, Ordering::Relaxed);
+                    return false;
+                }
+                cur | bit
+            } else if cur_block > block {
+                // Another thread moved the window past us.
+                return self.out_of_range();
             } else {
-                // We are going to have to accept some losses, take offset - 47 to mitigate that
-                // as much as possible.
-                debug_assert!(offset >= 47);
-                self.lost_packets += self.lost_in_shift(offset - 47);
-                offset = self.do_shift(offset, offset - 47);
+                (block as u64) << 32 | bit
+            };
+            match slot.compare_exchange_weak(cur, next, Ordering::AcqRel, Ordering::Acquire) {
+                Ok(_) => break,
+                Err(actual) => cur = actual,
             }
         }
 
-        let mask = 1_u64 << offset;
-
-        if self.bitfield & mask != 0 {
-            self.duplicates += 1;
-            return false;
+        let cur_block = (cur >> 32) as u32;
+        if cur_block != block {
+            self.lost_packets.fetch_add(self.lost_in_shift(cur, block), Ordering::Relaxed);
         }
+        self.received_packets.fetch_add(1, Ordering::Relaxed);
+        true
+    }
 
-        self.bitfield |= mask;
-        return true;
+    #[inline]
+    fn out_of_range(&self) -> bool {
+        self.received_out_of_range.fetch_add(1, Ordering::Relaxed);
+        false
     }
 
+    /// Nonces lost when `block` takes over a slot which held `old`: whatever is missing
+    /// from the old block plus every block in between which landed on this slot and
+    /// was never seen at all.
     #[inline]
-    fn do_shift(&mut self, offset: u32, bits: u32) -> u32 {
-        self.base_offset += bits;
-        if bits > 63 {
-            self.bitfield = 0;
-        } else {
-            self.bitfield >>= bits;
+    fn lost_in_shift(&self, old: u64, block: u32) -> u32 {
+        let old_block = (old >> 32) as u32;
+        if old_block == 0 {
+            let first = self.base_offset.load(Ordering::Relaxed) / BLOCK_BITS + 1;
+            return block.saturating_sub(first) / self.blocks() * BLOCK_BITS;
         }
-        offset - bits
+        let missing = BLOCK_BITS - (old as u32).count_ones();
+        missing + ((block - old_block) / self.blocks() - 1) * BLOCK_BITS
     }
+}
 
-    #[inline]
-    fn lost_in_shift(&self, shift_amount: u32) -> u32 {
-        if shift_amount == 0 {
-            return 0;
+#[cfg(test)]
+mod tests {
+    use std::collections::HashSet;
+    use std::sync::Arc;
+
+    use super::ReplayProtector;
+
+    #[test]
+    fn test_duplicates() {
+        // Same as crypto/test/ReplayProtector_test.c
+        let rp = ReplayProtector::new(ReplayProtector::MIN_WINDOW);
+        let mut seen = HashSet::new();
+        let mut x = 0x1234_5678_u32;
+        for i in 0..1024 {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            let nonce = (x & 0xffff) % (i + 20);
+            if rp.check_nonce(nonce) {
+                assert!(seen.insert(nonce), "nonce {} accepted twice", nonce);
+            }
+        }
+    }
+
+    #[test]
+    fn test_stats() {
+        let rp = ReplayProtector::new(64);
+        rp.init(5);
+        for nonce in (5..200).filter(|n| n % 10 != 0) {
+            assert!(rp.check_nonce(nonce));
         }
-        if shift_amount > 63 {
-            return shift_amount - self.bitfield.count_ones();
+        assert!(!rp.check_nonce(151));
+        assert!(!rp.check_nonce(4));
+        // At least 64 behind, up to 31 more depending on where the blocks fall
+        assert!(rp.check_nonce(150));
+        assert!(rp.check_nonce(130));
+        assert!(!rp.check_nonce(90));
+
+        // Losses are counted as the window slides: 3 from each of 0..31, 32..63, 64..95
+        // and 96..127 as newer blocks took their slots, then 1000 takes the slot of
+        // 128..159, where 140 never came, and skips 8 blocks which would have landed there.
+        assert!(rp.check_nonce(1000));
+        let stats = rp.stats();
+        assert_eq!(stats.received_packets, 179);
+        assert_eq!(stats.duplicate_packets, 1);
+        assert_eq!(stats.received_unexpected, 2);
+        assert_eq!(stats.lost_packets, 4 * 3 + 1 + 8 * 32);
+    }
+
+    #[test]
+    fn test_window() {
+        assert_eq!(ReplayProtector::new(0).window(), ReplayProtector::MIN_WINDOW);
+        assert_eq!(ReplayProtector::new(1000).window(), 1024);
+        assert_eq!(ReplayProtector::new(3000).window(), 3008);
+        assert_eq!(ReplayProtector::new(u32::MAX).window(), ReplayProtector::MAX_WINDOW);
+
+        for window in [1024, 3008, 8192] {
+            let rp = ReplayProtector::new(window);
+            // Every other nonce arrives in order, the rest come a full window late.
+            let top = 3 * window;
+            for nonce in (0..=top).step_by(2) {
+                assert!(rp.check_nonce(nonce));
+            }
+            assert!(!rp.check_nonce(top - window - 1));
+            for nonce in (top - window + 1..top).step_by(2) {
+                assert!(rp.check_nonce(nonce), "window {} nonce {}", window, nonce);
+            }
+            assert!(!rp.check_nonce(top - window + 1));
+            let stats = rp.stats();
+            assert_eq!(stats.received_unexpected, 1);
+            assert_eq!(stats.duplicate_packets, 1);
+            // The odd nonces in the blocks which left the window before the late ones came.
+            assert_eq!(stats.lost_packets, window);
         }
-        return shift_amount - (self.bitfield << (64 - shift_amount)).count_ones();
+    }
+
+    #[test]
+    fn test_concurrent() {
+        const THREADS: u32 = 4;
+        const NONCES: u32 = 200_000;
+        let rp = Arc::new(ReplayProtector::default());
+        let accepted = (0..THREADS)
+            .map(|t| {
+                let rp = Arc::clone(&rp);
+                std::thread::spawn(move || {
+                    // Every thread tries every nonce, a little out of order
+                    (0..NONCES)
+                        .map(|n| n ^ ((t * 7) & 15))
+                        .filter(|&n| rp.check_nonce(n))
+                        .collect::<Vec<_>>()
+                })
+            })
+            .flat_map(|h| h.join().unwrap())
+            .collect::<Vec<_>>();
+        let unique = accepted.iter().collect::<HashSet<_>>();
+        assert_eq!(unique.len(), accepted.len(), "a nonce was accepted twice");
+        assert_eq!(rp.stats().received_packets as usize, accepted.len());
     }
 }
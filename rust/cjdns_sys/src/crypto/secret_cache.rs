@@ -0,0 +1,183 @@
+//! Cache of secrets shared with peers' permanent keys
+
+use crate::crypto::wipe::Wipe;
+
+struct Entry {
+    her_public_key: [u8; 32],
+    password_hash: Option<[u8; 32]>,
+    secret: [u8; 32],
+    last_used: u64,
+}
+
+impl Entry {
+    fn wipe(&mut self) {
+        (&mut self.her_public_key).wipe();
+        if let Some(p) = self.password_hash.as_mut() {
+            p.wipe();
+        }
+        (&mut self.secret).wipe();
+    }
+}
+
+#[derive(Clone, Default, PartialEq, Eq, Debug)]
+pub struct SecretCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+}
+
+/// Least recently used cache of the secrets made from our permanent key and a
+/// peer's, keyed by her public key and the password hash.
+///
+/// Each hello costs one of these, so without the cache a peer whose session keeps
+/// resetting costs a scalar multiplication every time. Only secrets involving no
+/// temporary key are cached, the rest are different every handshake.
+///
+/// The entries are kept in place, without a map, so that an evicted secret can be
+/// overwritten with zeroes rather than left behind wherever a map had moved it.
+pub struct SecretCache {
+    entries: Vec<Entry>,
+    capacity: usize,
+    clock: u64,
+    stats: SecretCacheStats,
+}
+
+impl Default for SecretCache {
+    fn default() -> Self {
+        Self::new(Self::DEFAULT_CAPACITY)
+    }
+}
+
+impl SecretCache {
+    pub const DEFAULT_CAPACITY: usize = 256;
+
+    pub fn new(capacity: usize) -> Self {
+        Self {
+            entries: Vec::with_capacity(capacity),
+            capacity,
+            clock: 0,
+            stats: SecretCacheStats::default(),
+        }
+    }
+
+    pub fn get(&mut self, her_public_key: &[u8; 32], password_hash: &Option<[u8; 32]>) -> Option<[u8; 32]> {
+        self.clock += 1;
+        let clock = self.clock;
+        match self
+            .entries
+            .iter_mut()
+            .find(|e| &e.her_public_key == her_public_key && &e.password_hash == password_hash)
+        {
+            Some(e) => {
+                e.last_used = clock;
+                self.stats.hits += 1;
+                Some(e.secret)
+            }
+            None => {
+                self.stats.misses += 1;
+                None
+            }
+        }
+    }
+
+    /// Add a secret, evicting the least recently used one if the cache is full.
+    pub fn insert(&mut self, her_public_key: [u8; 32], password_hash: Option<[u8; 32]>, secret: [u8; 32]) {
+        if self.capacity == 0 {
+            return;
+        }
+        self.clock += 1;
+        let entry = Entry { her_public_key, password_hash, secret, last_used: self.clock };
+        let existing = self
+            .entries
+            .iter()
+            .position(|e| e.her_public_key == her_public_key && e.password_hash == password_hash);
+        let slot = match existing {
+            // Made by two threads at once
+            Some(i) => i,
+            None if self.entries.len() < self.capacity => {
+                self.entries.push(entry);
+                return;
+            }
+            None => {
+                let (i, _) = self.entries.iter().enumerate().min_by_key(|(_, e)| e.last_used).unwrap();
+                i
+            }
+        };
+        self.entries[slot].wipe();
+        self.entries[slot] = entry;
+    }
+
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    pub fn stats(&self) -> SecretCacheStats {
+        self.stats.clone()
+    }
+}
+
+impl Drop for SecretCache {
+    fn drop(&mut self) {
+        for e in self.entries.iter_mut() {
+            e.wipe();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{SecretCache, SecretCacheStats};
+
+    fn key(i: u8) -> [u8; 32] {
+        [i; 32]
+    }
+
+    #[test]
+    fn test_hits_and_misses() {
+        let mut c = SecretCache::new(4);
+        assert_eq!(c.get(&key(1), &None), None);
+        c.insert(key(1), None, key(101));
+        assert_eq!(c.get(&key(1), &None), Some(key(101)));
+        // The password hash is part of the key
+        assert_eq!(c.get(&key(1), &Some(key(9))), None);
+        c.insert(key(1), Some(key(9)), key(102));
+        assert_eq!(c.get(&key(1), &Some(key(9))), Some(key(102)));
+        assert_eq!(c.get(&key(1), &None), Some(key(101)));
+        assert_eq!(c.stats(), SecretCacheStats { hits: 3, misses: 2 });
+    }
+
+    #[test]
+    fn test_lru_eviction() {
+        let mut c = SecretCache::new(3);
+        for i in 1..=3 {
+            c.insert(key(i), None, key(100 + i));
+        }
+        // 1 is used again so 2 is now the least recently used
+        assert!(c.get(&key(1), &None).is_some());
+        c.insert(key(4), None, key(104));
+        assert_eq!(c.len(), 3);
+        assert_eq!(c.get(&key(2), &None), None);
+        for i in [1, 3, 4] {
+            assert_eq!(c.get(&key(i), &None), Some(key(100 + i)));
+        }
+        // Inserting what is already there replaces it rather than evicting another
+        c.insert(key(4), None, key(104));
+        assert_eq!(c.len(), 3);
+        assert!(c.get(&key(3), &None).is_some());
+    }
+
+    #[test]
+    fn test_eviction_wipes() {
+        let mut c = SecretCache::new(1);
+        c.insert(key(1), Some(key(2)), key(3));
+        let e = &mut c.entries[0];
+        e.wipe();
+        assert_eq!((e.her_public_key, e.password_hash, e.secret), ([0; 32], Some([0; 32]), [0; 32]));
+    }
+
+    #[test]
+    fn test_zero_capacity() {
+        let mut c = SecretCache::new(0);
+        c.insert(key(1), None, key(2));
+        assert_eq!(c.get(&key(1), &None), None);
+    }
+}
@@ -35,4 +35,17 @@ pub trait SessionTrait {
     fn tick(&self, alloc: &mut Allocator) -> Result<Option<Message>>;
 
     fn cjdns_ver(&self) -> u32;
+
+    /// Decrypt a data packet on an established session in place, without going through
+    /// the handshake state machine or the session ifaces. Used by the switch fast path.
+    /// Returns false, leaving the message untouched, if the packet needs the normal path.
+    fn decrypt_run(&self, msg: &mut Message) -> Result<bool>;
+
+    /// Encrypt a data packet on an established session in place, like decrypt_run().
+    /// Returns false, leaving the message untouched, if the packet needs the normal path.
+    fn encrypt_run(&self, msg: &mut Message) -> Result<bool>;
+
+    /// Pass a message which was decrypted using decrypt_run() to whatever is plumbed to
+    /// the plaintext iface, exactly as though the session had decrypted it itself.
+    fn deliver_plaintext(&self, msg: Message) -> Result<()>;
 }
\ No newline at end of file
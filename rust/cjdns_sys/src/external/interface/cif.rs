@@ -1,14 +1,17 @@
+use std::cell::RefCell;
 use std::os::raw::c_void;
 use std::sync::atomic::AtomicBool;
 use std::sync::Arc;
 use eyre::{Result,bail};
+use once_cell::sync::OnceCell;
 
 use crate::cffi::{self, Allocator_t};
 use crate::rffi::allocator::{self, file_line};
 use crate::rtypes::RTypes_Error_t;
 use crate::external::interface::iface::{self, IfRecv, Iface, IfacePvt};
 use crate::interface::wire::message::Message;
-use crate::gcl::Protected;
+use crate::gcl::{Protected, Site, GCL};
+use crate::gcl::core_thread::{CoreThread, CoreThreadStats, Job, Submitter};
 use crate::util::identity::{Identity,from_c};
 
 struct CRecv {
@@ -16,20 +19,134 @@ struct CRecv {
     dg: Arc<AtomicBool>,
 }
 
+impl CRecv {
+    fn dropped(&self) -> bool {
+        self.dg.load(std::sync::atomic::Ordering::Relaxed)
+    }
+    /// Must be called with the GCL held
+    unsafe fn incoming(c_iface: *mut cffi::Iface, m: &Message) -> Result<()> {
+        (cffi::Iface_incoming_fromRust(m.as_c_message(), c_iface) as *mut RTypes_Error_t).as_mut()
+            .map(|e|e.e.take())
+            .flatten()
+            .map(Err)
+            .unwrap_or(Ok(()))
+    }
+}
+
+/// A message on its way into C through the core thread
+struct CJob {
+    c_iface: *mut cffi::Iface,
+    dg: Arc<AtomicBool>,
+    msg: Message,
+}
+// The iface pointer is only used on the core thread, with the GCL held
+unsafe impl Send for CJob {}
+
+impl Job for CJob {
+    type Done = Message;
+    fn run(self) -> Message {
+        if !self.dg.load(std::sync::atomic::Ordering::Relaxed) {
+            if let Err(e) = unsafe { CRecv::incoming(self.c_iface, &self.msg) } {
+                log::debug!("Error processing packet: {e}");
+            }
+        }
+        self.msg
+    }
+}
+
+static CORE_THREAD: OnceCell<CoreThread<CJob>> = OnceCell::new();
+
+thread_local! {
+    static CORE_SUBMITTER: RefCell<Option<Submitter<CJob>>> = RefCell::new(None);
+}
+
+/// Start running all messages from Rust into C on a single thread, optionally
+/// pinned to `cpu`, rather than on whichever thread received them.
+/// This cannot be undone.
+pub fn start_core_thread(cpu: Option<usize>) -> Result<()> {
+    CORE_THREAD.get_or_try_init(|| CoreThread::new(&GCL, cpu))?;
+    Ok(())
+}
+
+pub fn core_thread_stats() -> Option<CoreThreadStats> {
+    CORE_THREAD.get().map(|ct| ct.stats())
+}
+
+impl CRecv {
+    /// The core thread, if there is one and this thread does not already hold the
+    /// GCL. If it does then we are being called from inside C (or from the core
+    /// thread itself) and the message must go in now, not after what is queued.
+    fn core_thread() -> Option<&'static CoreThread<CJob>> {
+        CORE_THREAD.get().filter(|_| !GCL.is_owned_by_current_thread())
+    }
+
+    fn submit(&self, ct: &CoreThread<CJob>, msg: Message) -> Result<()> {
+        let job = CJob {
+            c_iface: unsafe { self.c_iface.get_unlocked() },
+            dg: Arc::clone(&self.dg),
+            msg,
+        };
+        CORE_SUBMITTER.with_borrow_mut(|s| {
+            match s.get_or_insert_with(|| ct.submitter()).submit(job) {
+                Ok(()) => Ok(()),
+                Err(_) => bail!("Core thread queue is full"),
+            }
+        })
+    }
+}
+
 impl IfRecv for CRecv {
     fn recv(&self, m: Message) -> Result<()> {
-        if self.dg.load(std::sync::atomic::Ordering::Relaxed) {
+        if self.dropped() {
             bail!("Other end has been dropped");
         }
-        let c_msg = m.as_c_message();
+        if let Some(ct) = Self::core_thread() {
+            return self.submit(ct, m);
+        }
         let cif = self.c_iface.lock();
-        unsafe {
-            (cffi::Iface_incoming_fromRust(c_msg, *cif) as *mut RTypes_Error_t).as_mut()
-                .map(|e|e.e.take())
-                .flatten()
-                .map(Err)
-                .unwrap_or(Ok(()))
+        // C might have freed the iface while we were waiting for the lock
+        if self.dropped() {
+            bail!("Other end has been dropped");
+        }
+        unsafe { Self::incoming(*cif, &m) }
+    }
+
+    /// Hand the whole batch to C under one acquisition of the GCL. The messages
+    /// are released after the lock, as they are in recv().
+    fn recv_batch(&self, msgs: &mut Vec<Message>) -> Result<()> {
+        if msgs.is_empty() {
+            return Ok(());
+        }
+        if self.dropped() {
+            msgs.clear();
+            bail!("Other end has been dropped");
+        }
+        if let Some(ct) = Self::core_thread() {
+            for m in msgs.drain(..) {
+                if let Err(e) = self.submit(ct, m) {
+                    log::debug!("Error processing packet: {e}");
+                }
+            }
+            return Ok(());
+        }
+        let cif = self.c_iface.lock();
+        let mut dropped = false;
+        for m in msgs.iter() {
+            // Any message might cause C to free the iface
+            dropped = self.dropped();
+            if dropped {
+                break;
+            }
+            if let Err(e) = unsafe { Self::incoming(*cif, m) } {
+                log::debug!("Error processing packet: {e}");
+            }
+        }
+        drop(cif);
+        msgs.clear();
+        if dropped {
+            bail!("Other end has been dropped");
         }
+        Ok(())
     }
 }
 
@@ -85,7 +202,7 @@ fn new<T: Into<String>>(alloc: *mut Allocator_t, name: T) -> (Iface, *mut cffi::
     );
     allocator::rs(alloc).on_free(on_free, out as _, file_line!());
     let c_iface = unsafe { (&mut (*out).cif) as *mut cffi::Iface };
-    iface.set_receiver(CRecv { c_iface: Protected::new(c_iface), dg: drop_guard });
+    iface.set_receiver(CRecv { c_iface: Protected::new(c_iface, Site::Iface), dg: drop_guard });
     (iface, c_iface)
 }
 
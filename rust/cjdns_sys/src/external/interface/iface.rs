@@ -11,6 +11,20 @@ use crate::interface::wire::message::Message;
 /// a cjdns Iface.
 pub trait IfRecv: Send + Sync {
     fn recv(&self, m: Message) -> Result<()>;
+
+    /// Receive a whole batch of messages, `msgs` is drained.
+    /// A message which fails is logged and dropped, an error is returned only if
+    /// the batch as a whole could not be handled.
+    /// The default just calls recv() for each message, implement this if there is
+    /// a per-call cost (such as taking a lock) which the batch can share.
+    fn recv_batch(&self, msgs: &mut Vec<Message>) -> Result<()> {
+        for m in msgs.drain(..) {
+            if let Err(e) = self.recv(m) {
+                log::debug!("Error processing packet: {e}");
+            }
+        }
+        Ok(())
+    }
 }
 
 // Receiver which just always causes an error, default if none other is registered
@@ -46,6 +60,21 @@ impl IfacePvt {
             None => bail!("No connected iface for {}", self.name),
         }
     }
+
+    /// Like send() but for a batch of messages, see IfRecv::recv_batch().
+    /// `msgs` is always drained, even if an error is returned.
+    pub fn send_batch(&self, msgs: &mut Vec<Message>) -> Result<()> {
+        if msgs.is_empty() {
+            return Ok(());
+        }
+        match &*self.peer_recv.read() {
+            Some(s) => s.recv_batch(msgs),
+            None => {
+                msgs.clear();
+                bail!("No connected iface for {}", self.name)
+            }
+        }
+    }
 }
 
 static NEXT_IFACE_ID: AtomicU32 = AtomicU32::new(0); 
@@ -241,3 +270,82 @@ impl Iface {
         Ok(())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::sync::Arc;
+
+    use eyre::{bail, Result};
+
+    use super::{IfRecv, Iface};
+    use crate::interface::wire::message::Message;
+
+    #[derive(Default)]
+    struct Counter {
+        recv: AtomicUsize,
+        batches: AtomicUsize,
+    }
+
+    /// Receives one at a time and refuses every other message
+    struct OneAtATime(Arc<Counter>);
+    impl IfRecv for OneAtATime {
+        fn recv(&self, _m: Message) -> Result<()> {
+            if self.0.recv.fetch_add(1, Ordering::Relaxed) % 2 == 1 {
+                bail!("refused");
+            }
+            Ok(())
+        }
+    }
+
+    struct Batched(Arc<Counter>);
+    impl IfRecv for Batched {
+        fn recv(&self, _m: Message) -> Result<()> {
+            self.0.recv.fetch_add(1, Ordering::Relaxed);
+            Ok(())
+        }
+        fn recv_batch(&self, msgs: &mut Vec<Message>) -> Result<()> {
+            self.0.batches.fetch_add(1, Ordering::Relaxed);
+            self.0.recv.fetch_add(msgs.len(), Ordering::Relaxed);
+            msgs.clear();
+            Ok(())
+        }
+    }
+
+    fn batch(n: usize) -> Vec<Message> {
+        (0..n).map(|_| Message::new(64)).collect()
+    }
+
+    #[test]
+    fn test_send_batch() -> Result<()> {
+        let c = Arc::new(Counter::default());
+        let (mut a, a_pvt) = Iface::new("a");
+        let (mut b, _b_pvt) = Iface::new("b");
+        b.set_receiver(OneAtATime(Arc::clone(&c)));
+        a.plumb(&mut b)?;
+        let mut msgs = batch(5);
+        a_pvt.send_batch(&mut msgs)?;
+        assert!(msgs.is_empty());
+        assert_eq!(c.recv.load(Ordering::Relaxed), 5);
+
+        let c = Arc::new(Counter::default());
+        let (mut a, a_pvt) = Iface::new("a");
+        let (mut b, _b_pvt) = Iface::new("b");
+        b.set_receiver(Batched(Arc::clone(&c)));
+        a.plumb(&mut b)?;
+        let mut msgs = batch(5);
+        a_pvt.send_batch(&mut msgs)?;
+        assert!(msgs.is_empty());
+        assert_eq!(c.recv.load(Ordering::Relaxed), 5);
+        assert_eq!(c.batches.load(Ordering::Relaxed), 1);
+        Ok(())
+    }
+
+    #[test]
+    fn test_send_batch_unplumbed() {
+        let (_a, a_pvt) = Iface::new("a");
+        let mut msgs = batch(3);
+        assert!(a_pvt.send_batch(&mut msgs).is_err());
+        assert!(msgs.is_empty());
+    }
+}
@@ -0,0 +1,370 @@
+//! A dedicated thread which runs work into C on behalf of the socket workers.
+//!
+//! Normally whichever worker is holding a packet takes the GCL and runs the C
+//! pipeline itself, so the workers queue up on the lock and the C state moves
+//! from core to core with them. With a CoreThread, each worker gets a ring of
+//! its own which only it pushes to, and the core thread (optionally pinned to
+//! one CPU) drains all of the rings and runs the jobs while holding the lock.
+//!
+//! Timers, admin calls and everything else which enters C still take the GCL
+//! from wherever they run, the core thread lets go of the lock between rounds
+//! so that they are not starved.
+
+use std::sync::atomic::{fence, AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::thread::{JoinHandle, Thread};
+use std::time::Duration;
+
+use eyre::{bail, Result};
+use parking_lot::{Mutex, ReentrantMutex};
+
+use super::{lock_at, Site};
+use crate::util::spsc::{self, Consumer, Producer};
+use crate::util::topology::set_affinity;
+
+/// Work which is run on the core thread.
+pub trait Job: Send + 'static {
+    /// Whatever is left after the job has run, dropped after the lock is released.
+    type Done;
+
+    /// Called on the core thread while holding the lock.
+    fn run(self) -> Self::Done;
+}
+
+/// Jobs which can be waiting for the core thread, per submitter.
+const RING_SIZE: usize = 1024;
+
+/// Jobs to run before releasing the lock, so others who need it get a chance.
+const MAX_PER_ROUND: usize = 256;
+
+/// Empty passes over the rings before the core thread goes to sleep.
+const IDLE_SPINS: u32 = 64;
+
+/// The longest the core thread will sleep without being woken.
+const IDLE_PARK: Duration = Duration::from_millis(100);
+
+#[derive(Default, Clone, Copy, Debug)]
+pub struct CoreThreadStats {
+    pub submitters: u64,
+    pub submitted: u64,
+    pub ring_full: u64,
+    pub rounds: u64,
+    pub wakeups: u64,
+}
+
+struct Shared<J: Job> {
+    lock: &'static ReentrantMutex<()>,
+    new_rings: Mutex<Vec<Consumer<J>>>,
+    has_new_rings: AtomicBool,
+    thread: Thread,
+    sleeping: AtomicBool,
+    stop: AtomicBool,
+
+    submitters: AtomicU64,
+    submitted: AtomicU64,
+    ring_full: AtomicU64,
+    rounds: AtomicU64,
+    wakeups: AtomicU64,
+}
+
+impl<J: Job> Shared<J> {
+    fn wake(&self) {
+        // Pairs with the fence in idle(), either we see that it is sleeping
+        // or it sees what we just pushed.
+        fence(Ordering::SeqCst);
+        if self.sleeping.load(Ordering::Relaxed) {
+            self.wakeups.fetch_add(1, Ordering::Relaxed);
+            self.thread.unpark();
+        }
+    }
+
+    fn idle(&self, rings: &[Consumer<J>]) {
+        self.sleeping.store(true, Ordering::Relaxed);
+        fence(Ordering::SeqCst);
+        if rings.iter().all(|r| r.is_empty())
+            && !self.has_new_rings.load(Ordering::Relaxed)
+            && !self.stop.load(Ordering::Relaxed)
+        {
+            std::thread::park_timeout(IDLE_PARK);
+        }
+        self.sleeping.store(false, Ordering::Relaxed);
+    }
+
+    fn run(&self) {
+        let mut rings: Vec<Consumer<J>> = Vec::new();
+        let mut jobs: Vec<J> = Vec::with_capacity(MAX_PER_ROUND);
+        let mut done: Vec<J::Done> = Vec::with_capacity(MAX_PER_ROUND);
+        let mut idle_spins = 0;
+        while !self.stop.load(Ordering::Relaxed) {
+            if self.has_new_rings.swap(false, Ordering::Acquire) {
+                rings.append(&mut self.new_rings.lock());
+            }
+
+            // Take round-robin from every ring so one busy worker cannot starve the rest
+            'fill: loop {
+                let mut got_any = false;
+                for r in rings.iter_mut() {
+                    if let Some(j) = r.pop() {
+                        jobs.push(j);
+                        got_any = true;
+                        if jobs.len() == MAX_PER_ROUND {
+                            break 'fill;
+                        }
+                    }
+                }
+                if !got_any {
+                    break;
+                }
+            }
+
+            if jobs.is_empty() {
+                rings.retain(|r| !r.is_abandoned() || !r.is_empty());
+                idle_spins += 1;
+                if idle_spins < IDLE_SPINS {
+                    std::hint::spin_loop();
+                } else {
+                    idle_spins = 0;
+                    self.idle(&rings);
+                }
+                continue;
+            }
+            idle_spins = 0;
+
+            {
+                let _l = lock_at(self.lock, Site::CoreThread);
+                done.extend(jobs.drain(..).map(|j| j.run()));
+            }
+            done.clear();
+            self.rounds.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+}
+
+/// Used by one thread to give jobs to the core thread.
+pub struct Submitter<J: Job> {
+    ring: Producer<J>,
+    shared: Arc<Shared<J>>,
+}
+
+impl<J: Job> Submitter<J> {
+    /// Queue a job for the core thread, it is given back if the ring is full.
+    pub fn submit(&mut self, j: J) -> Result<(), J> {
+        if let Err(j) = self.ring.push(j) {
+            self.shared.ring_full.fetch_add(1, Ordering::Relaxed);
+            return Err(j);
+        }
+        self.shared.submitted.fetch_add(1, Ordering::Relaxed);
+        self.shared.wake();
+        Ok(())
+    }
+}
+
+pub struct CoreThread<J: Job> {
+    shared: Arc<Shared<J>>,
+    handle: Option<JoinHandle<()>>,
+}
+
+impl<J: Job> CoreThread<J> {
+    /// Start the core thread, it runs jobs while holding `lock`.
+    /// If `cpu` is set then the thread is pinned to that CPU.
+    pub fn new(lock: &'static ReentrantMutex<()>, cpu: Option<usize>) -> Result<Self> {
+        let (ready_send, ready_recv) = std::sync::mpsc::channel::<Result<Arc<Shared<J>>>>();
+        let handle = std::thread::Builder::new()
+            .name("cjdns-core".into())
+            .spawn(move || {
+                if let Some(cpu) = cpu {
+                    if let Err(e) = set_affinity(&[cpu]) {
+                        let _ = ready_send.send(Err(e));
+                        return;
+                    }
+                }
+                let shared = Arc::new(Shared {
+                    lock,
+                    new_rings: Mutex::new(Vec::new()),
+                    has_new_rings: AtomicBool::new(false),
+                    thread: std::thread::current(),
+                    sleeping: AtomicBool::new(false),
+                    stop: AtomicBool::new(false),
+                    submitters: AtomicU64::new(0),
+                    submitted: AtomicU64::new(0),
+                    ring_full: AtomicU64::new(0),
+                    rounds: AtomicU64::new(0),
+                    wakeups: AtomicU64::new(0),
+                });
+                let _ = ready_send.send(Ok(Arc::clone(&shared)));
+                shared.run();
+            })?;
+        match ready_recv.recv() {
+            Ok(Ok(shared)) => Ok(Self { shared, handle: Some(handle) }),
+            Ok(Err(e)) => Err(e),
+            Err(_) => bail!("Core thread died during startup"),
+        }
+    }
+
+    /// Make a new ring for a thread to submit jobs with.
+    pub fn submitter(&self) -> Submitter<J> {
+        let (ring, consumer) = spsc::channel(RING_SIZE);
+        self.shared.new_rings.lock().push(consumer);
+        self.shared.has_new_rings.store(true, Ordering::Release);
+        self.shared.submitters.fetch_add(1, Ordering::Relaxed);
+        self.shared.wake();
+        Submitter { ring, shared: Arc::clone(&self.shared) }
+    }
+
+    pub fn stats(&self) -> CoreThreadStats {
+        let s = &self.shared;
+        CoreThreadStats {
+            submitters: s.submitters.load(Ordering::Relaxed),
+            submitted: s.submitted.load(Ordering::Relaxed),
+            ring_full: s.ring_full.load(Ordering::Relaxed),
+            rounds: s.rounds.load(Ordering::Relaxed),
+            wakeups: s.wakeups.load(Ordering::Relaxed),
+        }
+    }
+}
+
+impl<J: Job> Drop for CoreThread<J> {
+    fn drop(&mut self) {
+        self.shared.stop.store(true, Ordering::Relaxed);
+        self.shared.thread.unpark();
+        if let Some(h) = self.handle.take() {
+            let _ = h.join();
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use once_cell::sync::Lazy;
+    use std::sync::atomic::AtomicUsize;
+    use std::time::Instant;
+
+    static TEST_LOCK: Lazy<ReentrantMutex<()>> = Lazy::new(|| ReentrantMutex::new(()));
+
+    /// Stands in for C, checks that jobs from each submitter run in order and
+    /// only with the lock held.
+    struct Record {
+        from: usize,
+        seq: usize,
+        last: Arc<Vec<AtomicUsize>>,
+        count: Arc<AtomicUsize>,
+    }
+    impl Job for Record {
+        type Done = ();
+        fn run(self) {
+            assert!(TEST_LOCK.is_owned_by_current_thread());
+            assert_eq!(self.last[self.from].swap(self.seq + 1, Ordering::Relaxed), self.seq);
+            self.count.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    fn submit_spin<J: Job>(s: &mut Submitter<J>, mut j: J) {
+        while let Err(back) = s.submit(j) {
+            j = back;
+            std::thread::yield_now();
+        }
+    }
+
+    #[test]
+    fn test_core_thread() {
+        const THREADS: usize = 3;
+        const JOBS: usize = 5000;
+        let ct = CoreThread::<Record>::new(&TEST_LOCK, None).unwrap();
+        let last = Arc::new((0..THREADS).map(|_| AtomicUsize::new(0)).collect::<Vec<_>>());
+        let count = Arc::new(AtomicUsize::new(0));
+        let threads = (0..THREADS)
+            .map(|from| {
+                let mut s = ct.submitter();
+                let (last, count) = (Arc::clone(&last), Arc::clone(&count));
+                std::thread::spawn(move || {
+                    for seq in 0..JOBS {
+                        let j = Record { from, seq, last: Arc::clone(&last), count: Arc::clone(&count) };
+                        submit_spin(&mut s, j);
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        for t in threads {
+            t.join().unwrap();
+        }
+        while count.load(Ordering::Relaxed) < THREADS * JOBS {
+            std::thread::sleep(Duration::from_millis(1));
+        }
+        let st = ct.stats();
+        assert_eq!(st.submitters, THREADS as u64);
+        assert_eq!(st.submitted, (THREADS * JOBS) as u64);
+    }
+
+    /// Does next to nothing, so the benchmark measures the cost of getting work
+    /// to whoever holds the lock rather than the work itself.
+    struct Touch(Arc<AtomicU64>);
+    impl Job for Touch {
+        type Done = ();
+        fn run(self) {
+            self.0.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    fn bench_inline(threads: usize, jobs: usize) -> Duration {
+        let counter = Arc::new(AtomicU64::new(0));
+        let t0 = Instant::now();
+        let ts = (0..threads)
+            .map(|_| {
+                let counter = Arc::clone(&counter);
+                std::thread::spawn(move || {
+                    for _ in 0..jobs {
+                        let _l = TEST_LOCK.lock();
+                        Touch(Arc::clone(&counter)).run();
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        for t in ts {
+            t.join().unwrap();
+        }
+        t0.elapsed()
+    }
+
+    fn bench_core_thread(threads: usize, jobs: usize) -> Duration {
+        let ct = CoreThread::<Touch>::new(&TEST_LOCK, None).unwrap();
+        let counter = Arc::new(AtomicU64::new(0));
+        let t0 = Instant::now();
+        let ts = (0..threads)
+            .map(|_| {
+                let counter = Arc::clone(&counter);
+                let mut s = ct.submitter();
+                std::thread::spawn(move || {
+                    for _ in 0..jobs {
+                        submit_spin(&mut s, Touch(Arc::clone(&counter)));
+                    }
+                })
+            })
+            .collect::<Vec<_>>();
+        for t in ts {
+            t.join().unwrap();
+        }
+        while counter.load(Ordering::Relaxed) < (threads * jobs) as u64 {
+            std::hint::spin_loop();
+        }
+        t0.elapsed()
+    }
+
+    /// cargo test --release -- --ignored --nocapture bench_core_thread_vs_inline
+    #[test]
+    #[ignore]
+    fn bench_core_thread_vs_inline() {
+        const JOBS: usize = 1_000_000;
+        for threads in [1, 2, 4, 8] {
+            let inline = bench_inline(threads, JOBS);
+            let core = bench_core_thread(threads, JOBS);
+            let per_sec = |d: Duration| (threads * JOBS) as f64 / d.as_secs_f64();
+            println!(
+                "{} threads: inline locking {:.0} jobs/s, core thread {:.0} jobs/s",
+                threads,
+                per_sec(inline),
+                per_sec(core)
+            );
+        }
+    }
+}
@@ -1,19 +1,57 @@
 use once_cell::sync::Lazy;
 use parking_lot::{ReentrantMutex,ReentrantMutexGuard};
 use std::ops::Deref;
+use std::time::Instant;
+
+pub mod core_thread;
+pub mod profile;
+
+pub use profile::Site;
 
 /// Global C lock, to make callbacks into C, while keeping libuv's and tokio's async Runtimes synced.
 pub static GCL: Lazy<ReentrantMutex<()>> = Lazy::new(|| ReentrantMutex::new(()));
 
+/// A held GCL (or other reentrant lock), which reports the hold time to the
+/// profiler when released.
+pub struct GclGuard {
+    held_since: Option<(Site, Instant)>,
+    _lock: ReentrantMutexGuard<'static, ()>,
+}
+impl Drop for GclGuard {
+    fn drop(&mut self) {
+        if let Some((site, t0)) = self.held_since {
+            profile::record_hold(site, t0.elapsed());
+        }
+    }
+}
+
+/// Take `lock` on behalf of `site`, recording wait and hold time if the profiler is enabled.
+pub fn lock_at(lock: &'static ReentrantMutex<()>, site: Site) -> GclGuard {
+    if !profile::enabled() || lock.is_owned_by_current_thread() {
+        return GclGuard { held_since: None, _lock: lock.lock() };
+    }
+    let t0 = Instant::now();
+    let l = lock.lock();
+    let t1 = Instant::now();
+    profile::record_wait(site, t1 - t0);
+    GclGuard { held_since: Some((site, t1)), _lock: l }
+}
+
+/// Take the GCL on behalf of `site`.
+pub fn lock(site: Site) -> GclGuard {
+    lock_at(&GCL, site)
+}
+
 pub struct Protected<T: Copy> {
-    t: T
+    t: T,
+    site: Site,
 }
 unsafe impl<T: Copy> Send for Protected<T> {}
 unsafe impl<T: Copy> Sync for Protected<T> {}
 
 pub struct ProtectedMutexGuard<T: Copy> {
     t: T,
-    _lock: ReentrantMutexGuard<'static, ()>,
+    _lock: GclGuard,
 }
 impl<T: Copy> Deref for ProtectedMutexGuard<T> {
     type Target = T;
@@ -23,13 +61,19 @@ impl<T: Copy> Deref for ProtectedMutexGuard<T> {
 }
 
 impl<T: Copy> Protected<T> {
-    pub fn new(t: T) -> Self {
-        Self{t}
+    /// `site` is what the lock is accounted to by the GCL profiler.
+    pub fn new(t: T, site: Site) -> Self {
+        Self{t, site}
+    }
+    /// Get the value without taking the lock, it must only be used while the
+    /// lock is held.
+    pub unsafe fn get_unlocked(&self) -> T {
+        self.t
     }
     pub fn lock(&self) -> ProtectedMutexGuard<T> {
         ProtectedMutexGuard{
             t: self.t,
-            _lock: GCL.lock(),
+            _lock: lock(self.site),
         }
     }
-}
\ No newline at end of file
+}
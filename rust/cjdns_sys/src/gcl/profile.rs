@@ -0,0 +1,204 @@
+//! Accounting of where the GCL is taken, how long each taker waited for it and
+//! how long it was then held. Off by default, while off the only cost of a lock
+//! is one relaxed atomic load.
+//!
+//! Times are kept as log2 histograms of nanoseconds: bucket 0 is 0ns and bucket
+//! i counts times in [2^(i-1), 2^i) nanoseconds, the last bucket takes
+//! everything which is longer.
+
+use std::convert::TryFrom;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::time::Duration;
+
+use crate::rtypes::{RTypes_GclProfile_Histogram_t, RTypes_GclProfile_Site_t};
+
+/// Code which takes the GCL, only the outermost lock on a thread is recorded.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Site {
+    Timer,
+    FdReadable,
+    Iface,
+    CoreThread,
+    Process,
+    AllocatorFree,
+    UnixSocket,
+    Random,
+    /// Rffi_glock() called from C
+    CLock,
+    Other,
+}
+
+impl Site {
+    pub const ALL: [Site; 10] = [
+        Site::Timer,
+        Site::FdReadable,
+        Site::Iface,
+        Site::CoreThread,
+        Site::Process,
+        Site::AllocatorFree,
+        Site::UnixSocket,
+        Site::Random,
+        Site::CLock,
+        Site::Other,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Site::Timer => "timer",
+            Site::FdReadable => "fdReadable",
+            Site::Iface => "iface",
+            Site::CoreThread => "coreThread",
+            Site::Process => "process",
+            Site::AllocatorFree => "allocatorFree",
+            Site::UnixSocket => "unixSocket",
+            Site::Random => "random",
+            Site::CLock => "cLock",
+            Site::Other => "other",
+        }
+    }
+
+    /// Same as name() but nul terminated, for C
+    fn c_name(self) -> &'static [u8] {
+        match self {
+            Site::Timer => b"timer\0",
+            Site::FdReadable => b"fdReadable\0",
+            Site::Iface => b"iface\0",
+            Site::CoreThread => b"coreThread\0",
+            Site::Process => b"process\0",
+            Site::AllocatorFree => b"allocatorFree\0",
+            Site::UnixSocket => b"unixSocket\0",
+            Site::Random => b"random\0",
+            Site::CLock => b"cLock\0",
+            Site::Other => b"other\0",
+        }
+    }
+}
+
+pub const BUCKETS: usize = 32;
+
+pub fn bucket(ns: u64) -> usize {
+    ((u64::BITS - ns.leading_zeros()) as usize).min(BUCKETS - 1)
+}
+
+struct Histogram {
+    count: AtomicU64,
+    total_ns: AtomicU64,
+    max_ns: AtomicU64,
+    buckets: [AtomicU64; BUCKETS],
+}
+
+impl Histogram {
+    const fn new() -> Self {
+        #[allow(clippy::declare_interior_mutable_const)]
+        const ZERO: AtomicU64 = AtomicU64::new(0);
+        Self {
+            count: ZERO,
+            total_ns: ZERO,
+            max_ns: ZERO,
+            buckets: [ZERO; BUCKETS],
+        }
+    }
+
+    fn record(&self, d: Duration) {
+        let ns = u64::try_from(d.as_nanos()).unwrap_or(u64::MAX);
+        self.count.fetch_add(1, Ordering::Relaxed);
+        self.total_ns.fetch_add(ns, Ordering::Relaxed);
+        self.max_ns.fetch_max(ns, Ordering::Relaxed);
+        self.buckets[bucket(ns)].fetch_add(1, Ordering::Relaxed);
+    }
+
+    fn reset(&self) {
+        self.count.store(0, Ordering::Relaxed);
+        self.total_ns.store(0, Ordering::Relaxed);
+        self.max_ns.store(0, Ordering::Relaxed);
+        for b in &self.buckets {
+            b.store(0, Ordering::Relaxed);
+        }
+    }
+
+    fn snapshot(&self) -> RTypes_GclProfile_Histogram_t {
+        let mut buckets = [0; BUCKETS];
+        for (out, b) in buckets.iter_mut().zip(&self.buckets) {
+            *out = b.load(Ordering::Relaxed);
+        }
+        RTypes_GclProfile_Histogram_t {
+            count: self.count.load(Ordering::Relaxed),
+            total_ns: self.total_ns.load(Ordering::Relaxed),
+            max_ns: self.max_ns.load(Ordering::Relaxed),
+            buckets,
+        }
+    }
+}
+
+struct SiteProfile {
+    wait: Histogram,
+    hold: Histogram,
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const NEW_SITE: SiteProfile = SiteProfile { wait: Histogram::new(), hold: Histogram::new() };
+
+static PROFILE: [SiteProfile; Site::ALL.len()] = [NEW_SITE; Site::ALL.len()];
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+pub fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+pub fn set_enabled(enabled: bool) {
+    ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+/// Clear all of the counters, locks which are held at the time of the reset are
+/// still recorded when they are released.
+pub fn reset() {
+    for p in &PROFILE {
+        p.wait.reset();
+        p.hold.reset();
+    }
+}
+
+pub(super) fn record_wait(site: Site, d: Duration) {
+    PROFILE[site as usize].wait.record(d);
+}
+
+pub(super) fn record_hold(site: Site, d: Duration) {
+    PROFILE[site as usize].hold.record(d);
+}
+
+pub fn snapshot(site: Site) -> RTypes_GclProfile_Site_t {
+    let p = &PROFILE[site as usize];
+    RTypes_GclProfile_Site_t {
+        name: site.c_name().as_ptr() as _,
+        wait: p.wait.snapshot(),
+        hold: p.hold.snapshot(),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_bucket() {
+        assert_eq!(bucket(0), 0);
+        assert_eq!(bucket(1), 1);
+        assert_eq!(bucket(2), 2);
+        assert_eq!(bucket(3), 2);
+        assert_eq!(bucket(4), 3);
+        assert_eq!(bucket(1023), 10);
+        assert_eq!(bucket(1024), 11);
+        assert_eq!(bucket(1 << 30), BUCKETS - 1);
+        assert_eq!(bucket(u64::MAX), BUCKETS - 1);
+    }
+
+    #[test]
+    fn test_site_names() {
+        for (i, s) in Site::ALL.iter().enumerate() {
+            assert_eq!(*s as usize, i);
+            let c = s.c_name();
+            assert_eq!(&c[..c.len() - 1], s.name().as_bytes());
+        }
+    }
+}
@@ -0,0 +1,493 @@
+//! Ethernet transport on a PACKET_MMAP ring (Linux)
+//!
+//! The packet socket is given a TPACKET_V3 receive ring, which the kernel fills a
+//! block of frames at a time, and a transmit ring of fixed size frames which are all
+//! sent with one sendto(). One worker drains the receive ring and one fills the
+//! transmit ring, so the C event loop is only entered to hand over each block.
+//!
+//! The socket is SOCK_RAW so that every frame in the transmit ring can go to a
+//! different MAC. Messages to and from this iface begin with an EthIfaceHeader
+//! which carries the peer's MAC, followed by the content of the Ethernet frame.
+
+use std::convert::TryInto;
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+
+use eyre::{bail, Result};
+use tokio::io::unix::AsyncFd;
+use tokio::sync::mpsc::{Receiver, Sender};
+use tokio::sync::Mutex;
+
+use crate::external::interface::iface::{self, IfRecv, Iface, IfacePvt};
+use crate::interface::socketiface::MAX_BATCH;
+use crate::interface::wire::message::Message;
+
+const BUFFER_CAP: usize = 3496;
+const PADDING_AMOUNT: usize = 512;
+const TO_GO_OUT_QUEUE: usize = 256;
+
+pub(crate) const ETH_HLEN: usize = 14;
+pub(crate) const ETHERTYPE_CJDNS: u16 = 0xfc00;
+
+/// Size of the EthIfaceHeader at the front of every message.
+pub const HDR_LEN: usize = 8;
+
+// From linux/if_packet.h
+const PACKET_RX_RING: libc::c_int = 5;
+const PACKET_VERSION: libc::c_int = 10;
+const PACKET_TX_RING: libc::c_int = 13;
+const PACKET_LOSS: libc::c_int = 14;
+const TPACKET_V3: libc::c_int = 2;
+const TP_STATUS_KERNEL: u32 = 0;
+const TP_STATUS_USER: u32 = 1;
+const TP_STATUS_SEND_REQUEST: u32 = 1;
+const TP_STATUS_SENDING: u32 = 2;
+
+#[repr(C)]
+#[derive(Default)]
+struct TpacketReq3 {
+    tp_block_size: u32,
+    tp_block_nr: u32,
+    tp_frame_size: u32,
+    tp_frame_nr: u32,
+    tp_retire_blk_tov: u32,
+    tp_sizeof_priv: u32,
+    tp_feature_req_word: u32,
+}
+
+// Offsets in struct tpacket_block_desc
+const BLK_STATUS: usize = 8;
+const BLK_NUM_PKTS: usize = 12;
+const BLK_FIRST_PKT: usize = 16;
+
+// Offsets in struct tpacket3_hdr
+const TP_NEXT_OFFSET: usize = 0;
+const TP_SNAPLEN: usize = 12;
+const TP_LEN: usize = 16;
+const TP_STATUS: usize = 20;
+const TP_MAC: usize = 24;
+const TP_NET: usize = 26;
+/// TPACKET_ALIGN(sizeof(struct tpacket3_hdr)), a received frame has its sockaddr_ll
+/// here and a frame to send has its content here.
+const TP3_HDRLEN: usize = 48;
+
+// Offsets in struct sockaddr_ll
+const SLL_PKTTYPE: usize = 10;
+const SLL_ADDR: usize = 12;
+
+const FRAME_SIZE: usize = 2048;
+const RX_BLOCK_SIZE: usize = 1 << 17;
+const RX_BLOCKS: usize = 32;
+const TX_BLOCK_SIZE: usize = 1 << 17;
+const TX_BLOCKS: usize = 4;
+const TX_FRAMES: usize = TX_BLOCK_SIZE / FRAME_SIZE * TX_BLOCKS;
+/// A receive block which is not full is handed over after this many milliseconds.
+const RX_BLOCK_TIMEOUT_MS: u32 = 1;
+
+/// Carried in front of every message, it has the MAC of the peer which a frame came
+/// from or is going to, and the sll_pkttype of a frame which was received.
+#[derive(Default, Clone, Copy, Debug, PartialEq, Eq)]
+pub struct EthIfaceHeader {
+    pub mac: [u8; 6],
+    pub pkttype: u8,
+}
+
+impl EthIfaceHeader {
+    pub(crate) fn encode(&self) -> [u8; HDR_LEN] {
+        let mut out = [0_u8; HDR_LEN];
+        out[..6].copy_from_slice(&self.mac);
+        out[6] = self.pkttype;
+        out
+    }
+    pub(crate) fn decode(b: &[u8]) -> Self {
+        let mut mac = [0_u8; 6];
+        mac.copy_from_slice(&b[..6]);
+        Self { mac, pkttype: b[6] }
+    }
+}
+
+fn setsockopt<T>(fd: RawFd, opt: libc::c_int, val: &T) -> Result<()> {
+    let ret = unsafe {
+        libc::setsockopt(
+            fd,
+            libc::SOL_PACKET,
+            opt,
+            val as *const T as *const libc::c_void,
+            std::mem::size_of::<T>() as libc::socklen_t,
+        )
+    };
+    if ret < 0 {
+        bail!("setsockopt(SOL_PACKET, {}) [{}]", opt, std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+/// Both rings, mapped together with the receive ring first.
+struct Ring {
+    base: *mut u8,
+    len: usize,
+}
+unsafe impl Send for Ring {}
+unsafe impl Sync for Ring {}
+
+impl Ring {
+    fn new(fd: RawFd) -> Result<Self> {
+        setsockopt(fd, PACKET_VERSION, &TPACKET_V3)?;
+        // Frames which the kernel can't send are skipped rather than stopping the ring
+        setsockopt(fd, PACKET_LOSS, &1_i32)?;
+        setsockopt(fd, PACKET_RX_RING, &TpacketReq3 {
+            tp_block_size: RX_BLOCK_SIZE as u32,
+            tp_block_nr: RX_BLOCKS as u32,
+            tp_frame_size: FRAME_SIZE as u32,
+            tp_frame_nr: (RX_BLOCK_SIZE / FRAME_SIZE * RX_BLOCKS) as u32,
+            tp_retire_blk_tov: RX_BLOCK_TIMEOUT_MS,
+            ..Default::default()
+        })?;
+        setsockopt(fd, PACKET_TX_RING, &TpacketReq3 {
+            tp_block_size: TX_BLOCK_SIZE as u32,
+            tp_block_nr: TX_BLOCKS as u32,
+            tp_frame_size: FRAME_SIZE as u32,
+            tp_frame_nr: TX_FRAMES as u32,
+            ..Default::default()
+        })?;
+        let len = RX_BLOCK_SIZE * RX_BLOCKS + TX_BLOCK_SIZE * TX_BLOCKS;
+        let base = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_SHARED,
+                fd,
+                0,
+            )
+        };
+        if base == libc::MAP_FAILED {
+            bail!("mmap() of packet ring [{}]", std::io::Error::last_os_error());
+        }
+        Ok(Self { base: base as *mut u8, len })
+    }
+    fn rx_block(&self, i: usize) -> *mut u8 {
+        unsafe { self.base.add(i * RX_BLOCK_SIZE) }
+    }
+    fn tx_frame(&self, i: usize) -> *mut u8 {
+        unsafe { self.base.add(RX_BLOCK_SIZE * RX_BLOCKS + i * FRAME_SIZE) }
+    }
+}
+impl Drop for Ring {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.base as *mut libc::c_void, self.len) };
+    }
+}
+
+/// A status word which is shared with the kernel.
+fn status<'a>(p: *mut u8) -> &'a AtomicU32 {
+    unsafe { &*(p as *const AtomicU32) }
+}
+fn get_u32(p: *const u8) -> u32 {
+    unsafe { (p as *const u32).read_unaligned() }
+}
+fn get_u16(p: *const u8) -> u16 {
+    unsafe { (p as *const u16).read_unaligned() }
+}
+
+/// Make messages of all of the frames in a receive block.
+fn read_block(bd: *mut u8, out: &mut Vec<Message>) {
+    let count = get_u32(unsafe { bd.add(BLK_NUM_PKTS) });
+    let mut off = get_u32(unsafe { bd.add(BLK_FIRST_PKT) }) as usize;
+    for _ in 0..count {
+        if off == 0 || off >= RX_BLOCK_SIZE {
+            log::warn!("Packet ring block with bad offset [{off}]");
+            break;
+        }
+        let h = unsafe { bd.add(off) };
+        let snaplen = get_u32(unsafe { h.add(TP_SNAPLEN) }) as usize;
+        let mac_off = get_u16(unsafe { h.add(TP_MAC) }) as usize;
+        let net_off = get_u16(unsafe { h.add(TP_NET) }) as usize;
+        let sll = unsafe { std::slice::from_raw_parts(h.add(TP3_HDRLEN), 20) };
+        let hdr = EthIfaceHeader {
+            mac: sll[SLL_ADDR..SLL_ADDR + 6].try_into().unwrap(),
+            pkttype: sll[SLL_PKTTYPE],
+        };
+        // SOCK_RAW, the frame begins at tp_mac and the content at tp_net
+        let end = mac_off + snaplen;
+        if net_off < mac_off + ETH_HLEN || end <= net_off || end > RX_BLOCK_SIZE - off {
+            log::debug!("DROP: Frame with mac [{mac_off}] net [{net_off}] len [{snaplen}]");
+        } else {
+            let content = unsafe { std::slice::from_raw_parts(h.add(net_off), end - net_off) };
+            match message(&hdr, content) {
+                Ok(m) => out.push(m),
+                Err(e) => log::debug!("DROP: {e}"),
+            }
+        }
+        off += get_u32(unsafe { h.add(TP_NEXT_OFFSET) }) as usize;
+    }
+}
+
+pub(crate) fn message(hdr: &EthIfaceHeader, content: &[u8]) -> Result<Message> {
+    if HDR_LEN + content.len() > BUFFER_CAP - 2 {
+        bail!("Frame of [{}] bytes is too big", content.len());
+    }
+    let mut msg = Message::new_pooled(PADDING_AMOUNT + BUFFER_CAP);
+    msg.allocate_uninitialized(BUFFER_CAP)?;
+    // Knock it out of alignment by 2 bytes so that it will be aligned when
+    // the EthIfaceHeader and the ETHInterface header are popped.
+    msg.discard_bytes(2)?;
+    let b = msg.bytes_mut();
+    b[..HDR_LEN].copy_from_slice(&hdr.encode());
+    b[HDR_LEN..HDR_LEN + content.len()].copy_from_slice(content);
+    msg.set_len(HDR_LEN + content.len())?;
+    Ok(msg)
+}
+
+/// Write the Ethernet frame for a message to out, returning its length.
+pub(crate) fn write_frame(out: &mut [u8], src_mac: &[u8; 6], msg: &Message) -> Result<usize> {
+    let b = msg.bytes();
+    let hdr = EthIfaceHeader::decode(b);
+    let content = &b[HDR_LEN..];
+    let len = ETH_HLEN + content.len();
+    if len > out.len() {
+        bail!("Frame of [{}] bytes is too big", len);
+    }
+    out[0..6].copy_from_slice(&hdr.mac);
+    out[6..12].copy_from_slice(src_mac);
+    out[12..14].copy_from_slice(&ETHERTYPE_CJDNS.to_be_bytes());
+    out[ETH_HLEN..len].copy_from_slice(content);
+    Ok(len)
+}
+
+/// Put a message in a frame of the transmit ring.
+fn fill(frame: *mut u8, src_mac: &[u8; 6], msg: &Message) -> Result<()> {
+    let data =
+        unsafe { std::slice::from_raw_parts_mut(frame.add(TP3_HDRLEN), FRAME_SIZE - TP3_HDRLEN) };
+    let len = write_frame(data, src_mac, msg)?;
+    unsafe {
+        (frame.add(TP_LEN) as *mut u32).write_unaligned(len as u32);
+        (frame.add(TP_NEXT_OFFSET) as *mut u32).write_unaligned(0);
+    }
+    Ok(())
+}
+
+/// Ask the kernel to send every frame in the transmit ring which is ready.
+fn flush(fd: RawFd) {
+    let ret = unsafe {
+        libc::sendto(fd, std::ptr::null(), 0, libc::MSG_DONTWAIT, std::ptr::null(), 0)
+    };
+    if ret < 0 {
+        let e = std::io::Error::last_os_error();
+        match e.raw_os_error() {
+            Some(libc::EAGAIN) | Some(libc::ENOBUFS) | Some(libc::EINTR) => {}
+            _ => log::info!("Error sending packet ring: {e}"),
+        }
+    }
+}
+
+fn tx_free(ring: &Ring, head: usize) -> bool {
+    let st = status(unsafe { ring.tx_frame(head).add(TP_STATUS) });
+    st.load(Ordering::Acquire) & (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING) == 0
+}
+
+
+struct EthIfaceInternal {
+    iface: IfacePvt,
+    afd: AsyncFd<OwnedFd>,
+    ring: Ring,
+    src_mac: [u8; 6],
+
+    to_go_out_recv: Mutex<Receiver<Message>>,
+    to_go_out_send: Sender<Message>,
+    done_r: tokio::sync::broadcast::Receiver<()>,
+}
+impl IfRecv for Arc<EthIfaceInternal> {
+    fn recv(&self, m: Message) -> Result<()> {
+        if m.len() < HDR_LEN {
+            bail!("Message runt, [{}] bytes", m.len());
+        }
+        match self.to_go_out_send.try_send(m) {
+            Ok(()) => Ok(()),
+            Err(_) => bail!("Not enough buffer space to send frame"),
+        }
+    }
+}
+
+impl EthIfaceInternal {
+    async fn recv_worker(self: Arc<Self>) {
+        let mut block = 0;
+        let mut ready = Vec::with_capacity(MAX_BATCH);
+        loop {
+            let mut readable = match self.afd.readable().await {
+                Ok(r) => r,
+                Err(e) => {
+                    log::info!("Error polling packet socket: {e} - sleep 1 second");
+                    tokio::time::sleep(Duration::from_secs(1)).await;
+                    continue;
+                }
+            };
+            loop {
+                let bd = self.ring.rx_block(block);
+                let st = status(unsafe { bd.add(BLK_STATUS) });
+                if st.load(Ordering::Acquire) & TP_STATUS_USER == 0 {
+                    break;
+                }
+                read_block(bd, &mut ready);
+                st.store(TP_STATUS_KERNEL, Ordering::Release);
+                block = (block + 1) % RX_BLOCKS;
+                if let Err(e) = self.iface.send_batch(&mut ready) {
+                    log::debug!("Error processing frames: {e}");
+                }
+                ready.clear();
+            }
+            // If a block was handed over since we looked, readiness is kept
+            readable.clear_ready();
+        }
+    }
+
+    async fn send_worker(self: Arc<Self>) {
+        let mut head = 0;
+        let mut batch = Vec::with_capacity(MAX_BATCH);
+        loop {
+            self.to_go_out_recv.lock().await.recv_many(&mut batch, MAX_BATCH).await;
+            for msg in batch.drain(..) {
+                while !tx_free(&self.ring, head) {
+                    // The ring is full, kick the kernel and wait for it to free a frame
+                    flush(self.afd.as_raw_fd());
+                    match self.afd.writable().await {
+                        Ok(mut w) => {
+                            if !tx_free(&self.ring, head) {
+                                w.clear_ready();
+                            }
+                        }
+                        Err(e) => {
+                            log::info!("Error polling packet socket: {e} - sleep 1 second");
+                            tokio::time::sleep(Duration::from_secs(1)).await;
+                        }
+                    }
+                }
+                let frame = self.ring.tx_frame(head);
+                match fill(frame, &self.src_mac, &msg) {
+                    Ok(()) => {
+                        status(unsafe { frame.add(TP_STATUS) })
+                            .store(TP_STATUS_SEND_REQUEST, Ordering::Release);
+                        head = (head + 1) % TX_FRAMES;
+                    }
+                    Err(e) => log::debug!("DROP: {e}"),
+                }
+            }
+            flush(self.afd.as_raw_fd());
+        }
+    }
+
+    async fn worker(self: Arc<Self>, send: bool) {
+        let mut done = self.done_r.resubscribe();
+        if send {
+            tokio::select! {
+                _ = Arc::clone(&self).send_worker() => {},
+                _ = done.recv() => {},
+            }
+        } else {
+            tokio::select! {
+                _ = Arc::clone(&self).recv_worker() => {},
+                _ = done.recv() => {},
+            }
+        }
+    }
+}
+
+pub struct EthIface {
+    pub iface: Iface,
+    // This is never sent to, it is DROPPED in order to cause the tasks to exit
+    _done: tokio::sync::broadcast::Sender<()>,
+}
+
+impl EthIface {
+    /// Set up the rings on a bound AF_PACKET / SOCK_RAW socket, the fd is taken over
+    /// and closed when the workers exit, or right away if this fails.
+    /// src_mac is the MAC of the interface, used in sent frames.
+    pub fn new(fd: RawFd, src_mac: [u8; 6]) -> Result<Self> {
+        let fd = unsafe { OwnedFd::from_raw_fd(fd) };
+        let ring = Ring::new(fd.as_raw_fd())?;
+        let (tgo, tgo_r) = tokio::sync::mpsc::channel(TO_GO_OUT_QUEUE);
+        let (_done, done_r) = tokio::sync::broadcast::channel(1);
+        let (mut iface, iface_pvt) = iface::new("EthIface");
+        let inner = Arc::new(EthIfaceInternal {
+            iface: iface_pvt,
+            afd: AsyncFd::new(fd)?,
+            ring,
+            src_mac,
+            to_go_out_recv: Mutex::new(tgo_r),
+            to_go_out_send: tgo,
+            done_r,
+        });
+        iface.set_receiver(Arc::clone(&inner));
+        tokio::task::spawn(Arc::clone(&inner).worker(true));
+        tokio::task::spawn(inner.worker(false));
+        Ok(Self { iface, _done })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // Needs CAP_NET_RAW, frames are sent to the loopback device and received back.
+    #[test]
+    #[ignore]
+    fn test_ring_loopback() {
+        let fd = unsafe {
+            libc::socket(libc::AF_PACKET, libc::SOCK_RAW, (ETHERTYPE_CJDNS.to_be() as i32).into())
+        };
+        assert!(fd >= 0);
+        let mut sll: libc::sockaddr_ll = unsafe { std::mem::zeroed() };
+        sll.sll_family = libc::AF_PACKET as u16;
+        sll.sll_protocol = ETHERTYPE_CJDNS.to_be();
+        sll.sll_ifindex = unsafe { libc::if_nametoindex(b"lo\0".as_ptr() as _) } as i32;
+        let ret = unsafe {
+            libc::bind(fd, &sll as *const _ as *const libc::sockaddr,
+                std::mem::size_of::<libc::sockaddr_ll>() as u32)
+        };
+        assert_eq!(ret, 0);
+        let ring = Ring::new(fd).unwrap();
+
+        let peer = EthIfaceHeader { mac: [0, 0, 0, 0, 0, 0], pkttype: 0 };
+        let count = 100;
+        for i in 0..count {
+            let msg = message(&peer, &[i as u8; 200]).unwrap();
+            assert!(tx_free(&ring, i));
+            let frame = ring.tx_frame(i);
+            fill(frame, &[0; 6], &msg).unwrap();
+            status(unsafe { frame.add(TP_STATUS) }).store(TP_STATUS_SEND_REQUEST, Ordering::Release);
+        }
+        flush(fd);
+
+        let mut out = Vec::new();
+        let mut block = 0;
+        for _ in 0..100 {
+            let bd = ring.rx_block(block);
+            let st = status(unsafe { bd.add(BLK_STATUS) });
+            if st.load(Ordering::Acquire) & TP_STATUS_USER == 0 {
+                if out.len() >= count {
+                    break;
+                }
+                std::thread::sleep(Duration::from_millis(5));
+                continue;
+            }
+            read_block(bd, &mut out);
+            st.store(TP_STATUS_KERNEL, Ordering::Release);
+            block = (block + 1) % RX_BLOCKS;
+        }
+        assert_eq!(out.len(), count);
+        for (i, m) in out.iter().enumerate() {
+            let b = m.bytes();
+            assert_eq!(b.len(), HDR_LEN + 200);
+            assert_eq!(EthIfaceHeader::decode(b).mac, peer.mac);
+            assert!(b[HDR_LEN..].iter().all(|&x| x == i as u8));
+            assert_eq!(m.data_ptr() % 4, 2);
+        }
+        for i in 0..count {
+            assert!(tx_free(&ring, i));
+        }
+        drop(ring);
+        unsafe { libc::close(fd) };
+    }
+}
@@ -3,4 +3,11 @@ pub mod tuntap;
 pub mod rustiface_test_wrapper;
 pub mod udpaddriface;
 pub mod socketiface;
-pub mod unixsocketiface;
\ No newline at end of file
+#[cfg(target_os = "linux")]
+pub mod ethiface;
+#[cfg(target_os = "linux")]
+pub mod xdpiface;
+#[cfg(target_os = "linux")]
+pub mod uring;
+pub mod unixsocketiface;
+pub mod switch_fastpath;
\ No newline at end of file
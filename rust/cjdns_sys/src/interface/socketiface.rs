@@ -1,6 +1,8 @@
 use std::collections::VecDeque;
 use std::os::fd::AsRawFd;
-use std::sync::atomic::{AtomicI32, AtomicU32};
+use std::sync::atomic::{AtomicI32, AtomicU32, AtomicU64, Ordering};
+#[cfg(target_os = "linux")]
+use std::sync::atomic::AtomicBool;
 use std::time::Duration;
 use libc::cmsghdr;
 use num_enum::{IntoPrimitive, TryFromPrimitive};
@@ -9,33 +11,109 @@ use tokio::sync::mpsc::{Receiver, Sender};
 use tokio::sync::Mutex;
 use crate::rtypes::RTypes_SocketType;
 use crate::util::sockaddr::Sockaddr;
+use crate::util::topology;
 use std::convert::TryFrom;
 use std::sync::Arc;
 use crate::interface::wire::message::Message;
+use crate::interface::tuntap::vnet;
+#[cfg(target_os = "linux")]
+use crate::interface::uring::{self, AsyncUring, BufRing, RecvmsgOut, Sqe};
 use crate::external::interface::iface::{self, IfRecv, Iface, IfacePvt};
 use eyre::{Context, Result};
 
-const RECV_BATCH: usize = 8;
-const SEND_BATCH: usize = 8;
+/// Most messages which are sent or received in one batch.
+pub(crate) const MAX_BATCH: usize = 64;
+/// Workers start with this batch size and never shrink below it.
+const MIN_BATCH: usize = 8;
+/// Shrink the batch after this many batches in a row which are less than a quarter full.
+const SHRINK_AFTER: u32 = 16;
 
 const TO_GO_OUT_QUEUE: usize = 64;
 
 const BUFFER_CAP: usize = 3496;
 const PADDING_AMOUNT: usize = 512;
+/// Room for a TCP super-packet from a TUN device with IFF_VNET_HDR.
+const VNET_BUFFER_CAP: usize = vnet::PI_LEN + vnet::HDR_LEN + 65535;
 
-// sendmmsg() is only available on Linux, so on other systems we'll just emulate it.
+// Layout compatible with libc::mmsghdr, which only exists on Linux.
 #[repr(C)]
-struct Mmsghdr {
-    msg_hdr: libc::msghdr,
-    msg_len: libc::c_uint,
+pub(crate) struct Mmsghdr {
+    pub(crate) msg_hdr: libc::msghdr,
+    pub(crate) msg_len: libc::c_uint,
 }
+#[cfg(target_os = "linux")]
+const _: () = assert!(std::mem::size_of::<Mmsghdr>() == std::mem::size_of::<libc::mmsghdr>());
 
-fn recvmmsg(
+/// Cleared if recvmmsg() or sendmmsg() fail with ENOSYS, after that they are emulated.
+#[cfg(target_os = "linux")]
+static HAVE_MMSG: AtomicBool = AtomicBool::new(true);
+
+/// Set if io_uring could not be used, after that every worker uses epoll.
+#[cfg(target_os = "linux")]
+static URING_FAILED: AtomicBool = AtomicBool::new(false);
+
+/// Provided buffers for each io_uring receive worker, see UringRecv.
+#[cfg(target_os = "linux")]
+const URING_BUFS: u16 = 256;
+/// Reads from a TUN device which each io_uring receive worker keeps in flight.
+#[cfg(target_os = "linux")]
+const URING_READS: usize = MAX_BATCH;
+/// Room for the address and control data of a datagram in a provided buffer.
+#[cfg(target_os = "linux")]
+const URING_NAME_LEN: usize = 128;
+#[cfg(target_os = "linux")]
+const URING_CONTROL_LEN: usize = 64;
+#[cfg(target_os = "linux")]
+const _: () = assert!(uring::RECVMSG_OUT_LEN + URING_NAME_LEN + URING_CONTROL_LEN <= PADDING_AMOUNT);
+
+#[cfg(target_os = "linux")]
+fn uring_failed(err: &std::io::Error) {
+    if !URING_FAILED.swap(true, Ordering::Relaxed) {
+        log::info!("io_uring is not usable, SocketIface workers fall back to epoll: {err}");
+    }
+}
+
+/// Receive up to msgvec.len() messages, msg_len is set for each one which is received
+/// and the others are left as they were. Adds the number of syscalls made to `syscalls`.
+pub(crate) fn recvmmsg(
+    sockfd: libc::c_int,
+    msgvec: &mut [Mmsghdr],
+    flags: libc::c_int,
+    syscalls: &mut u64,
+) -> Result<(), std::io::Error> {
+    #[cfg(target_os = "linux")]
+    if HAVE_MMSG.load(Ordering::Relaxed) {
+        *syscalls += 1;
+        let ret = unsafe {
+            libc::recvmmsg(
+                sockfd,
+                msgvec.as_mut_ptr() as *mut libc::mmsghdr,
+                msgvec.len() as _,
+                flags,
+                std::ptr::null_mut(),
+            )
+        };
+        if ret >= 0 {
+            return Ok(());
+        }
+        let err = std::io::Error::last_os_error();
+        if err.raw_os_error() != Some(libc::ENOSYS) {
+            return Err(err);
+        }
+        log::info!("recvmmsg() is not supported, falling back to recvmsg()");
+        HAVE_MMSG.store(false, Ordering::Relaxed);
+    }
+    recvmmsg_emulated(sockfd, msgvec, flags, syscalls)
+}
+
+fn recvmmsg_emulated(
     sockfd: libc::c_int,
     msgvec: &mut [Mmsghdr],
     flags: libc::c_int,
+    syscalls: &mut u64,
 ) -> Result<(), std::io::Error> {
     for msg in msgvec {
+        *syscalls += 1;
         let ret = unsafe { libc::recvmsg(sockfd, &mut msg.msg_hdr as *mut _, flags) };
         if ret < 0 {
             return Err(std::io::Error::last_os_error());
@@ -67,21 +145,141 @@ fn write(
     Ok(ret as usize)
 }
 
-fn sendmmsg(
+/// Send the messages in msgvec in order, msg_len is set to the number of bytes sent
+/// for each message and to zero for each message which was not sent.
+/// Adds the number of syscalls made to `syscalls`.
+pub(crate) fn sendmmsg(
     sockfd: libc::c_int,
     msgvec: &mut [Mmsghdr],
     flags: libc::c_int,
+    syscalls: &mut u64,
 ) -> Result<(), std::io::Error> {
-    for msg in msgvec {
-        let ret = unsafe { libc::sendmsg(sockfd, &msg.msg_hdr as *const _, flags) };
+    #[cfg(target_os = "linux")]
+    if HAVE_MMSG.load(Ordering::Relaxed) {
+        *syscalls += 1;
+        let ret = unsafe {
+            libc::sendmmsg(
+                sockfd,
+                msgvec.as_mut_ptr() as *mut libc::mmsghdr,
+                msgvec.len() as _,
+                flags,
+            )
+        };
+        if ret >= 0 {
+            for msg in &mut msgvec[ret as usize..] {
+                msg.msg_len = 0;
+            }
+            return Ok(());
+        }
+        let err = std::io::Error::last_os_error();
+        if err.raw_os_error() != Some(libc::ENOSYS) {
+            for msg in msgvec {
+                msg.msg_len = 0;
+            }
+            return Err(err);
+        }
+        log::info!("sendmmsg() is not supported, falling back to sendmsg()");
+        HAVE_MMSG.store(false, Ordering::Relaxed);
+    }
+    sendmmsg_emulated(sockfd, msgvec, flags, syscalls)
+}
+
+fn sendmmsg_emulated(
+    sockfd: libc::c_int,
+    msgvec: &mut [Mmsghdr],
+    flags: libc::c_int,
+    syscalls: &mut u64,
+) -> Result<(), std::io::Error> {
+    for i in 0..msgvec.len() {
+        *syscalls += 1;
+        let ret = unsafe { libc::sendmsg(sockfd, &msgvec[i].msg_hdr as *const _, flags) };
         if ret < 0 {
+            for msg in &mut msgvec[i..] {
+                msg.msg_len = 0;
+            }
             return Err(std::io::Error::last_os_error());
         }
-        msg.msg_len = ret as libc::c_uint;
+        msgvec[i].msg_len = ret as libc::c_uint;
     }
     Ok(())
 }
 
+/// An error which just means to try again later.
+pub(crate) fn is_transient(err: &std::io::Error) -> bool {
+    matches!(err.kind(), std::io::ErrorKind::WouldBlock | std::io::ErrorKind::Interrupted)
+}
+
+/// Number of messages a worker handles per batch. It doubles whenever a batch is
+/// filled and halves after SHRINK_AFTER batches in a row which are less than a
+/// quarter full, so a busy socket is drained with few syscalls while an idle one
+/// does not hold on to many buffers.
+pub(crate) struct BatchSize {
+    size: usize,
+    small: u32,
+    max: usize,
+}
+impl BatchSize {
+    pub(crate) fn new() -> Self {
+        Self::with_max(MAX_BATCH)
+    }
+    /// A batch size which never grows past `max`, which is at most MAX_BATCH.
+    pub(crate) fn with_max(max: usize) -> Self {
+        let max = max.clamp(MIN_BATCH, MAX_BATCH);
+        Self { size: MIN_BATCH, small: 0, max }
+    }
+    pub(crate) fn get(&self) -> usize {
+        self.size
+    }
+    /// Update with the number of messages in the last batch.
+    pub(crate) fn update(&mut self, filled: usize) {
+        if filled >= self.size {
+            self.size = (self.size * 2).min(self.max);
+            self.small = 0;
+        } else if filled * 4 < self.size {
+            self.small += 1;
+            if self.small >= SHRINK_AFTER {
+                self.size = (self.size / 2).max(MIN_BATCH);
+                self.small = 0;
+            }
+        } else {
+            self.small = 0;
+        }
+    }
+}
+
+/// The file descriptor passed in the control data of a received message, if any.
+fn cmsg_fd(hdr: &libc::msghdr) -> Option<i32> {
+    if hdr.msg_controllen == 0 {
+        return None;
+    }
+    let bottom = hdr.msg_control as usize;
+    let top = bottom + hdr.msg_controllen as usize;
+    let mut cmsg = unsafe { libc::CMSG_FIRSTHDR(hdr as *const _) };
+    if cmsg.is_null() {
+        log::debug!("Message CMSG header is null");
+    }
+    while !cmsg.is_null() {
+        assert!((cmsg as usize) >= bottom && (cmsg as usize) < top);
+        let c = unsafe { *cmsg };
+        let data_len = c.cmsg_len as usize - std::mem::size_of::<cmsghdr>();
+        if c.cmsg_type != libc::SCM_RIGHTS {
+            log::debug!("Unexpected cmsg type in socket message: {}", c.cmsg_type);
+        } else if data_len != 4 {
+            let buf = unsafe {
+                let s = std::slice::from_raw_parts(libc::CMSG_DATA(cmsg), data_len);
+                hex::encode(s)
+            };
+            log::debug!("Passing file descriptor cmsg length unexpected: {} hex:{}", data_len, buf);
+        } else {
+            let fd = unsafe { *(libc::CMSG_DATA(cmsg) as *mut i32) };
+            log::debug!("Got file descriptor {fd} from message");
+            return Some(fd);
+        }
+        cmsg = unsafe { libc::CMSG_NXTHDR(hdr as *const _, cmsg) };
+    }
+    None
+}
+
 struct Additional {
     anciliary: [u8; 64],
     address: [u8; 128],
@@ -93,21 +291,36 @@ struct IoContext<const COUNT: usize> {
     hdrs: [Mmsghdr; COUNT],
     iovecs: [libc::iovec; COUNT],
     add: [Additional; COUNT],
+    /// Index in the batch of the message in each header, see prep_frames()
+    slots: [usize; COUNT],
     sockfd: libc::c_int,
     st: SocketType,
+    /// Frames carry a virtio_net_hdr, see SocketIface::new_vnet_hdr()
+    vnet: bool,
+    /// Super-packets are built here, only used if vnet is set
+    scratch: Vec<u8>,
+    /// Syscalls made since the last take_syscalls()
+    syscalls: u64,
 }
 unsafe impl<const COUNT: usize> Send for IoContext<COUNT> {}
 
 impl <const COUNT: usize> IoContext<COUNT> {
-    fn new(sockfd: libc::c_int, st: SocketType) -> Self {
+    fn new(sockfd: libc::c_int, st: SocketType, vnet: bool) -> Self {
         Self{
             hdrs: unsafe { std::mem::zeroed() },
             iovecs: unsafe { std::mem::zeroed() },
             add: unsafe { std::mem::zeroed() },
+            slots: [0; COUNT],
             sockfd,
             st,
+            vnet,
+            scratch: Vec::new(),
+            syscalls: 0,
         }
     }
+    fn take_syscalls(&mut self) -> u64 {
+        std::mem::take(&mut self.syscalls)
+    }
     /// send_stream sends a single message with all of the Message contents
     /// packet into a single array of iovec.
     /// With the exception that if you send_stream with a Message containing
@@ -165,7 +378,7 @@ impl <const COUNT: usize> IoContext<COUNT> {
         hdr.msg_len = total_len as _;
         hdr.msg_hdr.msg_flags = 0;
 
-        let ret = sendmmsg(self.sockfd, &mut self.hdrs[0..1], libc::MSG_DONTWAIT);
+        let ret = sendmmsg(self.sockfd, &mut self.hdrs[0..1], libc::MSG_DONTWAIT, &mut self.syscalls);
 
         // Now we need to go through our Messages and figure out which ones are already sent
         // which ones could not be sent, and which one was partially sent (if any).
@@ -184,16 +397,29 @@ impl <const COUNT: usize> IoContext<COUNT> {
                 break;
             }
         }
+        if let Err(e) = &ret {
+            if !is_transient(e) {
+                // The stream is broken, retrying will not help
+                messages.iter_mut().take(i).for_each(|m| m.clear());
+            }
+        }
 
         ret.err()
     }
 
     /// Send frame-like messages or udp packets
     fn send_frames(&mut self, messages: &mut VecDeque<Message>) -> Option<std::io::Error> {
+        let count = self.prep_frames(messages);
+        let ret = sendmmsg(self.sockfd, &mut self.hdrs[0..count], 0, &mut self.syscalls);
+        self.finish_frames(messages, count, ret)
+    }
+
+    /// Fill in a header for each message which can be sent, unparsable messages are
+    /// skipped, returns the number of headers.
+    fn prep_frames(&mut self, messages: &mut VecDeque<Message>) -> usize {
         let mut i = 0;
-        for (((msg, hdr), add), iovec) in
-            messages.iter_mut().zip(self.hdrs.iter_mut()).zip(self.add.iter_mut()).zip(self.iovecs.iter_mut())
-        {
+        for (j, msg) in messages.iter_mut().enumerate().take(COUNT) {
+            let (hdr, add, iovec) = (&mut self.hdrs[i], &mut self.add[i], &mut self.iovecs[i]);
             if self.st == SocketType::SendToFrames {
                 let sa = match Sockaddr::try_from(msg.bytes()) {
                     Ok(sa) => sa,
@@ -204,7 +430,7 @@ impl <const COUNT: usize> IoContext<COUNT> {
                     }
                 };
                 msg.discard_bytes(sa.byte_len()).expect("Message too short for sockaddr");
-                add.address.copy_from_slice(sa.bytes());
+                add.address[..sa.byte_len()].copy_from_slice(sa.bytes());
 
                 hdr.msg_hdr.msg_name = add.address.as_mut_ptr() as _;
                 hdr.msg_hdr.msg_namelen = sa.byte_len() as _;
@@ -228,17 +454,38 @@ impl <const COUNT: usize> IoContext<COUNT> {
             hdr.msg_hdr.msg_flags = 0;
             hdr.msg_len = iovec.iov_len as _;
 
+            self.slots[i] = j;
             i += 1;
         }
+        i
+    }
 
-        let ret = sendmmsg(self.sockfd, &mut self.hdrs[0..i], 0);
-
-        for (msg, hdr) in messages.iter_mut().zip(self.hdrs.iter_mut()) {
+    /// Clear the messages which were sent, given msg_len of the first `count` headers
+    /// and the result of sending them.
+    fn finish_frames(
+        &mut self,
+        messages: &mut VecDeque<Message>,
+        count: usize,
+        ret: Result<(), std::io::Error>,
+    ) -> Option<std::io::Error> {
+        let mut failed = ret.as_ref().err().map_or(false, |e| !is_transient(e));
+        for (k, hdr) in self.hdrs[0..count].iter().enumerate() {
+            let msg = &mut messages[self.slots[k]];
             let sent = hdr.msg_len as usize;
             if sent == msg.len() {
                 msg.clear();
             } else if sent == 0_usize {
-                break;
+                if failed {
+                    // This is the message which the error was about, drop it
+                    // so that the next try can get past it.
+                    log::debug!("DROP: sendmmsg() failed: {}", ret.as_ref().unwrap_err());
+                    msg.clear();
+                    failed = false;
+                } else if self.st == SocketType::SendToFrames {
+                    // Put the address back so that it can be sent next time
+                    let namelen = hdr.msg_hdr.msg_namelen as usize;
+                    msg.push_bytes(&self.add[k].address[..namelen]).unwrap();
+                }
             } else {
                 log::warn!("sendmmsg() claims [{sent}] bytes were sent on datagram message with size [{}]", msg.len());
                 // We're going to drop this message because the following message may have sent properly
@@ -251,8 +498,71 @@ impl <const COUNT: usize> IoContext<COUNT> {
         ret.err()
     }
 
+    /// Send frames as one chain of linked operations, the chain stops at the first
+    /// failure so the outcome is the same as a short sendmmsg() and finish_frames()
+    /// applies. TUN devices get writes rather than sendmsg().
+    #[cfg(target_os = "linux")]
+    async fn send_uring(
+        &mut self,
+        ring: &mut AsyncUring,
+        messages: &mut VecDeque<Message>,
+    ) -> Option<std::io::Error> {
+        let count = self.prep_frames(messages);
+        for k in 0..count {
+            let sqe = if self.st == SocketType::ReadFrames {
+                let iov = &self.iovecs[k];
+                let buf = unsafe { std::slice::from_raw_parts(iov.iov_base as *const u8, iov.iov_len) };
+                Sqe::write(self.sockfd, buf)
+            } else {
+                Sqe::sendmsg(self.sockfd, &self.hdrs[k].msg_hdr)
+            };
+            let sqe = sqe.user_data(k as u64);
+            let pushed = ring.ring.push(if k + 1 < count { sqe.link() } else { sqe });
+            assert!(pushed, "io_uring smaller than a batch");
+        }
+        let mut err = None;
+        let mut left = count;
+        if let Err(e) = ring.ring.submit(0) {
+            err = Some(e);
+            left = 0;
+            self.hdrs[0..count].iter_mut().for_each(|hdr| hdr.msg_len = 0);
+        }
+        while left > 0 {
+            while let Some(cqe) = ring.ring.pop() {
+                let hdr = &mut self.hdrs[cqe.user_data as usize];
+                match cqe.result() {
+                    Ok(len) => hdr.msg_len = len as _,
+                    Err(e) => {
+                        hdr.msg_len = 0;
+                        // The rest of the chain is cancelled, the error is about the first
+                        if err.is_none() && e.raw_os_error() != Some(libc::ECANCELED) {
+                            err = Some(e);
+                        }
+                    }
+                }
+                left -= 1;
+            }
+            if left > 0 {
+                if let Err(e) = ring.wait().await {
+                    // Only when the runtime is going away
+                    log::info!("Error waiting for io_uring: {e}");
+                    // The headers are reused by the next batch
+                    if let Err(e) = ring.ring.cancel_all() {
+                        log::error!("Unable to cancel io_uring sends: {e}");
+                    }
+                    self.hdrs[0..count].iter_mut().for_each(|hdr| hdr.msg_len = 0);
+                    err = Some(e);
+                    break;
+                }
+            }
+        }
+        self.syscalls += ring.ring.take_syscalls();
+        self.finish_frames(messages, count, err.map_or(Ok(()), Err))
+    }
+
     fn write_frames(&mut self, messages: &mut VecDeque<Message>) -> Option<std::io::Error> {
         for m in messages.iter_mut() {
+            self.syscalls += 1;
             match write(self.sockfd, m.bytes()) {
                 Ok(l) if l == m.len() => {
                     m.clear();
@@ -271,8 +581,64 @@ impl <const COUNT: usize> IoContext<COUNT> {
         None
     }
 
+    /// Write frames to a TUN device with IFF_VNET_HDR, runs of segments of one TCP
+    /// flow are coalesced into a super-packet and written together.
+    fn write_vnet(&mut self, messages: &mut VecDeque<Message>) -> Option<std::io::Error> {
+        let mut i = 0;
+        while i < messages.len() {
+            let run = vnet::run_len(messages.range(i..).map(|m| m.bytes()));
+            let ret = if run > 1 {
+                let frames = messages.range(i..i + run).map(|m| m.bytes()).collect::<Vec<_>>();
+                if let Err(e) = vnet::coalesce(&frames, &mut self.scratch) {
+                    log::debug!("DROP: Failed to coalesce [{run}] segments: {e}");
+                    messages.range_mut(i..i + run).for_each(|m| m.clear());
+                    i += run;
+                    continue;
+                }
+                write(self.sockfd, &self.scratch).map(|l| (l, self.scratch.len()))
+            } else {
+                let m = &mut messages[i];
+                if m.len() < vnet::PI_LEN {
+                    log::debug!("DROP: TUN frame runt, [{}] bytes", m.len());
+                    m.clear();
+                    i += 1;
+                    continue;
+                }
+                let (pi, ip) = m.bytes_mut().split_at_mut(vnet::PI_LEN);
+                let mut hdr = vnet::PLAIN_HDR;
+                let iov = [
+                    libc::iovec { iov_base: pi.as_mut_ptr() as _, iov_len: pi.len() },
+                    libc::iovec { iov_base: hdr.as_mut_ptr() as _, iov_len: hdr.len() },
+                    libc::iovec { iov_base: ip.as_mut_ptr() as _, iov_len: ip.len() },
+                ];
+                let ret = unsafe { libc::writev(self.sockfd, iov.as_ptr(), iov.len() as _) };
+                if ret < 0 {
+                    Err(std::io::Error::last_os_error())
+                } else {
+                    Ok((ret as usize, pi.len() + hdr.len() + ip.len()))
+                }
+            };
+            self.syscalls += 1;
+            match ret {
+                Ok((l, want)) => {
+                    if l != want {
+                        log::warn!("write_vnet: frame truncated from {want} to {l}");
+                    }
+                    messages.range_mut(i..i + run).for_each(|m| m.clear());
+                    i += run;
+                }
+                Err(e) => {
+                    return Some(e);
+                }
+            }
+        }
+        None
+    }
+
     fn send(&mut self, messages: &mut VecDeque<Message>) -> Option<std::io::Error> {
-        if self.st == SocketType::Stream {
+        if self.vnet {
+            self.write_vnet(messages)
+        } else if self.st == SocketType::Stream {
             self.send_stream(messages)
         } else if self.st == SocketType::ReadFrames {
             self.write_frames(messages)
@@ -284,6 +650,7 @@ impl <const COUNT: usize> IoContext<COUNT> {
     fn read(&mut self, messages: &mut VecDeque<Message>) -> (usize, Option<std::io::Error>) {
         let mut i = 0;
         for msg in messages.iter_mut() {
+            self.syscalls += 1;
             match read(self.sockfd, msg.bytes_mut()) {
                 Ok(c) => {
                     msg.set_len(c).unwrap();
@@ -297,6 +664,40 @@ impl <const COUNT: usize> IoContext<COUNT> {
         (i, None)
     }
 
+    /// Read up to max frames from a TUN device with IFF_VNET_HDR into buf, each one is
+    /// checksummed and cut into segments which are pushed to out as ordinary frames.
+    /// Super-packets are not carried any further: every session packet is encrypted with
+    /// its own nonce and has to fit the path MTU, so they would be cut up before the
+    /// session anyway. What is saved here is the read per segment, see
+    /// vnet::tests::bench_split_at_reader.
+    fn read_vnet(
+        &mut self,
+        buf: &mut [u8],
+        max: usize,
+        out: &mut Vec<Message>,
+    ) -> (usize, Option<std::io::Error>) {
+        for i in 0..max {
+            self.syscalls += 1;
+            let len = match read(self.sockfd, buf) {
+                Ok(len) => len,
+                Err(e) => {
+                    return (i, Some(e));
+                }
+            };
+            let ret = vnet::split(&mut buf[..len], &mut self.scratch, |pi, ip| {
+                let mut msg = Message::new_pooled(PADDING_AMOUNT + BUFFER_CAP);
+                msg.push_bytes(ip)?;
+                msg.push_bytes(pi)?;
+                out.push(msg);
+                Ok(())
+            });
+            if let Err(e) = ret {
+                log::debug!("DROP: Unusable frame from TUN: {e}");
+            }
+        }
+        (max, None)
+    }
+
     /// Receive either stream bytes OR frames
     /// Return value is the number of messages received plus the error which occurred that stopped further receiving.
     fn recv(&mut self, messages: &mut VecDeque<Message>) -> (usize, Option<std::io::Error>) {
@@ -328,7 +729,7 @@ impl <const COUNT: usize> IoContext<COUNT> {
             i += 1;
         }
 
-        let res = recvmmsg(self.sockfd, &mut self.hdrs[0..i], libc::MSG_DONTWAIT);
+        let res = recvmmsg(self.sockfd, &mut self.hdrs[0..i], libc::MSG_DONTWAIT, &mut self.syscalls);
 
         i = 0;
         for ((msg, hdr), add) in
@@ -356,35 +757,8 @@ impl <const COUNT: usize> IoContext<COUNT> {
                 };
                 msg.push_bytes(sa.bytes()).unwrap();
             }
-            if hdr.msg_hdr.msg_controllen > 0 {
-                // log::debug!("Message has control data len:{} hex:{}",
-                //     hdr.msg_hdr.msg_controllen, hex::encode(&add.anciliary[..]));
-                let bottom = add.anciliary.as_ptr() as usize;
-                let top = bottom + add.anciliary.len();
-                let mut cmsg = unsafe { libc::CMSG_FIRSTHDR(&hdr.msg_hdr as *const _) };
-                if cmsg.is_null() {
-                    log::debug!("Message CMSG header is null");
-                }
-                while !cmsg.is_null() {
-                    assert!((cmsg as usize) >= bottom && (cmsg as usize) < top);
-                    let c = unsafe { *cmsg };
-                    let data_len = c.cmsg_len as usize - std::mem::size_of::<cmsghdr>();
-                    if c.cmsg_type != libc::SCM_RIGHTS {
-                        log::debug!("Unexpected cmsg type in socket message: {}", c.cmsg_type);
-                    } else if data_len != 4 {
-                        let buf = unsafe {
-                            let s = std::slice::from_raw_parts(libc::CMSG_DATA(cmsg), data_len);
-                            hex::encode(s)
-                        };
-                        log::debug!("Passing file descriptor cmsg length unexpected: {} hex:{}", data_len, buf);
-                    } else {
-                        let fd = unsafe { *(libc::CMSG_DATA(cmsg) as *mut i32) };
-                        msg.set_fd(fd);
-                        log::debug!("Got file descriptor {fd} from message");
-                        break;
-                    }
-                    cmsg = unsafe { libc::CMSG_NXTHDR(&hdr.msg_hdr as *const _, cmsg) };
-                }
+            if let Some(fd) = cmsg_fd(&hdr.msg_hdr) {
+                msg.set_fd(fd);
             }
         }
 
@@ -392,6 +766,171 @@ impl <const COUNT: usize> IoContext<COUNT> {
     }
 }
 
+/// Receiving for a worker which uses io_uring. Datagrams come from a multishot
+/// recvmsg which stays armed until it runs out of buffers, frames from a TUN
+/// device from URING_READS reads which are each resubmitted as they complete.
+/// Either way the kernel picks a provided buffer, which is the buffer of a pooled
+/// message, so the message is handed on as it is and a new one takes its place.
+#[cfg(target_os = "linux")]
+struct UringRecv {
+    ring: AsyncUring,
+    bufs: BufRing,
+    /// Only msg_namelen and msg_controllen are used, they lay out each buffer
+    hdr: libc::msghdr,
+    /// Bytes before the payload in each buffer, see uring::RecvmsgOut
+    prefix: usize,
+    /// The message whose buffer is lent to the kernel as each bid
+    msgs: Vec<Option<Message>>,
+    /// Receives which are in flight
+    armed: usize,
+    /// Set once anything has been received
+    working: bool,
+}
+#[cfg(target_os = "linux")]
+unsafe impl Send for UringRecv {}
+#[cfg(target_os = "linux")]
+impl Drop for UringRecv {
+    fn drop(&mut self) {
+        // Receives refer to hdr and fill msgs, so they must be over before either is freed
+        if let Err(e) = self.ring.ring.cancel_all() {
+            log::error!("Unable to cancel io_uring receives: {e}");
+        }
+    }
+}
+
+#[cfg(target_os = "linux")]
+impl UringRecv {
+    fn new(st: SocketType) -> std::io::Result<Self> {
+        let ring = AsyncUring::new(URING_READS as u32, URING_BUFS as u32 * 2)?;
+        let bufs = BufRing::new(&ring.ring, 0, URING_BUFS)?;
+        let mut hdr: libc::msghdr = unsafe { std::mem::zeroed() };
+        if st == SocketType::SendToFrames {
+            hdr.msg_namelen = URING_NAME_LEN as _;
+        }
+        hdr.msg_controllen = URING_CONTROL_LEN as _;
+        let prefix = if st == SocketType::ReadFrames {
+            0
+        } else {
+            uring::RECVMSG_OUT_LEN + hdr.msg_namelen as usize + URING_CONTROL_LEN
+        };
+        let mut out = Self {
+            ring,
+            bufs,
+            hdr,
+            prefix,
+            msgs: (0..URING_BUFS).map(|_| None).collect(),
+            armed: 0,
+            working: false,
+        };
+        for bid in 0..URING_BUFS {
+            out.provide(bid);
+        }
+        out.bufs.publish();
+        Ok(out)
+    }
+
+    /// Lend the buffer of a new message to the kernel as bid. The prefix goes at the
+    /// end of the padding, so once it is discarded the payload is where a message
+    /// received with recvmmsg() would have it, and the message is the same size.
+    fn provide(&mut self, bid: u16) {
+        let mut msg = Message::new_pooled(PADDING_AMOUNT + BUFFER_CAP);
+        let buf = msg.allocate_uninitialized(self.prefix + BUFFER_CAP).unwrap();
+        // The message stays in msgs until the kernel hands bid back or the receives
+        // are cancelled
+        unsafe { self.bufs.provide(bid, buf.as_mut_ptr(), buf.len()) };
+        self.msgs[bid as usize] = Some(msg);
+    }
+
+    /// Queue receives until the right number are in flight.
+    fn arm(&mut self, fd: libc::c_int, st: SocketType) {
+        let want = if st == SocketType::ReadFrames { URING_READS } else { 1 };
+        while self.armed < want {
+            let sqe = if st == SocketType::ReadFrames {
+                Sqe::read_select(fd, BUFFER_CAP, self.bufs.bgid)
+            } else {
+                Sqe::recvmsg_multishot(fd, &self.hdr, self.bufs.bgid)
+            };
+            if !self.ring.ring.push(sqe) {
+                break;
+            }
+            self.armed += 1;
+        }
+    }
+
+    /// Take everything which has completed, messages are pushed to out.
+    /// Returns the number of messages and the first error.
+    fn reap(&mut self, st: SocketType, out: &mut Vec<Message>) -> (usize, Option<std::io::Error>) {
+        let mut received = 0;
+        let mut err = None;
+        while let Some(cqe) = self.ring.ring.pop() {
+            if !cqe.more() {
+                self.armed -= 1;
+            }
+            let bid = match (cqe.buffer(), cqe.result()) {
+                (Some(bid), Ok(_)) => bid,
+                // Out of buffers, the receive is armed again once they are handed back
+                (_, Err(e)) if e.raw_os_error() == Some(libc::ENOBUFS) => continue,
+                (_, Err(e)) => {
+                    err = err.or(Some(e));
+                    continue;
+                }
+                (None, Ok(_)) => continue,
+            };
+            self.working = true;
+            let msg = self.msgs[bid as usize].take().expect("buffer which was not provided");
+            self.provide(bid);
+            if let Some(msg) = self.message(st, msg, cqe.res as usize) {
+                out.push(msg);
+                received += 1;
+            }
+        }
+        self.bufs.publish();
+        (received, err)
+    }
+
+    /// Turn a message whose buffer the kernel filled with len bytes into a received message.
+    fn message(&self, st: SocketType, mut msg: Message, len: usize) -> Option<Message> {
+        let (payload_len, sa, fd) = if st == SocketType::ReadFrames {
+            (len, None, None)
+        } else {
+            let buf = &msg.bytes()[..len];
+            let out = RecvmsgOut::parse(buf, self.hdr.msg_namelen as _, self.hdr.msg_controllen as _)?;
+            if out.flags & libc::MSG_TRUNC as u32 != 0 {
+                log::debug!("DROP: Socket message truncated");
+                return None;
+            }
+            let sa = if st == SocketType::SendToFrames {
+                if out.name.is_empty() {
+                    log::info!("DROP: Socket message with 0 name length and push_from_addr");
+                    return None;
+                }
+                match Sockaddr::try_from(out.name) {
+                    Ok(sa) => Some(sa),
+                    Err(e) => {
+                        log::info!("DROP: Socket message unparsable sockaddr: {e}");
+                        return None;
+                    }
+                }
+            } else {
+                None
+            };
+            let mut hdr: libc::msghdr = unsafe { std::mem::zeroed() };
+            hdr.msg_control = out.control.as_ptr() as *mut _;
+            hdr.msg_controllen = out.control.len() as _;
+            (out.payload.len(), sa, cmsg_fd(&hdr))
+        };
+        msg.discard_bytes(self.prefix).unwrap();
+        msg.set_len(payload_len).unwrap();
+        if let Some(sa) = sa {
+            msg.push_bytes(sa.bytes()).unwrap();
+        }
+        if let Some(fd) = fd {
+            msg.set_fd(fd);
+        }
+        Some(msg)
+    }
+}
+
 #[derive(Debug,IntoPrimitive,TryFromPrimitive)]
 #[repr(i32)]
 pub enum SendWorkerState {
@@ -419,19 +958,62 @@ pub enum RecvWorkerState {
 }
 
 #[derive(Default)]
-struct WorkerState {
-    state: AtomicI32,
-    counter: AtomicU32,
+pub(crate) struct WorkerState {
+    pub(crate) state: AtomicI32,
+    pub(crate) counter: AtomicU32,
+    syscalls: AtomicU64,
+    packets: AtomicU64,
+    batch: AtomicU32,
+}
+impl WorkerState {
+    pub(crate) fn account(&self, syscalls: u64, packets: usize, batch: &BatchSize) {
+        self.syscalls.fetch_add(syscalls, Ordering::Relaxed);
+        self.packets.fetch_add(packets as u64, Ordering::Relaxed);
+        self.batch.store(batch.get() as u32, Ordering::Relaxed);
+    }
+    pub(crate) fn stats(&self) -> WorkerStats {
+        WorkerStats {
+            counter: self.counter.load(Ordering::Relaxed),
+            syscalls: self.syscalls.load(Ordering::Relaxed),
+            packets: self.packets.load(Ordering::Relaxed),
+            batch: self.batch.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// What a worker has done since it started.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct WorkerStats {
+    /// Number of state changes
+    pub counter: u32,
+    /// Send or receive syscalls
+    pub syscalls: u64,
+    /// Messages sent or received, divided by syscalls this is the average batch
+    pub packets: u64,
+    /// Current batch size
+    pub batch: u32,
+}
+
+/// Closed when the SocketIface is dropped.
+type Done = tokio::sync::broadcast::Receiver<()>;
+
+/// Wait for f, or None if the SocketIface is dropped first.
+async fn or_done<F: std::future::Future>(done: &mut Done, f: F) -> Option<F::Output> {
+    tokio::select! {
+        out = f => Some(out),
+        _ = done.recv() => None,
+    }
 }
 
 struct SocketIfaceInternal<T: AsRawFd + Sync + Send> {
     iface: IfacePvt,
     st: SocketType,
+    vnet: bool,
     afds: Vec<AsyncFd<T>>,
 
     to_go_out_recv: Mutex<Receiver<Message>>,
     to_go_out_send: Sender<Message>,
-    done_r: tokio::sync::broadcast::Receiver<()>,
+    done_r: Done,
 
     send_worker_states: Vec<WorkerState>,
     recv_worker_states: Vec<WorkerState>,
@@ -444,54 +1026,71 @@ impl<T: AsRawFd + Sync + Send> IfRecv for Arc<SocketIfaceInternal<T>> {
 }
 
 impl<T: AsRawFd + Sync + Send + 'static> SocketIfaceInternal<T> {
+    /// The workers stop only where they wait, never in the middle of a batch, so that
+    /// io_uring operations are drained before the buffers which they use are freed.
     async fn worker(self: Arc<Self>, n: usize, send: bool) {
         let mut done = self.done_r.resubscribe();
         if send {
-            tokio::select! {
-                _ = self.send_worker(n) => {},
-                _ = done.recv() => {
-                    log::info!("Send worker [{n}] received done");
-                },
-            }
+            self.send_worker(n, &mut done).await;
+            log::info!("Send worker [{n}] received done");
         } else {
-            tokio::select! {
-                _ = self.recv_worker(n) => {},
-                _ = done.recv() => {
-                    log::info!("Recv worker [{n}] received done");
-                },
-            }
+            self.recv_worker(n, &mut done).await;
+            log::info!("Recv worker [{n}] received done");
         }
     }
     fn send_worker_set_state(self: &Arc<Self>, n: usize, state: SendWorkerState) {
         self.send_worker_states[n].state.store(state as i32, std::sync::atomic::Ordering::Relaxed);
         self.send_worker_states[n].counter.fetch_add(1, std::sync::atomic::Ordering::Relaxed);
     }
-    async fn send_worker(self: Arc<Self>, n: usize) {
+    async fn send_worker(self: Arc<Self>, n: usize, done: &mut Done) {
         let fd_num = n % self.afds.len();
-        let mut ctx: IoContext<SEND_BATCH> = IoContext::new(self.afds[fd_num].as_raw_fd(), self.st);
-        let mut batch = VecDeque::with_capacity(SEND_BATCH);
-        let mut batch_vec = Vec::with_capacity(SEND_BATCH);
+        let mut ctx: IoContext<MAX_BATCH> = IoContext::new(self.afds[fd_num].as_raw_fd(), self.st, self.vnet);
+        let mut batch = VecDeque::with_capacity(MAX_BATCH);
+        let mut batch_vec = Vec::with_capacity(MAX_BATCH);
+        let mut size = BatchSize::new();
+        // Declared after ctx and batch so it is dropped, and what is in flight is
+        // drained, before the headers and messages which the sends refer to.
+        #[cfg(target_os = "linux")]
+        let mut ring = if self.use_uring() {
+            AsyncUring::new(MAX_BATCH as u32, MAX_BATCH as u32 * 2).map_err(|e| uring_failed(&e)).ok()
+        } else {
+            None
+        };
 
         loop {
             self.send_worker_set_state(n, SendWorkerState::WaitLock);
-            let mut tgo = self.to_go_out_recv.lock().await;
+            let mut tgo = match or_done(done, self.to_go_out_recv.lock()).await {
+                Some(tgo) => tgo,
+                None => return,
+            };
             self.send_worker_set_state(n, SendWorkerState::RecvBatch);
-            tgo.recv_many(&mut batch_vec, RECV_BATCH - batch.len()).await;
+            let want = size.get().saturating_sub(batch.len());
+            if or_done(done, tgo.recv_many(&mut batch_vec, want)).await.is_none() {
+                return;
+            }
             drop(tgo);
             batch.extend(batch_vec.drain(..));
+            size.update(batch.len());
 
             self.send_worker_set_state(n, SendWorkerState::WaitFdWritable);
-            let mut writable = match self.afds[fd_num].writable().await {
-                Ok(r) => r,
-                Err(e) => {
+            let mut writable = match or_done(done, self.afds[fd_num].writable()).await {
+                None => return,
+                Some(Ok(r)) => r,
+                Some(Err(e)) => {
                     self.send_worker_set_state(n, SendWorkerState::WaitFdError);
                     log::info!("Error polling fd.writable(): {e} - sleep 1 second");
-                    tokio::time::sleep(Duration::from_secs(1)).await;
+                    or_done(done, tokio::time::sleep(Duration::from_secs(1))).await;
                     continue;
                 }
             };
 
             self.send_worker_set_state(n, SendWorkerState::SendBatch);
+            #[cfg(target_os = "linux")]
+            let err = match ring.as_mut() {
+                Some(ring) => ctx.send_uring(ring, &mut batch).await,
+                None => ctx.send(&mut batch),
+            };
+            #[cfg(not(target_os = "linux"))]
             let err = ctx.send(&mut batch);
             self.send_worker_set_state(n, SendWorkerState::SentBatch);
 
@@ -519,6 +1118,7 @@ impl<T: AsRawFd + Sync + Send + 'static> SocketIfaceInternal<T> {
                 }
                 successfully_sent += 1;
             }
+            self.send_worker_states[n].account(ctx.take_syscalls(), successfully_sent, &size);
             if successfully_sent == 0 {
                 log::debug!("Worker {n} cycled with no messages sent");
             }
@@ -528,33 +1128,115 @@ impl<T: AsRawFd + Sync + Send + 'static> SocketIfaceInternal<T> {
         self.recv_worker_states[n].state.store(state as i32, std::sync::atomic::Ordering::Relaxed);
         self.recv_worker_states[n].counter.fetch_add(1, std::sync::atomic::Ordering::Relaxed);
     }
-    async fn recv_worker(self: Arc<Self>, n: usize) {
+    /// Whether workers should try io_uring, stream sockets and TUN devices with
+    /// IFF_VNET_HDR always use epoll.
+    #[cfg(target_os = "linux")]
+    fn use_uring(&self) -> bool {
+        topology::io_uring()
+            && !self.vnet
+            && self.st != SocketType::Stream
+            && !URING_FAILED.load(Ordering::Relaxed)
+    }
+
+    /// Returns the reason if io_uring can not be used, or None once done.
+    #[cfg(target_os = "linux")]
+    async fn recv_worker_uring(self: &Arc<Self>, n: usize, done: &mut Done) -> Option<std::io::Error> {
+        let fd_num = n % self.afds.len();
+        let fd = self.afds[fd_num].as_raw_fd();
+        let mut ur = match UringRecv::new(self.st) {
+            Ok(ur) => ur,
+            Err(e) => return Some(e),
+        };
+        let mut ready = Vec::with_capacity(MAX_BATCH);
+        let mut size = BatchSize::new();
+        loop {
+            ur.arm(fd, self.st);
+            self.recv_worker_set_state(n, RecvWorkerState::WaitFdReadable);
+            // Dropping ur cancels the receives which are armed
+            if let Err(e) = or_done(done, ur.ring.wait()).await? {
+                return Some(e);
+            }
+            self.recv_worker_set_state(n, RecvWorkerState::RecvBatch);
+            let (received, err) = ur.reap(self.st, &mut ready);
+            self.recv_worker_set_state(n, RecvWorkerState::RecievedBatch);
+            self.recv_worker_states[n].account(ur.ring.ring.take_syscalls(), received, &size);
+            size.update(received);
+            match err {
+                // Multishot recvmsg needs Linux 6.0
+                Some(err) if !ur.working && err.raw_os_error() == Some(libc::EINVAL) => return Some(err),
+                Some(err) => {
+                    if !is_transient(&err) {
+                        log::info!("Error reading from socket: {err}");
+                    }
+                    // Older kernels give EAGAIN rather than wait if the fd is O_NONBLOCK,
+                    // either way re-arming right away could spin.
+                    self.recv_worker_set_state(n, RecvWorkerState::WaitFdReadable);
+                    match or_done(done, self.afds[fd_num].readable()).await? {
+                        Ok(mut readable) => readable.clear_ready(),
+                        Err(e) => return Some(e),
+                    }
+                }
+                None => {}
+            }
+            if !ready.is_empty() {
+                let count = ready.len();
+                self.recv_worker_set_state(n, RecvWorkerState::IfaceSend);
+                match self.iface.send_batch(&mut ready) {
+                    Ok(()) => {
+                        log::trace!("Socket receiver thread sent {count} packets");
+                    },
+                    Err(e) => {
+                        log::debug!("Error processing packets: {e}");
+                    }
+                }
+            }
+        }
+    }
+
+    async fn recv_worker(self: Arc<Self>, n: usize, done: &mut Done) {
+        #[cfg(target_os = "linux")]
+        if self.use_uring() {
+            match self.recv_worker_uring(n, done).await {
+                Some(err) => uring_failed(&err),
+                None => return,
+            }
+        }
         let fd_num = n % self.afds.len();
-        let mut ctx: IoContext<RECV_BATCH> = IoContext::new(self.afds[fd_num].as_raw_fd(), self.st);
-        let mut batch = VecDeque::with_capacity(RECV_BATCH);
+        let mut ctx: IoContext<MAX_BATCH> = IoContext::new(self.afds[fd_num].as_raw_fd(), self.st, self.vnet);
+        let mut batch = VecDeque::with_capacity(MAX_BATCH);
+        let mut ready = Vec::with_capacity(MAX_BATCH);
+        let mut size = BatchSize::new();
+        // Frames are read here and split into messages, rather than read into the batch
+        let mut vnet_buf = if self.vnet { vec![0_u8; VNET_BUFFER_CAP] } else { Vec::new() };
         loop {
-            while batch.len() < RECV_BATCH {
-                let mut msg = Message::new(PADDING_AMOUNT + BUFFER_CAP);
+            // Shrinking returns the spare buffers to the pool
+            batch.truncate(size.get());
+            while !self.vnet && batch.len() < size.get() {
+                let mut msg = Message::new_pooled(PADDING_AMOUNT + BUFFER_CAP);
                 msg.allocate_uninitialized(BUFFER_CAP).unwrap();
                 batch.push_back(msg);
             }
             self.recv_worker_set_state(n, RecvWorkerState::WaitFdReadable);
-            let mut readable = match self.afds[fd_num].readable().await {
-                Ok(r) => r,
-                Err(e) => {
+            let mut readable = match or_done(done, self.afds[fd_num].readable()).await {
+                None => return,
+                Some(Ok(r)) => r,
+                Some(Err(e)) => {
                     self.recv_worker_set_state(n, RecvWorkerState::WaitFdError);
                     log::info!("Error polling fd.readable(): {e} - sleep 1 second");
-                    tokio::time::sleep(Duration::from_secs(1)).await;
+                    or_done(done, tokio::time::sleep(Duration::from_secs(1))).await;
                     continue;
                 }
             };
             self.recv_worker_set_state(n, RecvWorkerState::RecvBatch);
-            let (received, err) = if self.st == SocketType::ReadFrames {
+            let (received, err) = if self.vnet {
+                ctx.read_vnet(&mut vnet_buf, size.get(), &mut ready)
+            } else if self.st == SocketType::ReadFrames {
                 ctx.read(&mut batch)
             } else {
                 ctx.recv(&mut batch)
             };
             self.recv_worker_set_state(n, RecvWorkerState::RecievedBatch);
+            self.recv_worker_states[n].account(ctx.take_syscalls(), received, &size);
             // If err is EAGAIN / EWOULDBLOCK then we clear the readable state
             // If received is more than zero, we pop and forward those messages
             // If err is EINTER then we ignore and repeat
@@ -568,9 +1250,15 @@ impl<T: AsRawFd + Sync + Send + 'static> SocketIfaceInternal<T> {
                         readable.clear_ready();
                     }
                 }
+            } else if received < size.get() {
+                // recvmmsg() stopped early so the socket is drained, there is no need
+                // for another syscall just to get EAGAIN.
+                readable.clear_ready();
             }
+            size.update(received);
 
-            for _ in 0..received {
+            let mut closed = false;
+            for _ in 0..(if self.vnet { 0 } else { received }) {
                 if let Some(mut msg) = batch.pop_front() {
                     if msg.cap() == 0 {
                         // Ignore failed receive and return the message to the queue
@@ -582,59 +1270,68 @@ impl<T: AsRawFd + Sync + Send + 'static> SocketIfaceInternal<T> {
                         batch.push_back(msg);
                         continue;
                     }
-                    let mlen = msg.len();
-                    self.recv_worker_set_state(n, RecvWorkerState::IfaceSend);
-                    match self.iface.send(msg) {
-                        Ok(()) => {
-                            log::trace!("Socket receiver thread sent packet of len {mlen}");
-                        },
-                        Err(e) => {
-                            log::debug!("Error processing packet: {e}");
-                        }
-                    }
-                    if mlen == 0 {
-                        // In the event that the socket was disconnected, we receive a 0 length
-                        // message every time we poll. This is handled upstream by dropping the
-                        // iface, but that only causes the drop of a broadcast which needs to be
-                        // polled in the worker thread.
-                        //
-                        // Without yielding here, this can go into a busyloop because none of the
-                        // awaits here are actually waiting at all.
-                        self.recv_worker_set_state(n, RecvWorkerState::Yield);
-                        tokio::task::yield_now().await;
-                    }
+                    closed |= msg.len() == 0;
+                    ready.push(msg);
                 } else {
                     log::error!("Number of messages received does not match - should not happen");
                 }
             }
+            if !ready.is_empty() {
+                let count = ready.len();
+                self.recv_worker_set_state(n, RecvWorkerState::IfaceSend);
+                // One handoff for the whole batch, so C is entered once per batch
+                match self.iface.send_batch(&mut ready) {
+                    Ok(()) => {
+                        log::trace!("Socket receiver thread sent {count} packets");
+                    },
+                    Err(e) => {
+                        log::debug!("Error processing packets: {e}");
+                    }
+                }
+            }
+            if closed {
+                // In the event that the socket was disconnected, we receive a 0 length
+                // message every time we poll. This is handled upstream by dropping the
+                // iface, but that only causes the drop of a broadcast which needs to be
+                // polled in the worker thread.
+                //
+                // Without yielding here, this can go into a busyloop because none of the
+                // awaits here are actually waiting at all.
+                self.recv_worker_set_state(n, RecvWorkerState::Yield);
+                if or_done(done, tokio::task::yield_now()).await.is_none() {
+                    return;
+                }
+            }
         }
     }
 }
 
 trait SocketIfaceInternalT: Send + Sync {
-    fn worker_states(&self) -> (Vec<(SendWorkerState, u32)>,Vec<(RecvWorkerState, u32)>);
+    fn worker_states(&self) -> (Vec<(SendWorkerState, WorkerStats)>,Vec<(RecvWorkerState, WorkerStats)>);
+    fn fd_count(&self) -> usize;
 }
 impl<T: AsRawFd + Sync + Send> SocketIfaceInternalT for SocketIfaceInternal<T> {
-    fn worker_states(&self) -> (Vec<(SendWorkerState, u32)>,Vec<(RecvWorkerState, u32)>) {
+    fn fd_count(&self) -> usize {
+        self.afds.len()
+    }
+    fn worker_states(&self) -> (Vec<(SendWorkerState, WorkerStats)>,Vec<(RecvWorkerState, WorkerStats)>) {
         let mut rout = Vec::with_capacity(self.recv_worker_states.len());
         let mut sout = Vec::with_capacity(self.send_worker_states.len());
         for r in &self.recv_worker_states {
-            let n = r.state.load(std::sync::atomic::Ordering::Relaxed);
+            let n = r.state.load(Ordering::Relaxed);
             let x = match RecvWorkerState::try_from(n) {
                 Ok(x) => x,
                 Err(_) => RecvWorkerState::Invalid,
             };
-            let c = r.counter.load(std::sync::atomic::Ordering::Relaxed);
-            rout.push((x, c));
+            rout.push((x, r.stats()));
         }
         for s in &self.send_worker_states {
-            let n = s.state.load(std::sync::atomic::Ordering::Relaxed);
+            let n = s.state.load(Ordering::Relaxed);
             let x = match SendWorkerState::try_from(n) {
                 Ok(x) => x,
                 Err(_) => SendWorkerState::Invalid,
             };
-            let c = s.counter.load(std::sync::atomic::Ordering::Relaxed);
-            sout.push((x, c));
+            sout.push((x, s.stats()));
         }
         (sout, rout)
     }
@@ -652,7 +1349,22 @@ impl Drop for SocketIface {
     }
 }
 impl SocketIface {
-    pub fn new<T: AsRawFd + Sync + Send + 'static>(mut fds: Vec<T>, st: SocketType) -> Result<Self> {
+    pub fn new<T: AsRawFd + Sync + Send + 'static>(fds: Vec<T>, st: SocketType) -> Result<Self> {
+        Self::new_inner(fds, st, false)
+    }
+
+    /// For TUN devices opened with IFF_VNET_HDR, each frame which is read is split into
+    /// ordinary frames and frames which are sent are coalesced where possible,
+    /// see interface::tuntap::vnet.
+    pub fn new_vnet_hdr<T: AsRawFd + Sync + Send + 'static>(fds: Vec<T>) -> Result<Self> {
+        Self::new_inner(fds, SocketType::ReadFrames, true)
+    }
+
+    fn new_inner<T: AsRawFd + Sync + Send + 'static>(
+        mut fds: Vec<T>,
+        st: SocketType,
+        vnet: bool,
+    ) -> Result<Self> {
         if fds.is_empty() {
             eyre::bail!("Cannot create a SocketIface with no file descriptors");
         }
@@ -668,9 +1380,9 @@ impl SocketIface {
 
         // Lets assume that in general, we're going to have 2 interfaces with one receiving
         // and the other one sending, both as fast as they can... e.g. TUN / UDP
-        // In this scenario, half the core count will be receiving and the other half will be
-        // sending.
-        let workers = match num_cpus::get() / 2 {
+        // In this scenario, half the runtime threads will be receiving and the other half
+        // will be sending, unless configured otherwise.
+        let workers = match topology::socket_workers() {
             n if n < afds.len() => afds.len(),
             n => n,
         };
@@ -679,6 +1391,7 @@ impl SocketIface {
             iface: iface_pvt,
             afds,
             st,
+            vnet,
             to_go_out_recv: Mutex::new(tgo_r),
             to_go_out_send: tgo,
             done_r,
@@ -695,7 +1408,142 @@ impl SocketIface {
         Ok(Self{ iface, _done, inner: out, })
     }
 
-    pub fn worker_states(&self) -> (Vec<(SendWorkerState, u32)>,Vec<(RecvWorkerState, u32)>) {
+    pub fn worker_states(&self) -> (Vec<(SendWorkerState, WorkerStats)>,Vec<(RecvWorkerState, WorkerStats)>) {
         self.inner.worker_states()
     }
-}
\ No newline at end of file
+
+    /// Number of file descriptors (e.g. TUN queues) which the workers are spread over.
+    pub fn fd_count(&self) -> usize {
+        self.inner.fd_count()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn dgram_pair() -> (libc::c_int, libc::c_int) {
+        let mut fds = [0; 2];
+        let ret = unsafe { libc::socketpair(libc::AF_UNIX, libc::SOCK_DGRAM, 0, fds.as_mut_ptr()) };
+        assert_eq!(ret, 0);
+        (fds[0], fds[1])
+    }
+
+    fn hdrs(bufs: &mut [Vec<u8>], iovecs: &mut [libc::iovec]) -> Vec<Mmsghdr> {
+        bufs.iter_mut().zip(iovecs.iter_mut()).map(|(b, iov)| {
+            iov.iov_base = b.as_mut_ptr() as _;
+            iov.iov_len = b.len();
+            let mut h: Mmsghdr = unsafe { std::mem::zeroed() };
+            h.msg_hdr.msg_iov = iov as *mut _;
+            h.msg_hdr.msg_iovlen = 1;
+            h.msg_len = !0;
+            h
+        }).collect()
+    }
+
+    #[test]
+    fn test_mmsg() {
+        let (a, b) = dgram_pair();
+        let mut out = (0..3_u8).map(|i| vec![i; 10 + i as usize]).collect::<Vec<_>>();
+        let mut out_iov: [libc::iovec; 3] = unsafe { std::mem::zeroed() };
+        let mut out_hdrs = hdrs(&mut out, &mut out_iov);
+        let mut syscalls = 0;
+        sendmmsg(a, &mut out_hdrs, 0, &mut syscalls).unwrap();
+        assert_eq!(out_hdrs.iter().map(|h| h.msg_len).collect::<Vec<_>>(), vec![10, 11, 12]);
+
+        let mut inb = vec![vec![0_u8; 64]; 8];
+        let mut in_iov: [libc::iovec; 8] = unsafe { std::mem::zeroed() };
+        let mut in_hdrs = hdrs(&mut inb, &mut in_iov);
+        let res = recvmmsg(b, &mut in_hdrs, libc::MSG_DONTWAIT, &mut syscalls);
+        let lens = in_hdrs.iter().map(|h| h.msg_len).take_while(|l| *l != !0).collect::<Vec<_>>();
+        assert_eq!(lens, vec![10, 11, 12]);
+        assert_eq!(inb[2][..12], [2_u8; 12]);
+        if cfg!(target_os = "linux") {
+            // One syscall each way and the short batch is not an error
+            assert!(res.is_ok());
+            assert_eq!(syscalls, 2);
+        } else {
+            assert_eq!(res.unwrap_err().kind(), std::io::ErrorKind::WouldBlock);
+        }
+
+        // The emulation behaves the same
+        let mut out_hdrs = hdrs(&mut out, &mut out_iov);
+        sendmmsg_emulated(a, &mut out_hdrs, 0, &mut syscalls).unwrap();
+        let mut in_hdrs = hdrs(&mut inb, &mut in_iov);
+        let res = recvmmsg_emulated(b, &mut in_hdrs, libc::MSG_DONTWAIT, &mut syscalls);
+        assert_eq!(res.unwrap_err().kind(), std::io::ErrorKind::WouldBlock);
+        assert_eq!(in_hdrs.iter().filter(|h| h.msg_len != !0).count(), 3);
+
+        // Messages which are not sent get msg_len 0
+        unsafe { libc::close(b) };
+        let mut out_hdrs = hdrs(&mut out, &mut out_iov);
+        assert!(sendmmsg(a, &mut out_hdrs, 0, &mut syscalls).is_err());
+        assert!(out_hdrs.iter().all(|h| h.msg_len == 0));
+        unsafe { libc::close(a) };
+    }
+
+    #[test]
+    fn test_batch_size() {
+        let mut bs = BatchSize::new();
+        assert_eq!(bs.get(), MIN_BATCH);
+        // Full batches grow it up to the max
+        for _ in 0..10 {
+            let full = bs.get();
+            bs.update(full);
+        }
+        assert_eq!(bs.get(), MAX_BATCH);
+        // A single small batch does not shrink it, a run of them does
+        bs.update(1);
+        assert_eq!(bs.get(), MAX_BATCH);
+        for _ in 1..SHRINK_AFTER {
+            bs.update(1);
+        }
+        assert_eq!(bs.get(), MAX_BATCH / 2);
+        // Half full batches neither grow nor shrink it, and break a run of small ones
+        for _ in 0..SHRINK_AFTER - 1 {
+            bs.update(1);
+        }
+        bs.update(MAX_BATCH / 4);
+        for _ in 0..SHRINK_AFTER - 1 {
+            bs.update(1);
+        }
+        assert_eq!(bs.get(), MAX_BATCH / 2);
+        for _ in 0..1000 {
+            bs.update(0);
+        }
+        assert_eq!(bs.get(), MIN_BATCH);
+        // A lower max stops the growth there
+        let mut bs = BatchSize::with_max(MAX_BATCH / 2);
+        for _ in 0..10 {
+            let full = bs.get();
+            bs.update(full);
+        }
+        assert_eq!(bs.get(), MAX_BATCH / 2);
+    }
+
+    #[test]
+    #[ignore]
+    fn bench_syscalls_per_packet() {
+        // cargo test --release -- --ignored --nocapture bench_syscalls_per_packet
+        let (a, b) = dgram_pair();
+        let n = 64;
+        let mut out = vec![vec![0_u8; 1400]; n];
+        let mut out_iov = vec![unsafe { std::mem::zeroed::<libc::iovec>() }; n];
+        let mut inb = vec![vec![0_u8; 1500]; n];
+        let mut in_iov = vec![unsafe { std::mem::zeroed::<libc::iovec>() }; n];
+        for batch in [1, 8, 64] {
+            let rounds = 20_000 / batch;
+            let (mut calls, start) = (0, std::time::Instant::now());
+            for _ in 0..rounds {
+                let mut oh = hdrs(&mut out[..batch], &mut out_iov[..batch]);
+                sendmmsg(a, &mut oh, 0, &mut calls).unwrap();
+                let mut ih = hdrs(&mut inb[..batch], &mut in_iov[..batch]);
+                recvmmsg(b, &mut ih, libc::MSG_DONTWAIT, &mut calls).unwrap();
+            }
+            let pkts = (rounds * batch) as u64;
+            println!("batch {batch}: {:?}/packet, {:.3} syscalls/packet",
+                start.elapsed() / pkts as u32, calls as f64 / pkts as f64);
+        }
+        unsafe { libc::close(a); libc::close(b) };
+    }
+}
@@ -0,0 +1,625 @@
+//! Transit switching without the global C lock.
+//!
+//! Normally every packet from the wire crosses into C, where InterfaceController
+//! decrypts it, SwitchCore rewrites the label and InterfaceController encrypts it
+//! again for the next hop, all while holding the GCL. When InterfaceController
+//! registers its established peers here, the socket worker which received the packet
+//! does that work itself, so transit traffic is switched on as many threads as there
+//! are workers.
+//!
+//! Only plain transit data is handled. Handshakes, control frames, traffic addressed
+//! to this node and anything which SwitchCore would answer with an error are given
+//! to C exactly as before.
+
+use std::collections::HashMap;
+use std::convert::TryFrom;
+use std::convert::TryInto;
+use std::net::SocketAddr;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, Weak};
+
+use eyre::{bail, Result};
+use parking_lot::RwLock;
+
+use crate::crypto::session::SessionTrait;
+use crate::external::interface::iface::{self, IfRecv, Iface, IfacePvt};
+use crate::interface::wire::message::Message;
+use crate::rtypes::RTypes_SwitchFastPath_PeerStats_t as PeerStats;
+use crate::rtypes::RTypes_SwitchFastPath_Stats_t as FastPathStats;
+use crate::util::now_ms;
+use crate::util::sockaddr::Sockaddr;
+
+const SWITCH_HEADER_SIZE: usize = 12;
+
+/// Handle which follows the switch header of a control frame.
+const CONTROL_HANDLE: [u8; 4] = [0xff; 4];
+
+/// Port of switch/NumberCompress.h, SwitchCore is built with the v3x5x8 scheme.
+mod number_compress {
+    pub fn bits_used_for_label(label: u64) -> u32 {
+        if 0 != (label & 0x1) {
+            4
+        } else if 0 != (label & 0x2) {
+            7
+        } else {
+            10
+        }
+    }
+
+    pub fn bits_used_for_number(number: u32) -> u32 {
+        if number < 8 {
+            4
+        } else if number < 33 {
+            7
+        } else {
+            10
+        }
+    }
+
+    pub fn get_compressed(number: u32, bits_used: u32) -> u64 {
+        if 1 == number {
+            return 1;
+        }
+        let number = number as u64;
+        match bits_used {
+            4 => if 0 == number { 3 } else { (number << 1) | 1 },
+            // skip the number 1
+            7 => if 0 == number { 2 } else { ((number - 1) << 2) | 2 },
+            10 => if 0 == number { 0 } else { (number - 1) << 2 },
+            _ => 0,
+        }
+    }
+
+    pub fn get_decompressed(label: u64, bits_used: u32) -> u32 {
+        match bits_used {
+            4 => match ((label >> 1) & 0x7) as u32 {
+                0 => 1,
+                1 => 0,
+                n => n,
+            },
+            // skip the number 1
+            7 => match ((label >> 2) & 0x1f) as u32 {
+                0 => 0,
+                n => n + 1,
+            },
+            10 => match ((label >> 2) & 0xff) as u32 {
+                0 => 0,
+                n => n + 1,
+            },
+            _ => 0,
+        }
+    }
+}
+use number_compress as nc;
+
+/// Result of switching a packet, see SwitchCore.c receiveMessage()
+#[derive(Debug, PartialEq, Eq)]
+struct Route {
+    dest: u32,
+    label: u64,
+    label_shift: u8,
+}
+
+/// Compute what SwitchCore would do with a packet which came in on interface
+/// number `src_index`. None means anything other than a plain forward to another
+/// interface, these are left to SwitchCore.
+fn route(msg: &[u8], src_index: u32) -> Option<Route> {
+    if msg.len() < SWITCH_HEADER_SIZE {
+        return None;
+    }
+    if msg.len() >= SWITCH_HEADER_SIZE + 4 && msg[SWITCH_HEADER_SIZE..][..4] == CONTROL_HANDLE {
+        return None;
+    }
+    let label = u64::from_be_bytes(msg[0..8].try_into().unwrap());
+    let bits = nc::bits_used_for_label(label);
+    let dest = nc::get_decompressed(label, bits);
+    if dest == 1 {
+        // For us
+        return None;
+    }
+    if nc::bits_used_for_number(src_index) > bits {
+        // SwitchCore sends back an error
+        return None;
+    }
+    let label_shift = (msg[9] & 0x3f) as u32 + bits;
+    if label_shift > 63 {
+        return None;
+    }
+    let source_label = nc::get_compressed(src_index, bits).reverse_bits();
+    Some(Route {
+        dest,
+        label: (label >> bits) | source_label,
+        label_shift: label_shift as u8,
+    })
+}
+
+fn apply_route(msg: &mut [u8], r: &Route) {
+    msg[0..8].copy_from_slice(&r.label.to_be_bytes());
+    msg[9] = (msg[9] & 0xc0) | r.label_shift;
+    // Traffic class 0xffff
+    msg[10] = 0xff;
+    msg[11] = 0xff;
+}
+
+/// Switch interface number of a peer, from the label which SwitchCore gave it.
+fn index_for_label(label: u64) -> u32 {
+    nc::get_decompressed(label, nc::bits_used_for_label(label))
+}
+
+/// Sessions are also used by C from whichever thread holds the GCL, so they
+/// already need to be safe to use from any thread.
+struct SessionRef(Arc<dyn SessionTrait>);
+unsafe impl Send for SessionRef {}
+unsafe impl Sync for SessionRef {}
+impl SessionRef {
+    fn is(&self, other: &Arc<dyn SessionTrait>) -> bool {
+        Arc::as_ptr(&self.0) as *const () == Arc::as_ptr(other) as *const ()
+    }
+}
+
+struct FastPeer {
+    /// Interface number in the switch
+    index: u32,
+    port: Weak<Port>,
+    /// Sockaddr to push in front of packets for this peer
+    lladdr: Vec<u8>,
+    session: SessionRef,
+
+    // Traffic which was never seen by C, taken by take_peer_stats()
+    bytes_in: AtomicU64,
+    bytes_out: AtomicU64,
+    last_recv_ms: AtomicU64,
+}
+
+#[derive(Default)]
+struct Peers {
+    by_index: HashMap<u32, Arc<FastPeer>>,
+    by_addr: HashMap<(u32, SocketAddr), Arc<FastPeer>>,
+}
+
+#[derive(Default)]
+struct FastPathInner {
+    enabled: AtomicBool,
+    ports: RwLock<HashMap<u32, Weak<Port>>>,
+    peers: RwLock<Peers>,
+
+    forwarded: AtomicU64,
+    to_core: AtomicU64,
+    dropped: AtomicU64,
+}
+
+impl FastPathInner {
+    fn to_core_plaintext(&self, src: &FastPeer, msg: Message) -> Result<()> {
+        self.to_core.fetch_add(1, Ordering::Relaxed);
+        src.session.0.deliver_plaintext(msg)
+    }
+
+    /// Messages which must go to C untouched are added to `to_core`.
+    fn incoming(&self, port_num: u32, mut msg: Message, to_core: &mut Vec<Message>) -> Result<()> {
+        let sa = match Sockaddr::try_from(msg.bytes()) {
+            Ok(sa) => sa,
+            Err(_) => {
+                to_core.push(msg);
+                return Ok(());
+            }
+        };
+        let src = match sa.rs() {
+            Ok(addr) => self.peers.read().by_addr.get(&(port_num, addr)).cloned(),
+            Err(_) => None,
+        };
+        let src = match src {
+            Some(src) => src,
+            None => {
+                to_core.push(msg);
+                return Ok(());
+            }
+        };
+
+        msg.discard_bytes(sa.byte_len())?;
+        match src.session.0.decrypt_run(&mut msg) {
+            Ok(true) => (),
+            Ok(false) => {
+                msg.push_bytes(sa.bytes())?;
+                self.to_core.fetch_add(1, Ordering::Relaxed);
+                to_core.push(msg);
+                return Ok(());
+            }
+            Err(e) => {
+                log::debug!("Fast path DROP from [{}]: {}", src.index, e);
+                self.dropped.fetch_add(1, Ordering::Relaxed);
+                return Ok(());
+            }
+        }
+
+        let r = match route(msg.bytes(), src.index) {
+            Some(r) => r,
+            None => return self.to_core_plaintext(&src, msg),
+        };
+        let dst = match self.peers.read().by_index.get(&r.dest) {
+            Some(dst) => Arc::clone(dst),
+            None => return self.to_core_plaintext(&src, msg),
+        };
+        let dst_port = match dst.port.upgrade() {
+            Some(p) => p,
+            None => return self.to_core_plaintext(&src, msg),
+        };
+
+        let len = msg.len() as u64;
+        let mut orig_header = [0_u8; SWITCH_HEADER_SIZE];
+        orig_header.copy_from_slice(&msg.bytes()[..SWITCH_HEADER_SIZE]);
+        apply_route(msg.bytes_mut(), &r);
+        match dst.session.0.encrypt_run(&mut msg) {
+            Ok(true) => (),
+            Ok(false) => {
+                msg.bytes_mut()[..SWITCH_HEADER_SIZE].copy_from_slice(&orig_header);
+                return self.to_core_plaintext(&src, msg);
+            }
+            Err(e) => {
+                log::debug!("Fast path DROP to [{}]: {}", dst.index, e);
+                self.dropped.fetch_add(1, Ordering::Relaxed);
+                return Ok(());
+            }
+        }
+        src.bytes_in.fetch_add(len, Ordering::Relaxed);
+        src.last_recv_ms.store(now_ms(), Ordering::Relaxed);
+        dst.bytes_out.fetch_add(len, Ordering::Relaxed);
+        self.forwarded.fetch_add(1, Ordering::Relaxed);
+
+        msg.push_bytes(&dst.lladdr)?;
+        dst_port.wire.send(msg)
+    }
+}
+
+/// Per-InterfaceController switch fast path, shared by all of the ports which
+/// are attached to it.
+#[derive(Clone, Default)]
+pub struct SwitchFastPath {
+    inner: Arc<FastPathInner>,
+}
+
+impl SwitchFastPath {
+    pub fn new() -> Self {
+        Self::default()
+    }
+
+    pub fn set_enabled(&self, enabled: bool) {
+        self.inner.enabled.store(enabled, Ordering::Relaxed);
+    }
+
+    /// Make `port` the wire for interface number `port_num` of the InterfaceController.
+    pub fn attach(&self, port_num: u32, port: &Arc<Port>) {
+        self.inner.ports.write().insert(port_num, Arc::downgrade(port));
+        *port.fast_path.write() = Some((port_num, Arc::clone(&self.inner)));
+    }
+
+    /// Register an established peer, replacing whatever was in its switch slot.
+    pub fn add_peer(
+        &self,
+        port_num: u32,
+        lladdr: &Sockaddr,
+        label: u64,
+        session: Arc<dyn SessionTrait>,
+    ) -> Result<()> {
+        let port = match self.inner.ports.read().get(&port_num) {
+            Some(p) => Weak::clone(p),
+            None => bail!("Interface [{}] has no fast path port", port_num),
+        };
+        let addr = lladdr.rs()?;
+        let index = index_for_label(label);
+        let peer = Arc::new(FastPeer {
+            index,
+            port,
+            lladdr: lladdr.bytes().to_vec(),
+            session: SessionRef(session),
+            bytes_in: AtomicU64::new(0),
+            bytes_out: AtomicU64::new(0),
+            last_recv_ms: AtomicU64::new(0),
+        });
+        let mut peers = self.inner.peers.write();
+        if let Some(old) = peers.by_index.insert(index, Arc::clone(&peer)) {
+            peers.by_addr.retain(|_, p| !Arc::ptr_eq(p, &old));
+        }
+        peers.by_addr.insert((port_num, addr), peer);
+        Ok(())
+    }
+
+    /// Unregister a peer, if the slot for `label` still belongs to `session`.
+    pub fn remove_peer(&self, label: u64, session: &Arc<dyn SessionTrait>) {
+        let index = index_for_label(label);
+        let mut peers = self.inner.peers.write();
+        match peers.by_index.get(&index) {
+            Some(p) if p.session.is(session) => (),
+            _ => return,
+        }
+        if let Some(old) = peers.by_index.remove(&index) {
+            peers.by_addr.retain(|_, p| !Arc::ptr_eq(p, &old));
+        }
+    }
+
+    /// Traffic counters for a peer since the last call, so that C can fold them
+    /// into its own peer stats. None if the peer is not registered.
+    pub fn take_peer_stats(&self, label: u64, session: &Arc<dyn SessionTrait>) -> Option<PeerStats> {
+        let peers = self.inner.peers.read();
+        let p = peers.by_index.get(&index_for_label(label))?;
+        if !p.session.is(session) {
+            return None;
+        }
+        Some(PeerStats {
+            bytes_in: p.bytes_in.swap(0, Ordering::Relaxed),
+            bytes_out: p.bytes_out.swap(0, Ordering::Relaxed),
+            last_recv_ms: p.last_recv_ms.load(Ordering::Relaxed),
+        })
+    }
+
+    pub fn stats(&self) -> FastPathStats {
+        FastPathStats {
+            enabled: self.inner.enabled.load(Ordering::Relaxed),
+            peers: self.inner.peers.read().by_index.len() as u32,
+            forwarded: self.inner.forwarded.load(Ordering::Relaxed),
+            to_core: self.inner.to_core.load(Ordering::Relaxed),
+            dropped: self.inner.dropped.load(Ordering::Relaxed),
+        }
+    }
+}
+
+/// Sits between a wire iface (UDPAddrIface) and the C code which it would
+/// otherwise be plumbed to. Everything passes straight through until the port
+/// is attached to an enabled SwitchFastPath.
+pub struct Port {
+    wire: IfacePvt,
+    core: IfacePvt,
+    fast_path: RwLock<Option<(u32, Arc<FastPathInner>)>>,
+}
+
+struct WireRecv(Arc<Port>);
+impl WireRecv {
+    fn fast_path(&self) -> Option<(u32, Arc<FastPathInner>)> {
+        match &*self.0.fast_path.read() {
+            Some((port_num, fp)) if fp.enabled.load(Ordering::Relaxed) => {
+                Some((*port_num, Arc::clone(fp)))
+            }
+            _ => None,
+        }
+    }
+}
+impl IfRecv for WireRecv {
+    fn recv(&self, m: Message) -> Result<()> {
+        match self.fast_path() {
+            Some((port_num, fp)) => {
+                let mut to_core = Vec::new();
+                fp.incoming(port_num, m, &mut to_core)?;
+                self.0.core.send_batch(&mut to_core)
+            }
+            None => self.0.core.send(m),
+        }
+    }
+
+    fn recv_batch(&self, msgs: &mut Vec<Message>) -> Result<()> {
+        let (port_num, fp) = match self.fast_path() {
+            Some(x) => x,
+            None => return self.0.core.send_batch(msgs),
+        };
+        let mut to_core = Vec::with_capacity(msgs.len());
+        for m in msgs.drain(..) {
+            if let Err(e) = fp.incoming(port_num, m, &mut to_core) {
+                log::debug!("Error processing packet: {e}");
+            }
+        }
+        self.0.core.send_batch(&mut to_core)
+    }
+}
+
+struct CoreRecv(Arc<Port>);
+impl IfRecv for CoreRecv {
+    fn recv(&self, m: Message) -> Result<()> {
+        self.0.wire.send(m)
+    }
+
+    fn recv_batch(&self, msgs: &mut Vec<Message>) -> Result<()> {
+        self.0.wire.send_batch(msgs)
+    }
+}
+
+impl Port {
+    /// Returns the port, the iface to plumb to the wire and the iface to give to C.
+    pub fn new(name: &str) -> (Arc<Port>, Iface, Iface) {
+        let (mut wire_if, wire) = iface::new(format!("{}::FastPath(wire)", name));
+        let (mut core_if, core) = iface::new(format!("{}::FastPath(core)", name));
+        let port = Arc::new(Port { wire, core, fast_path: RwLock::new(None) });
+        wire_if.set_receiver(WireRecv(Arc::clone(&port)));
+        core_if.set_receiver(CoreRecv(Arc::clone(&port)));
+        (port, wire_if, core_if)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::bytestring::ByteString;
+    use crate::rffi::allocator::Allocator;
+    use crate::rtypes::RTypes_CryptoAuth_State_t as State;
+    use crate::rtypes::RTypes_CryptoStats_t as CryptoStats;
+
+    #[test]
+    fn test_number_compress_roundtrip() {
+        for n in 0..257 {
+            let bits = nc::bits_used_for_number(n);
+            let label = nc::get_compressed(n, bits) | (1 << bits);
+            assert_eq!(nc::bits_used_for_label(label), bits, "number {}", n);
+            assert_eq!(index_for_label(label), n, "number {}", n);
+        }
+    }
+
+    fn header(label: u64, label_shift: u8) -> Vec<u8> {
+        let mut h = label.to_be_bytes().to_vec();
+        h.extend_from_slice(&[0, (1 << 6) | label_shift, 0, 0]);
+        // session handle
+        h.extend_from_slice(&[0, 0, 0, 4]);
+        h
+    }
+
+    #[test]
+    fn test_route() {
+        // 0x13 is interface 0, the source is interface 5 which is 0xb
+        let mut msg = header(0x13 | (0x15 << 4), 0);
+        let r = route(&msg, 5).unwrap();
+        assert_eq!(r.dest, 0);
+        assert_eq!(r.label, 0x15 | (0xb_u64.reverse_bits()));
+        assert_eq!(r.label_shift, 4);
+        apply_route(&mut msg, &r);
+        assert_eq!(&msg[0..8], &r.label.to_be_bytes());
+        assert_eq!(msg[9], (1 << 6) | 4);
+        assert_eq!(&msg[10..12], &[0xff, 0xff]);
+    }
+
+    #[test]
+    fn test_route_leaves_to_core() {
+        // addressed to this node
+        assert_eq!(route(&header(0x1, 0), 5), None);
+        // runt
+        assert_eq!(route(&header(0x13, 0)[..8], 5), None);
+        // label shift rolls over
+        assert_eq!(route(&header(0x13, 62), 5), None);
+        // source interface 100 (10 bits) does not fit in a 4 bit destination
+        assert_eq!(route(&header(0x13, 0), 100), None);
+        // control frame
+        let mut ctrl = header(0x13, 0);
+        ctrl[12..16].copy_from_slice(&CONTROL_HANDLE);
+        assert_eq!(route(&ctrl, 5), None);
+    }
+
+    /// Session which is always established and does no crypto, counting the packets
+    /// which the fast path hands back to C after decrypting them.
+    #[derive(Default)]
+    struct NullSession {
+        delivered: AtomicU64,
+    }
+    impl SessionTrait for NullSession {
+        fn set_auth(&self, _: Option<ByteString>, _: Option<ByteString>) {}
+        fn get_state(&self) -> State {
+            State::Established
+        }
+        fn get_her_pubkey(&self) -> [u8; 32] {
+            [0; 32]
+        }
+        fn get_her_ip6(&self) -> [u8; 16] {
+            [0; 16]
+        }
+        fn get_name(&self) -> Option<String> {
+            None
+        }
+        fn stats(&self) -> CryptoStats {
+            CryptoStats {
+                lost_packets: 0,
+                received_unexpected: 0,
+                received_packets: self.delivered.load(Ordering::Relaxed),
+                duplicate_packets: 0,
+                noise_proto: false,
+                secret_cache_hits: 0,
+                secret_cache_misses: 0,
+            }
+        }
+        fn reset_if_timeout(&self) {}
+        fn reset(&self) {}
+        fn her_key_known(&self) -> bool {
+            true
+        }
+        fn ifaces(&self) -> Option<(Iface, Iface)> {
+            None
+        }
+        fn tick(&self, _: &mut Allocator) -> Result<Option<Message>> {
+            Ok(None)
+        }
+        fn cjdns_ver(&self) -> u32 {
+            0
+        }
+        fn decrypt_run(&self, _: &mut Message) -> Result<bool> {
+            Ok(true)
+        }
+        fn encrypt_run(&self, _: &mut Message) -> Result<bool> {
+            Ok(true)
+        }
+        fn deliver_plaintext(&self, _: Message) -> Result<()> {
+            self.delivered.fetch_add(1, Ordering::Relaxed);
+            Ok(())
+        }
+    }
+
+    type Sink = Arc<parking_lot::Mutex<Vec<Vec<u8>>>>;
+
+    /// Plumb `to` to an iface which records everything sent to it, returns the
+    /// iface's pvt for sending into `to` and what it has received.
+    fn sink(to: &mut Iface) -> (Iface, IfacePvt, Sink) {
+        let got = Sink::default();
+        let (mut i, pvt) = iface::new("test sink");
+        i.set_receiver_f(
+            |got: &Sink, m: Message| {
+                got.lock().push(m.bytes().to_vec());
+                Ok(())
+            },
+            Arc::clone(&got),
+        );
+        i.plumb(to).unwrap();
+        (i, pvt, got)
+    }
+
+    fn from_wire(lladdr: &Sockaddr, header: &[u8]) -> Message {
+        let mut msg = Message::new(512);
+        msg.push_bytes(&[0xaa; 32]).unwrap();
+        msg.push_bytes(header).unwrap();
+        msg.push_bytes(lladdr.bytes()).unwrap();
+        msg
+    }
+
+    #[test]
+    fn test_removed_peer_goes_to_core() {
+        let fp = SwitchFastPath::new();
+        fp.set_enabled(true);
+        let (port_a, mut wire_a, mut core_a) = Port::new("a");
+        let (port_b, mut wire_b, mut core_b) = Port::new("b");
+        fp.attach(1, &port_a);
+        fp.attach(2, &port_b);
+        let (_wa, to_a, _) = sink(&mut wire_a);
+        let (_ca, _, core_got_a) = sink(&mut core_a);
+        let (_wb, _, wire_got_b) = sink(&mut wire_b);
+        let (_cb, _, _) = sink(&mut core_b);
+
+        // x is interface 5 behind port a, y is interface 0 behind port b
+        let x_addr = Sockaddr::from(&"10.0.0.1:1".parse::<SocketAddr>().unwrap());
+        let y_addr = Sockaddr::from(&"10.0.0.2:2".parse::<SocketAddr>().unwrap());
+        let x = Arc::new(NullSession::default());
+        let y = Arc::new(NullSession::default());
+        let x_dyn: Arc<dyn SessionTrait> = x.clone();
+        let y_dyn: Arc<dyn SessionTrait> = y.clone();
+        fp.add_peer(1, &x_addr, 0x1b, Arc::clone(&x_dyn)).unwrap();
+        fp.add_peer(2, &y_addr, 0x13, Arc::clone(&y_dyn)).unwrap();
+        let x_to_y = header(0x13 | (0x15 << 4), 0);
+
+        to_a.send(from_wire(&x_addr, &x_to_y)).unwrap();
+        assert_eq!(wire_got_b.lock().len(), 1);
+        assert_eq!(fp.stats().forwarded, 1);
+
+        // Only the session which holds the slot can remove it
+        let other: Arc<dyn SessionTrait> = Arc::new(NullSession::default());
+        fp.remove_peer(0x13, &other);
+        assert_eq!(fp.stats().peers, 2);
+
+        // y is gone, SwitchCore gets the decrypted packet from x instead
+        fp.remove_peer(0x13, &y_dyn);
+        assert!(fp.take_peer_stats(0x13, &y_dyn).is_none());
+        to_a.send(from_wire(&x_addr, &x_to_y)).unwrap();
+        assert_eq!(wire_got_b.lock().len(), 1);
+        assert_eq!(x.delivered.load(Ordering::Relaxed), 1);
+        assert_eq!(fp.stats().to_core, 1);
+
+        // x is gone, its packets go to C still encrypted with the sockaddr in front
+        fp.remove_peer(0x1b, &x_dyn);
+        assert_eq!(fp.stats().peers, 0);
+        let msg = from_wire(&x_addr, &x_to_y);
+        let raw = msg.bytes().to_vec();
+        to_a.send(msg).unwrap();
+        assert_eq!(*core_got_a.lock(), vec![raw]);
+        assert_eq!(x.delivered.load(Ordering::Relaxed), 1);
+        assert_eq!(fp.stats().forwarded, 1);
+    }
+}
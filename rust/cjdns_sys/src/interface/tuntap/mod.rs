@@ -1 +1,2 @@
-pub mod android;
\ No newline at end of file
+pub mod android;
+pub mod vnet;
@@ -0,0 +1,555 @@
+//! virtio-net header offloads for Linux TUN devices
+//!
+//! When a TUN device is opened with IFF_VNET_HDR and TUNSETOFFLOAD, every frame
+//! carries a struct virtio_net_hdr between the packet information and the IP
+//! packet. The kernel then hands us TCP packets of up to 64KiB which still need
+//! to be cut into segments, and packets whose checksum is left for us to finish.
+//! In the other direction, runs of segments of one TCP flow can be written as a
+//! single super-packet which the kernel segments (or doesn't, if it is local).
+//!
+//! Frames in cjdns carry a 4 byte packet information header (see TUNMessageType.h)
+//! which comes before the virtio_net_hdr, the functions here take and return frames
+//! with that header so that the rest of cjdns never sees the virtio_net_hdr.
+
+use eyre::{bail, Result};
+
+/// Size of the packet information header (flags and ethertype) at the front of every frame.
+pub const PI_LEN: usize = 4;
+
+/// Size of struct virtio_net_hdr, which is what the kernel uses unless TUNSETVNETHDRSZ is called.
+pub const HDR_LEN: usize = 10;
+
+/// The virtio_net_hdr for a frame which is written as it is.
+pub const PLAIN_HDR: [u8; HDR_LEN] = [0; HDR_LEN];
+
+/// TUNSETOFFLOAD flags, from linux/if_tun.h
+pub const TUN_F_CSUM: u32 = 0x01;
+pub const TUN_F_TSO4: u32 = 0x02;
+pub const TUN_F_TSO6: u32 = 0x04;
+
+/// From linux/virtio_net.h
+pub const F_NEEDS_CSUM: u8 = 1;
+pub const GSO_NONE: u8 = 0;
+pub const GSO_TCPV4: u8 = 1;
+pub const GSO_TCPV6: u8 = 4;
+pub const GSO_ECN: u8 = 0x80;
+
+const TCP_FIN: u8 = 0x01;
+const TCP_PSH: u8 = 0x08;
+const TCP_ACK: u8 = 0x10;
+const TCP_CWR: u8 = 0x80;
+
+/// Largest IP packet which can be described by the length field.
+const MAX_SUPER: usize = 65535;
+
+/// struct virtio_net_hdr, the fields are in host byte order.
+#[derive(Default, Debug, Clone, Copy, PartialEq, Eq)]
+pub struct VnetHdr {
+    pub flags: u8,
+    pub gso_type: u8,
+    pub hdr_len: u16,
+    pub gso_size: u16,
+    pub csum_start: u16,
+    pub csum_offset: u16,
+}
+
+impl VnetHdr {
+    pub fn decode(b: &[u8]) -> Result<Self> {
+        if b.len() < HDR_LEN {
+            bail!("virtio_net_hdr runt, [{}] bytes", b.len());
+        }
+        let u16_at = |i: usize| u16::from_ne_bytes([b[i], b[i + 1]]);
+        Ok(Self {
+            flags: b[0],
+            gso_type: b[1],
+            hdr_len: u16_at(2),
+            gso_size: u16_at(4),
+            csum_start: u16_at(6),
+            csum_offset: u16_at(8),
+        })
+    }
+
+    pub fn encode(&self) -> [u8; HDR_LEN] {
+        let mut out = [0_u8; HDR_LEN];
+        out[0] = self.flags;
+        out[1] = self.gso_type;
+        out[2..4].copy_from_slice(&self.hdr_len.to_ne_bytes());
+        out[4..6].copy_from_slice(&self.gso_size.to_ne_bytes());
+        out[6..8].copy_from_slice(&self.csum_start.to_ne_bytes());
+        out[8..10].copy_from_slice(&self.csum_offset.to_ne_bytes());
+        out
+    }
+}
+
+/// Add the 16 bit big endian words of data to a ones complement sum, only the last
+/// slice which is summed may have an odd length.
+fn sum(data: &[u8], mut acc: u64) -> u64 {
+    let mut chunks = data.chunks_exact(2);
+    for c in &mut chunks {
+        acc += u16::from_be_bytes([c[0], c[1]]) as u64;
+    }
+    if let [b] = chunks.remainder() {
+        acc += (*b as u64) << 8;
+    }
+    acc
+}
+
+fn fold(mut acc: u64) -> u16 {
+    while acc > 0xffff {
+        acc = (acc & 0xffff) + (acc >> 16);
+    }
+    acc as u16
+}
+
+fn get16(b: &[u8], i: usize) -> u16 {
+    u16::from_be_bytes([b[i], b[i + 1]])
+}
+
+fn put16(b: &mut [u8], i: usize, v: u16) {
+    b[i..i + 2].copy_from_slice(&v.to_be_bytes());
+}
+
+fn get32(b: &[u8], i: usize) -> u32 {
+    u32::from_be_bytes([b[i], b[i + 1], b[i + 2], b[i + 3]])
+}
+
+/// Where the headers of a TCP/IP packet are.
+#[derive(Debug, Clone, Copy)]
+struct Tcp {
+    v6: bool,
+    /// Length of the IP header, which is where the TCP header begins
+    iph: usize,
+    /// Length of the TCP header
+    thl: usize,
+}
+
+impl Tcp {
+    fn parse(ip: &[u8]) -> Result<Self> {
+        if ip.len() < 20 {
+            bail!("IP runt, [{}] bytes", ip.len());
+        }
+        let (v6, iph) = match ip[0] >> 4 {
+            4 => {
+                if ip[9] != 6 {
+                    bail!("IPv4 protocol [{}] is not TCP", ip[9]);
+                }
+                (false, (ip[0] & 0x0f) as usize * 4)
+            }
+            6 => {
+                if ip.len() < 40 {
+                    bail!("IPv6 runt, [{}] bytes", ip.len());
+                }
+                if ip[6] != 6 {
+                    bail!("IPv6 next header [{}] is not TCP", ip[6]);
+                }
+                (true, 40)
+            }
+            v => bail!("Unknown IP version [{}]", v),
+        };
+        if iph < 20 || ip.len() < iph + 20 {
+            bail!("TCP runt, [{}] bytes", ip.len());
+        }
+        let thl = (ip[iph + 12] >> 4) as usize * 4;
+        if thl < 20 || ip.len() < iph + thl {
+            bail!("TCP header length [{}] is invalid", thl);
+        }
+        Ok(Self { v6, iph, thl })
+    }
+
+    fn hlen(&self) -> usize {
+        self.iph + self.thl
+    }
+
+    /// Sum of the pseudo-header for a TCP segment of len bytes.
+    fn pseudo(&self, ip: &[u8], len: usize) -> u64 {
+        let addrs = if self.v6 { &ip[8..40] } else { &ip[12..20] };
+        sum(addrs, 6 + len as u64)
+    }
+
+    /// Set the length fields of the IP header, for IPv4 also add id_add to the id and
+    /// recompute the header checksum.
+    fn fix_ip(&self, ip: &mut [u8], id_add: u16) {
+        let len = ip.len();
+        if self.v6 {
+            put16(ip, 4, (len - 40) as u16);
+        } else {
+            put16(ip, 2, len as u16);
+            let id = get16(ip, 4).wrapping_add(id_add);
+            put16(ip, 4, id);
+            put16(ip, 10, 0);
+            let csum = !fold(sum(&ip[..self.iph], 0));
+            put16(ip, 10, csum);
+        }
+    }
+
+    fn fix_tcp_csum(&self, ip: &mut [u8]) {
+        let at = self.iph + 16;
+        put16(ip, at, 0);
+        let csum = !fold(sum(&ip[self.iph..], self.pseudo(ip, ip.len() - self.iph)));
+        put16(ip, at, csum);
+    }
+}
+
+/// Finish a checksum which the kernel left partial (VIRTIO_NET_HDR_F_NEEDS_CSUM).
+fn finish_csum(ip: &mut [u8], hdr: &VnetHdr) -> Result<()> {
+    let start = hdr.csum_start as usize;
+    let at = start + hdr.csum_offset as usize;
+    if at + 2 > ip.len() {
+        bail!("Checksum at [{}] is past the end of the [{}] byte packet", at, ip.len());
+    }
+    let initial = get16(ip, at) as u64;
+    put16(ip, at, 0);
+    let csum = !fold(sum(&ip[start..], initial));
+    put16(ip, at, csum);
+    Ok(())
+}
+
+/// Take a frame read from the TUN device, finish its checksum and cut it into segments
+/// if it is a TCP super-packet. emit() is called with the packet information header and
+/// each IP packet which results. scratch is used for building segments.
+pub fn split(
+    frame: &mut [u8],
+    scratch: &mut Vec<u8>,
+    mut emit: impl FnMut(&[u8], &[u8]) -> Result<()>,
+) -> Result<()> {
+    if frame.len() < PI_LEN + HDR_LEN {
+        bail!("Frame runt, [{}] bytes", frame.len());
+    }
+    let (pi, rest) = frame.split_at_mut(PI_LEN);
+    let (vh, ip) = rest.split_at_mut(HDR_LEN);
+    let hdr = VnetHdr::decode(vh)?;
+    match hdr.gso_type & !GSO_ECN {
+        GSO_NONE => {
+            if hdr.flags & F_NEEDS_CSUM != 0 {
+                finish_csum(ip, &hdr)?;
+            }
+            emit(pi, ip)
+        }
+        GSO_TCPV4 | GSO_TCPV6 => {
+            let t = Tcp::parse(ip)?;
+            if t.v6 != (hdr.gso_type & !GSO_ECN == GSO_TCPV6) {
+                bail!("GSO type [{}] does not match the IP version", hdr.gso_type);
+            }
+            let mss = hdr.gso_size as usize;
+            let hlen = t.hlen();
+            if mss == 0 || ip.len() <= hlen {
+                bail!("GSO packet with mss [{}] and [{}] bytes of payload", mss, ip.len() - hlen);
+            }
+            let payload_len = ip.len() - hlen;
+            let seq = get32(ip, t.iph + 4);
+            let flags = ip[t.iph + 13];
+            for (i, chunk) in ip[hlen..].chunks(mss).enumerate() {
+                scratch.clear();
+                scratch.extend_from_slice(&ip[..hlen]);
+                scratch.extend_from_slice(chunk);
+                t.fix_ip(scratch, i as u16);
+                let seg_seq = seq.wrapping_add((i * mss) as u32);
+                scratch[t.iph + 4..t.iph + 8].copy_from_slice(&seg_seq.to_be_bytes());
+                let mut f = flags;
+                if (i + 1) * mss < payload_len {
+                    f &= !(TCP_FIN | TCP_PSH);
+                }
+                if i > 0 {
+                    f &= !TCP_CWR;
+                }
+                scratch[t.iph + 13] = f;
+                t.fix_tcp_csum(scratch);
+                emit(pi, scratch)?;
+            }
+            Ok(())
+        }
+        x => bail!("Unsupported GSO type [{}]", x),
+    }
+}
+
+/// A TCP segment which could be part of a super-packet.
+struct Segment<'a> {
+    t: Tcp,
+    ip: &'a [u8],
+}
+
+impl<'a> Segment<'a> {
+    fn parse(frame: &'a [u8]) -> Option<Self> {
+        let ip = frame.get(PI_LEN..)?;
+        let t = Tcp::parse(ip).ok()?;
+        let total = if t.v6 {
+            get16(ip, 4) as usize + 40
+        } else {
+            // No options and no fragments
+            if t.iph != 20 || get16(ip, 6) & 0x3fff != 0 {
+                return None;
+            }
+            get16(ip, 2) as usize
+        };
+        if total != ip.len() || ip.len() == t.hlen() {
+            return None;
+        }
+        let flags = ip[t.iph + 13];
+        if flags != TCP_ACK && flags != TCP_ACK | TCP_PSH {
+            return None;
+        }
+        Some(Self { t, ip })
+    }
+    fn payload_len(&self) -> usize {
+        self.ip.len() - self.t.hlen()
+    }
+    fn seq(&self) -> u32 {
+        get32(self.ip, self.t.iph + 4)
+    }
+    fn psh(&self) -> bool {
+        self.ip[self.t.iph + 13] & TCP_PSH != 0
+    }
+    /// Everything except lengths, ids, checksums, sequence numbers and flags is the same.
+    fn same_flow(&self, o: &Segment<'_>) -> bool {
+        let (a, b) = (self.ip, o.ip);
+        let (ta, tb) = (&a[self.t.iph..self.t.hlen()], &b[o.t.iph..o.t.hlen()]);
+        let ip_same = if self.t.v6 {
+            o.t.v6 && a[0..4] == b[0..4] && a[6..40] == b[6..40]
+        } else {
+            !o.t.v6 && a[0..2] == b[0..2] && a[6..10] == b[6..10] && a[12..20] == b[12..20]
+        };
+        ip_same
+            && ta.len() == tb.len()
+            && ta[0..4] == tb[0..4]
+            && ta[8..13] == tb[8..13]
+            && ta[14..16] == tb[14..16]
+            && ta[18..] == tb[18..]
+    }
+}
+
+/// The number of frames at the front of frames which can be coalesced into one TCP
+/// super-packet, 1 if the first frame can't be coalesced with the next.
+pub fn run_len<'a>(frames: impl IntoIterator<Item = &'a [u8]>) -> usize {
+    let mut frames = frames.into_iter();
+    let (first_frame, first) = match frames.next() {
+        Some(f) => match Segment::parse(f) {
+            Some(s) if !s.psh() => (f, s),
+            _ => return 1,
+        },
+        None => return 0,
+    };
+    let mss = first.payload_len();
+    let mut seq = first.seq().wrapping_add(mss as u32);
+    let mut total = first.ip.len();
+    let mut count = 1;
+    for f in frames {
+        let s = match Segment::parse(f) {
+            Some(s) => s,
+            None => break,
+        };
+        let len = s.payload_len();
+        if f[..PI_LEN] != first_frame[..PI_LEN]
+            || !first.same_flow(&s)
+            || s.seq() != seq
+            || len > mss
+            || total + len > MAX_SUPER
+        {
+            break;
+        }
+        count += 1;
+        total += len;
+        seq = seq.wrapping_add(len as u32);
+        if len < mss || s.psh() {
+            // Only the last segment may be short or pushed
+            break;
+        }
+    }
+    count
+}
+
+/// Write frames, which run_len() has said can be coalesced, into out as one frame with
+/// a virtio_net_hdr describing a TCP super-packet.
+pub fn coalesce(frames: &[&[u8]], out: &mut Vec<u8>) -> Result<()> {
+    let first = match frames.first().and_then(|f| Segment::parse(f)) {
+        Some(s) => s,
+        None => bail!("First frame is not a TCP segment"),
+    };
+    let t = first.t;
+    let hlen = t.hlen();
+    let hdr = VnetHdr {
+        flags: F_NEEDS_CSUM,
+        gso_type: if t.v6 { GSO_TCPV6 } else { GSO_TCPV4 },
+        hdr_len: hlen as u16,
+        gso_size: first.payload_len() as u16,
+        csum_start: t.iph as u16,
+        csum_offset: 16,
+    };
+    out.clear();
+    out.extend_from_slice(&frames[0][..PI_LEN]);
+    out.extend_from_slice(&hdr.encode());
+    let ip_at = out.len();
+    out.extend_from_slice(first.ip);
+    for f in &frames[1..] {
+        out.extend_from_slice(&f[PI_LEN + hlen..]);
+    }
+    let last_flags = frames[frames.len() - 1][PI_LEN + t.iph + 13];
+    let ip = &mut out[ip_at..];
+    if ip.len() > MAX_SUPER {
+        bail!("Super-packet of [{}] bytes is too big", ip.len());
+    }
+    t.fix_ip(ip, 0);
+    ip[t.iph + 13] = last_flags;
+    // With NEEDS_CSUM the kernel expects only the pseudo-header sum, not inverted.
+    let partial = fold(t.pseudo(ip, ip.len() - t.iph));
+    put16(ip, t.iph + 16, partial);
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn tcp_frame(v6: bool, id: u16, seq: u32, flags: u8, payload: &[u8]) -> Vec<u8> {
+        let mut ip = Vec::new();
+        if v6 {
+            ip.extend_from_slice(&[0x60, 0, 0, 0, 0, 0, 6, 64]);
+            ip.extend_from_slice(&[0xfc; 16]);
+            ip.extend_from_slice(&[0xfd; 16]);
+        } else {
+            ip.extend_from_slice(&[0x45, 0, 0, 0, 0, 0, 0x40, 0, 64, 6, 0, 0]);
+            ip.extend_from_slice(&[10, 0, 0, 1, 10, 0, 0, 2]);
+        }
+        let iph = ip.len();
+        // ports 1234 -> 80, seq, ack, 32 byte header with a timestamp option
+        ip.extend_from_slice(&[0x04, 0xd2, 0, 80]);
+        ip.extend_from_slice(&seq.to_be_bytes());
+        ip.extend_from_slice(&[0, 0, 0x10, 0, 0x80, flags, 0x01, 0x00, 0, 0, 0, 0]);
+        ip.extend_from_slice(&[1, 1, 8, 10, 0, 0, 0, 1, 0, 0, 0, 2]);
+        ip.extend_from_slice(payload);
+        let t = Tcp::parse(&ip).unwrap();
+        assert_eq!(t.iph, iph);
+        t.fix_ip(&mut ip, id);
+        t.fix_tcp_csum(&mut ip);
+        let mut frame = vec![0, 0, 0x86, 0xdd];
+        if !v6 {
+            frame[2..4].copy_from_slice(&[0x08, 0x00]);
+        }
+        frame.extend_from_slice(&ip);
+        frame
+    }
+
+    fn burst(v6: bool, sizes: &[usize]) -> Vec<Vec<u8>> {
+        let mut seq = 1000_u32;
+        sizes.iter().enumerate().map(|(i, &len)| {
+            let flags = if i + 1 == sizes.len() { TCP_ACK | TCP_PSH } else { TCP_ACK };
+            let payload = (0..len).map(|x| (x + i) as u8).collect::<Vec<_>>();
+            let f = tcp_frame(v6, 7 + i as u16, seq, flags, &payload);
+            seq += len as u32;
+            f
+        }).collect()
+    }
+
+    fn split_all(frame: &[u8]) -> Vec<Vec<u8>> {
+        let mut frame = frame.to_vec();
+        let mut out = Vec::new();
+        let mut scratch = Vec::new();
+        split(&mut frame, &mut scratch, |pi, ip| {
+            out.push([pi, ip].concat());
+            Ok(())
+        }).unwrap();
+        out
+    }
+
+    #[test]
+    fn test_coalesce_split() {
+        for v6 in [true, false] {
+            let frames = burst(v6, &[1200, 1200, 1200, 1200, 500]);
+            let refs = frames.iter().map(|f| &f[..]).collect::<Vec<_>>();
+            assert_eq!(run_len(refs.iter().copied()), 5);
+            let mut sup = Vec::new();
+            coalesce(&refs, &mut sup).unwrap();
+            let hdr = VnetHdr::decode(&sup[PI_LEN..]).unwrap();
+            assert_eq!(hdr.gso_size, 1200);
+            assert_eq!(sup.len(), PI_LEN + HDR_LEN + frames[0].len() - PI_LEN + 4 * 1200 + 500 - 1200);
+            // What the kernel hands back for a super-packet is what we started with
+            assert_eq!(split_all(&sup), frames);
+        }
+    }
+
+    #[test]
+    fn test_run_len() {
+        let mut frames = burst(true, &[1200, 1200, 1200]);
+        // A gap in the sequence numbers ends the run
+        let mut gap = frames.clone();
+        gap[2] = tcp_frame(true, 0, 1000 + 2 * 1200 + 1, TCP_ACK, &[0; 1200]);
+        assert_eq!(run_len(gap.iter().map(|f| &f[..])), 2);
+        // A short segment can only be the last one
+        frames.insert(1, tcp_frame(true, 0, 1000 + 1200, TCP_ACK, &[0; 100]));
+        assert_eq!(run_len(frames.iter().map(|f| &f[..])), 2);
+        // Different port
+        let mut other = frames.clone();
+        other[1][PI_LEN + 40 + 1] = 81;
+        assert_eq!(run_len(other.iter().map(|f| &f[..])), 1);
+        // Not TCP
+        let mut udp = frames.clone();
+        udp[0][PI_LEN + 6] = 17;
+        assert_eq!(run_len(udp.iter().map(|f| &f[..])), 1);
+        assert_eq!(run_len(std::iter::empty()), 0);
+    }
+
+    #[test]
+    fn test_finish_csum() {
+        let frame = tcp_frame(true, 0, 5, TCP_ACK, b"hello world");
+        let ip = &frame[PI_LEN..];
+        // What the kernel sends with NEEDS_CSUM: only the pseudo-header sum in the field
+        let t = Tcp::parse(ip).unwrap();
+        let mut partial = ip.to_vec();
+        let p = fold(t.pseudo(ip, ip.len() - 40));
+        put16(&mut partial, 40 + 16, p);
+        let hdr = VnetHdr {
+            flags: F_NEEDS_CSUM,
+            csum_start: 40,
+            csum_offset: 16,
+            ..Default::default()
+        };
+        let mut input = frame[..PI_LEN].to_vec();
+        input.extend_from_slice(&hdr.encode());
+        input.extend_from_slice(&partial);
+        assert_eq!(split_all(&input), vec![frame]);
+    }
+
+    #[test]
+    #[ignore]
+    fn bench_split_at_reader() {
+        // cargo test --release -- --ignored --nocapture bench_split_at_reader
+        // A SOCK_SEQPACKET pair stands in for the TUN fd, it keeps frame boundaries the same way.
+        let mut fds = [0; 2];
+        let ret = unsafe { libc::socketpair(libc::AF_UNIX, libc::SOCK_SEQPACKET, 0, fds.as_mut_ptr()) };
+        assert_eq!(ret, 0);
+        let (a, b) = (fds[0], fds[1]);
+        // 45 full size segments of a 1500 byte MTU flow, as plain frames and as one super-packet
+        let frames = burst(false, &[1448; 45]);
+        let plain = frames.iter().map(|f| {
+            [&f[..PI_LEN], &PLAIN_HDR[..], &f[PI_LEN..]].concat()
+        }).collect::<Vec<_>>();
+        let mut sup = Vec::new();
+        coalesce(&frames.iter().map(|f| &f[..]).collect::<Vec<_>>(), &mut sup).unwrap();
+        let mut buf = vec![0_u8; PI_LEN + HDR_LEN + MAX_SUPER];
+        let mut scratch = Vec::new();
+        let rounds = 20_000;
+        for (name, writes) in [("frame per segment", &plain), ("super-packet", &vec![sup])] {
+            let (mut reads, mut segs, mut took) = (0_u64, 0_u64, std::time::Duration::ZERO);
+            for _ in 0..rounds {
+                for w in writes.iter() {
+                    let ret = unsafe { libc::write(a, w.as_ptr() as _, w.len()) };
+                    assert_eq!(ret, w.len() as isize);
+                }
+                let start = std::time::Instant::now();
+                for _ in 0..writes.len() {
+                    let len = unsafe { libc::read(b, buf.as_mut_ptr() as _, buf.len()) };
+                    assert!(len > 0);
+                    reads += 1;
+                    split(&mut buf[..len as usize], &mut scratch, |_pi, ip| {
+                        segs += 1;
+                        std::hint::black_box(ip);
+                        Ok(())
+                    }).unwrap();
+                }
+                took += start.elapsed();
+            }
+            println!("{name}: {:?}/segment, {:.3} reads/segment",
+                took / segs as u32, reads as f64 / segs as f64);
+        }
+        unsafe { libc::close(a); libc::close(b) };
+    }
+}
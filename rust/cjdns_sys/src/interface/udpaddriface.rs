@@ -1,23 +1,36 @@
 use num_enum::{IntoPrimitive, TryFromPrimitive};
 use socket2::{Domain, Protocol, SockAddr, Type};
+use tokio::io::Interest;
 use tokio::net::UdpSocket;
 use tokio::sync::mpsc::{Receiver, Sender};
 use tokio::sync::Mutex;
+use crate::interface::socketiface::{
+    self, is_transient, BatchSize, Mmsghdr, WorkerState, WorkerStats, MAX_BATCH,
+};
 use crate::util::sockaddr::Sockaddr;
+use crate::util::topology;
+#[cfg(target_os = "linux")]
+use crate::interface::xdpiface::{XdpMode, XdpUdp};
+use std::collections::VecDeque;
 use std::convert::TryFrom;
-use std::sync::atomic::AtomicI32;
+use std::os::fd::AsRawFd;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
 use std::sync::Arc;
+use std::time::Duration;
 use crate::interface::wire::message::Message;
 use crate::external::interface::iface::{self, IfRecv, Iface, IfacePvt};
 use eyre::{Context, Result};
 use std::net::SocketAddr;
 
-const SEND_MSGS_LIMIT: usize = 16;
 const TO_GO_OUT_QUEUE: usize = 64;
 
 const BUFFER_CAP: usize = 3496;
 const PADDING_AMOUNT: usize = 512;
 
+/// Largest batch the UDP workers grow to. In bench_loopback_pps batches of 32 did
+/// at least as well as one datagram per syscall while batches of 64 did worse.
+const UDP_MAX_BATCH: usize = 32;
+
 #[derive(Debug,IntoPrimitive,TryFromPrimitive)]
 #[repr(i32)]
 pub enum SendWorkerState {
@@ -26,6 +39,7 @@ pub enum SendWorkerState {
     WaitLock = 1,
     RecvBatch = 2,
     SendBatch = 3,
+    WaitWritable = 4,
 }
 
 #[derive(Debug,IntoPrimitive,TryFromPrimitive)]
@@ -35,18 +49,576 @@ pub enum RecvWorkerState {
     Initializing = 0,
     RecvBatch = 1,
     RecievedBatch = 2,
-    IfaceSendOne = 3,
-    IfaceSendTwo = 4,
+    IfaceSend = 3,
+    WaitReadable = 4,
+}
+
+// From linux/udp.h, not every libc target has them.
+const SOL_UDP: libc::c_int = 17;
+const UDP_SEGMENT: libc::c_int = 103;
+const UDP_GRO: libc::c_int = 104;
+
+/// Most datagrams in one GSO send, older kernels do not allow more.
+const GSO_MAX_SEGMENTS: usize = 64;
+/// Most bytes in one GSO send, the whole super-datagram must fit in one IP packet.
+const GSO_MAX_BYTES: usize = 65000;
+/// Size of a buffer for receiving a GRO super-datagram.
+const GRO_BUFFER_CAP: usize = 65536;
+/// Number of GRO buffers per receive worker.
+const GRO_BATCH: usize = 8;
+
+/// Whether segmentation offload (GSO) for sending and receive coalescing (GRO)
+/// are available on the socket, and whether they are being used.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct Offload {
+    pub gso_supported: bool,
+    pub gso: bool,
+    pub gro_supported: bool,
+    pub gro: bool,
+}
+
+#[cfg(target_os = "linux")]
+fn gso_supported(fd: libc::c_int) -> bool {
+    let mut val: libc::c_int = 0;
+    let mut len = std::mem::size_of::<libc::c_int>() as libc::socklen_t;
+    unsafe {
+        libc::getsockopt(fd, SOL_UDP, UDP_SEGMENT, &mut val as *mut _ as *mut _, &mut len) == 0
+    }
+}
+#[cfg(not(target_os = "linux"))]
+fn gso_supported(_fd: libc::c_int) -> bool {
+    false
+}
+
+fn set_gro(fd: libc::c_int, enable: bool) -> Result<(), std::io::Error> {
+    let val = enable as libc::c_int;
+    let ret = unsafe {
+        libc::setsockopt(
+            fd,
+            SOL_UDP,
+            UDP_GRO,
+            &val as *const _ as *const _,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if ret < 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+/// The segment size of a datagram received with GRO, None if it was not coalesced.
+fn gro_segment_size(hdr: &libc::msghdr) -> Option<usize> {
+    unsafe {
+        let mut cmsg = libc::CMSG_FIRSTHDR(hdr as *const _);
+        while !cmsg.is_null() {
+            if (*cmsg).cmsg_level == SOL_UDP && (*cmsg).cmsg_type == UDP_GRO {
+                let size = std::ptr::read_unaligned(libc::CMSG_DATA(cmsg) as *const libc::c_int);
+                return if size > 0 { Some(size as usize) } else { None };
+            }
+            cmsg = libc::CMSG_NXTHDR(hdr as *const _, cmsg);
+        }
+    }
+    None
+}
+
+/// Headers and addresses for one recvmmsg() or sendmmsg() on the UDP socket.
+struct UdpBatch {
+    hdrs: [Mmsghdr; MAX_BATCH],
+    iovecs: [libc::iovec; MAX_BATCH],
+    names: [libc::sockaddr_storage; MAX_BATCH],
+    /// Control data for UDP_SEGMENT and UDP_GRO, u64 to keep it aligned for cmsghdr.
+    control: [[u64; 8]; MAX_BATCH],
+    /// Number of messages in each header which is sent
+    segments: [usize; MAX_BATCH],
+    /// Buffers for receiving with GRO, allocated when it is first used.
+    gro_bufs: Vec<Vec<u8>>,
+    /// Send the next batch without GSO because a GSO send was refused.
+    no_gso_once: bool,
+    /// Syscalls made since the last take_syscalls()
+    syscalls: u64,
+}
+unsafe impl Send for UdpBatch {}
+
+impl UdpBatch {
+    fn new() -> Box<Self> {
+        Box::new(Self {
+            hdrs: unsafe { std::mem::zeroed() },
+            iovecs: unsafe { std::mem::zeroed() },
+            names: unsafe { std::mem::zeroed() },
+            control: [[0; 8]; MAX_BATCH],
+            segments: [0; MAX_BATCH],
+            gro_bufs: Vec::new(),
+            no_gso_once: false,
+            syscalls: 0,
+        })
+    }
+    fn take_syscalls(&mut self) -> u64 {
+        std::mem::take(&mut self.syscalls)
+    }
+
+    /// Receive into the messages in `msgs`, each one which is received gets its length set
+    /// and the address it came from pushed on the front. Messages which are received but
+    /// must be dropped are clear()'d.
+    /// Returns the number of messages received and the error which stopped further receiving.
+    fn recv(&mut self, fd: libc::c_int, msgs: &mut VecDeque<Message>) -> (usize, Option<std::io::Error>) {
+        let count = msgs.len().min(MAX_BATCH);
+        for (i, msg) in msgs.iter_mut().take(count).enumerate() {
+            let iovec = &mut self.iovecs[i];
+            iovec.iov_base = msg.bytes_mut().as_mut_ptr() as _;
+            iovec.iov_len = msg.len();
+            let hdr = &mut self.hdrs[i];
+            hdr.msg_hdr.msg_iov = iovec as _;
+            hdr.msg_hdr.msg_iovlen = 1;
+            hdr.msg_hdr.msg_name = &mut self.names[i] as *mut _ as _;
+            hdr.msg_hdr.msg_namelen = std::mem::size_of::<libc::sockaddr_storage>() as _;
+            hdr.msg_hdr.msg_control = std::ptr::null_mut();
+            hdr.msg_hdr.msg_controllen = 0;
+            hdr.msg_hdr.msg_flags = 0;
+            hdr.msg_len = !0;
+        }
+
+        let res = socketiface::recvmmsg(fd, &mut self.hdrs[0..count], libc::MSG_DONTWAIT, &mut self.syscalls);
+
+        let mut received = 0;
+        for (i, msg) in msgs.iter_mut().take(count).enumerate() {
+            let hdr = &self.hdrs[i];
+            if hdr.msg_len == !0 {
+                break;
+            }
+            received += 1;
+            let from = match self.from(i) {
+                Some(from) => from,
+                None => {
+                    log::info!("DROP: UDP message with unparsable address");
+                    msg.clear();
+                    continue;
+                }
+            };
+            let byte_count = hdr.msg_len as usize;
+            log::trace!("Ok UDP packet from {from} with {byte_count} bytes");
+            if hdr.msg_hdr.msg_flags & libc::MSG_TRUNC != 0 {
+                log::warn!("Truncated incoming message from {from}");
+            }
+            msg.set_len(byte_count).unwrap();
+            let addr = Sockaddr::from(&from);
+            msg.push_bytes(addr.bytes()).unwrap();
+        }
+        (received, res.err())
+    }
+
+    /// Like recv() but for a socket with UDP_GRO on, datagrams are received into large
+    /// buffers and each coalesced one is split back into the datagrams which it was
+    /// made of. Those are pushed to `out` as messages with the address on the front.
+    /// Returns the number of datagrams (before splitting) received and the error which
+    /// stopped further receiving.
+    fn recv_gro(&mut self, fd: libc::c_int, out: &mut Vec<Message>) -> (usize, Option<std::io::Error>) {
+        if self.gro_bufs.is_empty() {
+            self.gro_bufs = (0..GRO_BATCH).map(|_| vec![0_u8; GRO_BUFFER_CAP]).collect();
+        }
+        for (i, buf) in self.gro_bufs.iter_mut().enumerate() {
+            let iovec = &mut self.iovecs[i];
+            iovec.iov_base = buf.as_mut_ptr() as _;
+            iovec.iov_len = buf.len();
+            let hdr = &mut self.hdrs[i];
+            hdr.msg_hdr.msg_iov = iovec as _;
+            hdr.msg_hdr.msg_iovlen = 1;
+            hdr.msg_hdr.msg_name = &mut self.names[i] as *mut _ as _;
+            hdr.msg_hdr.msg_namelen = std::mem::size_of::<libc::sockaddr_storage>() as _;
+            hdr.msg_hdr.msg_control = self.control[i].as_mut_ptr() as _;
+            hdr.msg_hdr.msg_controllen = std::mem::size_of_val(&self.control[i]) as _;
+            hdr.msg_hdr.msg_flags = 0;
+            hdr.msg_len = !0;
+        }
+
+        let res = socketiface::recvmmsg(fd, &mut self.hdrs[0..GRO_BATCH], libc::MSG_DONTWAIT, &mut self.syscalls);
+
+        let mut received = 0;
+        for i in 0..GRO_BATCH {
+            let hdr = &self.hdrs[i];
+            if hdr.msg_len == !0 {
+                break;
+            }
+            received += 1;
+            let from = match self.from(i) {
+                Some(from) => from,
+                None => {
+                    log::info!("DROP: UDP message with unparsable address");
+                    continue;
+                }
+            };
+            if hdr.msg_hdr.msg_flags & libc::MSG_TRUNC != 0 {
+                log::warn!("Truncated incoming message from {from}");
+            }
+            let len = hdr.msg_len as usize;
+            let seg = gro_segment_size(&hdr.msg_hdr).unwrap_or(len).max(1);
+            let addr = Sockaddr::from(&from);
+            for datagram in self.gro_bufs[i][..len].chunks(seg) {
+                if datagram.len() > BUFFER_CAP {
+                    log::warn!("Truncated incoming message from {from}");
+                    continue;
+                }
+                let mut msg = Message::new_pooled(PADDING_AMOUNT + BUFFER_CAP);
+                msg.allocate_uninitialized(datagram.len()).unwrap().copy_from_slice(datagram);
+                msg.push_bytes(addr.bytes()).unwrap();
+                out.push(msg);
+            }
+        }
+        (received, res.err())
+    }
+
+    fn from(&self, i: usize) -> Option<SocketAddr> {
+        unsafe { SockAddr::new(self.names[i], self.hdrs[i].msg_hdr.msg_namelen) }.as_socket()
+    }
+
+    /// Send the messages at the front of `msgs` with one sendmmsg(), popping off those
+    /// which are sent. If sending fails with an error which is not transient, the message
+    /// which it was about is dropped so that the next try can get past it.
+    ///
+    /// If `gso` is set, runs of messages to the same address which are the same size
+    /// (the last one may be shorter) are sent as one GSO super-datagram. If the kernel
+    /// refuses a GSO send, they are tried again one by one, and if the device cannot do
+    /// it at all, `gso` is cleared.
+    /// Returns the number of messages sent and the error, if any.
+    fn send(
+        &mut self,
+        fd: libc::c_int,
+        msgs: &mut VecDeque<(Message, SocketAddr)>,
+        gso: &AtomicBool,
+    ) -> (usize, Option<std::io::Error>) {
+        let count = msgs.len().min(MAX_BATCH);
+        for (i, (msg, _)) in msgs.iter_mut().take(count).enumerate() {
+            self.iovecs[i].iov_base = msg.bytes_mut().as_mut_ptr() as _;
+            self.iovecs[i].iov_len = msg.len();
+        }
+        let use_gso = gso.load(Ordering::Relaxed) && !std::mem::take(&mut self.no_gso_once);
+
+        let mut n_hdrs = 0;
+        let mut i = 0;
+        while i < count {
+            let (first, to) = &msgs[i];
+            let seg = first.len();
+            let mut n = 1;
+            if use_gso && seg > 0 {
+                let mut total = seg;
+                while i + n < count && n < GSO_MAX_SEGMENTS {
+                    let (msg, sa) = &msgs[i + n];
+                    if sa != to || msg.len() == 0 || msg.len() > seg || total + msg.len() > GSO_MAX_BYTES {
+                        break;
+                    }
+                    total += msg.len();
+                    n += 1;
+                    if msg.len() < seg {
+                        // Only the last segment can be shorter
+                        break;
+                    }
+                }
+            }
+
+            let sa = SockAddr::from(*to);
+            unsafe {
+                std::ptr::copy_nonoverlapping(
+                    sa.as_ptr() as *const u8,
+                    &mut self.names[n_hdrs] as *mut _ as *mut u8,
+                    sa.len() as usize,
+                );
+            }
+            let hdr = &mut self.hdrs[n_hdrs];
+            hdr.msg_hdr.msg_iov = &mut self.iovecs[i] as *mut _;
+            hdr.msg_hdr.msg_iovlen = n as _;
+            hdr.msg_hdr.msg_name = &mut self.names[n_hdrs] as *mut _ as _;
+            hdr.msg_hdr.msg_namelen = sa.len();
+            hdr.msg_hdr.msg_flags = 0;
+            hdr.msg_len = 0;
+            if n > 1 {
+                let control = &mut self.control[n_hdrs];
+                hdr.msg_hdr.msg_control = control.as_mut_ptr() as _;
+                unsafe {
+                    let space = libc::CMSG_SPACE(std::mem::size_of::<u16>() as _);
+                    hdr.msg_hdr.msg_controllen = space as _;
+                    let cmsg = libc::CMSG_FIRSTHDR(&hdr.msg_hdr as *const _);
+                    (*cmsg).cmsg_level = SOL_UDP;
+                    (*cmsg).cmsg_type = UDP_SEGMENT;
+                    (*cmsg).cmsg_len = libc::CMSG_LEN(std::mem::size_of::<u16>() as _) as _;
+                    std::ptr::write_unaligned(libc::CMSG_DATA(cmsg) as *mut u16, seg as u16);
+                }
+            } else {
+                hdr.msg_hdr.msg_control = std::ptr::null_mut();
+                hdr.msg_hdr.msg_controllen = 0;
+            }
+            self.segments[n_hdrs] = n;
+            n_hdrs += 1;
+            i += n;
+        }
+
+        let res = socketiface::sendmmsg(fd, &mut self.hdrs[0..n_hdrs], 0, &mut self.syscalls);
+
+        // Datagrams are sent whole or not at all, sendmmsg() stops at the first one
+        // which is not sent.
+        let sent_hdrs = self.hdrs[0..n_hdrs].iter().take_while(|h| h.msg_len != 0).count();
+        let sent = self.segments[0..sent_hdrs].iter().sum();
+        for (msg, sa) in msgs.drain(0..sent) {
+            log::trace!("Message to {sa} sent ok (len: {})", msg.len());
+        }
+        match &res {
+            Err(e) if is_transient(e) => {},
+            Err(e) if sent_hdrs < n_hdrs && self.segments[sent_hdrs] > 1 => {
+                // EINVAL if the segment is bigger than the MTU, EIO if the device
+                // cannot checksum. Either way they can go without GSO.
+                log::debug!("GSO send of {} messages failed: {e}", self.segments[sent_hdrs]);
+                self.no_gso_once = true;
+                if e.raw_os_error() == Some(libc::EIO) {
+                    log::info!("UDP segmentation offload is not supported by the device, disabling");
+                    gso.store(false, Ordering::Relaxed);
+                }
+            }
+            Err(e) => {
+                if let Some((msg, sa)) = msgs.pop_front() {
+                    log::info!("Unable to send message (len: {}): {e} to: {}", msg.len(), sa);
+                }
+            }
+            Ok(()) => {},
+        }
+        (sent, res.err())
+    }
+}
+
+fn set_reuse_port(fd: libc::c_int) -> Result<(), std::io::Error> {
+    let val: libc::c_int = 1;
+    let ret = unsafe {
+        libc::setsockopt(
+            fd,
+            libc::SOL_SOCKET,
+            libc::SO_REUSEPORT,
+            &val as *const _ as *const _,
+            std::mem::size_of::<libc::c_int>() as libc::socklen_t,
+        )
+    };
+    if ret < 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+#[cfg(target_os = "linux")]
+mod steering {
+    // From linux/filter.h and asm-generic/socket.h
+    const SO_ATTACH_REUSEPORT_CBPF: libc::c_int = 51;
+    const SKF_NET_OFF: u32 = (-0x100000_i32) as u32;
+    const LD_W_ABS: u16 = 0x20;
+    const LD_H_ABS: u16 = 0x28;
+    const LD_B_ABS: u16 = 0x30;
+    const LD_H_IND: u16 = 0x48;
+    const LDX_B_MSH: u16 = 0xb1;
+    const LDX_MEM: u16 = 0x61;
+    const ST: u16 = 0x02;
+    const ALU_RSH_K: u16 = 0x74;
+    const ALU_MUL_K: u16 = 0x24;
+    const ALU_MOD_K: u16 = 0x94;
+    const ALU_XOR_X: u16 = 0xac;
+    const JMP_JA: u16 = 0x05;
+    const JMP_JEQ_K: u16 = 0x15;
+    const RET_A: u16 = 0x16;
+
+    fn op(code: u16, jt: u8, jf: u8, k: u32) -> libc::sock_filter {
+        libc::sock_filter { code, jt, jf, k }
+    }
+
+    /// Classic BPF which picks the socket in a SO_REUSEPORT group from a hash of the
+    /// sender's address and port, so all of a peer's packets land on the same shard.
+    /// The value is the index of the socket in the order they were bound.
+    pub fn program(shards: u32) -> Vec<libc::sock_filter> {
+        vec![
+            op(LD_B_ABS, 0, 0, SKF_NET_OFF),        // 0: A = IP version
+            op(ALU_RSH_K, 0, 0, 4),                 // 1:
+            op(JMP_JEQ_K, 5, 0, 6),                 // 2: IPv6 -> 8
+            op(LD_W_ABS, 0, 0, SKF_NET_OFF + 12),   // 3: IPv4 source address
+            op(ST, 0, 0, 0),                        // 4: M[0] = A
+            op(LDX_B_MSH, 0, 0, SKF_NET_OFF),       // 5: X = IPv4 header length
+            op(LD_H_IND, 0, 0, SKF_NET_OFF),        // 6: A = source port
+            op(JMP_JA, 0, 0, 15),                   // 7: -> 23
+            op(LD_W_ABS, 0, 0, SKF_NET_OFF + 8),    // 8: IPv6 source address
+            op(ST, 0, 0, 0),                        // 9: M[0] = word 0
+            op(LD_W_ABS, 0, 0, SKF_NET_OFF + 12),   // 10:
+            op(LDX_MEM, 0, 0, 0),                   // 11:
+            op(ALU_XOR_X, 0, 0, 0),                 // 12:
+            op(ST, 0, 0, 0),                        // 13: M[0] ^= word 1
+            op(LD_W_ABS, 0, 0, SKF_NET_OFF + 16),   // 14:
+            op(LDX_MEM, 0, 0, 0),                   // 15:
+            op(ALU_XOR_X, 0, 0, 0),                 // 16:
+            op(ST, 0, 0, 0),                        // 17: M[0] ^= word 2
+            op(LD_W_ABS, 0, 0, SKF_NET_OFF + 20),   // 18:
+            op(LDX_MEM, 0, 0, 0),                   // 19:
+            op(ALU_XOR_X, 0, 0, 0),                 // 20:
+            op(ST, 0, 0, 0),                        // 21: M[0] ^= word 3
+            op(LD_H_ABS, 0, 0, SKF_NET_OFF + 40),   // 22: A = source port
+            op(LDX_MEM, 0, 0, 0),                   // 23: X = M[0], the address
+            op(ALU_XOR_X, 0, 0, 0),                 // 24: A = port ^ address
+            op(ALU_MUL_K, 0, 0, 0x9e3779b1),        // 25:
+            op(ALU_RSH_K, 0, 0, 16),                // 26:
+            op(ALU_MOD_K, 0, 0, shards),            // 27:
+            op(RET_A, 0, 0, 0),                     // 28:
+        ]
+    }
+
+    /// Attach program() to the SO_REUSEPORT group of `fd`.
+    pub fn attach(fd: libc::c_int, shards: u32) -> Result<(), std::io::Error> {
+        let mut prog = program(shards);
+        let fprog = libc::sock_fprog {
+            len: prog.len() as _,
+            filter: prog.as_mut_ptr(),
+        };
+        let ret = unsafe {
+            libc::setsockopt(
+                fd,
+                libc::SOL_SOCKET,
+                SO_ATTACH_REUSEPORT_CBPF,
+                &fprog as *const _ as *const _,
+                std::mem::size_of::<libc::sock_fprog>() as libc::socklen_t,
+            )
+        };
+        if ret < 0 {
+            return Err(std::io::Error::last_os_error());
+        }
+        Ok(())
+    }
+
+    #[cfg(test)]
+    mod tests {
+        use super::*;
+
+        /// Run the program over a packet whose network header is at `net`.
+        fn run(prog: &[libc::sock_filter], net: &[u8]) -> u32 {
+            let at = |k: u32, len: usize| {
+                let off = k.wrapping_sub(SKF_NET_OFF) as usize;
+                net[off..off + len].iter().fold(0_u32, |v, b| (v << 8) | *b as u32)
+            };
+            let (mut a, mut x, mut m0, mut pc) = (0_u32, 0_u32, 0_u32, 0);
+            loop {
+                let i = prog[pc];
+                pc += 1;
+                match i.code {
+                    LD_W_ABS => a = at(i.k, 4),
+                    LD_H_ABS => a = at(i.k, 2),
+                    LD_B_ABS => a = at(i.k, 1),
+                    LD_H_IND => a = at(i.k.wrapping_add(x), 2),
+                    LDX_B_MSH => x = (at(i.k, 1) & 0xf) * 4,
+                    LDX_MEM => x = m0,
+                    ST => m0 = a,
+                    ALU_RSH_K => a >>= i.k,
+                    ALU_MUL_K => a = a.wrapping_mul(i.k),
+                    ALU_MOD_K => a %= i.k,
+                    ALU_XOR_X => a ^= x,
+                    JMP_JA => pc += i.k as usize,
+                    JMP_JEQ_K => pc += if a == i.k { i.jt } else { i.jf } as usize,
+                    RET_A => return a,
+                    c => panic!("unexpected instruction {c:#x}"),
+                }
+            }
+        }
+
+        fn expect(addr: u32, port: u16, shards: u32) -> u32 {
+            ((addr ^ port as u32).wrapping_mul(0x9e3779b1) >> 16) % shards
+        }
+
+        #[test]
+        fn test_program_ipv4() {
+            let prog = program(7);
+            for i in 0..64_u32 {
+                let addr = 0x0a000000 | i * 0x10101;
+                let port = 1000 + i as u16 * 17;
+                let mut pkt = vec![0_u8; 28];
+                pkt[0] = 0x45;
+                pkt[12..16].copy_from_slice(&addr.to_be_bytes());
+                pkt[20..22].copy_from_slice(&port.to_be_bytes());
+                assert_eq!(run(&prog, &pkt), expect(addr, port, 7));
+            }
+        }
+
+        #[test]
+        fn test_program_ipv6() {
+            let prog = program(7);
+            let mut shards = std::collections::HashSet::new();
+            for i in 0..64_u32 {
+                // Peers which differ only in the last word of the address
+                let words = [0xfc000000, 0x1234, 0x5678, i * 0x01010101];
+                let port = 4000_u16;
+                let mut pkt = vec![0_u8; 48];
+                pkt[0] = 0x60;
+                for (j, w) in words.iter().enumerate() {
+                    pkt[8 + j * 4..12 + j * 4].copy_from_slice(&w.to_be_bytes());
+                }
+                pkt[40..42].copy_from_slice(&port.to_be_bytes());
+                let shard = run(&prog, &pkt);
+                assert_eq!(shard, expect(words.iter().fold(0, |h, w| h ^ w), port, 7));
+                shards.insert(shard);
+            }
+            assert!(shards.len() > 1, "the address does not change the shard");
+        }
+    }
+}
+
+/// Bind `count` sockets to `bind_addr`, if there is more than one then they share it
+/// with SO_REUSEPORT and the kernel spreads the peers over them.
+fn bind_shards(bind_addr: &SocketAddr, count: usize) -> Result<Vec<socket2::Socket>> {
+    let mut addr = *bind_addr;
+    let mut out = Vec::with_capacity(count);
+    for _ in 0..count {
+        let udp = socket2::Socket::new(
+            Domain::for_address(addr),
+            Type::DGRAM,
+            Some(Protocol::UDP),
+        )?;
+        udp.set_nonblocking(true)?;
+        udp.set_reuse_address(true)?;
+        if count > 1 {
+            set_reuse_port(udp.as_raw_fd()).context("Setting SO_REUSEPORT")?;
+        }
+        udp.bind(&SockAddr::from(addr))?;
+        // If the port was 0, the rest must join the port which the first one got
+        if let Some(real) = udp.local_addr()?.as_socket() {
+            addr = real;
+        }
+        out.push(udp);
+    }
+    #[cfg(target_os = "linux")]
+    if count > 1 {
+        if let Err(e) = steering::attach(out[0].as_raw_fd(), count as u32) {
+            log::info!("Unable to attach UDP steering program, using the kernel's hash: {e}");
+        }
+    }
+    Ok(out)
+}
+
+/// One of the sockets bound to the iface's address, there are several if it was
+/// created with SO_REUSEPORT shards.
+struct Shard {
+    udp: UdpSocket,
+    recv_packets: AtomicU64,
+    send_packets: AtomicU64,
+}
+
+/// Counters of one shard.
+#[derive(Debug, Clone, Copy, Default)]
+pub struct ShardStats {
+    pub fd: i32,
+    pub recv_packets: u64,
+    pub send_packets: u64,
 }
 
 struct UDPAddrIfaceInternal {
     iface: IfacePvt,
-    udp: UdpSocket,
+    shards: Vec<Shard>,
     to_go_out_recv: Mutex<Receiver<(Message,SocketAddr)>>,
     to_go_out_send: Sender<(Message,SocketAddr)>,
 
-    send_worker_states: Vec<AtomicI32>,
-    recv_worker_states: Vec<AtomicI32>,
+    gso_supported: bool,
+    gro_supported: bool,
+    gso: AtomicBool,
+    gro: AtomicBool,
+
+    send_worker_states: Vec<WorkerState>,
+    recv_worker_states: Vec<WorkerState>,
 }
 impl IfRecv for Arc<UDPAddrIfaceInternal> {
     fn recv(&self, mut m: Message) -> Result<()> {
@@ -60,71 +632,141 @@ impl IfRecv for Arc<UDPAddrIfaceInternal> {
 }
 impl UDPAddrIfaceInternal {
     fn send_worker_set_state(self: &Arc<Self>, n: usize, state: SendWorkerState) {
-        self.send_worker_states[n].store(state as i32, std::sync::atomic::Ordering::Relaxed);
+        self.send_worker_states[n].state.store(state as i32, Ordering::Relaxed);
+        self.send_worker_states[n].counter.fetch_add(1, Ordering::Relaxed);
     }
     async fn send_worker(self: Arc<Self>, n: usize) {
-        let mut send_msgs = Vec::with_capacity(SEND_MSGS_LIMIT);
+        let shard = &self.shards[n % self.shards.len()];
+        let fd = shard.udp.as_raw_fd();
+        let mut ctx = UdpBatch::new();
+        let mut batch = VecDeque::with_capacity(MAX_BATCH);
+        let mut batch_vec = Vec::with_capacity(MAX_BATCH);
+        let mut size = BatchSize::with_max(UDP_MAX_BATCH);
         loop {
             self.send_worker_set_state(n, SendWorkerState::WaitLock);
             let mut tgo = self.to_go_out_recv.lock().await;
             self.send_worker_set_state(n, SendWorkerState::RecvBatch);
-            tgo.recv_many(&mut send_msgs, SEND_MSGS_LIMIT).await;
+            if batch.is_empty() {
+                tgo.recv_many(&mut batch_vec, size.get()).await;
+            } else {
+                // Messages are waiting to be retried, top up the batch without waiting
+                while batch.len() + batch_vec.len() < size.get() {
+                    match tgo.try_recv() {
+                        Ok(m) => batch_vec.push(m),
+                        Err(_) => break,
+                    }
+                }
+            }
             drop(tgo);
+            batch.extend(batch_vec.drain(..));
+            size.update(batch.len());
+
+            self.send_worker_set_state(n, SendWorkerState::WaitWritable);
+            if let Err(e) = shard.udp.writable().await {
+                log::info!("Error polling UDP socket writable: {e} - sleep 1 second");
+                tokio::time::sleep(Duration::from_secs(1)).await;
+                continue;
+            }
             self.send_worker_set_state(n, SendWorkerState::SendBatch);
-            for (msg, sa) in send_msgs.drain(..) {
-                // println!("got message with length: {}", msg.len());
-                let bytes = msg.bytes();
-                match self.udp.send_to(bytes, &sa).await {
-                    Ok(_) => {
-                        log::trace!("Message to {sa} sent ok");
-                    },
-                    Err(e) => {
-                        log::info!("Unable to send message (len: {}): {e} to: {}",
-                            bytes.len(), sa);
-                    }
+            let mut sent = 0;
+            let res = shard.udp.try_io(Interest::WRITABLE, || {
+                let (s, err) = ctx.send(fd, &mut batch, &self.gso);
+                sent = s;
+                // Transient errors are returned so tokio clears the readiness,
+                // anything else has already been dealt with by dropping the message.
+                match err {
+                    Some(e) if is_transient(&e) => Err(e),
+                    _ => Ok(()),
                 }
+            });
+            if let Err(e) = res {
+                log::trace!("UDP send worker [{n}] waiting: {e}");
             }
+            self.send_worker_states[n].account(ctx.take_syscalls(), sent, &size);
+            shard.send_packets.fetch_add(sent as u64, Ordering::Relaxed);
         }
     }
     fn recv_worker_set_state(self: &Arc<Self>, n: usize, state: RecvWorkerState) {
-        self.recv_worker_states[n].store(state as i32, std::sync::atomic::Ordering::Relaxed);
+        self.recv_worker_states[n].state.store(state as i32, Ordering::Relaxed);
+        self.recv_worker_states[n].counter.fetch_add(1, Ordering::Relaxed);
     }
     async fn recv_worker(self: Arc<Self>, n: usize) {
-        let mut message = None;
+        let shard = &self.shards[n % self.shards.len()];
+        let fd = shard.udp.as_raw_fd();
+        let mut ctx = UdpBatch::new();
+        let mut batch = VecDeque::with_capacity(MAX_BATCH);
+        let mut ready = Vec::with_capacity(MAX_BATCH);
+        let mut size = BatchSize::with_max(UDP_MAX_BATCH);
         loop {
-            // If we get the lock on the receive channel, drain it and send back until it's empty
-            // Allocate a Message
-            let mut msg = if let Some(msg) = message.take() {
-                msg
-            } else {
-                let mut msg = Message::new(PADDING_AMOUNT + BUFFER_CAP);
+            // Shrinking returns the spare buffers to the pool
+            batch.truncate(size.get());
+            while batch.len() < size.get() {
+                let mut msg = Message::new_pooled(PADDING_AMOUNT + BUFFER_CAP);
                 msg.allocate_uninitialized(BUFFER_CAP).unwrap();
-                msg
-            };
+                batch.push_back(msg);
+            }
+            self.recv_worker_set_state(n, RecvWorkerState::WaitReadable);
+            if let Err(e) = shard.udp.readable().await {
+                log::warn!("Error polling UDP socket readable: {e} - sleep 1 second");
+                tokio::time::sleep(Duration::from_secs(1)).await;
+                continue;
+            }
             self.recv_worker_set_state(n, RecvWorkerState::RecvBatch);
-            let res = self.udp.recv_from(msg.bytes_mut()).await;
+            let gro = self.gro.load(Ordering::Relaxed);
+            let mut received = 0;
+            let res = shard.udp.try_io(Interest::READABLE, || {
+                let (r, err, full) = if gro {
+                    let (r, err) = ctx.recv_gro(fd, &mut ready);
+                    (r, err, GRO_BATCH)
+                } else {
+                    let (r, err) = ctx.recv(fd, &mut batch);
+                    (r, err, batch.len())
+                };
+                received = r;
+                match err {
+                    Some(e) => Err(e),
+                    // recvmmsg() stopped early so the socket is drained, reporting
+                    // WouldBlock has tokio clear the readiness without another syscall.
+                    None if r < full => Err(std::io::ErrorKind::WouldBlock.into()),
+                    None => Ok(()),
+                }
+            });
             self.recv_worker_set_state(n, RecvWorkerState::RecievedBatch);
-            log::trace!("recv_worker got a recv_from");
-            match res {
-                Ok((byte_count,from)) => {
-                    log::trace!("Ok UDP packet from {from} with {byte_count} bytes");
-                    if byte_count == BUFFER_CAP {
-                        log::warn!("Truncated incoming message from {from}");
-                    }
-                    msg.set_len(byte_count).unwrap();
-                    let addr = Sockaddr::from(&from);
-                    msg.push_bytes(addr.bytes()).unwrap();
-                    match self.iface.send(msg) {
-                        Ok(()) => {
-                            log::trace!("UDP receiver thread sent packet successfully");
-                        },
-                        Err(e) => {
-                            log::debug!("Error processing packet: {e}");
-                        }
+            log::trace!("recv_worker got {received} messages");
+            if let Err(e) = res {
+                if !is_transient(&e) {
+                    log::warn!("Error receiving UDP message {e}");
+                }
+            }
+            if gro {
+                // Datagrams are counted after splitting, the batch size is left alone
+                // because GRO has buffers of its own.
+                self.recv_worker_states[n].account(ctx.take_syscalls(), ready.len(), &size);
+            } else {
+                self.recv_worker_states[n].account(ctx.take_syscalls(), received, &size);
+                size.update(received);
+                for _ in 0..received {
+                    let mut msg = batch.pop_front().unwrap();
+                    if msg.cap() == 0 {
+                        // Dropped by UdpBatch::recv(), reuse the buffer
+                        msg.allocate_uninitialized(BUFFER_CAP).unwrap();
+                        batch.push_back(msg);
+                        continue;
                     }
+                    ready.push(msg);
                 }
-                Err(e) => {
-                    log::warn!("Error receiving UDP message {e}");
+            }
+            if !ready.is_empty() {
+                let count = ready.len();
+                shard.recv_packets.fetch_add(count as u64, Ordering::Relaxed);
+                self.recv_worker_set_state(n, RecvWorkerState::IfaceSend);
+                match self.iface.send_batch(&mut ready) {
+                    Ok(()) => {
+                        log::trace!("UDP receiver thread sent {count} packets successfully");
+                    },
+                    Err(e) => {
+                        log::debug!("Error processing packets: {e}");
+                    }
                 }
             }
         }
@@ -135,40 +777,61 @@ impl UDPAddrIfaceInternal {
 pub struct UDPAddrIface {
     internal: Arc<UDPAddrIfaceInternal>,
     pub local_addr: SocketAddr,
+    #[cfg(target_os = "linux")]
+    xdp: parking_lot::Mutex<Option<XdpUdp>>,
 }
 
 impl UDPAddrIface {
-    pub fn new(bind_addr: &SocketAddr) -> Result<(Self,Iface)> {
-        let udp = socket2::Socket::new(
-            Domain::for_address(bind_addr.clone()),
-            Type::DGRAM,
-            Some(Protocol::UDP),
-        )?;
-        udp.set_nonblocking(true)?;
-        udp.set_reuse_address(true)?;
-        let sa = SockAddr::from((*bind_addr).clone());
-        udp.bind(&sa)?;
-        let udp = UdpSocket::from_std(udp.into())?;
-        let real_addr = udp.local_addr()?;
-        let (mut iface, iface_pvt) = iface::new("UDPAddrIface");
-        let (tgo, tgo_r) =
-            tokio::sync::mpsc::channel(TO_GO_OUT_QUEUE);
-
-        let workers = num_cpus::get();
+    /// Bind a UDP socket to `bind_addr`. If `shards` is more than 1, that many sockets
+    /// share the address using SO_REUSEPORT, 0 means one for each receive worker.
+    pub fn new(bind_addr: &SocketAddr, shards: usize) -> Result<(Self,Iface)> {
+        let workers = topology::udp_workers();
         let workers = if workers < 2 {
             log::warn!("UDPAddrIface WORKERS = {workers} is too few, using 2");
             2
         } else {
             workers
         };
+        let shards = match shards {
+            0 => workers,
+            n => n,
+        };
+        // Every shard needs a receive worker
+        let workers = workers.max(shards);
+
+        let socks = bind_shards(bind_addr, shards)?;
+        // Both are off until they are asked for, see set_offload()
+        let gso_supported = gso_supported(socks[0].as_raw_fd());
+        let gro_supported = cfg!(target_os = "linux") && socks.iter().all(|udp| {
+            set_gro(udp.as_raw_fd(), true).and_then(|_| set_gro(udp.as_raw_fd(), false)).is_ok()
+        });
+        log::info!("UDP offload: GSO {}, GRO {}",
+            if gso_supported { "supported" } else { "not supported" },
+            if gro_supported { "supported" } else { "not supported" });
+        let mut shard_v = Vec::with_capacity(socks.len());
+        for udp in socks {
+            shard_v.push(Shard {
+                udp: UdpSocket::from_std(udp.into())?,
+                recv_packets: AtomicU64::new(0),
+                send_packets: AtomicU64::new(0),
+            });
+        }
+        let real_addr = shard_v[0].udp.local_addr()?;
+        let (mut iface, iface_pvt) = iface::new("UDPAddrIface");
+        let (tgo, tgo_r) =
+            tokio::sync::mpsc::channel(TO_GO_OUT_QUEUE);
 
         let internal = Arc::new(UDPAddrIfaceInternal {
             iface: iface_pvt,
-            udp,
+            shards: shard_v,
             to_go_out_recv: Mutex::new(tgo_r),
             to_go_out_send: tgo,
-            send_worker_states: (0..workers).map(|_|AtomicI32::new(0)).collect(),
-            recv_worker_states: (0..workers).map(|_|AtomicI32::new(0)).collect(),
+            gso_supported,
+            gro_supported,
+            gso: AtomicBool::new(false),
+            gro: AtomicBool::new(false),
+            send_worker_states: (0..workers).map(|_|Default::default()).collect(),
+            recv_worker_states: (0..workers).map(|_|Default::default()).collect(),
         });
         iface.set_receiver(Arc::clone(&internal));
 
@@ -180,59 +843,330 @@ impl UDPAddrIface {
             UDPAddrIface{
                 internal,
                 local_addr: real_addr,
+                #[cfg(target_os = "linux")]
+                xdp: Default::default(),
             },
             iface
         ))
     }
 
     pub fn set_dscp(&self, dscp: u8) -> Result<()> {
-        let local_addr = self.internal.udp.local_addr()?;
         let tos = (dscp as u32) << 2;
-        if local_addr.is_ipv6() {
-            socket2::SockRef::from(&self.internal.udp).set_tclass_v6(tos)?;
-        } else {
-            self.internal.udp.set_tos(tos)?;
+        for shard in &self.internal.shards {
+            if self.local_addr.is_ipv6() {
+                socket2::SockRef::from(&shard.udp).set_tclass_v6(tos)?;
+            } else {
+                shard.udp.set_tos(tos)?;
+            }
         }
         Ok(())
     }
 
     pub fn set_broadcast(&self, enable: bool) -> Result<()> {
-        self.internal.udp.set_broadcast(enable)?;
+        for shard in &self.internal.shards {
+            shard.udp.set_broadcast(enable)?;
+        }
         Ok(())
     }
 
+    pub fn shard_stats(&self) -> Vec<ShardStats> {
+        self.internal.shards.iter().map(|shard| ShardStats {
+            fd: shard.udp.as_raw_fd(),
+            recv_packets: shard.recv_packets.load(Ordering::Relaxed),
+            send_packets: shard.send_packets.load(Ordering::Relaxed),
+        }).collect()
+    }
+
+    pub fn offload(&self) -> Offload {
+        Offload {
+            gso_supported: self.internal.gso_supported,
+            gso: self.internal.gso.load(Ordering::Relaxed),
+            gro_supported: self.internal.gro_supported,
+            gro: self.internal.gro.load(Ordering::Relaxed),
+        }
+    }
+
+    /// Turn GSO and/or GRO on or off, None leaves it as it is.
+    /// It is an error to turn on one which is not supported.
+    pub fn set_offload(&self, gso: Option<bool>, gro: Option<bool>) -> Result<Offload> {
+        if gso == Some(true) && !self.internal.gso_supported {
+            eyre::bail!("UDP segmentation offload (GSO) is not supported");
+        }
+        if gro == Some(true) && !self.internal.gro_supported {
+            eyre::bail!("UDP receive offload (GRO) is not supported");
+        }
+        if let Some(gso) = gso {
+            self.internal.gso.store(gso, Ordering::Relaxed);
+        }
+        if let Some(gro) = gro {
+            // The workers switch to large buffers before GRO is turned on and
+            // switch back only after it is turned off.
+            if gro {
+                self.internal.gro.store(true, Ordering::Relaxed);
+            }
+            if self.internal.gro_supported {
+                for shard in &self.internal.shards {
+                    set_gro(shard.udp.as_raw_fd(), gro)?;
+                }
+            }
+            if !gro {
+                self.internal.gro.store(false, Ordering::Relaxed);
+            }
+        }
+        Ok(self.offload())
+    }
+
+    /// Take datagrams to this socket from device `ifname` on AF_XDP sockets, see XdpUdp,
+    /// or if it is None go back to receiving everything on the socket.
+    /// Returns whether the XDP program runs in the driver and the number of queues.
+    #[cfg(target_os = "linux")]
+    pub fn set_xdp(&self, ifname: Option<&str>, mode: XdpMode) -> Result<Option<(bool, u32)>> {
+        let mut xdp = self.xdp.lock();
+        // Detach the old program first, a device takes only one
+        *xdp = None;
+        let ifname = match ifname {
+            Some(n) => n,
+            None => return Ok(None),
+        };
+        let internal = Arc::clone(&self.internal);
+        let x = XdpUdp::new(ifname, &self.local_addr, mode, move |ready| {
+            if let Err(e) = internal.iface.send_batch(ready) {
+                log::debug!("Error processing packets: {e}");
+            }
+        })?;
+        let out = (x.native, x.queues);
+        *xdp = Some(x);
+        Ok(Some(out))
+    }
+
+    pub fn shard_count(&self) -> usize {
+        self.internal.shards.len()
+    }
+
+    /// The fd of one of the shards, -1 if there is no such shard.
     #[cfg(os = "windows")]
-    pub fn get_fd(&self) -> u32 {
+    pub fn get_fd(&self, _shard: usize) -> u32 {
         -1
     }
 
+    /// The fd of one of the shards, -1 if there is no such shard.
     #[cfg(not(os = "windows"))]
-    pub fn get_fd(&self) -> i32 {
+    pub fn get_fd(&self, shard: usize) -> i32 {
         use std::os::fd::AsFd;
-        use std::os::fd::AsRawFd;
-        let bfd = self.internal.udp.as_fd();
-        bfd.as_raw_fd()
+        match self.internal.shards.get(shard) {
+            Some(s) => s.udp.as_fd().as_raw_fd(),
+            None => -1,
+        }
     }
 
-    pub fn worker_states(&self) -> (Vec<SendWorkerState>,Vec<RecvWorkerState>) {
+    pub fn worker_states(&self) -> (Vec<(SendWorkerState, WorkerStats)>,Vec<(RecvWorkerState, WorkerStats)>) {
         let mut rout = Vec::with_capacity(self.internal.recv_worker_states.len());
         let mut sout = Vec::with_capacity(self.internal.send_worker_states.len());
         for r in &self.internal.recv_worker_states {
-            let n = r.load(std::sync::atomic::Ordering::Relaxed);
+            let n = r.state.load(Ordering::Relaxed);
             let x = match RecvWorkerState::try_from(n) {
                 Ok(x) => x,
                 Err(_) => RecvWorkerState::Invalid,
             };
-            rout.push(x);
+            rout.push((x, r.stats()));
         }
         for s in &self.internal.send_worker_states {
-            let n = s.load(std::sync::atomic::Ordering::Relaxed);
+            let n = s.state.load(Ordering::Relaxed);
             let x = match SendWorkerState::try_from(n) {
                 Ok(x) => x,
                 Err(_) => SendWorkerState::Invalid,
             };
-            sout.push(x);
+            sout.push((x, s.stats()));
         }
         (sout, rout)
     }
-}
\ No newline at end of file
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn loopback_pair() -> (std::net::UdpSocket, std::net::UdpSocket) {
+        let a = std::net::UdpSocket::bind("127.0.0.1:0").unwrap();
+        let b = std::net::UdpSocket::bind("127.0.0.1:0").unwrap();
+        b.set_nonblocking(true).unwrap();
+        (a, b)
+    }
+
+    fn outgoing(n: usize, size: usize, to: SocketAddr) -> VecDeque<(Message, SocketAddr)> {
+        (0..n).map(|i| {
+            let mut msg = Message::new(PADDING_AMOUNT + size);
+            msg.push_bytes(&vec![i as u8; size]).unwrap();
+            (msg, to)
+        }).collect()
+    }
+
+    fn incoming(n: usize) -> VecDeque<Message> {
+        (0..n).map(|_| {
+            let mut msg = Message::new(PADDING_AMOUNT + BUFFER_CAP);
+            msg.allocate_uninitialized(BUFFER_CAP).unwrap();
+            msg
+        }).collect()
+    }
+
+    #[test]
+    fn test_udp_batch() {
+        let (a, b) = loopback_pair();
+        let mut ctx = UdpBatch::new();
+        let mut out = outgoing(3, 100, b.local_addr().unwrap());
+        let (sent, err) = ctx.send(a.as_raw_fd(), &mut out, &AtomicBool::new(false));
+        assert!(err.is_none());
+        assert_eq!(sent, 3);
+        assert!(out.is_empty());
+
+        let mut inb = incoming(8);
+        let (received, _) = ctx.recv(b.as_raw_fd(), &mut inb);
+        assert_eq!(received, 3);
+        for (i, msg) in inb.iter_mut().take(received).enumerate() {
+            let sa = Sockaddr::try_from(msg.bytes()).unwrap();
+            assert_eq!(sa.rs().unwrap(), a.local_addr().unwrap());
+            msg.discard_bytes(sa.byte_len()).unwrap();
+            assert_eq!(msg.bytes(), &vec![i as u8; 100][..]);
+        }
+        if cfg!(target_os = "linux") {
+            assert_eq!(ctx.take_syscalls(), 2);
+        }
+    }
+
+    #[test]
+    fn test_gso_gro() {
+        let (a, b) = loopback_pair();
+        if !gso_supported(a.as_raw_fd()) || set_gro(b.as_raw_fd(), true).is_err() {
+            println!("GSO/GRO not supported, skipping");
+            return;
+        }
+        let mut ctx = UdpBatch::new();
+        // 10 full segments and a short one, then one to another address
+        let to = b.local_addr().unwrap();
+        let mut out = outgoing(11, 1200, to);
+        out[10].0.discard_bytes(200).unwrap();
+        out.extend(outgoing(1, 1200, a.local_addr().unwrap()));
+        let gso = AtomicBool::new(true);
+        let (sent, err) = ctx.send(a.as_raw_fd(), &mut out, &gso);
+        assert!(err.is_none());
+        assert_eq!(sent, 12);
+        assert_eq!(&ctx.segments[0..2], &[11, 1]);
+        assert!(gso.load(Ordering::Relaxed));
+
+        // Whether the kernel coalesces them or not, they come out as they went in
+        let mut inb = Vec::new();
+        let mut datagrams = 0;
+        loop {
+            let (r, err) = ctx.recv_gro(b.as_raw_fd(), &mut inb);
+            datagrams += r;
+            if let Some(e) = err {
+                assert_eq!(e.kind(), std::io::ErrorKind::WouldBlock);
+                break;
+            }
+        }
+        println!("11 messages in {datagrams} datagrams");
+        assert_eq!(inb.len(), 11);
+        for (i, msg) in inb.iter_mut().enumerate() {
+            let sa = Sockaddr::try_from(msg.bytes()).unwrap();
+            assert_eq!(sa.rs().unwrap(), a.local_addr().unwrap());
+            msg.discard_bytes(sa.byte_len()).unwrap();
+            assert_eq!(msg.len(), if i == 10 { 1000 } else { 1200 });
+            assert!(msg.bytes().iter().all(|b| *b == i as u8));
+        }
+    }
+
+    fn check_shards(local: &str) {
+        let shards = bind_shards(&format!("{local}:0").parse().unwrap(), 4).unwrap();
+        let to = shards[0].local_addr().unwrap().as_socket().unwrap();
+        for s in &shards {
+            assert_eq!(s.local_addr().unwrap().as_socket().unwrap(), to);
+        }
+        #[cfg(target_os = "linux")]
+        steering::attach(shards[0].as_raw_fd(), 4).unwrap();
+
+        let peers = (0..16).map(|_| std::net::UdpSocket::bind(format!("{local}:0")).unwrap()).collect::<Vec<_>>();
+        for p in &peers {
+            for _ in 0..4 {
+                p.send_to(b"hello", to).unwrap();
+            }
+        }
+        // Every peer's packets all land on one shard
+        let mut seen = std::collections::HashMap::new();
+        let mut buf = [std::mem::MaybeUninit::new(0_u8); 64];
+        let mut count = 0;
+        for (i, s) in shards.iter().enumerate() {
+            while let Ok((_, from)) = s.recv_from(&mut buf) {
+                let from = from.as_socket().unwrap();
+                assert_eq!(*seen.entry(from).or_insert(i), i, "{} on two shards", from);
+                count += 1;
+            }
+        }
+        assert_eq!(count, peers.len() * 4);
+        assert_eq!(seen.len(), peers.len());
+    }
+
+    #[test]
+    fn test_shards() {
+        check_shards("127.0.0.1");
+    }
+
+    #[test]
+    fn test_shards_ipv6() {
+        if std::net::UdpSocket::bind("[::1]:0").is_err() {
+            println!("No IPv6 loopback, skipping");
+            return;
+        }
+        check_shards("[::1]");
+    }
+
+    #[test]
+    #[ignore]
+    fn bench_loopback_pps() {
+        // cargo test --release -- --ignored --nocapture bench_loopback_pps
+        let (a, b) = loopback_pair();
+        let to = b.local_addr().unwrap();
+        let rounds = 200_000;
+
+        // One send_to() and one recv_from() per packet, as UDPAddrIface used to
+        let start = std::time::Instant::now();
+        for _ in 0..rounds {
+            let (msg, to) = outgoing(1, 1400, to).pop_front().unwrap();
+            a.send_to(msg.bytes(), to).unwrap();
+            let mut msg = incoming(1).pop_front().unwrap();
+            b.recv_from(msg.bytes_mut()).unwrap();
+        }
+        let el = start.elapsed();
+        println!("unbatched: {:.0} pps", rounds as f64 / el.as_secs_f64());
+
+        let mut ctx = UdpBatch::new();
+        for batch in [8, UDP_MAX_BATCH, MAX_BATCH] {
+            let (mut pkts, start) = (0, std::time::Instant::now());
+            while pkts < rounds {
+                let mut out = outgoing(batch, 1400, to);
+                ctx.send(a.as_raw_fd(), &mut out, &AtomicBool::new(false));
+                let mut inb = incoming(batch);
+                pkts += ctx.recv(b.as_raw_fd(), &mut inb).0;
+            }
+            let el = start.elapsed();
+            println!("batch {batch}: {:.0} pps, {:.3} syscalls/packet",
+                pkts as f64 / el.as_secs_f64(), ctx.take_syscalls() as f64 / pkts as f64);
+        }
+
+        if !gso_supported(a.as_raw_fd()) || set_gro(b.as_raw_fd(), true).is_err() {
+            return;
+        }
+        let gso = AtomicBool::new(true);
+        let mut inb = Vec::with_capacity(GRO_BATCH * GSO_MAX_SEGMENTS);
+        let (mut pkts, start) = (0, std::time::Instant::now());
+        while pkts < rounds {
+            let mut out = outgoing(MAX_BATCH, 1400, to);
+            ctx.send(a.as_raw_fd(), &mut out, &gso);
+            ctx.recv_gro(b.as_raw_fd(), &mut inb);
+            pkts += inb.len();
+            inb.clear();
+        }
+        let el = start.elapsed();
+        println!("batch {MAX_BATCH} with GSO/GRO: {:.0} pps, {:.3} syscalls/packet",
+            pkts as f64 / el.as_secs_f64(), ctx.take_syscalls() as f64 / pkts as f64);
+    }
+}
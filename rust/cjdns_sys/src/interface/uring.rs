@@ -0,0 +1,872 @@
+//! A minimal io_uring for the SocketIface workers (Linux)
+//!
+//! Only what the workers need is here: a ring with an eventfd which is signalled
+//! for every completion, a provided buffer ring which multishot receives pick
+//! the caller's buffers from, and the few operations which they submit. A receive stays armed
+//! across many packets and sends are submitted as one linked chain per batch, so
+//! a busy worker makes about one syscall per batch and none per packet.
+
+use std::convert::TryInto;
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+use std::sync::atomic::{AtomicU16, AtomicU32, Ordering};
+use tokio::io::unix::AsyncFd;
+
+const IORING_SETUP_CQSIZE: u32 = 1 << 3;
+const IORING_FEAT_SINGLE_MMAP: u32 = 1 << 0;
+const IORING_ENTER_GETEVENTS: u32 = 1 << 0;
+const IORING_OFF_SQ_RING: libc::off_t = 0;
+const IORING_OFF_CQ_RING: libc::off_t = 0x8000000;
+const IORING_OFF_SQES: libc::off_t = 0x10000000;
+const IORING_REGISTER_EVENTFD: libc::c_uint = 4;
+const IORING_REGISTER_PBUF_RING: libc::c_uint = 22;
+const IORING_UNREGISTER_PBUF_RING: libc::c_uint = 23;
+
+const IORING_OP_SENDMSG: u8 = 9;
+const IORING_OP_RECVMSG: u8 = 10;
+const IORING_OP_ASYNC_CANCEL: u8 = 14;
+const IORING_OP_READ: u8 = 22;
+const IORING_OP_WRITE: u8 = 23;
+const IOSQE_IO_LINK: u8 = 1 << 2;
+const IOSQE_BUFFER_SELECT: u8 = 1 << 5;
+const IORING_RECV_MULTISHOT: u16 = 1 << 1;
+const IORING_ASYNC_CANCEL_ANY: u32 = 1 << 2;
+
+/// user_data of the cancel which cancel_all() submits.
+const CANCEL_USER_DATA: u64 = u64::MAX;
+
+const IORING_CQE_F_BUFFER: u32 = 1 << 0;
+const IORING_CQE_F_MORE: u32 = 1 << 1;
+const IORING_CQE_BUFFER_SHIFT: u32 = 16;
+
+/// sizeof(struct io_uring_recvmsg_out), which comes before the name, control data
+/// and payload in the buffer of a multishot recvmsg.
+pub(crate) const RECVMSG_OUT_LEN: usize = 16;
+
+#[repr(C)]
+#[derive(Default)]
+struct SqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    flags: u32,
+    dropped: u32,
+    array: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct CqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    overflow: u32,
+    cqes: u32,
+    flags: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct Params {
+    sq_entries: u32,
+    cq_entries: u32,
+    flags: u32,
+    sq_thread_cpu: u32,
+    sq_thread_idle: u32,
+    features: u32,
+    wq_fd: u32,
+    resv: [u32; 3],
+    sq_off: SqringOffsets,
+    cq_off: CqringOffsets,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct BufReg {
+    ring_addr: u64,
+    ring_entries: u32,
+    bgid: u16,
+    flags: u16,
+    resv: [u64; 3],
+}
+
+/// struct io_uring_sqe, only the fields which are used.
+#[repr(C)]
+#[derive(Default, Clone, Copy)]
+pub(crate) struct Sqe {
+    opcode: u8,
+    flags: u8,
+    ioprio: u16,
+    fd: i32,
+    off: u64,
+    addr: u64,
+    len: u32,
+    op_flags: u32,
+    user_data: u64,
+    buf_group: u16,
+    personality: u16,
+    file_index: i32,
+    addr3: u64,
+    pad: u64,
+}
+const _: () = assert!(std::mem::size_of::<Sqe>() == 64);
+
+impl Sqe {
+    /// Receive until cancelled or out of buffers, each message goes in a buffer from
+    /// group bgid, laid out as described by RecvmsgOut. Only msg_namelen and
+    /// msg_controllen of hdr are used, to size those parts of the buffer.
+    pub(crate) fn recvmsg_multishot(fd: RawFd, hdr: *const libc::msghdr, bgid: u16) -> Self {
+        Self {
+            opcode: IORING_OP_RECVMSG,
+            flags: IOSQE_BUFFER_SELECT,
+            ioprio: IORING_RECV_MULTISHOT,
+            fd,
+            addr: hdr as u64,
+            len: 1,
+            buf_group: bgid,
+            ..Default::default()
+        }
+    }
+    /// Read one frame into a buffer from group bgid.
+    pub(crate) fn read_select(fd: RawFd, len: usize, bgid: u16) -> Self {
+        Self {
+            opcode: IORING_OP_READ,
+            flags: IOSQE_BUFFER_SELECT,
+            fd,
+            off: u64::MAX,
+            len: len as u32,
+            buf_group: bgid,
+            ..Default::default()
+        }
+    }
+    /// Cancel every operation on the ring, Linux 5.19.
+    fn cancel_any() -> Self {
+        Self {
+            opcode: IORING_OP_ASYNC_CANCEL,
+            fd: -1,
+            op_flags: IORING_ASYNC_CANCEL_ANY,
+            ..Default::default()
+        }
+    }
+    pub(crate) fn sendmsg(fd: RawFd, hdr: *const libc::msghdr) -> Self {
+        Self { opcode: IORING_OP_SENDMSG, fd, addr: hdr as u64, len: 1, ..Default::default() }
+    }
+    pub(crate) fn write(fd: RawFd, buf: &[u8]) -> Self {
+        Self {
+            opcode: IORING_OP_WRITE,
+            fd,
+            off: u64::MAX,
+            addr: buf.as_ptr() as u64,
+            len: buf.len() as u32,
+            ..Default::default()
+        }
+    }
+    /// The next entry is not started until this one completes, and is cancelled if
+    /// this one fails.
+    pub(crate) fn link(mut self) -> Self {
+        self.flags |= IOSQE_IO_LINK;
+        self
+    }
+    pub(crate) fn user_data(mut self, user_data: u64) -> Self {
+        self.user_data = user_data;
+        self
+    }
+}
+
+/// struct io_uring_cqe
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub(crate) struct Cqe {
+    pub(crate) user_data: u64,
+    pub(crate) res: i32,
+    pub(crate) flags: u32,
+}
+
+impl Cqe {
+    /// The result as an io::Result.
+    pub(crate) fn result(&self) -> std::io::Result<usize> {
+        if self.res < 0 {
+            Err(std::io::Error::from_raw_os_error(-self.res))
+        } else {
+            Ok(self.res as usize)
+        }
+    }
+    /// The id of the provided buffer which was used, if any.
+    pub(crate) fn buffer(&self) -> Option<u16> {
+        if self.flags & IORING_CQE_F_BUFFER != 0 {
+            Some((self.flags >> IORING_CQE_BUFFER_SHIFT) as u16)
+        } else {
+            None
+        }
+    }
+    /// False if this was the last completion of a multishot operation.
+    pub(crate) fn more(&self) -> bool {
+        self.flags & IORING_CQE_F_MORE != 0
+    }
+}
+
+/// An mmap()'d region, unmapped on drop.
+struct Mmap {
+    base: *mut u8,
+    len: usize,
+}
+impl Mmap {
+    fn new(len: usize, fd: RawFd, off: libc::off_t) -> std::io::Result<Self> {
+        let flags = if fd < 0 {
+            libc::MAP_PRIVATE | libc::MAP_ANONYMOUS
+        } else {
+            libc::MAP_SHARED | libc::MAP_POPULATE
+        };
+        let base = unsafe {
+            libc::mmap(std::ptr::null_mut(), len, libc::PROT_READ | libc::PROT_WRITE, flags, fd, off)
+        };
+        if base == libc::MAP_FAILED {
+            return Err(std::io::Error::last_os_error());
+        }
+        Ok(Self { base: base as *mut u8, len })
+    }
+    fn at<T>(&self, off: u32) -> *mut T {
+        assert!(off as usize + std::mem::size_of::<T>() <= self.len);
+        unsafe { self.base.add(off as usize) as *mut T }
+    }
+}
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.base as *mut libc::c_void, self.len) };
+    }
+}
+
+fn register(fd: &OwnedFd, opcode: libc::c_uint, arg: *const libc::c_void, nr: u32) -> std::io::Result<()> {
+    let ret = unsafe {
+        libc::syscall(libc::SYS_io_uring_register, fd.as_raw_fd(), opcode, arg, nr)
+    };
+    if ret < 0 {
+        return Err(std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+pub(crate) struct Uring {
+    fd: OwnedFd,
+    sq_ring: Mmap,
+    // None if the CQ ring is in the same mapping as the SQ ring
+    cq_ring: Option<Mmap>,
+    sqes: Mmap,
+    p: Params,
+    /// Entries added to the SQ which have not been submitted
+    pending: u32,
+    /// Entries added to the SQ whose last completion has not been popped, the kernel
+    /// may still use memory which they refer to.
+    inflight: u32,
+    /// Syscalls made since the last take_syscalls()
+    syscalls: u64,
+}
+// The rings are only touched through &mut self
+unsafe impl Send for Uring {}
+unsafe impl Sync for Uring {}
+
+impl Uring {
+    pub(crate) fn new(entries: u32, cq_entries: u32) -> std::io::Result<Self> {
+        let mut p = Params { flags: IORING_SETUP_CQSIZE, cq_entries, ..Default::default() };
+        let fd = unsafe { libc::syscall(libc::SYS_io_uring_setup, entries, &mut p as *mut Params) };
+        if fd < 0 {
+            return Err(std::io::Error::last_os_error());
+        }
+        let fd = unsafe { OwnedFd::from_raw_fd(fd as RawFd) };
+        let raw = fd.as_raw_fd();
+        let sq_len = p.sq_off.array as usize + p.sq_entries as usize * 4;
+        let cq_len = p.cq_off.cqes as usize + p.cq_entries as usize * std::mem::size_of::<Cqe>();
+        let (sq_ring, cq_ring) = if p.features & IORING_FEAT_SINGLE_MMAP != 0 {
+            (Mmap::new(sq_len.max(cq_len), raw, IORING_OFF_SQ_RING)?, None)
+        } else {
+            (
+                Mmap::new(sq_len, raw, IORING_OFF_SQ_RING)?,
+                Some(Mmap::new(cq_len, raw, IORING_OFF_CQ_RING)?),
+            )
+        };
+        let sqes = Mmap::new(p.sq_entries as usize * std::mem::size_of::<Sqe>(), raw, IORING_OFF_SQES)?;
+        Ok(Self { fd, sq_ring, cq_ring, sqes, p, pending: 0, inflight: 0, syscalls: 0 })
+    }
+
+    fn cq(&self) -> &Mmap {
+        self.cq_ring.as_ref().unwrap_or(&self.sq_ring)
+    }
+    fn atomic(m: &Mmap, off: u32) -> &AtomicU32 {
+        unsafe { &*m.at::<AtomicU32>(off) }
+    }
+
+    /// Have the kernel signal efd whenever there is a completion.
+    pub(crate) fn register_eventfd(&self, efd: RawFd) -> std::io::Result<()> {
+        register(&self.fd, IORING_REGISTER_EVENTFD, &efd as *const RawFd as *const libc::c_void, 1)
+    }
+
+    /// Add an entry to the submission queue, false if it is full.
+    pub(crate) fn push(&mut self, sqe: Sqe) -> bool {
+        let head = Self::atomic(&self.sq_ring, self.p.sq_off.head).load(Ordering::Acquire);
+        let tail = Self::atomic(&self.sq_ring, self.p.sq_off.tail).load(Ordering::Relaxed);
+        if tail.wrapping_sub(head) >= self.p.sq_entries {
+            return false;
+        }
+        let mask = unsafe { *self.sq_ring.at::<u32>(self.p.sq_off.ring_mask) };
+        let idx = tail & mask;
+        unsafe {
+            *self.sqes.at::<Sqe>(idx * std::mem::size_of::<Sqe>() as u32) = sqe;
+            *self.sq_ring.at::<u32>(self.p.sq_off.array + idx * 4) = idx;
+        }
+        Self::atomic(&self.sq_ring, self.p.sq_off.tail).store(tail.wrapping_add(1), Ordering::Release);
+        self.pending += 1;
+        self.inflight += 1;
+        true
+    }
+
+    /// Room in the submission queue.
+    pub(crate) fn space(&self) -> u32 {
+        let head = Self::atomic(&self.sq_ring, self.p.sq_off.head).load(Ordering::Acquire);
+        let tail = Self::atomic(&self.sq_ring, self.p.sq_off.tail).load(Ordering::Relaxed);
+        self.p.sq_entries - tail.wrapping_sub(head)
+    }
+
+    /// Submit what has been pushed, and if wait is non-zero block until there are that
+    /// many completions.
+    pub(crate) fn submit(&mut self, wait: u32) -> std::io::Result<()> {
+        if self.pending == 0 && wait == 0 {
+            return Ok(());
+        }
+        let flags = if wait > 0 { IORING_ENTER_GETEVENTS } else { 0 };
+        loop {
+            self.syscalls += 1;
+            let ret = unsafe {
+                libc::syscall(
+                    libc::SYS_io_uring_enter,
+                    self.fd.as_raw_fd(),
+                    self.pending,
+                    wait,
+                    flags,
+                    std::ptr::null::<libc::c_void>(),
+                    0,
+                )
+            };
+            if ret >= 0 {
+                self.pending -= (ret as u32).min(self.pending);
+                return Ok(());
+            }
+            let err = std::io::Error::last_os_error();
+            if err.kind() != std::io::ErrorKind::Interrupted {
+                return Err(err);
+            }
+        }
+    }
+
+    /// Take the next completion, if there is one.
+    pub(crate) fn pop(&mut self) -> Option<Cqe> {
+        let cq = self.cq();
+        let head = Self::atomic(cq, self.p.cq_off.head).load(Ordering::Relaxed);
+        let tail = Self::atomic(cq, self.p.cq_off.tail).load(Ordering::Acquire);
+        if head == tail {
+            return None;
+        }
+        let mask = unsafe { *cq.at::<u32>(self.p.cq_off.ring_mask) };
+        let off = self.p.cq_off.cqes + (head & mask) * std::mem::size_of::<Cqe>() as u32;
+        let cqe = unsafe { *cq.at::<Cqe>(off) };
+        Self::atomic(cq, self.p.cq_off.head).store(head.wrapping_add(1), Ordering::Release);
+        if !cqe.more() {
+            self.inflight -= 1;
+        }
+        Some(cqe)
+    }
+
+    /// Cancel everything which is in flight and wait for the last completion of each,
+    /// after that the kernel no longer touches the buffers and headers which they
+    /// refer to. Completions which are not yet popped are discarded.
+    pub(crate) fn cancel_all(&mut self) -> std::io::Result<()> {
+        if self.inflight == 0 {
+            return Ok(());
+        }
+        if self.space() == 0 {
+            self.submit(0)?;
+        }
+        let mut cancelled = self.push(Sqe::cancel_any().user_data(CANCEL_USER_DATA));
+        while self.inflight > 0 {
+            self.submit(1)?;
+            while let Some(cqe) = self.pop() {
+                if cqe.user_data == CANCEL_USER_DATA && cqe.res == -libc::EINVAL {
+                    // Before 5.19 there is no cancelling everything at once, but only
+                    // sends can be in flight since receives need provided buffer rings
+                    // which are just as new, and sends finish on their own.
+                    cancelled = false;
+                }
+            }
+        }
+        if !cancelled {
+            log::debug!("io_uring operations waited for rather than cancelled");
+        }
+        Ok(())
+    }
+
+    pub(crate) fn take_syscalls(&mut self) -> u64 {
+        std::mem::take(&mut self.syscalls)
+    }
+}
+
+impl Drop for Uring {
+    fn drop(&mut self) {
+        // The memory which operations refer to is freed right after this
+        if let Err(e) = self.cancel_all() {
+            log::error!("Unable to cancel io_uring operations: {e}");
+        }
+    }
+}
+
+/// A ring of buffers which the kernel picks from for IOSQE_BUFFER_SELECT operations.
+/// The buffers belong to the caller, which lends each one to the kernel with
+/// provide() and gets it back, filled, in the completion which names its bid.
+pub(crate) struct BufRing {
+    /// The ring is unregistered through this, which keeps the io_uring alive until then
+    fd: OwnedFd,
+    ring: Mmap,
+    count: u16,
+    tail: u16,
+    pub(crate) bgid: u16,
+}
+unsafe impl Send for BufRing {}
+unsafe impl Sync for BufRing {}
+
+impl BufRing {
+    /// An empty ring with room for count buffers, count must be a power of 2.
+    pub(crate) fn new(uring: &Uring, bgid: u16, count: u16) -> std::io::Result<Self> {
+        assert!(count.is_power_of_two());
+        let ring = Mmap::new(count as usize * 16, -1, 0)?;
+        let reg = BufReg {
+            ring_addr: ring.base as u64,
+            ring_entries: count as u32,
+            bgid,
+            ..Default::default()
+        };
+        let fd = uring.fd.try_clone()?;
+        register(&fd, IORING_REGISTER_PBUF_RING, &reg as *const BufReg as *const libc::c_void, 1)?;
+        Ok(Self { fd, ring, count, tail: 0, bgid })
+    }
+
+    /// Lend buf to the kernel as buffer bid, it is not seen until publish().
+    /// Each bid may be lent once at a time, no more than count in all.
+    ///
+    /// *Unsafe:* the kernel may write to buf until a completion hands bid back, or
+    /// until nothing which selects from this ring is in flight any more.
+    pub(crate) unsafe fn provide(&mut self, bid: u16, buf: *mut u8, len: usize) {
+        assert!(bid < self.count);
+        let e = (self.tail & (self.count - 1)) as u32 * 16;
+        // The tail shares the resv field of the first entry so that is not written
+        *self.ring.at::<u64>(e) = buf as u64;
+        *self.ring.at::<u32>(e + 8) = len as u32;
+        *self.ring.at::<u16>(e + 12) = bid;
+        self.tail = self.tail.wrapping_add(1);
+    }
+
+    /// Make the buffers provided so far available to the kernel.
+    pub(crate) fn publish(&self) {
+        unsafe { &*self.ring.at::<AtomicU16>(14) }.store(self.tail, Ordering::Release);
+    }
+}
+
+impl Drop for BufRing {
+    fn drop(&mut self) {
+        // Before the ring's memory is unmapped, after this the kernel picks no more
+        // buffers from it and the bgid is free again
+        let reg = BufReg { bgid: self.bgid, ..Default::default() };
+        if let Err(e) = register(
+            &self.fd,
+            IORING_UNREGISTER_PBUF_RING,
+            &reg as *const BufReg as *const libc::c_void,
+            1,
+        ) {
+            log::error!("Unable to unregister io_uring buffer ring {}: {e}", self.bgid);
+        }
+    }
+}
+
+/// The parts of a buffer which was filled by a multishot recvmsg.
+pub(crate) struct RecvmsgOut<'a> {
+    pub(crate) name: &'a [u8],
+    pub(crate) control: &'a [u8],
+    pub(crate) payload: &'a [u8],
+    pub(crate) flags: u32,
+}
+
+impl<'a> RecvmsgOut<'a> {
+    /// namelen and controllen are those of the msghdr which the recvmsg was made with.
+    pub(crate) fn parse(buf: &'a [u8], namelen: usize, controllen: usize) -> Option<Self> {
+        let word = |i: usize| u32::from_ne_bytes(buf[i * 4..i * 4 + 4].try_into().unwrap()) as usize;
+        let start = RECVMSG_OUT_LEN + namelen + controllen;
+        if buf.len() < start {
+            return None;
+        }
+        let name = &buf[RECVMSG_OUT_LEN..RECVMSG_OUT_LEN + word(0).min(namelen)];
+        let control = &buf[RECVMSG_OUT_LEN + namelen..][..word(1).min(controllen)];
+        let payload = &buf[start..][..word(2).min(buf.len() - start)];
+        Some(Self { name, control, payload, flags: word(3) as u32 })
+    }
+}
+
+/// A Uring which a task can wait on, an eventfd registered with it is signalled
+/// for every completion and is polled by tokio.
+pub(crate) struct AsyncUring {
+    pub(crate) ring: Uring,
+    efd: AsyncFd<OwnedFd>,
+}
+
+impl AsyncUring {
+    /// Must be called from within the tokio runtime.
+    pub(crate) fn new(entries: u32, cq_entries: u32) -> std::io::Result<Self> {
+        let ring = Uring::new(entries, cq_entries)?;
+        let fd = unsafe { libc::eventfd(0, libc::EFD_NONBLOCK | libc::EFD_CLOEXEC) };
+        if fd < 0 {
+            return Err(std::io::Error::last_os_error());
+        }
+        let efd = unsafe { OwnedFd::from_raw_fd(fd) };
+        ring.register_eventfd(efd.as_raw_fd())?;
+        Ok(Self { ring, efd: AsyncFd::new(efd)? })
+    }
+
+    /// Submit anything which is pending and wait until there may be new completions,
+    /// there can be spurious wakeups. The eventfd is never read, the reactor is edge
+    /// triggered and every signal is a new edge, so readiness is cleared before the
+    /// caller looks at the completion queue and no completion can be missed.
+    pub(crate) async fn wait(&mut self) -> std::io::Result<()> {
+        self.ring.submit(0)?;
+        let mut ready = self.efd.readable().await?;
+        ready.clear_ready();
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::interface::socketiface::{recvmmsg, sendmmsg, Mmsghdr};
+
+    fn dgram_pair() -> (libc::c_int, libc::c_int) {
+        let mut fds = [0; 2];
+        let ret = unsafe { libc::socketpair(libc::AF_UNIX, libc::SOCK_DGRAM, 0, fds.as_mut_ptr()) };
+        assert_eq!(ret, 0);
+        (fds[0], fds[1])
+    }
+
+    fn uring() -> Option<Uring> {
+        match Uring::new(64, 256) {
+            Ok(u) => Some(u),
+            Err(e) => {
+                println!("io_uring not available: {e}");
+                None
+            }
+        }
+    }
+
+    /// Buffers for a BufRing, which the tests only look at so they are plain memory.
+    struct Bufs {
+        ring: BufRing,
+        mem: Vec<Vec<u8>>,
+    }
+    impl Bufs {
+        fn new(u: &Uring, count: u16, size: usize) -> std::io::Result<Self> {
+            let mut out = Bufs { ring: BufRing::new(u, 0, count)?, mem: vec![vec![0; size]; count as usize] };
+            out.recycle(&(0..count).collect::<Vec<_>>());
+            Ok(out)
+        }
+        fn get(&self, bid: u16, len: usize) -> &[u8] {
+            &self.mem[bid as usize][..len]
+        }
+        /// Give buffers back to the kernel.
+        fn recycle(&mut self, bids: &[u16]) {
+            for &bid in bids {
+                let m = &mut self.mem[bid as usize];
+                unsafe { self.ring.provide(bid, m.as_mut_ptr(), m.len()) };
+            }
+            self.ring.publish();
+        }
+    }
+
+    fn send_hdrs(bufs: &[Vec<u8>], iovecs: &mut [libc::iovec]) -> Vec<libc::msghdr> {
+        bufs.iter().zip(iovecs.iter_mut()).map(|(b, iov)| {
+            iov.iov_base = b.as_ptr() as _;
+            iov.iov_len = b.len();
+            let mut h: libc::msghdr = unsafe { std::mem::zeroed() };
+            h.msg_iov = iov as *mut _;
+            h.msg_iovlen = 1;
+            h
+        }).collect()
+    }
+
+    /// Submit one linked chain of sends and wait for all of them.
+    fn send_linked(u: &mut Uring, fd: RawFd, hdrs: &[libc::msghdr]) -> Vec<i32> {
+        for (i, h) in hdrs.iter().enumerate() {
+            let sqe = Sqe::sendmsg(fd, h).user_data(i as u64);
+            assert!(u.push(if i + 1 < hdrs.len() { sqe.link() } else { sqe }));
+        }
+        u.submit(hdrs.len() as u32).unwrap();
+        let mut res = vec![0; hdrs.len()];
+        for _ in 0..hdrs.len() {
+            let c = u.pop().unwrap();
+            res[c.user_data as usize] = c.res;
+        }
+        res
+    }
+
+    #[test]
+    fn test_uring_dgram() {
+        let mut u = match uring() {
+            Some(u) => u,
+            None => return,
+        };
+        let (a, b) = dgram_pair();
+        let out = (0..3_u8).map(|i| vec![i; 10 + i as usize]).collect::<Vec<_>>();
+        let mut iov: [libc::iovec; 3] = unsafe { std::mem::zeroed() };
+        let hdrs = send_hdrs(&out, &mut iov);
+        assert_eq!(send_linked(&mut u, a, &hdrs), vec![10, 11, 12]);
+        assert_eq!(u.take_syscalls(), 1);
+
+        let mut r = match Uring::new(8, 64) {
+            Ok(r) => r,
+            Err(_) => return,
+        };
+        let mut bufs = match Bufs::new(&r, 4, 256) {
+            Ok(b) => b,
+            Err(e) => {
+                println!("Provided buffer rings not available: {e}");
+                return;
+            }
+        };
+        let mut rh: libc::msghdr = unsafe { std::mem::zeroed() };
+        rh.msg_controllen = 32;
+        assert!(r.push(Sqe::recvmsg_multishot(b, &rh, bufs.ring.bgid)));
+        r.submit(3).unwrap();
+        for i in 0..3_u8 {
+            let c = r.pop().unwrap();
+            if c.res == -libc::EINVAL {
+                println!("Multishot recvmsg not available");
+                return;
+            }
+            assert!(c.more());
+            let bid = c.buffer().unwrap();
+            let m = RecvmsgOut::parse(bufs.get(bid, c.res as usize), 0, 32).unwrap();
+            assert_eq!(m.payload, &out[i as usize][..]);
+            assert!(m.control.is_empty());
+            bufs.recycle(&[bid]);
+        }
+        assert!(r.pop().is_none());
+
+        // More messages than buffers, the receive ends when the buffers run out
+        let many = (0..6_u8).map(|i| vec![i; 100]).collect::<Vec<_>>();
+        let mut iov: [libc::iovec; 6] = unsafe { std::mem::zeroed() };
+        let hdrs = send_hdrs(&many, &mut iov);
+        assert_eq!(send_linked(&mut u, a, &hdrs), vec![100; 6]);
+        r.submit(1).unwrap();
+        let mut got = 0;
+        let mut ended = false;
+        while let Some(c) = r.pop() {
+            if c.res == -libc::ENOBUFS {
+                assert!(!c.more());
+                ended = true;
+            } else {
+                assert!(c.res > 0);
+                got += 1;
+            }
+        }
+        assert_eq!(got, 4);
+        assert!(ended);
+
+        // A failed send cancels the rest of the chain
+        unsafe { libc::close(b) };
+        let res = send_linked(&mut u, a, &hdrs[..3]);
+        assert!(res[0] < 0);
+        assert_eq!(&res[1..], &[-libc::ECANCELED, -libc::ECANCELED]);
+        unsafe { libc::close(a) };
+    }
+
+    #[test]
+    fn test_cancel_all() {
+        let mut r = match uring() {
+            Some(r) => r,
+            None => return,
+        };
+        let bufs = match Bufs::new(&r, 4, 256) {
+            Ok(b) => b,
+            Err(_) => return,
+        };
+        let (a, b) = dgram_pair();
+        let rh: libc::msghdr = unsafe { std::mem::zeroed() };
+        assert!(r.push(Sqe::recvmsg_multishot(b, &rh, bufs.ring.bgid)));
+        r.submit(0).unwrap();
+        assert_eq!(r.inflight, 1);
+        r.cancel_all().unwrap();
+        assert_eq!(r.inflight, 0);
+        // Nothing is received into the buffers after that
+        assert_eq!(unsafe { libc::send(a, b"hello".as_ptr() as _, 5, 0) }, 5);
+        r.submit(0).unwrap();
+        assert!(r.pop().is_none());
+        assert!((0..4).all(|bid| bufs.get(bid, 256).iter().all(|&x| x == 0)));
+        // Nothing in flight, so there is nothing to wait for
+        r.cancel_all().unwrap();
+        assert_eq!(r.take_syscalls(), 2);
+        unsafe { libc::close(a) };
+        unsafe { libc::close(b) };
+    }
+
+    #[test]
+    fn test_buf_ring_unregister() {
+        let r = match uring() {
+            Some(r) => r,
+            None => return,
+        };
+        let bufs = match BufRing::new(&r, 3, 4) {
+            Ok(b) => b,
+            Err(_) => return,
+        };
+        // A bgid can only be registered once at a time
+        assert!(BufRing::new(&r, 3, 4).is_err());
+        drop(bufs);
+        assert!(BufRing::new(&r, 3, 4).is_ok());
+    }
+
+    #[test]
+    fn test_recvmsg_out() {
+        let mut buf = vec![0_u8; RECVMSG_OUT_LEN + 8 + 4 + 5];
+        for (i, v) in [3_u32, 0, 5, 0].iter().enumerate() {
+            buf[i * 4..i * 4 + 4].copy_from_slice(&v.to_ne_bytes());
+        }
+        buf[RECVMSG_OUT_LEN..RECVMSG_OUT_LEN + 3].copy_from_slice(b"abc");
+        buf[RECVMSG_OUT_LEN + 12..].copy_from_slice(b"hello");
+        let m = RecvmsgOut::parse(&buf, 8, 4).unwrap();
+        assert_eq!(m.name, b"abc");
+        assert!(m.control.is_empty());
+        assert_eq!(m.payload, b"hello");
+        // A short buffer truncates the payload
+        let m = RecvmsgOut::parse(&buf[..buf.len() - 2], 8, 4).unwrap();
+        assert_eq!(m.payload, b"hel");
+        assert!(RecvmsgOut::parse(&buf[..RECVMSG_OUT_LEN + 4], 8, 4).is_none());
+    }
+
+    #[test]
+    #[ignore]
+    fn bench_engines() {
+        // cargo test --release -- --ignored --nocapture bench_engines
+        // Throughput is a batch of sends and draining the other end, latency is one
+        // packet sent and waited for. "epoll" is what the workers do by default,
+        // sendmmsg() and recvmmsg() after a poll().
+        let mut u = match uring() {
+            Some(u) => u,
+            None => return,
+        };
+        let mut r = Uring::new(8, 1024).unwrap();
+        let mut bufs = Bufs::new(&r, 256, 2048).unwrap();
+        let rh: libc::msghdr = unsafe { std::mem::zeroed() };
+        let (a, b) = dgram_pair();
+        let sz: libc::c_int = 8 << 20;
+        unsafe {
+            libc::setsockopt(b, libc::SOL_SOCKET, libc::SO_RCVBUF, &sz as *const _ as _, 4);
+        }
+        let batch = 64;
+        let rounds = 20_000 / batch;
+        let out = vec![vec![0_u8; 1400]; batch];
+        let mut out_iov = vec![unsafe { std::mem::zeroed::<libc::iovec>() }; batch];
+        let mut inb = vec![vec![0_u8; 1500]; batch];
+        let mut in_iov = vec![unsafe { std::mem::zeroed::<libc::iovec>() }; batch];
+        let mmsg = |bufs: &mut [Vec<u8>], iovs: &mut [libc::iovec]| -> Vec<Mmsghdr> {
+            bufs.iter_mut().zip(iovs.iter_mut()).map(|(b, iov)| {
+                iov.iov_base = b.as_mut_ptr() as _;
+                iov.iov_len = b.len();
+                let mut h: Mmsghdr = unsafe { std::mem::zeroed() };
+                h.msg_hdr.msg_iov = iov as *mut _;
+                h.msg_hdr.msg_iovlen = 1;
+                h.msg_len = !0;
+                h
+            }).collect()
+        };
+        let poll_in = |fd: RawFd| {
+            let mut p = libc::pollfd { fd, events: libc::POLLIN, revents: 0 };
+            unsafe { libc::poll(&mut p, 1, 1000) };
+        };
+
+        // epoll engine
+        let mut out_c = out.clone();
+        let (mut calls, start) = (0, std::time::Instant::now());
+        for _ in 0..rounds {
+            let mut oh = mmsg(&mut out_c, &mut out_iov);
+            sendmmsg(a, &mut oh, 0, &mut calls).unwrap();
+            let mut left = batch;
+            while left > 0 {
+                poll_in(b);
+                calls += 1;
+                let mut ih = mmsg(&mut inb[..left], &mut in_iov[..left]);
+                let _ = recvmmsg(b, &mut ih, libc::MSG_DONTWAIT, &mut calls);
+                left -= ih.iter().filter(|h| h.msg_len != !0).count();
+            }
+        }
+        let pkts = (rounds * batch) as f64;
+        let el = start.elapsed().as_secs_f64();
+        println!("epoll:    {:.0} pps, {:.3} syscalls/packet", pkts / el, calls as f64 / pkts);
+
+        // io_uring engine
+        let hdrs = send_hdrs(&out, &mut out_iov);
+        r.push(Sqe::recvmsg_multishot(b, &rh, bufs.ring.bgid));
+        r.submit(0).unwrap();
+        let mut bids = Vec::with_capacity(batch);
+        let start = std::time::Instant::now();
+        for _ in 0..rounds {
+            send_linked(&mut u, a, &hdrs);
+            let mut left = batch;
+            while left > 0 {
+                r.submit(1).unwrap();
+                while let Some(c) = r.pop() {
+                    bids.extend(c.buffer());
+                    if c.res > 0 {
+                        left -= 1;
+                    }
+                    if !c.more() {
+                        r.push(Sqe::recvmsg_multishot(b, &rh, bufs.ring.bgid));
+                    }
+                }
+                bufs.recycle(&bids);
+                bids.clear();
+            }
+        }
+        let el = start.elapsed().as_secs_f64();
+        let calls = u.take_syscalls() + r.take_syscalls();
+        println!("io_uring: {:.0} pps, {:.3} syscalls/packet", pkts / el, calls as f64 / pkts);
+
+        // Latency, one packet at a time
+        let n = 10_000;
+        let one = &hdrs[..1];
+        let start = std::time::Instant::now();
+        for _ in 0..n {
+            let mut oh = mmsg(&mut out_c[..1], &mut out_iov[..1]);
+            sendmmsg(a, &mut oh, 0, &mut 0).unwrap();
+            r.submit(1).unwrap();
+            while let Some(c) = r.pop() {
+                bids.extend(c.buffer());
+                if !c.more() {
+                    r.push(Sqe::recvmsg_multishot(b, &rh, bufs.ring.bgid));
+                }
+            }
+            bufs.recycle(&bids);
+            bids.clear();
+        }
+        println!("io_uring: {:?} per packet sent and received", start.elapsed() / n);
+        // Cancel the receive so that the epoll measurement gets the packets
+        drop(r);
+        drop(bufs);
+        let start = std::time::Instant::now();
+        for _ in 0..n {
+            send_linked(&mut u, a, one);
+            poll_in(b);
+            let mut ih = mmsg(&mut inb[..1], &mut in_iov[..1]);
+            recvmmsg(b, &mut ih, libc::MSG_DONTWAIT, &mut 0).unwrap();
+        }
+        println!("epoll:    {:?} per packet sent and received", start.elapsed() / n);
+        unsafe { libc::close(a); libc::close(b) };
+    }
+}
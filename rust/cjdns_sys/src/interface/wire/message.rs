@@ -15,7 +15,8 @@ use crate::rffi::allocator::{self, Allocator};
 /// *Unsafe:* The original pointer *must* remain valid while this instance still in use.
 pub struct Message {
     msg: *mut cffi::Message,
-    alloc: Option<Allocator>,
+    /// Keeps the message's allocator alive, None if it's up to the caller
+    alloc: Option<allocator::Hold>,
 }
 // Needed to use Message in an any async function
 unsafe impl Sync for Message {}
@@ -86,11 +87,17 @@ impl Message {
     /// Create a new message with a self-contained allocator,
     /// this message is thus "owned" but Rust.
     pub fn new(padding: usize) -> Self {
-        let alloc = allocator::new!();
-        let mut child = allocator::child!(alloc);
-        let mut out = Self::anew(padding, &mut child);
-        out.alloc = Some(alloc);
-        out
+        let alloc = Allocator::new_held(allocator::file_line!());
+        let msg = unsafe { cffi::Message_new_fromRust(0, padding as u32, alloc.c()) };
+        Message { msg, alloc: Some(alloc) }
+    }
+
+    /// Same as new() but the buffer comes from the per-thread packet buffer pool
+    /// and goes back to it when the message is freed, for use on receive paths.
+    pub fn new_pooled(padding: usize) -> Self {
+        let alloc = Allocator::new_held(allocator::file_line!());
+        let msg = unsafe { cffi::Message_newPooled_fromRust(0, padding as u32, alloc.c()) };
+        Message { msg, alloc: Some(alloc) }
     }
 
     pub fn anew(padding: usize, alloc: &mut Allocator) -> Self {
@@ -109,11 +116,12 @@ impl Message {
     /// Construct a Rust `Message` by wrapping a pointer to C `Message`.
     ///
     /// *Unsafe:* The original pointer *must* remain valid until this instance is dropped.
+    /// The message's allocator is held rather than adopted into a new allocator,
+    /// so this costs a lock and no heap allocation.
     #[inline]
     pub fn from_c_message(c_msg: *mut cffi::Message) -> Self {
-        let my_alloc = allocator::new!();
-        my_alloc.adopt_alloc(allocator::rs(unsafe { (*c_msg)._alloc }));
-        Message { msg: c_msg, alloc: Some(my_alloc) }
+        let hold = allocator::rs(unsafe { (*c_msg)._alloc }).hold();
+        Message { msg: c_msg, alloc: Some(hold) }
     }
 
     /// Return original C `Message` pointer from this Rust `Message`.
@@ -466,6 +474,7 @@ mod tests {
     use crate::cffi;
 
     use super::Message;
+    use crate::for_tests::c_packet;
     use crate::rffi::allocator;
 
     #[test]
@@ -532,4 +541,30 @@ mod tests {
         // Pop 4 bytes unaligned
         assert_eq!(msg.pop(), Ok(0x345678EE_u32));
     }
+
+    #[test]
+    fn test_from_c_message_outlives_c() {
+        let root = allocator::new!();
+        let (mut c_alloc, c_msg) = c_packet(&root);
+        let mut msg = Message::from_c_message(c_msg);
+        // C is done with the packet, but Rust still has it
+        c_alloc.free(&allocator::file_line!());
+        assert_eq!(allocator::Rffi_allocator_isFreeing(c_alloc.c()), 0);
+        assert_eq!(msg.len(), 1024);
+        msg.push(0x12345678_u32).unwrap();
+        assert_eq!(msg.pop(), Ok(0x12345678_u32));
+    }
+
+    #[test]
+    fn test_new_adopted_by_c() {
+        let root = allocator::new!();
+        let msg = Message::new(64);
+        root.adopt_alloc(allocator::rs(unsafe { (*msg.as_c_message())._alloc }));
+        let c_msg = msg.as_c_message();
+        drop(msg);
+        // C adopted it, so it outlives the Rust Message
+        let mut msg = Message::from_c_message(c_msg);
+        msg.push(7_u8).unwrap();
+        assert_eq!(msg.pop(), Ok(7_u8));
+    }
 }
@@ -0,0 +1,1227 @@
+//! Ethernet transport on AF_XDP sockets (Linux)
+//!
+//! A small XDP program is attached to the device, it redirects every frame with the
+//! cjdns ethertype into the XSK of the queue which it arrived on and passes anything
+//! else to the kernel stack. Each queue has its own UMEM, half of which is kept in
+//! the fill ring for receiving and half of which is used for sending, and its own
+//! pair of workers, so frames move without a syscall per packet.
+//!
+//! Messages to and from this iface are the same as those of EthIface, they begin
+//! with an EthIfaceHeader which carries the peer's MAC.
+//!
+//! XdpUdp does the same for the receive side of a UDP socket: datagrams to its port
+//! are taken from the device and handed on with the sender's Sockaddr in front,
+//! exactly as UDPAddrIface would have received them, while sending stays with the
+//! socket.
+
+use std::convert::TryInto;
+use std::net::{IpAddr, SocketAddr};
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::sync::Arc;
+use std::time::Duration;
+
+use eyre::{bail, Result};
+use tokio::io::unix::AsyncFd;
+use tokio::sync::mpsc::{Receiver, Sender};
+use tokio::sync::Mutex;
+
+use crate::external::interface::iface::{self, IfRecv, Iface, IfacePvt};
+use crate::interface::ethiface::{self, EthIfaceHeader, ETHERTYPE_CJDNS, ETH_HLEN, HDR_LEN};
+use crate::interface::socketiface::MAX_BATCH;
+use crate::interface::wire::message::Message;
+use crate::util::sockaddr::Sockaddr;
+
+const TO_GO_OUT_QUEUE: usize = 256;
+
+/// Size of a UMEM chunk, one frame goes in each.
+const FRAME_SIZE: usize = 2048;
+/// Number of chunks in each UMEM, the first half are for receiving.
+const UMEM_FRAMES: usize = 4096;
+const RX_FRAMES: usize = UMEM_FRAMES / 2;
+/// Size of every ring, a power of 2 which can hold all of the receive frames.
+const RING_SIZE: u32 = RX_FRAMES as u32;
+/// Most queues which will be given sockets.
+const MAX_QUEUES: u32 = 64;
+/// Times to retry binding to a queue which is busy, 10ms apart.
+const BIND_BUSY_TRIES: u32 = 50;
+/// Room left in front of a received UDP datagram, as UDPAddrIface leaves.
+const UDP_PADDING: usize = 512;
+
+const ETH_P_IP: u16 = 0x0800;
+const ETH_P_IPV6: u16 = 0x86dd;
+const IPPROTO_UDP: i32 = 17;
+
+// From linux/if_xdp.h
+const AF_XDP: libc::c_int = 44;
+const SOL_XDP: libc::c_int = 283;
+const XDP_MMAP_OFFSETS: libc::c_int = 1;
+const XDP_RX_RING: libc::c_int = 2;
+const XDP_TX_RING: libc::c_int = 3;
+const XDP_UMEM_REG: libc::c_int = 4;
+const XDP_UMEM_FILL_RING: libc::c_int = 5;
+const XDP_UMEM_COMPLETION_RING: libc::c_int = 6;
+const XDP_COPY: u16 = 1 << 1;
+const XDP_ZEROCOPY: u16 = 1 << 2;
+const XDP_USE_NEED_WAKEUP: u16 = 1 << 3;
+const XDP_RING_NEED_WAKEUP: u32 = 1;
+const XDP_PGOFF_RX_RING: libc::off_t = 0;
+const XDP_PGOFF_TX_RING: libc::off_t = 0x80000000;
+const XDP_UMEM_PGOFF_FILL_RING: libc::off_t = 0x100000000;
+const XDP_UMEM_PGOFF_COMPLETION_RING: libc::off_t = 0x180000000;
+/// sizeof(struct xdp_desc)
+const DESC_LEN: usize = 16;
+
+// From linux/if_link.h
+const XDP_FLAGS_SKB_MODE: u32 = 1 << 1;
+const XDP_FLAGS_DRV_MODE: u32 = 1 << 2;
+
+/// Where the XDP program is run.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum XdpMode {
+    /// In the driver if it supports XDP, otherwise generic.
+    Auto,
+    /// After the skb is built, works with any device, veth pairs included.
+    Generic,
+    /// In the driver, frames are received to the UMEM without a copy if possible.
+    Native,
+}
+
+impl XdpMode {
+    /// Mode number from the config or admin api, 1 auto, 2 generic and 3 native.
+    pub fn from_int(mode: i32) -> Result<Self> {
+        Ok(match mode {
+            1 => XdpMode::Auto,
+            2 => XdpMode::Generic,
+            3 => XdpMode::Native,
+            _ => bail!("Invalid XDP mode [{}]", mode),
+        })
+    }
+}
+
+/// The parts of the bpf() syscall which are needed to load and attach the program.
+mod bpf {
+    use std::convert::TryInto;
+    use std::net::{IpAddr, SocketAddr};
+    use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+
+    use eyre::{bail, Result};
+
+    const BPF_MAP_CREATE: libc::c_long = 0;
+    const BPF_MAP_UPDATE_ELEM: libc::c_long = 2;
+    const BPF_PROG_LOAD: libc::c_long = 5;
+    const BPF_LINK_CREATE: libc::c_long = 28;
+    const BPF_MAP_TYPE_XSKMAP: u32 = 17;
+    const BPF_PROG_TYPE_XDP: u32 = 6;
+    const BPF_XDP: u32 = 37;
+    const BPF_PSEUDO_MAP_FD: u8 = 1;
+    const BPF_FUNC_REDIRECT_MAP: i32 = 51;
+    const XDP_PASS: i32 = 2;
+
+    /// union bpf_attr, fields are written at their offsets and the rest is zero.
+    #[repr(C, align(8))]
+    struct Attr([u8; 128]);
+    impl Attr {
+        fn new() -> Self {
+            Self([0; 128])
+        }
+        fn u32(mut self, off: usize, v: u32) -> Self {
+            self.0[off..off + 4].copy_from_slice(&v.to_ne_bytes());
+            self
+        }
+        fn u64(mut self, off: usize, v: u64) -> Self {
+            self.0[off..off + 8].copy_from_slice(&v.to_ne_bytes());
+            self
+        }
+    }
+
+    fn sys_bpf(cmd: libc::c_long, attr: &mut Attr) -> std::io::Result<libc::c_int> {
+        let ret = unsafe {
+            libc::syscall(libc::SYS_bpf, cmd, attr as *mut Attr, std::mem::size_of::<Attr>())
+        };
+        if ret < 0 {
+            return Err(std::io::Error::last_os_error());
+        }
+        Ok(ret as libc::c_int)
+    }
+
+    fn sys_bpf_fd(cmd: libc::c_long, mut attr: Attr, what: &str) -> Result<OwnedFd> {
+        match sys_bpf(cmd, &mut attr) {
+            Ok(fd) => Ok(unsafe { OwnedFd::from_raw_fd(fd) }),
+            Err(e) => bail!("bpf({}) [{}]", what, e),
+        }
+    }
+
+    pub fn xskmap_new(max_entries: u32) -> Result<OwnedFd> {
+        let attr = Attr::new()
+            .u32(0, BPF_MAP_TYPE_XSKMAP)
+            .u32(4, 4)
+            .u32(8, 4)
+            .u32(12, max_entries);
+        sys_bpf_fd(BPF_MAP_CREATE, attr, "BPF_MAP_CREATE")
+    }
+
+    pub fn map_update(map: &OwnedFd, key: u32, value: u32) -> Result<()> {
+        let mut attr = Attr::new()
+            .u32(0, map.as_raw_fd() as u32)
+            .u64(8, &key as *const u32 as u64)
+            .u64(16, &value as *const u32 as u64);
+        if let Err(e) = sys_bpf(BPF_MAP_UPDATE_ELEM, &mut attr) {
+            bail!("bpf(BPF_MAP_UPDATE_ELEM) [{}]", e);
+        }
+        Ok(())
+    }
+
+    fn insn(code: u8, dst: u8, src: u8, off: i16, imm: i32) -> u64 {
+        let mut b = [0_u8; 8];
+        b[0] = code;
+        b[1] = dst | (src << 4);
+        b[2..4].copy_from_slice(&off.to_ne_bytes());
+        b[4..8].copy_from_slice(&imm.to_ne_bytes());
+        u64::from_ne_bytes(b)
+    }
+
+    /// The XDP program, redirect frames with the cjdns ethertype to the XSK of their
+    /// queue and pass everything else.
+    pub fn program(xskmap: &OwnedFd, ethertype_be: u16) -> Vec<u64> {
+        // The ethertype as it reads when loaded from the packet as a u16
+        let et = u16::from_ne_bytes(ethertype_be.to_be_bytes()) as i32;
+        vec![
+            insn(0x61, 2, 1, 0, 0),    // r2 = ctx->data
+            insn(0x61, 3, 1, 4, 0),    // r3 = ctx->data_end
+            insn(0xbf, 4, 2, 0, 0),    // r4 = r2
+            insn(0x07, 4, 0, 0, 14),   // r4 += ETH_HLEN
+            insn(0x2d, 4, 3, 8, 0),    // if r4 > r3 goto pass
+            insn(0x69, 4, 2, 12, 0),   // r4 = *(u16 *)(r2 + 12)
+            insn(0x55, 4, 0, 6, et),   // if r4 != ethertype goto pass
+            insn(0x61, 2, 1, 16, 0),   // r2 = ctx->rx_queue_index
+            insn(0x18, 1, BPF_PSEUDO_MAP_FD, 0, xskmap.as_raw_fd()), // r1 = xskmap
+            insn(0, 0, 0, 0, 0),
+            insn(0xb7, 3, 0, 0, XDP_PASS), // r3 = XDP_PASS, if there is no socket
+            insn(0x85, 0, 0, 0, BPF_FUNC_REDIRECT_MAP),
+            insn(0x95, 0, 0, 0, 0),    // return
+            insn(0xb7, 0, 0, 0, XDP_PASS), // pass: return XDP_PASS
+            insn(0x95, 0, 0, 0, 0),
+        ]
+    }
+
+    /// The UDP program, every jump goes to the end where the frame is passed.
+    #[derive(Default)]
+    struct Asm {
+        insns: Vec<u64>,
+        jumps: Vec<usize>,
+    }
+    impl Asm {
+        fn op(&mut self, code: u8, dst: u8, src: u8, off: i16, imm: i32) {
+            self.insns.push(insn(code, dst, src, off, imm));
+        }
+        fn jmp_pass(&mut self, code: u8, dst: u8, src: u8) {
+            self.jumps.push(self.insns.len());
+            self.op(code, dst, src, 0, 0);
+        }
+        /// if r4 != imm goto pass, imm is compared as a u32.
+        fn pass_unless(&mut self, imm: u32) {
+            self.op(0xb4, 5, 0, 0, imm as i32); // w5 = imm, zero extended
+            self.jmp_pass(0x5d, 4, 5); // if r4 != r5 goto pass
+        }
+        /// if data + len > data_end goto pass
+        fn pass_if_shorter(&mut self, len: i32) {
+            self.op(0xbf, 4, 2, 0, 0); // r4 = r2
+            self.op(0x07, 4, 0, 0, len); // r4 += len
+            self.jmp_pass(0x2d, 4, 3); // if r4 > r3 goto pass
+        }
+        fn load(&mut self, size: u8, off: i16) {
+            // r4 = *(size *)(r2 + off)
+            let code = match size {
+                1 => 0x71,
+                2 => 0x69,
+                _ => 0x61,
+            };
+            self.op(code, 4, 2, off, 0);
+        }
+        fn finish(mut self) -> Vec<u64> {
+            let pass = self.insns.len() as i16;
+            self.op(0xb7, 0, 0, 0, XDP_PASS); // pass: return XDP_PASS
+            self.op(0x95, 0, 0, 0, 0);
+            for at in self.jumps {
+                let mut b = self.insns[at].to_ne_bytes();
+                b[2..4].copy_from_slice(&(pass - at as i16 - 1).to_ne_bytes());
+                self.insns[at] = u64::from_ne_bytes(b);
+            }
+            self.insns
+        }
+    }
+
+    /// A u16 or u32 in network byte order as it reads when loaded from the packet.
+    fn be16(x: u16) -> u32 {
+        u16::from_ne_bytes(x.to_be_bytes()) as u32
+    }
+    fn be32(b: &[u8]) -> u32 {
+        u32::from_ne_bytes(b.try_into().unwrap())
+    }
+
+    /// The XDP program for a UDP socket bound to `local`, redirect datagrams to its
+    /// port, and its address unless that is unspecified, to the XSK of their queue.
+    /// Only the family of `local` is matched. Everything else is passed, including
+    /// fragments, IPv4 with options and IPv6 with extension headers, so the socket
+    /// still receives those.
+    pub fn program_udp(xskmap: &OwnedFd, local: &SocketAddr) -> Vec<u64> {
+        const ETH_HLEN: i16 = super::ETH_HLEN as i16;
+        let mut a = Asm::default();
+        a.op(0x61, 2, 1, 0, 0); // r2 = ctx->data
+        a.op(0x61, 3, 1, 4, 0); // r3 = ctx->data_end
+        match local.ip() {
+            IpAddr::V4(ip) => {
+                a.pass_if_shorter(ETH_HLEN as i32 + 20 + 8);
+                a.load(2, 12);
+                a.pass_unless(be16(super::ETH_P_IP));
+                a.load(1, ETH_HLEN);
+                a.pass_unless(0x45); // version 4, no options
+                a.load(1, ETH_HLEN + 9);
+                a.pass_unless(super::IPPROTO_UDP as u32);
+                a.load(2, ETH_HLEN + 6);
+                a.op(0x57, 4, 0, 0, be16(0x3fff) as i32); // r4 &= more fragments | offset
+                a.pass_unless(0);
+                if !ip.is_unspecified() {
+                    a.load(4, ETH_HLEN + 16);
+                    a.pass_unless(be32(&ip.octets()));
+                }
+                a.load(2, ETH_HLEN + 20 + 2);
+            }
+            IpAddr::V6(ip) => {
+                a.pass_if_shorter(ETH_HLEN as i32 + 40 + 8);
+                a.load(2, 12);
+                a.pass_unless(be16(super::ETH_P_IPV6));
+                a.load(1, ETH_HLEN + 6);
+                a.pass_unless(super::IPPROTO_UDP as u32);
+                if !ip.is_unspecified() {
+                    for (i, w) in ip.octets().chunks(4).enumerate() {
+                        a.load(4, ETH_HLEN + 24 + 4 * i as i16);
+                        a.pass_unless(be32(w));
+                    }
+                }
+                a.load(2, ETH_HLEN + 40 + 2);
+            }
+        }
+        a.pass_unless(be16(local.port()));
+        a.op(0x61, 2, 1, 16, 0); // r2 = ctx->rx_queue_index
+        a.op(0x18, 1, BPF_PSEUDO_MAP_FD, 0, xskmap.as_raw_fd()); // r1 = xskmap
+        a.op(0, 0, 0, 0, 0);
+        a.op(0xb7, 3, 0, 0, XDP_PASS); // r3 = XDP_PASS, if there is no socket
+        a.op(0x85, 0, 0, 0, BPF_FUNC_REDIRECT_MAP);
+        a.op(0x95, 0, 0, 0, 0); // return
+        a.finish()
+    }
+
+    pub fn prog_load(insns: &[u64]) -> Result<OwnedFd> {
+        let license = b"GPL\0";
+        let mut log = vec![0_u8; 4096];
+        let mut attr = Attr::new()
+            .u32(0, BPF_PROG_TYPE_XDP)
+            .u32(4, insns.len() as u32)
+            .u64(8, insns.as_ptr() as u64)
+            .u64(16, license.as_ptr() as u64)
+            .u32(24, 1)
+            .u32(28, log.len() as u32)
+            .u64(32, log.as_mut_ptr() as u64)
+            .u32(68, BPF_XDP);
+        attr.0[48..55].copy_from_slice(b"cjdns_x");
+        match sys_bpf(BPF_PROG_LOAD, &mut attr) {
+            Ok(fd) => Ok(unsafe { OwnedFd::from_raw_fd(fd) }),
+            Err(e) => {
+                let end = log.iter().position(|&c| c == 0).unwrap_or(log.len());
+                bail!("bpf(BPF_PROG_LOAD) [{}] {}", e, String::from_utf8_lossy(&log[..end]))
+            }
+        }
+    }
+
+    /// Attach the program to the device, it is detached when the link is closed.
+    pub fn link_xdp(prog: &OwnedFd, ifindex: u32, flags: u32) -> Result<OwnedFd> {
+        let attr = Attr::new()
+            .u32(0, prog.as_raw_fd() as u32)
+            .u32(4, ifindex)
+            .u32(8, BPF_XDP)
+            .u32(12, flags);
+        sys_bpf_fd(BPF_LINK_CREATE, attr, "BPF_LINK_CREATE")
+    }
+}
+
+fn setsockopt<T>(fd: RawFd, opt: libc::c_int, val: &T) -> Result<()> {
+    let ret = unsafe {
+        libc::setsockopt(
+            fd,
+            SOL_XDP,
+            opt,
+            val as *const T as *const libc::c_void,
+            std::mem::size_of::<T>() as libc::socklen_t,
+        )
+    };
+    if ret < 0 {
+        bail!("setsockopt(SOL_XDP, {}) [{}]", opt, std::io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct XdpUmemReg {
+    addr: u64,
+    len: u64,
+    chunk_size: u32,
+    headroom: u32,
+    flags: u32,
+    tx_metadata_len: u32,
+}
+
+#[repr(C)]
+#[derive(Default, Clone, Copy)]
+struct XdpRingOffset {
+    producer: u64,
+    consumer: u64,
+    desc: u64,
+    flags: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct XdpMmapOffsets {
+    rx: XdpRingOffset,
+    tx: XdpRingOffset,
+    fr: XdpRingOffset,
+    cr: XdpRingOffset,
+}
+
+#[repr(C)]
+struct SockaddrXdp {
+    sxdp_family: u16,
+    sxdp_flags: u16,
+    sxdp_ifindex: u32,
+    sxdp_queue_id: u32,
+    sxdp_shared_umem_fd: u32,
+}
+
+/// An mmap()'d region, unmapped on drop.
+struct Mmap {
+    base: *mut u8,
+    len: usize,
+}
+unsafe impl Send for Mmap {}
+unsafe impl Sync for Mmap {}
+impl Mmap {
+    fn new(len: usize, fd: RawFd, off: libc::off_t) -> Result<Self> {
+        let flags = if fd < 0 {
+            libc::MAP_PRIVATE | libc::MAP_ANONYMOUS
+        } else {
+            libc::MAP_SHARED | libc::MAP_POPULATE
+        };
+        let base = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                len,
+                libc::PROT_READ | libc::PROT_WRITE,
+                flags,
+                fd,
+                off,
+            )
+        };
+        if base == libc::MAP_FAILED {
+            bail!("mmap() [{}]", std::io::Error::last_os_error());
+        }
+        Ok(Self { base: base as *mut u8, len })
+    }
+}
+impl Drop for Mmap {
+    fn drop(&mut self) {
+        unsafe { libc::munmap(self.base as *mut libc::c_void, self.len) };
+    }
+}
+
+/// One of the four rings which are shared with the kernel, we are the only producer
+/// of the fill and tx rings and the only consumer of the rx and completion rings.
+struct XskRing {
+    map: Mmap,
+    off: XdpRingOffset,
+}
+impl XskRing {
+    fn new(fd: RawFd, off: XdpRingOffset, desc_len: usize, pgoff: libc::off_t) -> Result<Self> {
+        let map = Mmap::new(off.desc as usize + RING_SIZE as usize * desc_len, fd, pgoff)?;
+        Ok(Self { map, off })
+    }
+    fn word(&self, off: u64) -> &AtomicU32 {
+        unsafe { &*(self.map.base.add(off as usize) as *const AtomicU32) }
+    }
+    fn producer(&self) -> &AtomicU32 {
+        self.word(self.off.producer)
+    }
+    fn consumer(&self) -> &AtomicU32 {
+        self.word(self.off.consumer)
+    }
+    fn needs_wakeup(&self) -> bool {
+        self.word(self.off.flags).load(Ordering::Relaxed) & XDP_RING_NEED_WAKEUP != 0
+    }
+    fn desc(&self, idx: u32, desc_len: usize) -> *mut u8 {
+        let i = (idx & (RING_SIZE - 1)) as usize;
+        unsafe { self.map.base.add(self.off.desc as usize + i * desc_len) }
+    }
+
+    /// Entries ready to be consumed and the index of the first.
+    fn peek(&self) -> (u32, u32) {
+        let cons = self.consumer().load(Ordering::Relaxed);
+        let prod = self.producer().load(Ordering::Acquire);
+        (cons, prod.wrapping_sub(cons))
+    }
+    fn release(&self, n: u32) {
+        let cons = self.consumer().load(Ordering::Relaxed);
+        self.consumer().store(cons.wrapping_add(n), Ordering::Release);
+    }
+
+    /// Free entries which may be produced and the index of the first.
+    fn reserve(&self) -> (u32, u32) {
+        let prod = self.producer().load(Ordering::Relaxed);
+        let cons = self.consumer().load(Ordering::Acquire);
+        (prod, RING_SIZE - prod.wrapping_sub(cons))
+    }
+    fn submit(&self, n: u32) {
+        let prod = self.producer().load(Ordering::Relaxed);
+        self.producer().store(prod.wrapping_add(n), Ordering::Release);
+    }
+
+    fn get_addr(&self, idx: u32) -> u64 {
+        unsafe { (self.desc(idx, 8) as *const u64).read() }
+    }
+    fn put_addr(&self, idx: u32, addr: u64) {
+        unsafe { (self.desc(idx, 8) as *mut u64).write(addr) }
+    }
+    fn get_desc(&self, idx: u32) -> (u64, u32) {
+        let d = self.desc(idx, DESC_LEN);
+        unsafe { ((d as *const u64).read(), (d.add(8) as *const u32).read()) }
+    }
+    fn put_desc(&self, idx: u32, addr: u64, len: u32) {
+        let d = self.desc(idx, DESC_LEN);
+        unsafe {
+            (d as *mut u64).write(addr);
+            (d.add(8) as *mut u32).write(len);
+            (d.add(12) as *mut u32).write(0);
+        }
+    }
+}
+
+/// An AF_XDP socket bound to one queue, with its own UMEM and rings.
+struct Xsk {
+    fd: OwnedFd,
+    umem: Mmap,
+    fill: XskRing,
+    comp: XskRing,
+    rx: XskRing,
+    tx: XskRing,
+}
+
+impl Xsk {
+    fn new(ifindex: u32, queue: u32, zerocopy: bool) -> Result<Self> {
+        let fd = unsafe { libc::socket(AF_XDP, libc::SOCK_RAW | libc::SOCK_CLOEXEC, 0) };
+        if fd < 0 {
+            bail!("socket(AF_XDP) [{}]", std::io::Error::last_os_error());
+        }
+        let fd = unsafe { OwnedFd::from_raw_fd(fd) };
+        let raw = fd.as_raw_fd();
+
+        let umem = Mmap::new(UMEM_FRAMES * FRAME_SIZE, -1, 0)?;
+        setsockopt(raw, XDP_UMEM_REG, &XdpUmemReg {
+            addr: umem.base as u64,
+            len: umem.len as u64,
+            chunk_size: FRAME_SIZE as u32,
+            ..Default::default()
+        })?;
+        for opt in [XDP_UMEM_FILL_RING, XDP_UMEM_COMPLETION_RING, XDP_RX_RING, XDP_TX_RING] {
+            setsockopt(raw, opt, &RING_SIZE)?;
+        }
+        let mut off = XdpMmapOffsets::default();
+        let mut len = std::mem::size_of::<XdpMmapOffsets>() as libc::socklen_t;
+        let ret = unsafe {
+            libc::getsockopt(
+                raw,
+                SOL_XDP,
+                XDP_MMAP_OFFSETS,
+                &mut off as *mut XdpMmapOffsets as *mut libc::c_void,
+                &mut len,
+            )
+        };
+        if ret < 0 {
+            bail!("getsockopt(XDP_MMAP_OFFSETS) [{}]", std::io::Error::last_os_error());
+        }
+        let xsk = Self {
+            fill: XskRing::new(raw, off.fr, 8, XDP_UMEM_PGOFF_FILL_RING)?,
+            comp: XskRing::new(raw, off.cr, 8, XDP_UMEM_PGOFF_COMPLETION_RING)?,
+            rx: XskRing::new(raw, off.rx, DESC_LEN, XDP_PGOFF_RX_RING)?,
+            tx: XskRing::new(raw, off.tx, DESC_LEN, XDP_PGOFF_TX_RING)?,
+            umem,
+            fd,
+        };
+
+        // Every receive frame goes in the fill ring before binding
+        let (prod, free) = xsk.fill.reserve();
+        assert!(free as usize >= RX_FRAMES);
+        for i in 0..RX_FRAMES as u32 {
+            xsk.fill.put_addr(prod.wrapping_add(i), i as u64 * FRAME_SIZE as u64);
+        }
+        xsk.fill.submit(RX_FRAMES as u32);
+
+        let copy = if zerocopy { XDP_ZEROCOPY } else { XDP_COPY };
+        let sxdp = SockaddrXdp {
+            sxdp_family: AF_XDP as u16,
+            sxdp_flags: copy | XDP_USE_NEED_WAKEUP,
+            sxdp_ifindex: ifindex,
+            sxdp_queue_id: queue,
+            sxdp_shared_umem_fd: 0,
+        };
+        // A socket which was just closed holds on to its queue for a moment after
+        for tries in 0.. {
+            let ret = unsafe {
+                libc::bind(
+                    raw,
+                    &sxdp as *const SockaddrXdp as *const libc::sockaddr,
+                    std::mem::size_of::<SockaddrXdp>() as libc::socklen_t,
+                )
+            };
+            if ret == 0 {
+                break;
+            }
+            let e = std::io::Error::last_os_error();
+            if e.raw_os_error() != Some(libc::EBUSY) || tries >= BIND_BUSY_TRIES {
+                bail!("bind(AF_XDP) queue [{}] [{}]", queue, e);
+            }
+            std::thread::sleep(Duration::from_millis(10));
+        }
+        Ok(xsk)
+    }
+
+    fn frame(&self, addr: u64, len: usize) -> &mut [u8] {
+        assert!(addr as usize + len <= self.umem.len);
+        unsafe { std::slice::from_raw_parts_mut(self.umem.base.add(addr as usize), len) }
+    }
+
+    /// Pass up to max received frames to f and put their chunks back in the fill ring,
+    /// returns the number of frames which were taken.
+    fn recv(&self, max: u32, mut f: impl FnMut(&[u8])) -> u32 {
+        let (cons, ready) = self.rx.peek();
+        let n = ready.min(max);
+        if n == 0 {
+            return 0;
+        }
+        let (prod, free) = self.fill.reserve();
+        // The fill ring can hold every receive chunk so there is always room
+        assert!(free >= n);
+        for i in 0..n {
+            let (addr, len) = self.rx.get_desc(cons.wrapping_add(i));
+            f(self.frame(addr, len as usize));
+            self.fill.put_addr(prod.wrapping_add(i), addr & !(FRAME_SIZE as u64 - 1));
+        }
+        self.rx.release(n);
+        self.fill.submit(n);
+        if self.fill.needs_wakeup() {
+            self.kick_rx();
+        }
+        n
+    }
+
+    /// Take back the transmit chunks which the kernel is done with.
+    fn complete(&self, free: &mut Vec<u64>) {
+        let (cons, n) = self.comp.peek();
+        for i in 0..n {
+            free.push(self.comp.get_addr(cons.wrapping_add(i)));
+        }
+        self.comp.release(n);
+    }
+
+    /// Put frames in the tx ring for as many messages as there are free chunks,
+    /// the rest are left in msgs.
+    fn send(&self, src_mac: &[u8; 6], msgs: &mut Vec<Message>, free: &mut Vec<u64>) {
+        let (prod, room) = self.tx.reserve();
+        let n = (msgs.len() as u32).min(room).min(free.len() as u32);
+        let mut i = 0;
+        for msg in msgs.drain(..n as usize) {
+            let addr = free.pop().unwrap();
+            match ethiface::write_frame(self.frame(addr, FRAME_SIZE), src_mac, &msg) {
+                Ok(len) => {
+                    self.tx.put_desc(prod.wrapping_add(i), addr, len as u32);
+                    i += 1;
+                }
+                Err(e) => {
+                    log::debug!("DROP: {e}");
+                    free.push(addr);
+                }
+            }
+        }
+        self.tx.submit(i);
+    }
+
+    /// Ask the kernel to send what is in the tx ring, in copy mode it only takes a
+    /// few frames per call so keep going until it has them all.
+    fn kick_tx(&self) {
+        for _ in 0..(RING_SIZE / 16) {
+            if !self.tx.needs_wakeup() {
+                return;
+            }
+            let ret = unsafe {
+                libc::sendto(
+                    self.fd.as_raw_fd(),
+                    std::ptr::null(),
+                    0,
+                    libc::MSG_DONTWAIT,
+                    std::ptr::null(),
+                    0,
+                )
+            };
+            if ret < 0 {
+                let e = std::io::Error::last_os_error();
+                match e.raw_os_error() {
+                    Some(libc::EAGAIN) | Some(libc::EBUSY) | Some(libc::ENOBUFS) => {}
+                    _ => {
+                        log::info!("Error sending on AF_XDP socket: {e}");
+                        return;
+                    }
+                }
+            }
+            let (_, room) = self.tx.reserve();
+            if room == RING_SIZE {
+                return;
+            }
+        }
+    }
+
+    fn kick_rx(&self) {
+        unsafe {
+            libc::recvfrom(
+                self.fd.as_raw_fd(),
+                std::ptr::null_mut(),
+                0,
+                libc::MSG_DONTWAIT,
+                std::ptr::null_mut(),
+                std::ptr::null_mut(),
+            )
+        };
+    }
+}
+
+/// Make the EthIface message for a received frame.
+fn eth_message(frame: &[u8], src_mac: &[u8; 6], out: &mut Vec<Message>) {
+    if frame.len() < ETH_HLEN {
+        log::debug!("DROP: runt frame of [{}] bytes", frame.len());
+        return;
+    }
+    let hdr = EthIfaceHeader {
+        mac: frame[6..12].try_into().unwrap(),
+        pkttype: pkttype(frame, src_mac),
+    };
+    match ethiface::message(&hdr, &frame[ETH_HLEN..]) {
+        Ok(m) => out.push(m),
+        Err(e) => log::debug!("DROP: {e}"),
+    }
+}
+
+/// The sender and payload of a UDP datagram in a frame which was redirected by the
+/// UDP program. The lengths in the headers are used because short frames are padded.
+/// The kernel would have checked the UDP checksum, that is left to CryptoAuth.
+fn udp_datagram(frame: &[u8]) -> Option<(SocketAddr, &[u8])> {
+    let ethertype = u16::from_be_bytes(frame.get(12..14)?.try_into().unwrap());
+    let ip = frame.get(ETH_HLEN..)?;
+    let (src, udp) = match ethertype {
+        ETH_P_IP => {
+            let ihl = (*ip.first()? & 0xf) as usize * 4;
+            let len = u16::from_be_bytes(ip.get(2..4)?.try_into().unwrap()) as usize;
+            let src: [u8; 4] = ip.get(12..16)?.try_into().unwrap();
+            (IpAddr::from(src), ip.get(ihl..len)?)
+        }
+        ETH_P_IPV6 => {
+            let len = u16::from_be_bytes(ip.get(4..6)?.try_into().unwrap()) as usize;
+            let src: [u8; 16] = ip.get(8..24)?.try_into().unwrap();
+            (IpAddr::from(src), ip.get(40..40 + len)?)
+        }
+        _ => return None,
+    };
+    let port = u16::from_be_bytes(udp.get(0..2)?.try_into().unwrap());
+    let len = u16::from_be_bytes(udp.get(4..6)?.try_into().unwrap()) as usize;
+    Some((SocketAddr::new(src, port), udp.get(8..len)?))
+}
+
+/// Make the message which UDPAddrIface would have made for a received frame.
+fn udp_message(frame: &[u8], out: &mut Vec<Message>) {
+    let (from, payload) = match udp_datagram(frame) {
+        Some(x) => x,
+        None => {
+            log::debug!("DROP: unparsable UDP frame of [{}] bytes", frame.len());
+            return;
+        }
+    };
+    let addr = Sockaddr::from(&from);
+    let mut msg = Message::new_pooled(UDP_PADDING + addr.byte_len() + payload.len());
+    msg.push_bytes(payload).unwrap();
+    msg.push_bytes(addr.bytes()).unwrap();
+    out.push(msg);
+}
+
+/// The sll_pkttype which the kernel would have given this frame.
+fn pkttype(frame: &[u8], src_mac: &[u8; 6]) -> u8 {
+    let dst = &frame[..6];
+    if dst.iter().all(|&b| b == 0xff) {
+        libc::PACKET_BROADCAST as u8
+    } else if dst[0] & 1 != 0 {
+        libc::PACKET_MULTICAST as u8
+    } else if dst == src_mac {
+        libc::PACKET_HOST as u8
+    } else {
+        libc::PACKET_OTHERHOST as u8
+    }
+}
+
+/// Addresses of the UMEM chunks which are used for sending.
+fn tx_chunks() -> Vec<u64> {
+    (RX_FRAMES..UMEM_FRAMES).map(|i| (i * FRAME_SIZE) as u64).collect()
+}
+
+/// Number of receive queues of a device.
+fn queue_count(ifname: &str) -> u32 {
+    let n = match std::fs::read_dir(format!("/sys/class/net/{ifname}/queues")) {
+        Ok(rd) => rd
+            .filter_map(|e| e.ok())
+            .filter(|e| e.file_name().to_string_lossy().starts_with("rx-"))
+            .count() as u32,
+        Err(_) => 1,
+    };
+    n.clamp(1, MAX_QUEUES)
+}
+
+/// The XDP program attached to a device and the map of sockets which it sends to,
+/// dropping this detaches the program.
+struct Program {
+    _link: OwnedFd,
+    _prog: OwnedFd,
+    xskmap: OwnedFd,
+    native: bool,
+}
+
+impl Program {
+    /// Load the program which program() makes for the map and attach it.
+    fn attach(
+        ifindex: u32,
+        queues: u32,
+        mode: XdpMode,
+        program: impl FnOnce(&OwnedFd) -> Vec<u64>,
+    ) -> Result<Self> {
+        let xskmap = bpf::xskmap_new(queues)?;
+        let prog = bpf::prog_load(&program(&xskmap))?;
+        // A link never replaces a program which is already attached
+        let try_mode = |flags| bpf::link_xdp(&prog, ifindex, flags);
+        let (link, native) = match mode {
+            XdpMode::Generic => (try_mode(XDP_FLAGS_SKB_MODE)?, false),
+            XdpMode::Native => (try_mode(XDP_FLAGS_DRV_MODE)?, true),
+            XdpMode::Auto => match try_mode(XDP_FLAGS_DRV_MODE) {
+                Ok(link) => (link, true),
+                Err(e) => {
+                    log::debug!("Native XDP not available, using generic: {e}");
+                    (try_mode(XDP_FLAGS_SKB_MODE)?, false)
+                }
+            },
+        };
+        Ok(Self { _link: link, _prog: prog, xskmap, native })
+    }
+
+    /// Open an AF_XDP socket for each queue and add it to the map, frames on queues
+    /// without a socket are passed to the kernel.
+    fn open_sockets(&self, ifname: &str, ifindex: u32, queues: u32) -> Result<Vec<Xsk>> {
+        let mut xsks = Vec::new();
+        for q in 0..queues {
+            let xsk = if self.native {
+                Xsk::new(ifindex, q, true).or_else(|e| {
+                    log::debug!("AF_XDP zero copy not available: {e}");
+                    Xsk::new(ifindex, q, false)
+                })
+            } else {
+                Xsk::new(ifindex, q, false)
+            };
+            match xsk {
+                Ok(xsk) => {
+                    bpf::map_update(&self.xskmap, q, xsk.as_raw_fd() as u32)?;
+                    xsks.push(xsk);
+                }
+                Err(e) if q > 0 => log::warn!("[{ifname}] No AF_XDP socket for queue {q}: {e}"),
+                Err(e) => return Err(e),
+            }
+        }
+        Ok(xsks)
+    }
+}
+
+/// Pass every frame received on q to f, and what f makes of them to deliver().
+async fn recv_loop(
+    q: &AsyncFd<Xsk>,
+    f: impl Fn(&[u8], &mut Vec<Message>),
+    deliver: impl Fn(&mut Vec<Message>),
+) {
+    let mut ready = Vec::with_capacity(MAX_BATCH);
+    loop {
+        let mut readable = match q.readable().await {
+            Ok(r) => r,
+            Err(e) => {
+                log::info!("Error polling AF_XDP socket: {e} - sleep 1 second");
+                tokio::time::sleep(Duration::from_secs(1)).await;
+                continue;
+            }
+        };
+        while q.get_ref().recv(MAX_BATCH as u32, |frame| f(frame, &mut ready)) > 0 {
+            if !ready.is_empty() {
+                deliver(&mut ready);
+            }
+            ready.clear();
+        }
+        readable.clear_ready();
+    }
+}
+
+impl AsRawFd for Xsk {
+    fn as_raw_fd(&self) -> RawFd {
+        self.fd.as_raw_fd()
+    }
+}
+
+struct XdpIfaceInternal {
+    iface: IfacePvt,
+    src_mac: [u8; 6],
+
+    to_go_out_recv: Mutex<Receiver<Message>>,
+    to_go_out_send: Sender<Message>,
+    done_r: tokio::sync::broadcast::Receiver<()>,
+}
+impl IfRecv for Arc<XdpIfaceInternal> {
+    fn recv(&self, m: Message) -> Result<()> {
+        if m.len() < HDR_LEN {
+            bail!("Message runt, [{}] bytes", m.len());
+        }
+        match self.to_go_out_send.try_send(m) {
+            Ok(()) => Ok(()),
+            Err(_) => bail!("Not enough buffer space to send frame"),
+        }
+    }
+}
+
+impl XdpIfaceInternal {
+    async fn recv_worker(self: Arc<Self>, q: Arc<AsyncFd<Xsk>>) {
+        recv_loop(
+            &q,
+            |frame, out| eth_message(frame, &self.src_mac, out),
+            |ready| {
+                if let Err(e) = self.iface.send_batch(ready) {
+                    log::debug!("Error processing frames: {e}");
+                }
+            },
+        )
+        .await
+    }
+
+    async fn send_worker(self: Arc<Self>, q: Arc<AsyncFd<Xsk>>) {
+        let xsk = q.get_ref();
+        let mut free = tx_chunks();
+        let mut batch = Vec::with_capacity(MAX_BATCH);
+        loop {
+            self.to_go_out_recv.lock().await.recv_many(&mut batch, MAX_BATCH).await;
+            let mut tries = 0;
+            while !batch.is_empty() {
+                xsk.complete(&mut free);
+                xsk.send(&self.src_mac, &mut batch, &mut free);
+                xsk.kick_tx();
+                if batch.is_empty() {
+                    break;
+                }
+                // Out of chunks, give the kernel a chance to complete some
+                tries += 1;
+                if tries > 3 {
+                    log::debug!("DROP: [{}] frames, AF_XDP transmit ring is full", batch.len());
+                    batch.clear();
+                    break;
+                }
+                tokio::task::yield_now().await;
+            }
+        }
+    }
+
+    async fn worker(self: Arc<Self>, q: Arc<AsyncFd<Xsk>>, send: bool) {
+        let mut done = self.done_r.resubscribe();
+        if send {
+            tokio::select! {
+                _ = Arc::clone(&self).send_worker(q) => {},
+                _ = done.recv() => {},
+            }
+        } else {
+            tokio::select! {
+                _ = Arc::clone(&self).recv_worker(q) => {},
+                _ = done.recv() => {},
+            }
+        }
+    }
+}
+
+pub struct XdpIface {
+    pub iface: Iface,
+    pub native: bool,
+    pub queues: u32,
+    // This is never sent to, it is DROPPED in order to cause the tasks to exit
+    _done: tokio::sync::broadcast::Sender<()>,
+    // Detaches the program when dropped, after the workers are told to stop
+    _prog: Program,
+}
+
+impl XdpIface {
+    /// Attach an XDP program to a device and open an AF_XDP socket for each of its
+    /// receive queues. src_mac is the MAC of the device, used in sent frames.
+    pub fn new(ifname: &str, ifindex: u32, src_mac: [u8; 6], mode: XdpMode) -> Result<Self> {
+        let queues = queue_count(ifname);
+        let prog = Program::attach(ifindex, queues, mode, |xskmap| {
+            bpf::program(xskmap, ETHERTYPE_CJDNS)
+        })?;
+        let xsks = prog.open_sockets(ifname, ifindex, queues)?;
+
+        let (tgo, tgo_r) = tokio::sync::mpsc::channel(TO_GO_OUT_QUEUE);
+        let (_done, done_r) = tokio::sync::broadcast::channel(1);
+        let (mut iface, iface_pvt) = iface::new("XdpIface");
+        let inner = Arc::new(XdpIfaceInternal {
+            iface: iface_pvt,
+            src_mac,
+            to_go_out_recv: Mutex::new(tgo_r),
+            to_go_out_send: tgo,
+            done_r,
+        });
+        iface.set_receiver(Arc::clone(&inner));
+        let queues = xsks.len() as u32;
+        for xsk in xsks {
+            let q = Arc::new(AsyncFd::new(xsk)?);
+            tokio::task::spawn(Arc::clone(&inner).worker(Arc::clone(&q), true));
+            tokio::task::spawn(Arc::clone(&inner).worker(q, false));
+        }
+        Ok(Self { iface, native: prog.native, queues, _done, _prog: prog })
+    }
+}
+
+/// Receives the datagrams of a UDP socket from a device on AF_XDP sockets, the socket
+/// is still used for sending and receives whatever the program passes. Dropping this
+/// stops the workers and detaches the program.
+pub struct XdpUdp {
+    pub native: bool,
+    pub queues: u32,
+    // This is never sent to, it is DROPPED in order to cause the tasks to exit
+    _done: tokio::sync::broadcast::Sender<()>,
+    // Detaches the program when dropped, after the workers are told to stop
+    _prog: Program,
+}
+
+impl XdpUdp {
+    /// Take datagrams to `local`, the address of the socket, from device ifname and
+    /// give each batch of messages, which begin with the sender's Sockaddr, to deliver.
+    pub fn new<F>(ifname: &str, local: &SocketAddr, mode: XdpMode, deliver: F) -> Result<Self>
+    where
+        F: Fn(&mut Vec<Message>) + Send + Sync + 'static,
+    {
+        let cname = std::ffi::CString::new(ifname)?;
+        let ifindex = unsafe { libc::if_nametoindex(cname.as_ptr()) };
+        if ifindex == 0 {
+            bail!("No such device [{}]", ifname);
+        }
+        let queues = queue_count(ifname);
+        let prog = Program::attach(ifindex, queues, mode, |xskmap| {
+            bpf::program_udp(xskmap, local)
+        })?;
+        let xsks = prog.open_sockets(ifname, ifindex, queues)?;
+
+        let (_done, done_r) = tokio::sync::broadcast::channel(1);
+        let deliver = Arc::new(deliver);
+        let queues = xsks.len() as u32;
+        for xsk in xsks {
+            let q = AsyncFd::new(xsk)?;
+            let deliver = Arc::clone(&deliver);
+            let mut done = done_r.resubscribe();
+            tokio::task::spawn(async move {
+                tokio::select! {
+                    _ = recv_loop(&q, udp_message, |ready| deliver(ready)) => {},
+                    _ = done.recv() => {},
+                }
+            });
+        }
+        Ok(Self { native: prog.native, queues, _done, _prog: prog })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::convert::TryFrom;
+
+    #[test]
+    fn test_pkttype() {
+        let me = [2, 0, 0, 0, 0, 1];
+        let mut f = [0_u8; ETH_HLEN];
+        f[..6].copy_from_slice(&[0xff; 6]);
+        assert_eq!(pkttype(&f, &me), libc::PACKET_BROADCAST as u8);
+        f[..6].copy_from_slice(&[0x33, 0x33, 0, 0, 0, 1]);
+        assert_eq!(pkttype(&f, &me), libc::PACKET_MULTICAST as u8);
+        f[..6].copy_from_slice(&me);
+        assert_eq!(pkttype(&f, &me), libc::PACKET_HOST as u8);
+        f[..6].copy_from_slice(&[2, 0, 0, 0, 0, 2]);
+        assert_eq!(pkttype(&f, &me), libc::PACKET_OTHERHOST as u8);
+    }
+
+    fn udp_frame(src: SocketAddr, dst: SocketAddr, payload: &[u8]) -> Vec<u8> {
+        let mut udp = src.port().to_be_bytes().to_vec();
+        udp.extend_from_slice(&dst.port().to_be_bytes());
+        udp.extend_from_slice(&(8 + payload.len() as u16).to_be_bytes());
+        udp.extend_from_slice(&[0, 0]);
+        udp.extend_from_slice(payload);
+        let mut f = vec![0_u8; 12];
+        match (src.ip(), dst.ip()) {
+            (IpAddr::V4(s), IpAddr::V4(d)) => {
+                f.extend_from_slice(&ETH_P_IP.to_be_bytes());
+                f.extend_from_slice(&[0x45, 0]);
+                f.extend_from_slice(&(20 + udp.len() as u16).to_be_bytes());
+                f.extend_from_slice(&[0, 0, 0, 0, 64, IPPROTO_UDP as u8, 0, 0]);
+                f.extend_from_slice(&s.octets());
+                f.extend_from_slice(&d.octets());
+            }
+            (IpAddr::V6(s), IpAddr::V6(d)) => {
+                f.extend_from_slice(&ETH_P_IPV6.to_be_bytes());
+                f.extend_from_slice(&[0x60, 0, 0, 0]);
+                f.extend_from_slice(&(udp.len() as u16).to_be_bytes());
+                f.extend_from_slice(&[IPPROTO_UDP as u8, 64]);
+                f.extend_from_slice(&s.octets());
+                f.extend_from_slice(&d.octets());
+            }
+            _ => panic!("mixed families"),
+        }
+        f.extend_from_slice(&udp);
+        f
+    }
+
+    #[test]
+    fn test_udp_datagram() {
+        let pairs = [("10.0.0.1:1234", "10.0.0.2:5678"), ("[fc00::1]:1234", "[fc00::2]:5678")];
+        for (src, dst) in pairs {
+            let (src, dst) = (src.parse().unwrap(), dst.parse().unwrap());
+            let mut f = udp_frame(src, dst, b"hi");
+            // Short frames are padded to 60 bytes
+            f.resize(f.len().max(60), 0xee);
+            assert_eq!(udp_datagram(&f), Some((src, &b"hi"[..])));
+            let mut out = Vec::new();
+            udp_message(&f, &mut out);
+            let sa = Sockaddr::try_from(out[0].bytes()).unwrap();
+            assert_eq!(sa.rs().unwrap(), src);
+            assert_eq!(&out[0].bytes()[sa.byte_len()..], b"hi");
+
+            let f = udp_frame(src, dst, &[7; 100]);
+            assert_eq!(udp_datagram(&f[..f.len() - 1]), None);
+        }
+        assert_eq!(udp_datagram(&[0; 13]), None);
+        // IPv4 with a header length which runs past the packet
+        let mut f = udp_frame("10.0.0.1:1".parse().unwrap(), "10.0.0.2:2".parse().unwrap(), b"");
+        f[ETH_HLEN] = 0x4f;
+        assert_eq!(udp_datagram(&f), None);
+    }
+
+    /// Only one program at a time can be attached to the loopback device.
+    static LOOPBACK: std::sync::Mutex<()> = std::sync::Mutex::new(());
+
+    // Needs CAP_NET_ADMIN and CAP_BPF. Datagrams sent to a socket on the loopback
+    // device are taken by the UDP program, datagrams to another port are not.
+    fn check_xsk_udp_loopback(bind: &str) {
+        let ifindex = unsafe { libc::if_nametoindex(b"lo\0".as_ptr() as _) };
+        let sock = match std::net::UdpSocket::bind(bind) {
+            Ok(s) => s,
+            Err(e) => {
+                println!("Skipping {bind}: {e}");
+                return;
+            }
+        };
+        let local = sock.local_addr().unwrap();
+        let other = std::net::UdpSocket::bind(bind).unwrap();
+        other.set_read_timeout(Some(Duration::from_secs(1))).unwrap();
+        let from = std::net::UdpSocket::bind(bind).unwrap();
+        let prog = Program::attach(ifindex, 1, XdpMode::Generic, |xskmap| {
+            bpf::program_udp(xskmap, &local)
+        })
+        .unwrap();
+        let xsk = Xsk::new(ifindex, 0, false).unwrap();
+        bpf::map_update(&prog.xskmap, 0, xsk.as_raw_fd() as u32).unwrap();
+
+        let count = 100;
+        for i in 0..count {
+            from.send_to(&[i as u8; 200], local).unwrap();
+        }
+        from.send_to(b"passed", other.local_addr().unwrap()).unwrap();
+
+        let mut out = Vec::new();
+        for _ in 0..100 {
+            xsk.recv(MAX_BATCH as u32, |frame| udp_message(frame, &mut out));
+            if out.len() >= count {
+                break;
+            }
+            std::thread::sleep(Duration::from_millis(5));
+        }
+        assert_eq!(out.len(), count);
+        for (i, m) in out.iter().enumerate() {
+            let sa = Sockaddr::try_from(m.bytes()).unwrap();
+            assert_eq!(sa.rs().unwrap(), from.local_addr().unwrap());
+            assert_eq!(&m.bytes()[sa.byte_len()..], &[i as u8; 200][..]);
+        }
+        let mut buf = [0_u8; 16];
+        let (len, _) = other.recv_from(&mut buf).unwrap();
+        assert_eq!(&buf[..len], b"passed");
+    }
+
+    #[test]
+    #[ignore]
+    fn test_xsk_udp_loopback() {
+        let _lo = LOOPBACK.lock().unwrap();
+        check_xsk_udp_loopback("127.0.0.1:0");
+        check_xsk_udp_loopback("[::1]:0");
+    }
+
+    // Needs CAP_NET_ADMIN and CAP_BPF, the program is attached to the loopback device
+    // in generic mode and frames sent on the socket come back to it.
+    #[test]
+    #[ignore]
+    fn test_xsk_loopback() {
+        let _lo = LOOPBACK.lock().unwrap();
+        let ifindex = unsafe { libc::if_nametoindex(b"lo\0".as_ptr() as _) };
+        let prog = Program::attach(ifindex, 1, XdpMode::Generic, |xskmap| {
+            bpf::program(xskmap, ETHERTYPE_CJDNS)
+        })
+        .unwrap();
+        let xsk = Xsk::new(ifindex, 0, false).unwrap();
+        bpf::map_update(&prog.xskmap, 0, xsk.as_raw_fd() as u32).unwrap();
+
+        let me = [0_u8; 6];
+        let peer = EthIfaceHeader { mac: me, pkttype: 0 };
+        let count = 100;
+        let mut free = tx_chunks();
+        let mut msgs = (0..count)
+            .map(|i| ethiface::message(&peer, &[i as u8; 200]).unwrap())
+            .collect::<Vec<_>>();
+        xsk.send(&me, &mut msgs, &mut free);
+        assert!(msgs.is_empty());
+        xsk.kick_tx();
+
+        let mut out = Vec::new();
+        for _ in 0..100 {
+            xsk.recv(MAX_BATCH as u32, |frame| eth_message(frame, &me, &mut out));
+            if out.len() >= count {
+                break;
+            }
+            std::thread::sleep(Duration::from_millis(5));
+        }
+        assert_eq!(out.len(), count);
+        for (i, m) in out.iter().enumerate() {
+            let b = m.bytes();
+            assert_eq!(b.len(), HDR_LEN + 200);
+            assert_eq!(EthIfaceHeader::decode(b).pkttype, libc::PACKET_HOST as u8);
+            assert!(b[HDR_LEN..].iter().all(|&x| x == i as u8));
+        }
+        xsk.complete(&mut free);
+        assert_eq!(free.len(), UMEM_FRAMES - RX_FRAMES);
+    }
+}
@@ -10,8 +10,11 @@ pub fn rust_main(cmain: unsafe extern "C" fn(c_int, *const *mut c_char)) {
         std::env::set_var("RUST_BACKTRACE", "full");
     }
 
+    let topology = util::topology::get();
     tokio::runtime::Builder::new_multi_thread()
-        .worker_threads(8)
+        .worker_threads(topology.runtime_threads)
+        .thread_name_fn(util::topology::runtime_thread_namer(topology.runtime_threads))
+        .on_thread_start(util::topology::place_current_thread)
         .enable_all()
         .build()
         .unwrap()
@@ -63,4 +66,23 @@ mod rffi;
 mod rtypes;
 mod util;
 mod gcl;
-mod subnode;
\ No newline at end of file
+mod subnode;
+
+/// What the tests in tests/ use, they are built as crates of their own so they
+/// can only see what is public. Only built with the test-util feature.
+#[cfg(any(test, feature = "test-util"))]
+#[doc(hidden)]
+pub mod for_tests {
+    pub use crate::interface::wire::message::Message;
+    pub use crate::rffi::allocator::{self, Allocator, FileLine};
+    pub mod cffi {
+        pub use crate::cffi::{Message, Message_new_fromRust};
+    }
+
+    /// A C message in its own allocator, as C makes them for each packet.
+    pub fn c_packet(root: &Allocator) -> (Allocator, *mut cffi::Message) {
+        let mut alloc = allocator::child!(root);
+        let msg = unsafe { cffi::Message_new_fromRust(1024, 512, alloc.c()) };
+        (alloc, msg)
+    }
+}
@@ -4,40 +4,201 @@ use std::ffi::{c_void, CStr};
 use std::os::raw::c_char;
 use std::any::Any;
 use crate::cffi::Allocator_t;
-use crate::gcl::GCL;
-use std::cell::{RefCell,Ref};
+use crate::gcl::{self, Site};
+use crate::rtypes::{RTypes_AllocProfile_Entry_t, RTypes_AllocProfile_t, RTypes_BufPool_Stats_t};
+use crate::util::alloc_profile::{self, Sample};
+use crate::util::buf_pool;
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicU8, Ordering};
+
+/// Set this to 1 to overwrite memory with 0xef when it is freed, so that use after
+/// free shows up as garbage rather than as stale data.
+pub const ENV_POISON: &str = "CJDNS_ALLOCATOR_POISON";
+
+const POISON_UNKNOWN: u8 = 0;
+const POISON_OFF: u8 = 1;
+const POISON_ON: u8 = 2;
+static POISON: AtomicU8 = AtomicU8::new(POISON_UNKNOWN);
+
+fn poison_enabled() -> bool {
+    match POISON.load(Ordering::Relaxed) {
+        POISON_UNKNOWN => {
+            let on = std::env::var(ENV_POISON).map(|v| v.trim() != "0").unwrap_or(false);
+            set_poison(on);
+            on
+        }
+        p => p == POISON_ON,
+    }
+}
 
+/// Turn poisoning of freed memory on or off, overrides CJDNS_ALLOCATOR_POISON.
+pub fn set_poison(on: bool) {
+    POISON.store(if on { POISON_ON } else { POISON_OFF }, Ordering::Relaxed);
+}
+
+fn poison(mem: &mut [u128]) {
+    for w in mem.iter_mut() {
+        *w = 0xefefefefefefefefefefefefefefefef_u128;
+    }
+}
+
+fn uninit_vec(count: usize) -> Vec<u128> {
+    let mut v = Vec::with_capacity(count);
+    unsafe { v.set_len(count); }
+    v
+}
+
+/// A block of memory which is not in the arena, because it is large or pooled.
 struct Mem {
     loc: Vec<u128>,
+    /// The packet buffer pool which it came from, it goes back there when freed
+    pool: Option<buf_pool::Owner>,
 }
 impl Mem {
-    fn destroy(&mut self, _alloc_ident: &str) {
-        // Too noisy, even for trace
-        //log::trace!("Dropping memory {:p} from {}", &self.loc[0], alloc_ident);
-        for i in 0..self.loc.len() {
-            self.loc[i] = 0xefefefefefefefefefefefefefefefef_u128;
+    fn destroy(&mut self, poison_mem: bool) {
+        if poison_mem {
+            poison(&mut self.loc);
+        }
+        if let Some(pool) = self.pool.take() {
+            buf_pool::give(std::mem::take(&mut self.loc), &pool);
         }
     }
 }
 
+/// Allocations up to this many bytes are carved out of the arena.
+const ARENA_MAX_ALLOC: usize = 2048;
+/// Size of the first arena chunk in words, each next chunk is twice the size
+/// of the previous one up to ARENA_MAX_CHUNK.
+const ARENA_FIRST_CHUNK: usize = 512 / 16;
+const ARENA_MAX_CHUNK: usize = 32 * 1024 / 16;
+
+/// Each arena allocation is preceded by one header word holding its size in
+/// words and a tag identifying the arena, so realloc() can find it without a
+/// search and can tell when a pointer is not from this allocator.
+const HEADER_MAGIC: u64 = 0xa110c8ed_a110c8ed;
+
+/// Allocators are almost always freed as a whole, so small allocations are
+/// bump allocated from chunks which belong to the allocator and the chunks are
+/// only released when the allocator is freed. Chunks are never resized so the
+/// memory does not move.
+#[derive(Default)]
+struct Arena {
+    chunks: Vec<Vec<u128>>,
+    /// Words used in the last chunk
+    used: usize,
+}
+impl Arena {
+    /// The arena does not move while it is in use because it is inside of the
+    /// AllocatorInner, so its address identifies it.
+    fn tag(&self) -> u64 {
+        self as *const Arena as u64 ^ HEADER_MAGIC
+    }
+
+    fn header(&self, words: usize) -> u128 {
+        (self.tag() as u128) << 64 | words as u128
+    }
+
+    fn alloc(&mut self, words: usize) -> *mut u128 {
+        let fits = match self.chunks.last() {
+            Some(c) => c.len() - self.used > words,
+            None => false,
+        };
+        if !fits {
+            let next = match self.chunks.last() {
+                Some(c) => (c.len() * 2).min(ARENA_MAX_CHUNK),
+                None => ARENA_FIRST_CHUNK,
+            };
+            self.chunks.push(uninit_vec(next.max(words + 1)));
+            self.used = 0;
+        }
+        let header = self.header(words);
+        let c = self.chunks.last_mut().unwrap();
+        unsafe {
+            let h = c.as_mut_ptr().add(self.used);
+            *h = header;
+            self.used += words + 1;
+            h.add(1)
+        }
+    }
+
+    /// Size in words of the allocation at `loc`, None if it is not from this arena.
+    /// *Unsafe:* `loc` must not be the start of a block which is not from an arena.
+    unsafe fn words_of(&self, loc: *mut u128) -> Option<usize> {
+        if loc as usize % 16 != 0 {
+            return None;
+        }
+        let h = *loc.sub(1);
+        if (h >> 64) as u64 != self.tag() {
+            return None;
+        }
+        Some(h as u64 as usize)
+    }
+
+    /// Resize the allocation at `loc` without moving it, this is possible when
+    /// shrinking or if it is the last allocation in the last chunk and the chunk
+    /// has room.
+    fn resize_in_place(&mut self, loc: *mut u128, old_words: usize, words: usize) -> bool {
+        if words > old_words {
+            let c = match self.chunks.last() {
+                Some(c) => c,
+                None => return false,
+            };
+            let start = (loc as usize).wrapping_sub(c.as_ptr() as usize) / 16;
+            if start >= c.len() || start + old_words != self.used || start + words > c.len() {
+                return false;
+            }
+            self.used = start + words;
+        }
+        let header = self.header(words);
+        unsafe { *loc.sub(1) = header };
+        true
+    }
+
+    fn destroy(&mut self, poison_mem: bool) {
+        if poison_mem {
+            for c in self.chunks.iter_mut() {
+                poison(c);
+            }
+        }
+        self.chunks.clear();
+    }
+}
+
 struct AllocatorMut {
     // This is a leak, but we're not relying on drop() semantics to clear allocators
     parents: Vec<Arc<AllocatorInner>>,
     children: Vec<Arc<AllocatorInner>>,
-    mem: Vec<Mem>,
+    arena: Arena,
+    /// Blocks which are not in the arena, by address
+    mem: HashMap<usize, Mem>,
+    /// Allocations which were sampled by the allocation profiler, by address
+    samples: HashMap<usize, Sample>,
     obj: Vec<Box<dyn Any + Send>>,
     on_free: Vec<OnFreeJob>,
     is_freeing: bool,
+    /// Number of Holds on this allocator, it is not freed while there are any
+    holds: u32,
+    /// One of the Holds owns this allocator, so it can be adopted like an allocator with a parent
+    owner_hold: bool,
+    /// The allocator was freed while held, the free completes when the last Hold is dropped
+    free_pending: bool,
 }
 
 struct AllocatorInner {
     m: Mutex<AllocatorMut>,
-    ident: RefCell<String>,
+    file_line: FileLine,
     mebox: RefCell<*mut Allocator>,
 }
 unsafe impl Send for AllocatorInner {}
 unsafe impl Sync for AllocatorInner {}
 
+impl AllocatorInner {
+    /// Only for logging and errors, this allocates a string.
+    fn ident(&self) -> String {
+        format!("{}/{:p}", self.file_line.print(), *self.mebox.borrow())
+    }
+}
 struct OnFreeJob {
     f: OnFreeFun,
     c: *mut c_void,
@@ -47,7 +208,7 @@ unsafe impl Send for OnFreeJob {}
 
 fn assert_not_freeing(m: &AllocatorMut, inner: &AllocatorInner, thing_doing: &str) {
     if m.is_freeing {
-        panic!("Allocator [{}] cannot {} while freeing", inner.ident.borrow(), thing_doing);
+        panic!("Allocator [{}] cannot {} while freeing", inner.ident(), thing_doing);
     }
 }
 
@@ -59,35 +220,63 @@ fn as_count(size: usize) -> usize {
     count
 }
 
+fn alloc_locked(m: &mut AllocatorMut, size: usize) -> *mut u8 {
+    let count = as_count(size);
+    if size <= ARENA_MAX_ALLOC {
+        return m.arena.alloc(count) as *mut u8;
+    }
+    let mut mem = Mem{ loc: uninit_vec(count), pool: None };
+    let p = mem.loc.as_mut_ptr() as *mut u8;
+    m.mem.insert(p as usize, mem);
+    p
+}
+
 // Does not disconnect alloc from parent (!)
 fn get_to_free(
     parent: Option<&Arc<AllocatorInner>>,
     alloc: &Arc<AllocatorInner>,
     depth: i32,
     v: &mut Vec<(Arc<AllocatorInner>, i32)>,
-    orig_free_ident: &String,
+    orig_free: &AllocatorInner,
 ) {
     let children = {
         let mut m = alloc.m.lock();
         if let Some(parent) = parent {
-            m.parents.retain(|p| p.ident != parent.ident);
+            m.parents.retain(|p| !Arc::ptr_eq(p, parent));
             if !m.parents.is_empty() {
                 log::trace!("Continuing from child {} of {} because it has {} other parent(s):",
-                    alloc.ident.borrow(), parent.ident.borrow(), m.parents.len());
+                    alloc.ident(), parent.ident(), m.parents.len());
                 for p in m.parents.iter() {
-                    log::trace!("  {}", p.ident.borrow());
+                    log::trace!("  {}", p.ident());
                 }
                 return;
             }
         }
         assert!(!m.is_freeing);
+        if m.holds > 0 {
+            log::trace!("Deferring free of allocator [{}] because it has {} hold(s)",
+                alloc.ident(), m.holds);
+            m.free_pending = true;
+            return;
+        }
         log::trace!("Freeing allocator [{}] (depth: [{}]) because of: {}",
-            alloc.ident.borrow(), depth, orig_free_ident);
+            alloc.ident(), depth, orig_free.ident());
         m.is_freeing = true;
         std::mem::take(&mut m.children)
     };
+    get_children_to_free(alloc, children, depth, v, orig_free);
+}
+
+// For an alloc which has already been marked is_freeing
+fn get_children_to_free(
+    alloc: &Arc<AllocatorInner>,
+    children: Vec<Arc<AllocatorInner>>,
+    depth: i32,
+    v: &mut Vec<(Arc<AllocatorInner>, i32)>,
+    orig_free: &AllocatorInner,
+) {
     for c in children {
-        get_to_free(Some(alloc), &c, depth + 1, v, orig_free_ident);
+        get_to_free(Some(alloc), &c, depth + 1, v, orig_free);
     }
     v.push((Arc::clone(alloc), depth));
 }
@@ -112,11 +301,20 @@ fn free_allocs(mut allocs: Vec<(Arc<AllocatorInner>, i32)>) {
         }
     }
     for (alloc, _) in allocs {
-        log::trace!("Freeing {} 2", alloc.ident.borrow());
-        let mems = alloc.m.lock().mem.drain(..).collect::<Vec<_>>();
-        let ident = alloc.ident.borrow();
-        for mut mem in mems {
-            mem.destroy(&ident[..]);
+        log::trace!("Freeing {} 2", alloc.ident());
+        let poison_mem = poison_enabled();
+        let (mems, mut arena, samples) = {
+            let mut m = alloc.m.lock();
+            (std::mem::take(&mut m.mem), std::mem::take(&mut m.arena), std::mem::take(&mut m.samples))
+        };
+        if !samples.is_empty() {
+            alloc_profile::release(samples.into_values());
+        }
+        // Too noisy, even for trace
+        //log::trace!("Dropping {} chunks and {} blocks from {}", arena.chunks.len(), mems.len(), alloc.ident());
+        arena.destroy(poison_mem);
+        for (_, mut mem) in mems {
+            mem.destroy(poison_mem);
         }
         // Drop the allocator box
         unsafe { Box::from_raw(*alloc.mebox.borrow()) };
@@ -138,14 +336,18 @@ const MAGIC: u32 = 0xdeaffeed;
 
 pub type OnFreeFun = extern "C" fn(ctx: *mut c_void);
 
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
 pub struct FileLine{
     pub file_s: Option<&'static str>,
     pub file_c: Option<*const c_char>,
     pub line: usize,
 }
+// The file names are static strings
+unsafe impl Send for FileLine {}
+unsafe impl Sync for FileLine {}
 
 impl FileLine {
-    fn print(&self) -> String {
+    pub fn print(&self) -> String {
         if let Some(s) = self.file_s {
             format!("{}:{}", s, self.line)
         } else if let Some(file) = self.file_c {
@@ -193,22 +395,22 @@ pub(crate) use child;
 
 impl Allocator {
     fn new_int(file_line: FileLine, parents: Vec<Arc<AllocatorInner>>) -> *mut Allocator_t {
-        let parent = if let Some(parent) = parents.get(0) {
-            parent.ident.borrow().to_owned()
-        } else {
-            "<root>".to_owned()
-        };
         let a = Box::new(Allocator{
             inner: Arc::new(AllocatorInner{
                 m: Mutex::new(AllocatorMut{
                     parents: parents,
                     children: Vec::new(),
-                    mem: Vec::new(),
+                    arena: Arena::default(),
+                    mem: HashMap::new(),
+                    samples: HashMap::new(),
                     obj: Vec::new(),
                     on_free: Vec::new(),
                     is_freeing: false,
+                    holds: 0,
+                    owner_hold: false,
+                    free_pending: false,
                 }),
-                ident: RefCell::default(),
+                file_line,
                 mebox: RefCell::new(std::ptr::null_mut()),
             }),
             magic: MAGIC,
@@ -219,9 +421,9 @@ impl Allocator {
         unsafe {
             // Avoid creating implicit references from raw pointer field chaining; take an explicit ref.
             let alloc_ref: &mut Allocator = &mut *a;
-            alloc_ref.inner.ident.replace(format!("{}/{:p}", file_line.print(), a));
             alloc_ref.inner.mebox.replace(a);
-            log::trace!("New allocator {} <- {}", alloc_ref.ident(), parent);
+            log::trace!("New allocator {} <- {}", alloc_ref.ident(),
+                alloc_ref.inner.m.lock().parents.get(0).map(|p| p.ident()).unwrap_or_else(|| "<root>".into()));
         }
         a as *mut Allocator_t
     }
@@ -236,8 +438,8 @@ impl Allocator {
         Self::new_int(file_line, Vec::new())
     }
 
-    pub fn ident(&self) -> Ref<'_, String> {
-        self.inner.ident.borrow()
+    pub fn ident(&self) -> String {
+        self.inner.ident()
     }
 
     pub fn child(&self, file_line: FileLine) -> *mut Allocator_t {
@@ -249,42 +451,113 @@ impl Allocator {
         out
     }
 
-    pub fn malloc(&self, size: usize, zero_mem: bool) -> *mut u8 {
+    /// If the allocation profiler wants this allocation, record it against the
+    /// creation sites of this allocator and its ancestors. This must be called
+    /// without holding the lock because it locks each of the ancestors.
+    #[inline]
+    fn sample(&self, size: usize, file_line: FileLine) -> Option<Sample> {
+        if size == 0 || !alloc_profile::enabled() {
+            return None;
+        }
+        self.sample_slow(size, file_line)
+    }
+
+    #[inline(never)]
+    fn sample_slow(&self, size: usize, file_line: FileLine) -> Option<Sample> {
+        let weight = alloc_profile::sample(size)?;
+        let mut stack = vec![file_line];
+        let mut a = Some(Arc::clone(&self.inner));
+        while let Some(inner) = a {
+            stack.push(inner.file_line);
+            a = inner.m.lock().parents.get(0).map(Arc::clone);
+        }
+        stack.reverse();
+        Some(alloc_profile::record(stack, weight))
+    }
+
+    pub fn malloc(&self, size: usize, zero_mem: bool, file_line: FileLine) -> *mut u8 {
         if size == 0 {
             return std::ptr::null_mut();
         }
-        let count = as_count(size);
-        let mut mem = Mem{ loc: Vec::with_capacity(count) };
+        let sample = self.sample(size, file_line);
+        let mut m = self.inner.m.lock();
+        assert_not_freeing(&*m, &self.inner, "allocate");
+        let p = alloc_locked(&mut m, size);
+        if let Some(sample) = sample {
+            m.samples.insert(p as usize, sample);
+        }
         if zero_mem {
-            for _ in 0..count {
-                mem.loc.push(0);
-            }
-        } else {
-            unsafe { mem.loc.set_len(count); }
+            unsafe { std::ptr::write_bytes(p, 0, as_count(size) * 16) };
         }
+        p
+    }
+
+    /// Like malloc() but the memory is taken from the packet buffer pool of the
+    /// current thread and goes back to that pool when the allocator is freed,
+    /// whichever thread frees it.
+    /// The memory is not initialized.
+    pub fn malloc_pooled(&self, size: usize, file_line: FileLine) -> *mut u8 {
+        if size == 0 {
+            return std::ptr::null_mut();
+        }
+        let sample = self.sample(size, file_line);
+        let (loc, pool) = buf_pool::take(size);
+        let mem = Mem{ loc, pool };
         let p = &mem.loc[0] as *const u128 as *const u8 as *mut u8;
         let mut m = self.inner.m.lock();
         assert_not_freeing(&*m, &self.inner, "allocate");
-        m.mem.push(mem);
+        m.mem.insert(p as usize, mem);
+        if let Some(sample) = sample {
+            m.samples.insert(p as usize, sample);
+        }
         p
     }
 
-    pub fn realloc(&self, memptr: *mut u8, new_size: usize) -> *mut u8 {
+    pub fn realloc(&self, memptr: *mut u8, new_size: usize, file_line: FileLine) -> *mut u8 {
         if memptr.is_null() {
-            return self.malloc(new_size, false);
+            return self.malloc(new_size, false, file_line);
         }
-        let mut m = self.inner.m.lock();
-        assert_not_freeing(&*m, &self.inner, "realloc");
-        for (i, mem) in m.mem.iter_mut().enumerate() {
-            let p = &mem.loc[0] as *const u128 as *const u8 as *mut u8;
-            if p == memptr {
-                mem.loc.resize(as_count(new_size), 0);
-                if new_size == 0 {
-                    m.mem.remove(i);
-                    return std::ptr::null_mut();
-                }
-                return &mem.loc[0] as *const u128 as *const u8 as *mut u8;
+        let sample = self.sample(new_size, file_line);
+        let (p, released) = {
+            let mut m = self.inner.m.lock();
+            assert_not_freeing(&*m, &self.inner, "realloc");
+            let released = if m.samples.is_empty() { None } else { m.samples.remove(&(memptr as usize)) };
+            let p = self.realloc_locked(&mut m, memptr, new_size);
+            if let Some(sample) = sample {
+                m.samples.insert(p as usize, sample);
+            }
+            (p, released)
+        };
+        if let Some(r) = released {
+            alloc_profile::release(Some(r));
+        }
+        p
+    }
+
+    fn realloc_locked(&self, m: &mut AllocatorMut, memptr: *mut u8, new_size: usize) -> *mut u8 {
+        if let Some(mut mem) = m.mem.remove(&(memptr as usize)) {
+            if new_size == 0 {
+                return std::ptr::null_mut();
             }
+            mem.loc.resize(as_count(new_size), 0);
+            let p = mem.loc.as_mut_ptr() as *mut u8;
+            m.mem.insert(p as usize, mem);
+            return p;
+        }
+        // It is not a block so it is safe to look for an arena header
+        let loc = memptr as *mut u128;
+        if let Some(old_words) = unsafe { m.arena.words_of(loc) } {
+            if new_size == 0 {
+                // The space is dead until the allocator is freed
+                return std::ptr::null_mut();
+            }
+            let words = as_count(new_size);
+            if new_size <= ARENA_MAX_ALLOC && m.arena.resize_in_place(loc, old_words, words) {
+                return memptr;
+            }
+            let p = alloc_locked(m, new_size);
+            unsafe { std::ptr::copy_nonoverlapping(loc, p as *mut u128, old_words.min(words)) };
+            return p;
         }
         panic!("pointer {:p} is not in memory allocator {:p}", memptr, self);
     }
@@ -296,7 +569,7 @@ impl Allocator {
     }
 
     pub fn adopt_alloc(&self, a: Allocator) {
-        if self.inner.ident == a.inner.ident {
+        if Arc::ptr_eq(&self.inner, &a.inner) {
             return;
         }
         // Danger: possibility of deadlock if this is in the opposite order elsewhere!
@@ -304,20 +577,22 @@ impl Allocator {
         let mut am = a.inner.m.lock();
         assert_not_freeing(&*m, &self.inner, "adopt");
         assert_not_freeing(&*am, &a.inner, "be adopted");
-        if am.parents.is_empty() {
+        if am.parents.is_empty() && !am.owner_hold {
             // Adopting a root allocator is a no-op
             return;
         }
-        if m.children.iter().find(|c|c.ident == a.inner.ident).is_some() {
+        if m.children.iter().find(|c| Arc::ptr_eq(c, &a.inner)).is_some() {
             log::trace!("Allocator [{}] being adopted by [{}] but it is already a parent", a.ident(), self.ident());
             return;
-        } else if a.inner.ident == self.inner.ident {
+        } else if Arc::ptr_eq(&a.inner, &self.inner) {
             log::trace!("Allocator [{}] attempting to adopt itself", self.ident());
             return;
         }
         log::trace!("Allocator [{}] being adopted by [{}]", a.ident(), self.ident());
         m.children.push(Arc::clone(&a.inner));
         am.parents.push(Arc::clone(&self.inner));
+        // If it was freed while held, it is now kept alive by its new parent
+        am.free_pending = false;
     }
 
     pub fn adopt<T: 'static>(&self, t: T) -> *mut T {
@@ -333,8 +608,8 @@ impl Allocator {
         *self.inner.mebox.borrow() as _
     }
 
-    pub fn free(&mut self, source: &str) {
-        let _l = GCL.lock();
+    pub fn free(&mut self, source: &FileLine) {
+        let _l = gcl::lock(Site::AllocatorFree);
         let (parent, parent_count) = {
             let m = self.inner.m.lock();
             if m.is_freeing {
@@ -345,10 +620,10 @@ impl Allocator {
         };
         // Disconnect this alloc from it's parent because get_to_free does not do that
         if let Some(p) = &parent {
-            p.m.lock().children.retain(|c| c.ident != self.inner.ident);
+            p.m.lock().children.retain(|c| !Arc::ptr_eq(c, &self.inner));
             if parent_count > 1 {
                 log::trace!("Skip freeing [{}] at [{}] because it has [{}] more parents",
-                    self.inner.ident.borrow(), source, parent_count - 1);
+                    self.inner.ident(), source.print(), parent_count - 1);
                 let mut m = self.inner.m.lock();
                 let l0 = m.parents.len();
                 m.parents.retain(|p0|p0.as_ref() as *const _ != (p.as_ref() as *const _));
@@ -357,20 +632,82 @@ impl Allocator {
             }
         }
         let mut v = Vec::new();
-        log::trace!("Freeing [{}] because [{}]", self.inner.ident.borrow(), source);
-        get_to_free(parent.as_ref(), &self.inner, 0, &mut v, &self.inner.ident.borrow());
+        log::trace!("Freeing [{}] because [{}]", self.inner.ident(), source.print());
+        get_to_free(parent.as_ref(), &self.inner, 0, &mut v, &self.inner);
         free_allocs(v);
     }
+
+    /// Keep this allocator from being freed until the Hold is dropped, if it is
+    /// freed in the meantime then the free completes when the last Hold goes.
+    /// This is how a Rust Message keeps the allocator of a C Message alive, it
+    /// does not allocate anything.
+    pub fn hold(&self) -> Hold {
+        let mut m = self.inner.m.lock();
+        assert_not_freeing(&*m, &self.inner, "be held");
+        m.holds += 1;
+        Hold { inner: Arc::clone(&self.inner), owner: false }
+    }
+
+    /// Create a new root allocator which is owned by the returned Hold, it is
+    /// freed when the Hold is dropped unless something else has adopted it.
+    pub fn new_held(file_line: FileLine) -> Hold {
+        let a = rs(Self::new(file_line));
+        let mut m = a.inner.m.lock();
+        m.holds = 1;
+        m.owner_hold = true;
+        Hold { inner: Arc::clone(&a.inner), owner: true }
+    }
 }
 
 impl Drop for Allocator {
     fn drop(&mut self) {
         if self.free_on_drop {
-            self.free("<drop()>");
+            self.free(&file_line!());
         }
     }
 }
 
+/// See Allocator::hold()
+pub struct Hold {
+    inner: Arc<AllocatorInner>,
+    owner: bool,
+}
+
+impl Hold {
+    pub fn c(&self) -> *mut Allocator_t {
+        *self.inner.mebox.borrow() as _
+    }
+}
+
+impl Drop for Hold {
+    fn drop(&mut self) {
+        let children = {
+            let mut m = self.inner.m.lock();
+            m.holds -= 1;
+            if self.owner {
+                m.owner_hold = false;
+                // Unless something adopted it, it is no longer wanted
+                if m.parents.is_empty() {
+                    m.free_pending = true;
+                }
+            }
+            if m.holds > 0 || m.is_freeing || !m.free_pending {
+                return;
+            }
+            // Claim the free while still holding the lock, once it is released a
+            // free() or another hold can get in before we have the GCL.
+            m.free_pending = false;
+            m.is_freeing = true;
+            std::mem::take(&mut m.children)
+        };
+        let _l = gcl::lock(Site::AllocatorFree);
+        let mut v = Vec::new();
+        log::trace!("Freeing [{}] because the last hold was released", self.inner.ident());
+        get_children_to_free(&self.inner, children, 0, &mut v, &self.inner);
+        free_allocs(v);
+    }
+}
+
 /// Create a root level allocator.
 #[no_mangle]
 pub extern "C" fn Rffi_allocator_newRoot(file: *const c_char, line: usize) -> *mut Allocator_t {
@@ -379,7 +716,7 @@ pub extern "C" fn Rffi_allocator_newRoot(file: *const c_char, line: usize) -> *m
 
 #[no_mangle]
 pub extern "C" fn Rffi_allocator_free(a: *mut Allocator_t, file: *const c_char, line: usize) {
-    rs(a).free(&FileLine{ file_s: None, file_c: Some(file), line }.print())
+    rs(a).free(&FileLine{ file_s: None, file_c: Some(file), line })
 }
 
 #[no_mangle]
@@ -397,18 +734,96 @@ pub extern "C" fn Rffi_allocator_child(a: *mut Allocator_t, file: *const c_char,
 }
 
 #[no_mangle]
-pub extern "C" fn Rffi_allocator_malloc(a: *mut Allocator_t, size: usize) -> *mut u8 {
-    rs(a).malloc(size, false)
+pub extern "C" fn Rffi_allocator_malloc(
+    a: *mut Allocator_t,
+    size: usize,
+    file: *const c_char,
+    line: usize,
+) -> *mut u8 {
+    rs(a).malloc(size, false, FileLine{ file_s: None, file_c: Some(file), line })
+}
+
+/// Allocate a packet buffer from the buffer pool, see Allocator_mallocPooled()
+#[no_mangle]
+pub extern "C" fn Rffi_allocator_mallocPooled(
+    a: *mut Allocator_t,
+    size: usize,
+    file: *const c_char,
+    line: usize,
+) -> *mut u8 {
+    rs(a).malloc_pooled(size, FileLine{ file_s: None, file_c: Some(file), line })
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_allocator_bufPoolStats(statsOut: *mut RTypes_BufPool_Stats_t) {
+    *statsOut = buf_pool::stats();
+}
+
+/// Turn the allocation profiler on or off, see Allocator_profile()
+#[no_mangle]
+pub extern "C" fn Rffi_allocator_profileSetEnabled(enabled: bool) {
+    alloc_profile::set_enabled(enabled);
+}
+
+/// Average number of bytes allocated between samples, 0 for the default
+#[no_mangle]
+pub extern "C" fn Rffi_allocator_profileSetSampleBytes(sampleBytes: u64) {
+    alloc_profile::set_sample_bytes(sampleBytes);
 }
 
 #[no_mangle]
-pub extern "C" fn Rffi_allocator_calloc(a: *mut Allocator_t, size: usize) -> *mut u8 {
-    rs(a).malloc(size, true)
+pub extern "C" fn Rffi_allocator_profileReset() {
+    alloc_profile::reset();
 }
 
+/// Get up to `count` entries of the allocation profile starting at `first`, the
+/// result is allocated in alloc. If `fresh` then a new snapshot of the profile is
+/// taken, otherwise the entries are from the same snapshot as the last call.
 #[no_mangle]
-pub extern "C" fn Rffi_allocator_realloc(a: *mut Allocator_t, ptr: *mut u8, new_size: usize) -> *mut u8 {
-    rs(a).realloc(ptr, new_size)
+pub extern "C" fn Rffi_allocator_profile(
+    first: usize,
+    count: usize,
+    fresh: bool,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_AllocProfile_t {
+    let (stacks, total, elapsed_ms) = alloc_profile::page(first, count, fresh);
+    let entries = stacks.iter().map(|(stack, t)| RTypes_AllocProfile_Entry_t {
+        stack: super::str_to_c(&alloc_profile::fold(stack), alloc),
+        live_bytes: t.live_bytes,
+        live_allocs: t.live_allocs,
+        total_bytes: t.total_bytes,
+        total_allocs: t.total_allocs,
+    }).collect::<Vec<_>>();
+    let entries = adopt(alloc, entries);
+    adopt(alloc, RTypes_AllocProfile_t {
+        enabled: alloc_profile::enabled(),
+        sample_bytes: alloc_profile::sample_bytes(),
+        elapsed_ms,
+        count: unsafe { (*entries).len() },
+        total,
+        entries: unsafe { (*entries).as_ptr() },
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn Rffi_allocator_calloc(
+    a: *mut Allocator_t,
+    size: usize,
+    file: *const c_char,
+    line: usize,
+) -> *mut u8 {
+    rs(a).malloc(size, true, FileLine{ file_s: None, file_c: Some(file), line })
+}
+
+#[no_mangle]
+pub extern "C" fn Rffi_allocator_realloc(
+    a: *mut Allocator_t,
+    ptr: *mut u8,
+    new_size: usize,
+    file: *const c_char,
+    line: usize,
+) -> *mut u8 {
+    rs(a).realloc(ptr, new_size, FileLine{ file_s: None, file_c: Some(file), line })
 }
 
 #[no_mangle]
@@ -442,3 +857,149 @@ pub fn rs(a: *mut Allocator_t) -> Allocator {
     Box::into_raw(b);
     out
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    extern "C" fn count_free(c: *mut c_void) {
+        unsafe { &*(c as *const std::sync::atomic::AtomicUsize) }
+            .fetch_add(1, std::sync::atomic::Ordering::Relaxed);
+    }
+
+    /// Holds released on several threads at once after the allocator was freed
+    /// must complete the free, of it and its children, exactly once.
+    #[test]
+    fn test_hold_release_race() {
+        use std::sync::atomic::{AtomicUsize, Ordering};
+        let root = new!();
+        for _ in 0..200 {
+            let freed = Box::leak(Box::new(AtomicUsize::new(0)));
+            let mut c = child!(root);
+            c.on_free(count_free, freed as *mut AtomicUsize as *mut c_void, file_line!());
+            let holds = (0..4).map(|_| c.hold()).collect::<Vec<_>>();
+            let grandchild = child!(c);
+            grandchild.on_free(count_free, freed as *mut AtomicUsize as *mut c_void, file_line!());
+            c.free(&file_line!());
+            assert_eq!(freed.load(Ordering::Relaxed), 0);
+            let threads = holds.into_iter().map(|h| std::thread::spawn(move || drop(h))).collect::<Vec<_>>();
+            for t in threads {
+                t.join().unwrap();
+            }
+            // The allocator and its child
+            assert_eq!(freed.load(Ordering::Relaxed), 2);
+        }
+    }
+
+    use std::time::Instant;
+
+    fn bytes(p: *mut u8, len: usize) -> &'static mut [u8] {
+        unsafe { std::slice::from_raw_parts_mut(p, len) }
+    }
+
+    #[test]
+    fn test_arena() {
+        let a = new!();
+        let p1 = a.malloc(10, true, file_line!());
+        assert_eq!(p1 as usize % 16, 0);
+        assert!(bytes(p1, 16).iter().all(|b| *b == 0));
+        let p2 = a.malloc(100, false, file_line!());
+        // One word for p1 and one for p2's header
+        assert_eq!(p2 as usize, p1 as usize + 32);
+
+        // The last allocation grows in place
+        assert_eq!(a.realloc(p2, 200, file_line!()), p2);
+
+        // Others move and keep their content
+        bytes(p1, 10).copy_from_slice(b"0123456789");
+        let p3 = a.realloc(p1, 64, file_line!());
+        assert_ne!(p3, p1);
+        assert_eq!(&bytes(p3, 10)[..], b"0123456789");
+
+        // Past ARENA_MAX_ALLOC it gets a block of its own
+        let p4 = a.realloc(p3, 4096, file_line!());
+        assert_eq!(&bytes(p4, 10)[..], b"0123456789");
+        {
+            let m = a.inner.m.lock();
+            assert_eq!(m.mem.len(), 1);
+        }
+        assert!(a.realloc(p4, 0, file_line!()).is_null());
+        assert!(a.realloc(p2, 0, file_line!()).is_null());
+
+        for _ in 0..1000 {
+            a.malloc(200, false, file_line!());
+        }
+        let m = a.inner.m.lock();
+        assert!(m.mem.is_empty());
+        assert!(m.arena.chunks.len() > 1);
+        assert!(m.arena.chunks.iter().all(|c| c.len() <= ARENA_MAX_CHUNK));
+    }
+
+    #[test]
+    #[should_panic(expected = "is not in memory allocator")]
+    fn test_realloc_foreign() {
+        let a = new!();
+        let b = new!();
+        let p = a.malloc(10, false, file_line!());
+        b.realloc(p, 20, file_line!());
+    }
+
+    /// Realloc must not depend on how many other allocations there are. Grow
+    /// arrays 10 entries at a time, the same as util/Map.h, while allocating an
+    /// entry for each element, up to 100k entries.
+    #[test]
+    fn test_realloc_many_allocations() {
+        const ENTRIES: usize = 100_000;
+        let a = new!();
+        let mut cap = 0;
+        let mut handles = std::ptr::null_mut::<u32>();
+        let mut values = std::ptr::null_mut::<u64>();
+        for i in 0..ENTRIES {
+            if i == cap {
+                cap += 10;
+                handles = a.realloc(handles as *mut u8, cap * 4, file_line!()) as *mut u32;
+                values = a.realloc(values as *mut u8, cap * 8, file_line!()) as *mut u64;
+            }
+            let entry = a.malloc(24, false, file_line!()) as *mut u64;
+            unsafe {
+                *entry = i as u64;
+                *handles.add(i) = i as u32;
+                *values.add(i) = entry as u64;
+            }
+        }
+        for i in 0..ENTRIES {
+            unsafe {
+                assert_eq!(*handles.add(i), i as u32);
+                assert_eq!(*(*values.add(i) as *const u64), i as u64);
+            }
+        }
+    }
+
+    extern "C" fn nop(_c: *mut c_void) {}
+
+    /// Same pattern as an admin request in Admin.c or a query in MsgCore.c: a
+    /// child of a long lived allocator, a few small structures and strings and
+    /// an on_free job, then the whole child is freed.
+    #[test]
+    #[ignore]
+    fn bench_request_churn() {
+        const ROUNDS: usize = 200_000;
+        let root = new!();
+        for poison_mem in [false, true] {
+            set_poison(poison_mem);
+            let t0 = Instant::now();
+            for _ in 0..ROUNDS {
+                let mut c = child!(root);
+                c.malloc(96, true, file_line!());
+                for i in 0..16 {
+                    c.malloc(16 + (i % 4) * 24, false, file_line!());
+                }
+                c.on_free(nop, std::ptr::null_mut(), file_line!());
+                c.free(&file_line!());
+            }
+            let ns = t0.elapsed().as_nanos() / ROUNDS as u128;
+            println!("poison: {}, {} ns per request allocator", poison_mem, ns);
+        }
+        set_poison(false);
+    }
+}
@@ -6,14 +6,15 @@ use libc::{c_char, c_int, c_uchar, c_ulonglong};
 use cjdns::sodiumoxide::crypto::hash::sha512;
 
 use super::allocator::file_line;
-use super::{cstr, cstr_to_string, strc};
+use super::{c_error, cstr, cstr_to_string, strc};
 use crate::bytestring::ByteString;
 use crate::cffi::{self, Allocator_t, Random_t, String_t};
 use crate::crypto::crypto_auth;
-use crate::crypto::crypto_auth::DecryptError;
+use crate::crypto::handshake_pool;
 use crate::crypto::keys::{PrivateKey, PublicKey};
 use crate::crypto::session;
 use crate::external::interface::cif;
+use crate::external::interface::iface;
 use crate::rffi::allocator;
 use crate::interface::wire::message::Message;
 use crate::rtypes::*;
@@ -141,15 +142,7 @@ pub unsafe extern "C" fn Rffi_CryptoAuth2_tryHandshake(
     let ca = &from_c_const!(ca).ca;
     match crypto_auth::try_handshake(ca, msg, requireAuth) {
         Err(e) => {
-            let ee = match e.downcast_ref::<DecryptError>() {
-                Some(ee) => match ee {
-                    DecryptError::DecryptErr(ee) => ee,
-                    DecryptError::Internal(_) => &crate::crypto::crypto_auth::DecryptErr::Internal,
-                },
-                None => &crate::crypto::crypto_auth::DecryptErr::Internal,
-            }
-            .clone() as u32;
-            (*ret).err = ee;
+            (*ret).err = handshake_pool::err_code(&e);
             (*ret).code = RTypes_CryptoAuth2_TryHandshake_Code_t::Error;
         }
         Ok((code, sess)) => {
@@ -163,6 +156,90 @@ pub unsafe extern "C" fn Rffi_CryptoAuth2_tryHandshake(
     }
 }
 
+#[repr(C)]
+pub struct Rffi_CryptoAuth2_HandshakeIface_t {
+    r: RTypes_CryptoAuth2_HandshakeIface_t,
+    hs: handshake_pool::HandshakeIface,
+}
+
+/// Make the iface which handshakes submitted with it come back from, one per
+/// interface since the sources of handshakes are admitted per interface.
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_CryptoAuth2_handshakeIface(
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_CryptoAuth2_HandshakeIface_t {
+    let (mut iface, pvt) = iface::new("CryptoAuth handshakes");
+    let out = allocator::adopt(
+        alloc,
+        Rffi_CryptoAuth2_HandshakeIface_t {
+            r: RTypes_CryptoAuth2_HandshakeIface_t { iface: cif::wrap(alloc, &mut iface) },
+            hs: handshake_pool::HandshakeIface::new(pvt),
+        },
+    );
+    &mut (*out).r as *mut _
+}
+
+/// Admit a handshake and, if there are handshake workers, queue it to be run,
+/// otherwise it is to be run inline. The message starts with the 16 byte address of the source as it does for
+/// Rffi_CryptoAuth2_tryHandshake() and is left alone, a copy is queued.
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_CryptoAuth2_submitHandshake(
+    ca: *const RTypes_CryptoAuth2_t,
+    c_msg: *mut cffi::Message_t,
+    lladdr: *const u8,
+    lladdrLen: u32,
+    requireAuth: bool,
+    hs: *const RTypes_CryptoAuth2_HandshakeIface_t,
+) -> RTypes_CryptoAuth2_Handshake_Submit_t {
+    let msg = Message::from_c_message(c_msg);
+    let ca = &from_c_const!(ca).ca;
+    let hs = &*(hs as *const Rffi_CryptoAuth2_HandshakeIface_t);
+    let lladdr = std::slice::from_raw_parts(lladdr, lladdrLen as usize);
+    handshake_pool::global().submit(ca, &msg, lladdr, requireAuth, &hs.hs)
+}
+
+/// Take the outcome off of a handshake which came back from the handshake iface,
+/// filling in `ret` as Rffi_CryptoAuth2_tryHandshake() would have.
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_CryptoAuth2_handshakeDone(
+    c_msg: *mut cffi::Message_t,
+    alloc: *mut Allocator_t,
+    ret: *mut RTypes_CryptoAuth2_TryHandshake_Ret_t,
+) {
+    let mut msg = Message::from_c_message(c_msg);
+    let done = match msg.pop::<handshake_pool::Done>() {
+        Ok(done) => done,
+        Err(_) => {
+            (*ret).code = RTypes_CryptoAuth2_TryHandshake_Code_t::Error;
+            (*ret).err = crypto_auth::DecryptErr::Runt as u32;
+            return;
+        }
+    };
+    (*ret).code = done.code;
+    (*ret).err = done.err;
+    if let Some(sess) = done.sess.as_mut().and_then(|p| p.0.take()) {
+        let child = allocator::rs(alloc).child(file_line!());
+        (*ret).alloc = child;
+        (*ret).sess = wrap_session(sess, child)
+    }
+}
+
+/// Start running handshakes on `workers` threads rather than inline, 0 does nothing.
+/// Once started, they run until the process exits.
+#[no_mangle]
+pub extern "C" fn Rffi_CryptoAuth2_startHandshakeWorkers(
+    workers: u32,
+    errAlloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    c_error!(errAlloc, handshake_pool::global().start(workers));
+    std::ptr::null_mut()
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_CryptoAuth2_handshakeStats(statsOut: *mut RTypes_HandshakePool_Stats_t) {
+    *statsOut = handshake_pool::global().stats();
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn Rffi_CryptoAuth2_newSession(
     ca: *const RTypes_CryptoAuth2_t,
@@ -222,6 +299,13 @@ unsafe fn ffi_sess(s: *const RTypes_CryptoAuth2_Session_t) -> &'static Rffi_Cryp
     &*(s as *const Rffi_CryptoAuth2_Session_t)
 }
 
+/// Get the Rust session behind a C session handle.
+pub(super) unsafe fn session_arc(
+    s: *const RTypes_CryptoAuth2_Session_t,
+) -> Arc<dyn session::SessionTrait> {
+    Arc::clone(&ffi_sess(s).s)
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn Rffi_CryptoAuth2_setAuth(
     password: *const String_t,
@@ -326,6 +410,19 @@ pub unsafe extern "C" fn Rffi_CryptoAuth2_getSecret(
     0
 }
 
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_CryptoAuth2_replayWindow(
+    ca: *const RTypes_CryptoAuth2_t,
+    window: u32,
+) -> u32 {
+    let ca = &from_c_const!(ca).ca;
+    if window == 0 {
+        ca.replay_window()
+    } else {
+        ca.set_replay_window(window)
+    }
+}
+
 #[no_mangle]
 pub unsafe extern "C" fn Rffi_crypto_hash_sha512(
     out: *mut c_uchar, // Output buffer (hash result)
@@ -0,0 +1,88 @@
+use crate::cffi::{Allocator_t, Iface_t};
+use crate::external::interface::cif;
+use crate::interface::ethiface::EthIface;
+use crate::interface::xdpiface::{XdpIface, XdpMode};
+use crate::rffi::allocator;
+use crate::rtypes::RTypes_Error_t;
+use crate::util::identity::Identity;
+
+pub struct Rffi_EthIface_t {
+    eth: EthIface,
+    identity: Identity<Self>,
+}
+
+pub struct Rffi_XdpIface_t {
+    xdp: XdpIface,
+    identity: Identity<Self>,
+}
+
+/// Set up PACKET_MMAP rings on a bound AF_PACKET / SOCK_RAW socket, the fd is taken
+/// over and closed once the ring is freed, or right away if this fails. Messages to
+/// and from ifOut begin with the 6 byte MAC of the peer and 2 more bytes, the first
+/// of which is the sll_pkttype of a received frame.
+#[no_mangle]
+pub extern "C" fn Rffi_ethIfaceNew(
+    ifOut: *mut *mut Iface_t,
+    eth_out: *mut *mut Rffi_EthIface_t,
+    fd: libc::c_int,
+    srcMac: *const u8,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    let mut mac = [0_u8; 6];
+    mac.copy_from_slice(unsafe { std::slice::from_raw_parts(srcMac, 6) });
+    let mut eth = match EthIface::new(fd, mac) {
+        Ok(eth) => eth,
+        Err(e) => {
+            return allocator::adopt(alloc, RTypes_Error_t { e: Some(e) });
+        }
+    };
+    let out = cif::wrap(alloc, &mut eth.iface);
+    let eout = allocator::adopt(alloc, Rffi_EthIface_t { eth, identity: Default::default() });
+    unsafe {
+        *ifOut = out;
+        *eth_out = eout;
+    }
+    std::ptr::null_mut()
+}
+
+/// Attach an XDP program to the device and open an AF_XDP socket for each of its
+/// receive queues. mode is 1 to use native XDP if the driver supports it and generic
+/// otherwise, 2 for generic only and 3 for native only. Messages to and from ifOut
+/// are the same as those of Rffi_ethIfaceNew().
+#[no_mangle]
+pub extern "C" fn Rffi_xdpIfaceNew(
+    ifOut: *mut *mut Iface_t,
+    xdp_out: *mut *mut Rffi_XdpIface_t,
+    ifName: *const libc::c_char,
+    srcMac: *const u8,
+    mode: libc::c_int,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    let res = (|| -> eyre::Result<XdpIface> {
+        let mode = XdpMode::from_int(mode)?;
+        let ifindex = unsafe { libc::if_nametoindex(ifName) };
+        let name = unsafe { std::ffi::CStr::from_ptr(ifName) }.to_string_lossy();
+        if ifindex == 0 {
+            eyre::bail!("No such device [{}]", name);
+        }
+        let mut mac = [0_u8; 6];
+        mac.copy_from_slice(unsafe { std::slice::from_raw_parts(srcMac, 6) });
+        let xdp = XdpIface::new(&name, ifindex, mac, mode)?;
+        log::info!("[{}] AF_XDP on [{}] queues in {} mode", name, xdp.queues,
+            if xdp.native { "native" } else { "generic" });
+        Ok(xdp)
+    })();
+    let mut xdp = match res {
+        Ok(xdp) => xdp,
+        Err(e) => {
+            return allocator::adopt(alloc, RTypes_Error_t { e: Some(e) });
+        }
+    };
+    let out = cif::wrap(alloc, &mut xdp.iface);
+    let xout = allocator::adopt(alloc, Rffi_XdpIface_t { xdp, identity: Default::default() });
+    unsafe {
+        *ifOut = out;
+        *xdp_out = xout;
+    }
+    std::ptr::null_mut()
+}
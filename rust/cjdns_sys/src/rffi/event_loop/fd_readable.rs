@@ -1,7 +1,7 @@
 use tokio::io::Interest;
 use tokio::io::unix::AsyncFd;
 use crate::cffi::Allocator_t;
-use crate::gcl::Protected;
+use crate::gcl::{Protected, Site};
 use crate::rffi::allocator::{self, file_line};
 use crate::rtypes::RTypes_Error_t;
 use crate::util::identity::{from_c, Identity};
@@ -39,7 +39,7 @@ pub extern "C" fn Rffi_pollFdReadable(
         }
     };
 
-    let frc = Protected::new((cb, cb_context));
+    let frc = Protected::new((cb, cb_context), Site::FdReadable);
 
     let (kill, mut rx_kill) = tokio::sync::mpsc::unbounded_channel();
     let rtx = Arc::new(FdReadable {
@@ -1,7 +1,6 @@
 use self::timeout::TimerTx;
 use crate::cffi::{self,Allocator_t};
 use crate::rffi::{allocator, glock};
-use crate::gcl::{self, GCL};
 use crate::rtypes::RTypes_EventLoop_t;
 use crate::util::identity::{from_c, Identity};
 use parking_lot::{Mutex,ReentrantMutexGuard};
@@ -16,6 +15,8 @@ mod timeout;
 mod fd_readable;
 mod udp;
 mod unix_socket;
+#[cfg(target_os = "linux")]
+mod eth;
 
 struct Quit {
     recv: broadcast::Receiver<()>,
@@ -1,4 +1,4 @@
-use super::GCL;
+use crate::gcl::{self, Site};
 use crate::cffi::Allocator_t;
 use crate::rffi::str_to_c;
 use std::ffi::CStr;
@@ -45,7 +45,7 @@ pub unsafe extern "C" fn Rffi_spawn(
     tokio::task::spawn(async move {
         match (child_status.await, cb) {
             (Ok(status), Some(callback)) => {
-                let _guard = GCL.lock();
+                let _guard = gcl::lock(Site::Process);
                 callback(
                     status.code().unwrap_or(-127) as _,
                     status.signal().unwrap_or(-127),
@@ -1,5 +1,5 @@
 use crate::cffi::Allocator_t;
-use crate::gcl::Protected;
+use crate::gcl::{Protected, Site};
 use crate::rffi::allocator::{self, file_line};
 use crate::rtypes::RTypes_EventLoop_t;
 use crate::util::identity::{from_c, from_c_const, Identity};
@@ -46,7 +46,7 @@ pub extern "C" fn Rffi_setTimeout(
     alloc: *mut Allocator_t,
 ) {
     let cb_int = cb_context as u64;
-    let tcb = Protected::new((cb, cb_context));
+    let tcb = Protected::new((cb, cb_context), Site::Timer);
 
     // it must be unbounded, since its Sender is sync, and can be used directly by the controller methods.
     let (tx, mut rx) = tokio::sync::mpsc::unbounded_channel();
@@ -1,4 +1,4 @@
-use cjdns::bencode::object::Dict;
+use cjdns::bencode::object::{Dict, List, Object};
 
 use crate::cffi::{Allocator_t, Dict_t, Iface_t, Object_t, Sockaddr_t};
 use crate::external::interface::cif;
@@ -7,7 +7,11 @@ use crate::rtypes::RTypes_Error_t;
 use std::os::raw::c_char;
 use crate::util::sockaddr::Sockaddr;
 use crate::interface::udpaddriface::UDPAddrIface;
+use crate::interface::switch_fastpath::Port;
+use crate::rffi::switch_fastpath::Rffi_SwitchFastPath_t;
+use std::sync::Arc;
 use crate::util::identity::{Identity,from_c};
+use super::unix_socket::worker_dict;
 
 #[repr(C)]
 pub struct Rffi_UDPIface {
@@ -18,12 +22,41 @@ pub struct Rffi_UDPIface {
 
 pub struct Rffi_UDPIface_pvt {
     udp: UDPAddrIface,
+    port: Arc<Port>,
     identity: Identity<Self>,
 }
 
+/// The fd of one of the SO_REUSEPORT shards of the socket, -1 if there is no such shard.
 #[no_mangle]
-pub extern "C" fn Rffi_udpIfaceGetFd(iface: *mut Rffi_UDPIface_pvt) -> i32 {
-    from_c!(iface).udp.get_fd()
+pub extern "C" fn Rffi_udpIfaceGetFd(iface: *mut Rffi_UDPIface_pvt, shard: u32) -> i32 {
+    from_c!(iface).udp.get_fd(shard as usize)
+}
+
+#[no_mangle]
+pub extern "C" fn Rffi_udpIfaceShardCount(iface: *mut Rffi_UDPIface_pvt) -> u32 {
+    from_c!(iface).udp.shard_count() as u32
+}
+
+/// Outputs a list with a dict of counters for each shard of the socket.
+#[no_mangle]
+pub extern "C" fn Rffi_udpIfaceShardStats(
+    outP: *mut *mut Object_t,
+    iface: *mut Rffi_UDPIface_pvt,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    let mut list = List::new();
+    for st in from_c!(iface).udp.shard_stats() {
+        let mut d = Dict::new();
+        d.insert("fd", Object::Integer(st.fd as i64));
+        d.insert("recvPackets", Object::Integer(st.recv_packets as i64));
+        d.insert("sendPackets", Object::Integer(st.send_packets as i64));
+        list.push(d.obj());
+    }
+    let out = benc::value_to_c(alloc, &Object::List(list));
+    unsafe {
+        *outP = out;
+    }
+    std::ptr::null_mut()
 }
 
 #[no_mangle]
@@ -47,12 +80,12 @@ pub extern "C" fn Rffi_udpIface_worker_states(
     let mut bv = Dict::new();
     bv.insert("send", sws.iter()
         .enumerate()
-        .map(|(i,s)|(i.to_string(), format!("{s:?}")))
+        .map(|(i,(s, ws))|(i.to_string(), worker_dict(format!("{s:?}:{}", ws.counter), ws)))
         .collect::<Dict<'_>>(),
     );
     bv.insert("recv", rws.iter()
         .enumerate()
-        .map(|(i,r)|(i.to_string(), format!("{r:?}")))
+        .map(|(i,(r, ws))|(i.to_string(), worker_dict(format!("{r:?}:{}", ws.counter), ws)))
         .collect::<Dict<'_>>(),
     );
     let out = benc::value_to_c(alloc, &bv.obj());
@@ -62,6 +95,96 @@ pub extern "C" fn Rffi_udpIface_worker_states(
     std::ptr::null_mut()
 }
 
+/// Turn UDP segmentation offload (GSO) and receive offload (GRO) on (1) or off (0),
+/// -1 leaves it as it is. Outputs a dict of what is supported and what is on.
+#[no_mangle]
+pub extern "C" fn Rffi_udpIfaceOffload(
+    outP: *mut *mut Object_t,
+    iface: *mut Rffi_UDPIface_pvt,
+    gso: i32,
+    gro: i32,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    let flag = |x: i32| if x < 0 { None } else { Some(x != 0) };
+    let off = match from_c!(iface).udp.set_offload(flag(gso), flag(gro)) {
+        Ok(off) => off,
+        Err(e) => {
+            return allocator::adopt(alloc, RTypes_Error_t{ e: Some(e) });
+        }
+    };
+    let mut bv = Dict::new();
+    bv.insert("gsoSupported", Object::Integer(off.gso_supported as i64));
+    bv.insert("gso", Object::Integer(off.gso as i64));
+    bv.insert("groSupported", Object::Integer(off.gro_supported as i64));
+    bv.insert("gro", Object::Integer(off.gro as i64));
+    let out = benc::value_to_c(alloc, &bv.obj());
+    unsafe {
+        *outP = out;
+    }
+    std::ptr::null_mut()
+}
+
+/// Take the socket's datagrams from device ifName on AF_XDP sockets, mode is as for
+/// Rffi_xdpIfaceNew(), 0 goes back to receiving everything on the socket.
+/// Outputs a dict of xdp, native and queues.
+#[no_mangle]
+pub extern "C" fn Rffi_udpIfaceXdp(
+    outP: *mut *mut Object_t,
+    iface: *mut Rffi_UDPIface_pvt,
+    ifName: *const c_char,
+    mode: i32,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    let udp = &from_c!(iface).udp;
+    #[cfg(target_os = "linux")]
+    let res = (|| -> eyre::Result<Option<(bool, u32)>> {
+        use crate::interface::xdpiface::XdpMode;
+        if mode == 0 || ifName.is_null() {
+            return udp.set_xdp(None, XdpMode::Auto);
+        }
+        let name = unsafe { std::ffi::CStr::from_ptr(ifName) }.to_string_lossy();
+        let x = udp.set_xdp(Some(&name), XdpMode::from_int(mode)?)?;
+        if let Some((native, queues)) = x {
+            log::info!("[{}] AF_XDP for UDP [{}] on [{}] queues in {} mode", name,
+                udp.local_addr, queues, if native { "native" } else { "generic" });
+        }
+        Ok(x)
+    })();
+    #[cfg(not(target_os = "linux"))]
+    let res: eyre::Result<Option<(bool, u32)>> = {
+        let _ = (udp, ifName, mode);
+        Err(eyre::eyre!("AF_XDP is only supported on Linux"))
+    };
+    let x = match res {
+        Ok(x) => x,
+        Err(e) => {
+            return allocator::adopt(alloc, RTypes_Error_t{ e: Some(e) });
+        }
+    };
+    let mut bv = Dict::new();
+    bv.insert("xdp", Object::Integer(x.is_some() as i64));
+    if let Some((native, queues)) = x {
+        bv.insert("native", Object::Integer(native as i64));
+        bv.insert("queues", Object::Integer(queues as i64));
+    }
+    let out = benc::value_to_c(alloc, &bv.obj());
+    unsafe {
+        *outP = out;
+    }
+    std::ptr::null_mut()
+}
+
+/// Switch transit traffic from this socket using fp, as interface number ifNum.
+#[no_mangle]
+pub extern "C" fn Rffi_udpIfaceSetFastPath(
+    iface: *mut Rffi_UDPIface_pvt,
+    fp: *mut Rffi_SwitchFastPath_t,
+    ifNum: u32,
+) {
+    let fp = &from_c!(fp).fp;
+    fp.attach(ifNum, &from_c!(iface).port);
+}
+
 #[no_mangle]
 pub extern "C" fn Rffi_udpIfaceSetDscp(iface: *mut Rffi_UDPIface_pvt, dscp: u8) -> i32 {
     match from_c!(iface).udp.set_dscp(dscp) {
@@ -73,10 +196,13 @@ pub extern "C" fn Rffi_udpIfaceSetDscp(iface: *mut Rffi_UDPIface_pvt, dscp: u8)
     }
 }
 
+/// Bind a UDP socket, if shards is more than 1 then that many sockets share the
+/// address using SO_REUSEPORT, 0 means one for each receive worker.
 #[no_mangle]
 pub extern "C" fn Rffi_udpIfaceNew(
     outp: *mut *mut Rffi_UDPIface,
     bind_addr: *const Sockaddr_t,
+    shards: u32,
     c_alloc: *mut Allocator_t,
 ) -> *mut RTypes_Error_t {
     let addr = if bind_addr.is_null() {
@@ -85,21 +211,26 @@ pub extern "C" fn Rffi_udpIfaceNew(
         Sockaddr::from(bind_addr).rs().unwrap()
     };
     log::info!("Binding UDP socket: {addr}");
-    let (udp, mut iface) = match UDPAddrIface::new(&addr) {
+    let (udp, mut iface) = match UDPAddrIface::new(&addr, shards as usize) {
         Ok(uai) => uai,
         Err(e) => {
             return allocator::adopt(c_alloc, RTypes_Error_t{ e: Some(e) });
         }
     };
-    log::info!("Bound UDP socket: {}", &udp.local_addr);
+    log::info!("Bound UDP socket: {} ({} shards)", &udp.local_addr, udp.shard_count());
 
     let local_addr = Sockaddr::from(&udp.local_addr).c(c_alloc);
 
-    let iface = cif::wrap(c_alloc, &mut iface);
+    let (port, mut port_wire, mut port_core) = Port::new("UDPAddrIface");
+    if let Err(e) = iface.plumb(&mut port_wire) {
+        return allocator::adopt(c_alloc, RTypes_Error_t{ e: Some(e) });
+    }
+    let iface = cif::wrap(c_alloc, &mut port_core);
 
     let out = allocator::adopt(c_alloc, Rffi_UDPIface{
         pvt: allocator::adopt(c_alloc, Rffi_UDPIface_pvt{
             udp,
+            port,
             identity: Default::default(),
         }),
         iface,
@@ -2,9 +2,9 @@ use crate::cffi::{
     Allocator_t, Dict_t, Iface_t, Object_t, Sockaddr_t
 };
 use crate::external::interface::cif;
-use crate::gcl::Protected;
+use crate::gcl::{Protected, Site};
 use crate::interface::{
-    socketiface::{SocketIface, SocketType},
+    socketiface::{SocketIface, SocketType, WorkerStats},
     unixsocketiface::{UnixSocketClient, UnixSocketServer}
 };
 use crate::rffi::{allocator, benc};
@@ -17,7 +17,7 @@ use crate::util::{
 };
 use std::sync::Arc;
 use eyre::eyre;
-use cjdns::bencode::object::Dict;
+use cjdns::bencode::object::{Dict, Object};
 use libc::c_char;
 use std::ffi::CStr;
 
@@ -55,6 +55,15 @@ pub struct Rffi_SocketIface_t {
     identity: Identity<Self>,
 }
 
+pub(super) fn worker_dict(state: String, ws: &WorkerStats) -> Dict<'static> {
+    let mut d = Dict::new();
+    d.insert("state", state);
+    d.insert("syscalls", Object::Integer(ws.syscalls as i64));
+    d.insert("packets", Object::Integer(ws.packets as i64));
+    d.insert("batch", Object::Integer(ws.batch as i64));
+    d
+}
+
 #[no_mangle]
 pub extern "C" fn Rffi_socketWorkerStates(
     outP: *mut *mut Object_t,
@@ -66,12 +75,12 @@ pub extern "C" fn Rffi_socketWorkerStates(
     let mut bv = Dict::new();
     bv.insert("send", sws.iter()
         .enumerate()
-        .map(|(i,(s, c))|(i.to_string(), format!("{s:?}:{c}")))
+        .map(|(i,(s, ws))|(i.to_string(), worker_dict(format!("{s:?}:{}", ws.counter), ws)))
         .collect::<Dict<'_>>(),
     );
     bv.insert("recv", rws.iter()
         .enumerate()
-        .map(|(i,(r, c))|(i.to_string(), format!("{r:?}:{c}")))
+        .map(|(i,(r, ws))|(i.to_string(), worker_dict(format!("{r:?}:{}", ws.counter), ws)))
         .collect::<Dict<'_>>(),
     );
     let out = benc::value_to_c(alloc, &bv.obj());
@@ -81,15 +90,20 @@ pub extern "C" fn Rffi_socketWorkerStates(
     std::ptr::null_mut()
 }
 
-#[no_mangle]
-pub extern "C" fn Rffi_socketForFd(
+fn socket_for_fds(
     ifOut: *mut *mut Iface_t,
     so_out: *mut *mut Rffi_SocketIface_t,
-    fd: libc::c_int,
+    fds: Vec<libc::c_int>,
     st: RTypes_SocketType,
+    vnet_hdr: bool,
     alloc: *mut Allocator_t,
 ) -> *mut RTypes_Error_t {
-    let mut si = match SocketIface::new(vec![ fd ], st) {
+    let si = if vnet_hdr {
+        SocketIface::new_vnet_hdr(fds)
+    } else {
+        SocketIface::new(fds, st)
+    };
+    let mut si = match si {
         Ok(si) => si,
         Err(e) => {
             return allocator::adopt(alloc, RTypes_Error_t { e: Some(e) });
@@ -105,6 +119,39 @@ pub extern "C" fn Rffi_socketForFd(
     std::ptr::null_mut()
 }
 
+#[no_mangle]
+pub extern "C" fn Rffi_socketForFd(
+    ifOut: *mut *mut Iface_t,
+    so_out: *mut *mut Rffi_SocketIface_t,
+    fd: libc::c_int,
+    st: RTypes_SocketType,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    socket_for_fds(ifOut, so_out, vec![ fd ], st, false, alloc)
+}
+
+/// Like Rffi_socketForFd() but the workers are spread over a number of fds which
+/// all belong to the same device, e.g. the queues of a multi-queue TUN device.
+/// If vnetHdr is set then the fds are TUN queues opened with IFF_VNET_HDR and st is ignored.
+#[no_mangle]
+pub extern "C" fn Rffi_socketForFds(
+    ifOut: *mut *mut Iface_t,
+    so_out: *mut *mut Rffi_SocketIface_t,
+    fds: *const libc::c_int,
+    count: u32,
+    st: RTypes_SocketType,
+    vnetHdr: bool,
+    alloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    let fds = unsafe { std::slice::from_raw_parts(fds, count as usize) }.to_vec();
+    socket_for_fds(ifOut, so_out, fds, st, vnetHdr, alloc)
+}
+
+#[no_mangle]
+pub extern "C" fn Rffi_socketFdCount(si: *const Rffi_SocketIface_t) -> u32 {
+    from_c_const!(si).si.fd_count() as u32
+}
+
 #[no_mangle]
 pub extern "C" fn Rffi_unixSocketConnect(
     ifOut: *mut *mut Iface_t,
@@ -142,7 +189,7 @@ pub extern "C" fn Rffi_unixSocketServerOnConnect(
 ) {
     let rss = from_c!(rss);
     let v: Option<Arc<dyn Callable<_,_>>> = if !ctx.is_null() {
-        Some(Arc::new(<dyn Callable<_,_>>::new(Arc::new(Protected::new((f, ctx))), |fctx, sa: Sockaddr| {
+        Some(Arc::new(<dyn Callable<_,_>>::new(Arc::new(Protected::new((f, ctx), Site::UnixSocket)), |fctx, sa: Sockaddr| {
             let mut a = allocator::new!();
             let sa_ptr = sa.c(a.c());
             let l = fctx.lock();
@@ -1,19 +1,20 @@
-use once_cell::sync::Lazy;
-use parking_lot::{ReentrantMutex,ReentrantMutexGuard};
-use std::ops::Deref;
 use std::cell::RefCell;
 
-use crate::gcl::GCL;
+use crate::cffi::Allocator_t;
+use crate::external::interface::cif;
+use crate::gcl::{self, profile, GclGuard, Site};
+use crate::rffi::{allocator, c_error};
+use crate::rtypes::{RTypes_CoreThread_Stats_t, RTypes_Error_t, RTypes_GclProfile_Site_t};
 
 thread_local! {
-    static GCL_HELD: RefCell<Option<ReentrantMutexGuard<'static, ()>>> = RefCell::new(None);
+    static GCL_HELD: RefCell<Option<GclGuard>> = RefCell::new(None);
 }
 
 #[no_mangle]
 pub extern "C" fn Rffi_glock() {
     GCL_HELD.with_borrow_mut(|l|{
         if l.is_none() {
-            *l = Some(GCL.lock());
+            *l = Some(gcl::lock(Site::CLock));
         }
     })
 }
@@ -23,4 +24,61 @@ pub extern "C" fn Rffi_gunlock() {
     GCL_HELD.with_borrow_mut(|l|{
         drop(l.take());
     })
-}
\ No newline at end of file
+}
+
+/// Run every message from Rust into C on one dedicated thread instead of on
+/// whichever thread received it. If cpu is not negative, the thread is pinned
+/// to that CPU. Once started, the core thread runs until the process exits.
+#[no_mangle]
+pub extern "C" fn Rffi_startCoreThread(cpu: i32, errAlloc: *mut Allocator_t) -> *mut RTypes_Error_t {
+    let cpu = if cpu < 0 { None } else { Some(cpu as usize) };
+    c_error!(errAlloc, cif::start_core_thread(cpu));
+    std::ptr::null_mut()
+}
+
+/// Get the core thread counters, false if the core thread is not running.
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_coreThreadStats(statsOut: *mut RTypes_CoreThread_Stats_t) -> bool {
+    match cif::core_thread_stats() {
+        Some(st) => {
+            *statsOut = RTypes_CoreThread_Stats_t {
+                submitters: st.submitters,
+                submitted: st.submitted,
+                ring_full: st.ring_full,
+                rounds: st.rounds,
+                wakeups: st.wakeups,
+            };
+            true
+        }
+        None => false,
+    }
+}
+
+/// Start or stop recording how long the GCL is waited for and held, per call site.
+#[no_mangle]
+pub extern "C" fn Rffi_gclProfile_setEnabled(enabled: bool) {
+    profile::set_enabled(enabled)
+}
+
+#[no_mangle]
+pub extern "C" fn Rffi_gclProfile_enabled() -> bool {
+    profile::enabled()
+}
+
+#[no_mangle]
+pub extern "C" fn Rffi_gclProfile_reset() {
+    profile::reset()
+}
+
+/// Get the GCL profile of call site number `site`, false if there is no such site.
+/// Sites are numbered from zero.
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_gclProfile_site(statsOut: *mut RTypes_GclProfile_Site_t, site: u32) -> bool {
+    match Site::ALL.get(site as usize) {
+        Some(s) => {
+            *statsOut = profile::snapshot(*s);
+            true
+        }
+        None => false,
+    }
+}
@@ -17,6 +17,7 @@ mod base10;
 pub mod allocator;
 mod seeder;
 mod benc;
+mod switch_fastpath;
 
 use eyre::{bail, Result};
 
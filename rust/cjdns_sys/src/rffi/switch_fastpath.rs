@@ -0,0 +1,79 @@
+use crate::cffi::{Allocator_t, Sockaddr_t};
+use crate::interface::switch_fastpath::SwitchFastPath;
+use crate::rffi::allocator;
+use crate::rtypes::*;
+use crate::util::identity::{from_c, from_c_const, Identity};
+use crate::util::sockaddr::Sockaddr;
+
+use super::crypto::session_arc;
+
+pub struct Rffi_SwitchFastPath_t {
+    pub(crate) fp: SwitchFastPath,
+    identity: Identity<Self>,
+}
+
+/// Create a switch fast path, it is disabled until Rffi_SwitchFastPath_setEnabled().
+#[no_mangle]
+pub extern "C" fn Rffi_SwitchFastPath_new(alloc: *mut Allocator_t) -> *mut Rffi_SwitchFastPath_t {
+    allocator::adopt(alloc, Rffi_SwitchFastPath_t {
+        fp: SwitchFastPath::new(),
+        identity: Default::default(),
+    })
+}
+
+#[no_mangle]
+pub extern "C" fn Rffi_SwitchFastPath_setEnabled(fp: *mut Rffi_SwitchFastPath_t, enabled: bool) {
+    from_c!(fp).fp.set_enabled(enabled)
+}
+
+/// Register an established peer so that transit traffic from and to it can be
+/// switched without C. Fails if interface ifNum has no fast path port.
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_SwitchFastPath_addPeer(
+    fp: *mut Rffi_SwitchFastPath_t,
+    ifNum: u32,
+    lladdr: *const Sockaddr_t,
+    label: u64,
+    caSession: *const RTypes_CryptoAuth2_Session_t,
+    errAlloc: *mut Allocator_t,
+) -> *mut RTypes_Error_t {
+    let fp = &from_c!(fp).fp;
+    match fp.add_peer(ifNum, &Sockaddr::from(lladdr), label, session_arc(caSession)) {
+        Ok(()) => std::ptr::null_mut(),
+        Err(e) => allocator::adopt(errAlloc, RTypes_Error_t { e: Some(e) }),
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_SwitchFastPath_removePeer(
+    fp: *mut Rffi_SwitchFastPath_t,
+    label: u64,
+    caSession: *const RTypes_CryptoAuth2_Session_t,
+) {
+    from_c!(fp).fp.remove_peer(label, &session_arc(caSession))
+}
+
+/// Get (and reset) the traffic counters of a registered peer, false if not registered.
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_SwitchFastPath_takePeerStats(
+    statsOut: *mut RTypes_SwitchFastPath_PeerStats_t,
+    fp: *const Rffi_SwitchFastPath_t,
+    label: u64,
+    caSession: *const RTypes_CryptoAuth2_Session_t,
+) -> bool {
+    match from_c_const!(fp).fp.take_peer_stats(label, &session_arc(caSession)) {
+        Some(st) => {
+            *statsOut = st;
+            true
+        }
+        None => false,
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_SwitchFastPath_stats(
+    statsOut: *mut RTypes_SwitchFastPath_Stats_t,
+    fp: *const Rffi_SwitchFastPath_t,
+) {
+    *statsOut = from_c_const!(fp).fp.stats();
+}
@@ -3,6 +3,7 @@ use crate::cffi::{self, Allocator_t};
 use crate::external::interface::cif;
 use crate::rffi::allocator;
 use crate::rtypes::*;
+use crate::util::topology;
 use std::os::raw::{c_char, c_int};
 
 #[no_mangle]
@@ -80,3 +81,49 @@ pub unsafe extern "C" fn Rffi_printError(
         .map(|e| str_to_c(&format!("{:?}", e), alloc))
         .unwrap_or_else(std::ptr::null_mut)
 }
+
+/// Set the environment which the runtime topology of a child process is read
+/// from, this must be called before the core is spawned. A negative value
+/// leaves that setting alone.
+#[no_mangle]
+pub extern "C" fn Rffi_setRuntimeEnv(threads: i32, pinThreads: i32, numaNode: i32) {
+    for (var, val) in [
+        (topology::ENV_THREADS, threads),
+        (topology::ENV_PIN_THREADS, pinThreads),
+        (topology::ENV_NUMA_NODE, numaNode),
+    ] {
+        if val >= 0 {
+            std::env::set_var(var, val.to_string());
+        }
+    }
+}
+
+/// Set the number of send and receive workers for interfaces which are created
+/// from now on, 0 for automatic, and whether socket interfaces use io_uring
+/// (non-zero) or epoll (0). A negative value leaves that setting alone.
+#[no_mangle]
+pub extern "C" fn Rffi_setInterfaceWorkers(socketWorkers: i32, udpWorkers: i32, ioUring: i32) {
+    if socketWorkers >= 0 {
+        topology::set_socket_workers(socketWorkers as usize);
+    }
+    if udpWorkers >= 0 {
+        topology::set_udp_workers(udpWorkers as usize);
+    }
+    if ioUring >= 0 {
+        topology::set_io_uring(ioUring != 0);
+    }
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn Rffi_runtimeTopology(out: *mut RTypes_RuntimeTopology_t) {
+    let t = topology::get();
+    *out = RTypes_RuntimeTopology_t {
+        runtime_threads: t.runtime_threads as u32,
+        pin_threads: t.pin_threads,
+        numa_node: t.numa_node.map(|n| n as i32).unwrap_or(-1),
+        cpus: (if t.cpus.is_empty() { num_cpus::get() } else { t.cpus.len() }) as u32,
+        socket_workers: topology::socket_workers() as u32,
+        udp_workers: topology::udp_workers() as u32,
+        io_uring: topology::io_uring(),
+    };
+}
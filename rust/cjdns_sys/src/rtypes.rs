@@ -73,6 +73,119 @@ pub struct RTypes_CryptoStats_t {
 
     /// True if the session is using the Noise protocol
     pub noise_proto: bool,
+
+    /// Hellos, sent or received by any session of this CryptoAuth, whose secret
+    /// came from the cache of secrets shared with peers' permanent keys
+    pub secret_cache_hits: u64,
+
+    /// Hellos whose secret had to be made, with a scalar multiplication
+    pub secret_cache_misses: u64,
+}
+
+/// Traffic which the switch fast path handled without C, since the last time it was asked.
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+pub struct RTypes_SwitchFastPath_PeerStats_t {
+    /// Plaintext bytes received from the peer and switched by the fast path
+    pub bytes_in: u64,
+
+    /// Plaintext bytes sent to the peer by the fast path
+    pub bytes_out: u64,
+
+    /// Time (Rffi_now_ms) of the last packet switched from this peer, 0 if none
+    pub last_recv_ms: u64,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+pub struct RTypes_SwitchFastPath_Stats_t {
+    pub enabled: bool,
+
+    /// Number of peers registered with the fast path
+    pub peers: u32,
+
+    /// Packets switched without going through C
+    pub forwarded: u64,
+
+    /// Packets from registered peers which had to be given to C
+    pub to_core: u64,
+
+    /// Packets from registered peers which failed to decrypt or encrypt
+    pub dropped: u64,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+pub struct RTypes_CoreThread_Stats_t {
+    /// Threads which have handed messages to the core thread
+    pub submitters: u64,
+
+    /// Messages queued for the core thread
+    pub submitted: u64,
+
+    /// Messages dropped because the submitting thread's queue was full
+    pub ring_full: u64,
+
+    /// Times the core thread took the GCL to run queued messages
+    pub rounds: u64,
+
+    /// Times the core thread had to be woken up
+    pub wakeups: u64,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+pub struct RTypes_GclProfile_Histogram_t {
+    /// Number of times recorded
+    pub count: u64,
+
+    /// Sum of all recorded times, in nanoseconds
+    pub total_ns: u64,
+
+    /// Longest recorded time, in nanoseconds
+    pub max_ns: u64,
+
+    /// Bucket 0 counts times of 0ns, bucket i counts times from 2^(i-1) up to
+    /// 2^i nanoseconds and the last bucket counts anything longer.
+    pub buckets: [u64; 32],
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, Debug)]
+pub struct RTypes_GclProfile_Site_t {
+    /// Name of the code which takes the GCL, static nul terminated string
+    pub name: *const std::os::raw::c_char,
+
+    /// Time spent waiting for the GCL
+    pub wait: RTypes_GclProfile_Histogram_t,
+
+    /// Time the GCL was held for
+    pub hold: RTypes_GclProfile_Histogram_t,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+pub struct RTypes_RuntimeTopology_t {
+    /// Number of tokio worker threads
+    pub runtime_threads: u32,
+
+    /// Whether each runtime thread is pinned to one CPU
+    pub pin_threads: bool,
+
+    /// NUMA node which runtime threads are kept on, -1 if none
+    pub numa_node: i32,
+
+    /// Number of CPUs which runtime threads may run on
+    pub cpus: u32,
+
+    /// Send and receive workers for each new socket interface (e.g. TUN)
+    pub socket_workers: u32,
+
+    /// Send and receive workers for each new UDP interface
+    pub udp_workers: u32,
+
+    /// Whether new socket interfaces use io_uring where the kernel supports it
+    pub io_uring: bool,
 }
 
 #[repr(C)]
@@ -102,6 +215,23 @@ pub struct RTypes_CryptoAuth2_TryHandshake_Ret_t {
     pub alloc: *mut cffi::Allocator_t,
 }
 
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug)]
+pub enum RTypes_CryptoAuth2_Handshake_Submit_t {
+    /// Admitted but there are no handshake workers, run it with Rffi_CryptoAuth2_tryHandshake()
+    Inline,
+    /// It will come back through the handshake iface when it has run
+    Queued,
+    /// Dropped, the source is over its rate or must retry
+    Refused,
+}
+
+/// Where handshakes come back from the handshake workers.
+#[repr(C)]
+pub struct RTypes_CryptoAuth2_HandshakeIface_t {
+    pub iface: *mut cffi::Iface_t,
+}
+
 pub struct RTypes_EventLoop_t {
     pub inner: Arc<EventLoop>,
     pub identity: Identity<Self>,
@@ -116,6 +246,91 @@ pub enum RTypes_SocketType {
     Stream,
 }
 
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+pub struct RTypes_BufPool_Stats_t {
+    /// Pooled allocations which reused a free buffer
+    pub hits: u64,
+
+    /// Pooled allocations which had to allocate a new buffer
+    pub misses: u64,
+
+    /// Allocations too large to be pooled
+    pub oversize: u64,
+
+    /// Buffers returned to the pool when freed
+    pub returned: u64,
+
+    /// Of those returned, buffers freed on another thread than the one which took them
+    pub returned_remote: u64,
+
+    /// Buffers released when freed because the pool was full
+    pub released: u64,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, Debug)]
+pub struct RTypes_AllocProfile_Entry_t {
+    /// Where each allocator from the root down was created, then where the
+    /// memory was allocated, separated by ';'
+    pub stack: *const std::os::raw::c_char,
+
+    /// Estimated memory which is still allocated
+    pub live_bytes: u64,
+
+    /// Estimated number of allocations which are still allocated
+    pub live_allocs: u64,
+
+    /// Estimated memory allocated since the profile was started or reset
+    pub total_bytes: u64,
+
+    /// Estimated number of allocations since the profile was started or reset
+    pub total_allocs: u64,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, Debug)]
+pub struct RTypes_AllocProfile_t {
+    pub enabled: bool,
+
+    /// Average number of bytes allocated between samples
+    pub sample_bytes: u64,
+
+    /// Milliseconds since the profile was started or reset
+    pub elapsed_ms: u64,
+
+    /// Entries in this page
+    pub count: usize,
+
+    /// Entries in the whole profile
+    pub total: usize,
+
+    /// Sorted by live_bytes, largest first
+    pub entries: *const RTypes_AllocProfile_Entry_t,
+}
+
+#[repr(C)]
+#[derive(Copy, Clone, PartialEq, Eq, Debug, Default)]
+pub struct RTypes_HandshakePool_Stats_t {
+    /// Handshake worker threads, 0 if handshakes are run inline
+    pub workers: u32,
+
+    /// Handshakes waiting for a worker
+    pub queued: u32,
+
+    /// Handshakes run by the workers
+    pub completed: u64,
+
+    /// Handshakes refused because the source was over its rate
+    pub rate_limited: u64,
+
+    /// Handshakes refused under load because the source had to retry
+    pub retry_required: u64,
+
+    /// Handshakes refused because the queue was full
+    pub queue_full: u64,
+}
+
 #[allow(dead_code)]
 #[repr(C)]
 pub struct RTypes_ExportMe {
@@ -129,4 +344,14 @@ pub struct RTypes_ExportMe {
     h: RTypes_Seeder_DnsSeeds_t,
     i: *mut RTypes_EventLoop_t,
     j: RTypes_SocketType,
+    k: RTypes_SwitchFastPath_PeerStats_t,
+    l: RTypes_SwitchFastPath_Stats_t,
+    m: RTypes_CoreThread_Stats_t,
+    n: RTypes_GclProfile_Site_t,
+    o: RTypes_RuntimeTopology_t,
+    p: RTypes_BufPool_Stats_t,
+    q: RTypes_AllocProfile_t,
+    r: RTypes_CryptoAuth2_Handshake_Submit_t,
+    s: RTypes_CryptoAuth2_HandshakeIface_t,
+    t: RTypes_HandshakePool_Stats_t,
 }
@@ -0,0 +1,346 @@
+//! Sampling profile of where memory is allocated.
+//!
+//! While enabled, about one allocation per SAMPLE_BYTES allocated bytes is
+//! sampled. A sample is recorded against its stack: the sites where each
+//! allocator from the root down to the one which is allocating was created,
+//! followed by the site of the allocation itself. Each sample stands for
+//! SAMPLE_BYTES bytes (or its own size, if it is larger), so the totals are an
+//! estimate of all allocations, not only of the sampled ones.
+//!
+//! Samples count as live until the allocation is realloc'd or its allocator is
+//! freed. Because the stacks are rooted at the allocator tree, summing stacks by
+//! prefix gives the live memory of any allocator subtree, which is what a
+//! flame graph of the folded stacks shows.
+//!
+//! Off by default. While off, an allocation costs one relaxed atomic load.
+
+use std::cell::Cell;
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+use std::time::Instant;
+
+use once_cell::sync::Lazy;
+use parking_lot::Mutex;
+
+use crate::rffi::allocator::FileLine;
+
+/// Default distance between samples, in bytes.
+pub const DEFAULT_SAMPLE_BYTES: u64 = 512 * 1024;
+
+/// Longest recorded stack, deeper allocators are cut off at the root end.
+const MAX_STACK: usize = 32;
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+static SAMPLE_BYTES: AtomicU64 = AtomicU64::new(DEFAULT_SAMPLE_BYTES);
+
+thread_local! {
+    /// Bytes left to allocate on this thread before the next sample.
+    static UNTIL_SAMPLE: Cell<i64> = Cell::new(0);
+    static RAND: Cell<u64> = Cell::new(0);
+}
+
+#[derive(Default, Clone, Copy, Debug, PartialEq, Eq)]
+pub struct Totals {
+    pub live_bytes: u64,
+    pub live_allocs: u64,
+    pub total_bytes: u64,
+    pub total_allocs: u64,
+}
+
+struct Table {
+    /// Incremented on reset so that samples from before are not released twice
+    generation: u32,
+    ids: HashMap<Vec<FileLine>, u32>,
+    stacks: Vec<(Vec<FileLine>, Totals)>,
+    since: Instant,
+}
+
+static TABLE: Lazy<Mutex<Table>> = Lazy::new(|| {
+    Mutex::new(Table {
+        generation: 0,
+        ids: HashMap::new(),
+        stacks: Vec::new(),
+        since: Instant::now(),
+    })
+});
+
+/// A sorted snapshot as returned by snapshot().
+type Snapshot = (Vec<(Vec<FileLine>, Totals)>, u64);
+
+/// The snapshot which is being read a page at a time, see page().
+static PAGED: Lazy<Mutex<Option<Arc<Snapshot>>>> = Lazy::new(|| Mutex::new(None));
+
+/// Estimated size and number of allocations which one sample stands for.
+#[derive(Clone, Copy, Debug)]
+pub struct Weight {
+    bytes: u64,
+    allocs: u64,
+}
+
+/// A recorded sample, kept by the allocator until the memory is released.
+#[derive(Clone, Copy, Debug)]
+pub struct Sample {
+    id: u32,
+    generation: u32,
+    weight: Weight,
+}
+
+pub fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+pub fn set_enabled(enabled: bool) {
+    if enabled && !ENABLED.load(Ordering::Relaxed) {
+        TABLE.lock().since = Instant::now();
+    }
+    ENABLED.store(enabled, Ordering::Relaxed);
+}
+
+pub fn sample_bytes() -> u64 {
+    SAMPLE_BYTES.load(Ordering::Relaxed)
+}
+
+/// Set the average distance between samples, 0 for the default.
+pub fn set_sample_bytes(bytes: u64) {
+    let bytes = if bytes == 0 { DEFAULT_SAMPLE_BYTES } else { bytes };
+    SAMPLE_BYTES.store(bytes, Ordering::Relaxed);
+}
+
+/// Forget everything which has been recorded, memory sampled before the reset
+/// is not counted when it is released.
+pub fn reset() {
+    let mut t = TABLE.lock();
+    t.generation = t.generation.wrapping_add(1);
+    t.ids.clear();
+    t.stacks.clear();
+    t.since = Instant::now();
+    drop(t);
+    *PAGED.lock() = None;
+}
+
+/// Next distance between samples, the average distance +/- 50% so that
+/// allocations which repeat with a fixed period are not always missed.
+fn next_distance() -> i64 {
+    let avg = sample_bytes();
+    let r = RAND.with(|r| {
+        let mut x = r.get();
+        if x == 0 {
+            x = r as *const _ as u64 | 1;
+        }
+        // xorshift64
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        r.set(x);
+        x
+    });
+    (avg / 2 + r % avg.max(1)) as i64
+}
+
+/// Called for every allocation, if it should be sampled then this returns the
+/// weight of the sample.
+#[inline]
+pub fn sample(size: usize) -> Option<Weight> {
+    if !enabled() {
+        return None;
+    }
+    let take = UNTIL_SAMPLE.with(|u| {
+        let left = u.get() - size as i64;
+        if left > 0 {
+            u.set(left);
+            false
+        } else {
+            u.set(next_distance());
+            true
+        }
+    });
+    if !take {
+        return None;
+    }
+    let bytes = sample_bytes().max(size as u64);
+    Some(Weight { bytes, allocs: bytes / (size as u64).max(1) })
+}
+
+/// Record a sample against `stack`, the stack goes from the root to the allocation site.
+pub fn record(mut stack: Vec<FileLine>, weight: Weight) -> Sample {
+    if stack.len() > MAX_STACK {
+        stack.drain(..stack.len() - MAX_STACK);
+    }
+    let mut t = TABLE.lock();
+    let id = match t.ids.get(&stack) {
+        Some(id) => *id,
+        None => {
+            let id = t.stacks.len() as u32;
+            t.ids.insert(stack.clone(), id);
+            t.stacks.push((stack, Totals::default()));
+            id
+        }
+    };
+    let totals = &mut t.stacks[id as usize].1;
+    totals.live_bytes += weight.bytes;
+    totals.live_allocs += weight.allocs;
+    totals.total_bytes += weight.bytes;
+    totals.total_allocs += weight.allocs;
+    Sample { id, generation: t.generation, weight }
+}
+
+/// The sampled memory has been released.
+pub fn release<I: IntoIterator<Item = Sample>>(samples: I) {
+    let mut t = TABLE.lock();
+    let generation = t.generation;
+    for s in samples.into_iter().filter(|s| s.generation == generation) {
+        let totals = &mut t.stacks[s.id as usize].1;
+        totals.live_bytes -= s.weight.bytes;
+        totals.live_allocs -= s.weight.allocs;
+    }
+}
+
+/// Every stack which has been sampled since the last reset with its totals,
+/// largest live_bytes first, and the number of milliseconds since the reset.
+pub fn snapshot() -> (Vec<(Vec<FileLine>, Totals)>, u64) {
+    let (mut out, since) = {
+        let t = TABLE.lock();
+        (t.stacks.clone(), t.since)
+    };
+    out.sort_by(|a, b| b.1.live_bytes.cmp(&a.1.live_bytes).then(b.1.total_bytes.cmp(&a.1.total_bytes)));
+    (out, since.elapsed().as_millis() as u64)
+}
+
+/// Up to `count` entries of a snapshot starting at `first`, with the number of
+/// entries in the whole snapshot and its age in milliseconds. If `fresh` then a
+/// new snapshot is taken, otherwise the one which the last page came from is
+/// used, so that the pages of one listing agree and it is only sorted once.
+pub fn page(first: usize, count: usize, fresh: bool) -> (Vec<(Vec<FileLine>, Totals)>, usize, u64) {
+    let snap = {
+        let mut paged = PAGED.lock();
+        match &*paged {
+            Some(s) if !fresh => Arc::clone(s),
+            _ => {
+                let s = Arc::new(snapshot());
+                *paged = Some(Arc::clone(&s));
+                s
+            }
+        }
+    };
+    let (stacks, elapsed_ms) = &*snap;
+    let page = stacks.iter().skip(first).take(count).cloned().collect();
+    (page, stacks.len(), *elapsed_ms)
+}
+
+/// A stack in the folded format used by flame graph tools, frames from the
+/// root down separated by ';'.
+pub fn fold(stack: &[FileLine]) -> String {
+    stack.iter().map(|f| f.print()).collect::<Vec<_>>().join(";")
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::rffi::allocator::{self, file_line};
+
+    /// The profile is global, so the tests take turns and the settings are put
+    /// back to the defaults when one ends, even if it fails.
+    static PROFILE: std::sync::Mutex<()> = std::sync::Mutex::new(());
+    struct Exclusive {
+        _lock: std::sync::MutexGuard<'static, ()>,
+    }
+    fn exclusive() -> Exclusive {
+        Exclusive { _lock: PROFILE.lock().unwrap_or_else(|e| e.into_inner()) }
+    }
+    impl Drop for Exclusive {
+        fn drop(&mut self) {
+            set_enabled(false);
+            set_sample_bytes(0);
+        }
+    }
+
+    #[test]
+    fn test_sample() {
+        let _x = exclusive();
+        set_sample_bytes(1000);
+        set_enabled(true);
+        // A fresh thread, so that the distance to the first sample is known
+        let (bytes, allocs) = std::thread::spawn(|| {
+            let (mut bytes, mut allocs) = (0, 0);
+            for _ in 0..100_000 {
+                if let Some(w) = sample(10) {
+                    bytes += w.bytes;
+                    allocs += w.allocs;
+                }
+            }
+            (bytes, allocs)
+        }).join().unwrap();
+        // 1MB and 100k allocations, give or take
+        assert!((800_000..1_200_000).contains(&bytes), "{}", bytes);
+        assert!((80_000..120_000).contains(&allocs), "{}", allocs);
+
+        // Sample everything, the stack is the allocator tree and then the allocation
+        set_sample_bytes(1);
+        let root = allocator::new!();
+        let child_line = line!() as usize + 1;
+        let mut child = allocator::child!(root);
+        let p = child.malloc(100, false, file_line!());
+        child.realloc(p, 200, file_line!());
+        child.malloc(50, false, file_line!());
+        let find = || {
+            snapshot().0.into_iter().filter(|(st, _)| {
+                st.len() == 3 && st[1].file_s == Some(file!()) && st[1].line == child_line
+            }).map(|(_, t)| t).collect::<Vec<_>>()
+        };
+        let t = find();
+        // The 100 bytes were realloc'd so only 200 and 50 are live
+        assert_eq!(t.iter().map(|t| t.live_bytes).sum::<u64>(), 250);
+        assert_eq!(t.iter().map(|t| t.total_bytes).sum::<u64>(), 350);
+        child.free(&file_line!());
+        let t = find();
+        assert_eq!(t.iter().map(|t| t.live_bytes).sum::<u64>(), 0);
+        assert_eq!(t.iter().map(|t| t.total_allocs).sum::<u64>(), 3);
+
+        set_enabled(false);
+        assert!(sample(10).is_none());
+    }
+
+    #[test]
+    fn test_record_release() {
+        let _x = exclusive();
+        let a = file_line!();
+        let b = file_line!();
+        let w = Weight { bytes: 100, allocs: 2 };
+        let s1 = record(vec![a, b], w);
+        let s2 = record(vec![a, b], w);
+        assert_eq!(s1.id, s2.id);
+        let (stacks, _) = snapshot();
+        let t = stacks.iter().find(|s| s.0 == vec![a, b]).unwrap().1;
+        assert!(t.live_bytes >= 200 && t.total_allocs >= 4);
+        release(vec![s1, s2]);
+        let (stacks, _) = snapshot();
+        let t2 = stacks.iter().find(|s| s.0 == vec![a, b]).unwrap().1;
+        assert_eq!(t2.live_bytes, t.live_bytes - 200);
+        assert_eq!(t2.total_bytes, t.total_bytes);
+        assert!(fold(&[a, b]).contains(".rs:"));
+        assert_eq!(fold(&[a, b]).split(';').count(), 2);
+    }
+
+    #[test]
+    fn test_page() {
+        let _x = exclusive();
+        let a = file_line!();
+        let b = file_line!();
+        let c = file_line!();
+        let w = Weight { bytes: 100, allocs: 1 };
+        record(vec![a, b], w);
+        record(vec![a, c], w);
+        let (first, total, _) = page(0, 1, true);
+        assert_eq!(first.len(), 1);
+        assert!(total >= 2);
+        // Samples after the first page are not seen by the rest of the pages
+        record(vec![b, c], w);
+        let (rest, total2, _) = page(1, usize::MAX, false);
+        assert_eq!(total2, total);
+        assert_eq!(rest.len(), total - 1);
+        assert!(rest.iter().all(|s| s.0 != vec![b, c]));
+        let (_, total3, _) = page(0, 1, true);
+        assert!(total3 > total);
+    }
+}
@@ -0,0 +1,271 @@
+//! Per-thread pool of packet sized buffers.
+//!
+//! Receive paths allocate a buffer for every packet and the buffer is freed
+//! along with the packet's allocator. Buffers which are allocated with
+//! Allocator::malloc_pooled() are instead returned here when that allocator is
+//! freed, and handed out again by the next pooled allocation on the same thread,
+//! so a steady stream of packets does not touch malloc or fault in new pages.
+//!
+//! Sizes are rounded up to a class, larger allocations are not pooled. Each
+//! thread keeps at most POOL_BYTES of free buffers of each class, buffers
+//! returned beyond that are released.
+//!
+//! Packets are often freed on a different thread from the one which received
+//! them, so a buffer remembers the pool it was taken from and goes back there.
+//! Buffers freed on the thread which took them are returned without a lock,
+//! the others are queued on their pool, up to POOL_BYTES per class again, and
+//! the owning thread collects them all at once when it runs out.
+
+use std::cell::RefCell;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::Arc;
+
+use parking_lot::Mutex;
+
+use crate::rtypes::RTypes_BufPool_Stats_t;
+
+/// Buffers are Vec<u128> so that they have the same alignment as every other allocation.
+pub type Buf = Vec<u128>;
+
+/// Class sizes in bytes, all are multiples of 16.
+const CLASSES: [usize; 4] = [2048, 4096, 8192, 16384];
+
+/// Free bytes kept per class per thread.
+const POOL_BYTES: usize = 512 * 1024;
+
+type Classes = [Vec<Buf>; CLASSES.len()];
+
+/// The part of a thread's pool which other threads return buffers to.
+#[derive(Default)]
+pub struct Pool {
+    remote: Mutex<Classes>,
+    alive: AtomicBool,
+}
+
+/// The pool which a pooled buffer was taken from.
+pub type Owner = Arc<Pool>;
+
+struct Local {
+    pool: Owner,
+    free: Classes,
+}
+
+impl Default for Local {
+    fn default() -> Self {
+        let pool = Arc::new(Pool::default());
+        pool.alive.store(true, Ordering::Relaxed);
+        Self { pool, free: Default::default() }
+    }
+}
+
+impl Drop for Local {
+    fn drop(&mut self) {
+        // Buffers still out are released when they are freed
+        self.pool.alive.store(false, Ordering::Relaxed);
+        *self.pool.remote.lock() = Default::default();
+    }
+}
+
+thread_local! {
+    static POOL: RefCell<Local> = RefCell::new(Local::default());
+}
+
+static HITS: AtomicU64 = AtomicU64::new(0);
+static MISSES: AtomicU64 = AtomicU64::new(0);
+static OVERSIZE: AtomicU64 = AtomicU64::new(0);
+static RETURNED: AtomicU64 = AtomicU64::new(0);
+static RETURNED_REMOTE: AtomicU64 = AtomicU64::new(0);
+static RELEASED: AtomicU64 = AtomicU64::new(0);
+
+fn class_of(size: usize) -> Option<usize> {
+    CLASSES.iter().position(|c| *c >= size)
+}
+
+fn class_words(class: usize) -> usize {
+    CLASSES[class] / 16
+}
+
+fn push_bounded(free: &mut Vec<Buf>, class: usize, buf: Buf) -> bool {
+    if free.len() * CLASSES[class] < POOL_BYTES {
+        free.push(buf);
+        true
+    } else {
+        false
+    }
+}
+
+/// Get a buffer of at least `size` bytes, the contents are not initialized.
+/// The buffer is from the pool of the current thread, which is returned with it,
+/// unless `size` is larger than the largest class.
+pub fn take(size: usize) -> (Buf, Option<Owner>) {
+    let class = match class_of(size) {
+        Some(c) => c,
+        None => {
+            OVERSIZE.fetch_add(1, Ordering::Relaxed);
+            return (new_buf((size + 15) / 16), None);
+        }
+    };
+    let taken = POOL.try_with(|p| {
+        let mut p = p.borrow_mut();
+        let p = &mut *p;
+        let free = &mut p.free[class];
+        if free.is_empty() {
+            std::mem::swap(free, &mut p.pool.remote.lock()[class]);
+        }
+        (free.pop(), Arc::clone(&p.pool))
+    });
+    match taken {
+        Ok((Some(mut b), owner)) => {
+            HITS.fetch_add(1, Ordering::Relaxed);
+            // It may have been shrunk by realloc, but the capacity is the class size
+            unsafe { b.set_len(class_words(class)) };
+            (b, Some(owner))
+        }
+        Ok((None, owner)) => {
+            MISSES.fetch_add(1, Ordering::Relaxed);
+            (new_buf(class_words(class)), Some(owner))
+        }
+        // The thread is exiting
+        Err(_) => {
+            MISSES.fetch_add(1, Ordering::Relaxed);
+            (new_buf(class_words(class)), None)
+        }
+    }
+}
+
+fn new_buf(words: usize) -> Buf {
+    let mut b = Vec::with_capacity(words);
+    unsafe { b.set_len(words) };
+    b
+}
+
+/// Return a buffer which came from take() to the pool it was taken from.
+/// Buffers which have been resized, or which don't fit, are released.
+pub fn give(buf: Buf, owner: &Owner) {
+    let class = class_of(buf.capacity() * 16).filter(|c| class_words(*c) == buf.capacity());
+    let kept = match class {
+        None => false,
+        Some(class) => {
+            let mine = POOL.try_with(|p| Arc::ptr_eq(&p.borrow().pool, owner)).unwrap_or(false);
+            if mine {
+                POOL.with(|p| push_bounded(&mut p.borrow_mut().free[class], class, buf))
+            } else if owner.alive.load(Ordering::Relaxed) {
+                let kept = push_bounded(&mut owner.remote.lock()[class], class, buf);
+                if kept {
+                    RETURNED_REMOTE.fetch_add(1, Ordering::Relaxed);
+                }
+                kept
+            } else {
+                false
+            }
+        }
+    };
+    if kept {
+        RETURNED.fetch_add(1, Ordering::Relaxed);
+    } else {
+        RELEASED.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+pub fn stats() -> RTypes_BufPool_Stats_t {
+    RTypes_BufPool_Stats_t {
+        hits: HITS.load(Ordering::Relaxed),
+        misses: MISSES.load(Ordering::Relaxed),
+        oversize: OVERSIZE.load(Ordering::Relaxed),
+        returned: RETURNED.load(Ordering::Relaxed),
+        returned_remote: RETURNED_REMOTE.load(Ordering::Relaxed),
+        released: RELEASED.load(Ordering::Relaxed),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use std::sync::mpsc;
+
+    #[test]
+    fn test_take_give() {
+        // Run on a fresh thread so the pool starts empty
+        std::thread::spawn(|| {
+            let (b, owner) = take(4008);
+            let owner = owner.unwrap();
+            assert_eq!(b.len() * 16, 4096);
+            let p = b.as_ptr();
+            give(b, &owner);
+            let (b, _) = take(3000);
+            assert_eq!(b.as_ptr(), p);
+            give(b, &owner);
+
+            let (b, owner) = take(20000);
+            assert!(owner.is_none());
+            assert!(b.len() * 16 >= 20000);
+
+            // The pool is bounded
+            let bufs = (0..POOL_BYTES / 2048 + 10).map(|_| take(2048)).collect::<Vec<_>>();
+            bufs.into_iter().for_each(|(b, o)| give(b, &o.unwrap()));
+            POOL.with(|p| assert_eq!(p.borrow().free[0].len(), POOL_BYTES / 2048));
+        }).join().unwrap();
+    }
+
+    #[test]
+    fn test_returned_to_owner() {
+        let (to_freer, bufs) = mpsc::channel::<(Buf, Owner)>();
+        let freer = std::thread::spawn(move || {
+            for (b, owner) in bufs {
+                give(b, &owner);
+            }
+            // Nothing was kept here
+            POOL.with(|p| assert!(p.borrow().free.iter().all(|f| f.is_empty())));
+        });
+        let owner = std::thread::spawn(move || {
+            let (b, owner) = take(2048);
+            let owner = owner.unwrap();
+            let p = b.as_ptr();
+            to_freer.send((b, Arc::clone(&owner))).unwrap();
+            while owner.remote.lock()[0].is_empty() {
+                std::thread::yield_now();
+            }
+            // Collected from the other thread
+            let (b, _) = take(2048);
+            assert_eq!(b.as_ptr(), p);
+            (b, owner, to_freer)
+        }).join().unwrap();
+
+        // The owning thread is gone, so the buffer is released
+        let (b, pool, to_freer) = owner;
+        assert!(!pool.alive.load(Ordering::Relaxed));
+        to_freer.send((b, Arc::clone(&pool))).unwrap();
+        drop(to_freer);
+        freer.join().unwrap();
+        assert!(pool.remote.lock()[0].is_empty());
+    }
+
+    /// Hit rate of a receive thread whose packets are freed on another thread,
+    /// as when a packet from a socket worker is freed after C handled it.
+    #[test]
+    #[ignore]
+    fn bench_cross_thread_hit_rate() {
+        // cargo test --release -- --ignored --nocapture bench_cross_thread_hit_rate
+        const ROUNDS: usize = 1_000_000;
+        for in_flight in [16, 256] {
+            let (h0, m0) = (HITS.load(Ordering::Relaxed), MISSES.load(Ordering::Relaxed));
+            let (to_freer, bufs) = mpsc::sync_channel::<(Buf, Owner)>(in_flight);
+            let freer = std::thread::spawn(move || {
+                for (b, owner) in bufs {
+                    give(b, &owner);
+                }
+            });
+            let t0 = std::time::Instant::now();
+            std::thread::spawn(move || {
+                for _ in 0..ROUNDS {
+                    let (b, owner) = take(2048);
+                    to_freer.send((b, owner.unwrap())).unwrap();
+                }
+            }).join().unwrap();
+            freer.join().unwrap();
+            let (h, m) = (HITS.load(Ordering::Relaxed) - h0, MISSES.load(Ordering::Relaxed) - m0);
+            println!("{in_flight} in flight: {:.1}% hits, {:?}/buffer",
+                h as f64 * 100.0 / (h + m) as f64, t0.elapsed() / ROUNDS as u32);
+        }
+    }
+}
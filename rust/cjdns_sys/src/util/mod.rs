@@ -5,6 +5,10 @@ pub mod sockaddr;
 pub mod identity;
 pub mod async_callable;
 pub mod callable;
+pub mod spsc;
+pub mod topology;
+pub mod buf_pool;
+pub mod alloc_profile;
 
 pub mod events {
     use std::time::{SystemTime, UNIX_EPOCH};
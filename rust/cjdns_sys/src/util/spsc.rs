@@ -0,0 +1,172 @@
+//! Bounded lock-free ring with exactly one producer and one consumer.
+//!
+//! The producer and the consumer each keep a cached copy of the other side's
+//! index so that the shared cache lines are only read when the ring looks
+//! full (or empty).
+
+use std::cell::UnsafeCell;
+use std::mem::MaybeUninit;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Arc;
+
+/// Keeps the read and write indexes on different cache lines.
+#[repr(align(64))]
+struct Padded(AtomicUsize);
+
+struct Ring<T> {
+    /// Next slot to read, only written by the consumer
+    head: Padded,
+    /// Next slot to write, only written by the producer
+    tail: Padded,
+    mask: usize,
+    slots: Box<[UnsafeCell<MaybeUninit<T>>]>,
+}
+unsafe impl<T: Send> Send for Ring<T> {}
+unsafe impl<T: Send> Sync for Ring<T> {}
+
+impl<T> Drop for Ring<T> {
+    fn drop(&mut self) {
+        let mut head = *self.head.0.get_mut();
+        let tail = *self.tail.0.get_mut();
+        while head != tail {
+            unsafe { (*self.slots[head & self.mask].get()).assume_init_drop() };
+            head = head.wrapping_add(1);
+        }
+    }
+}
+
+pub struct Producer<T> {
+    ring: Arc<Ring<T>>,
+    head_cache: usize,
+}
+
+pub struct Consumer<T> {
+    ring: Arc<Ring<T>>,
+    tail_cache: usize,
+}
+
+/// Create a ring which holds at least `capacity` items, rounded up to a power of two.
+pub fn channel<T>(capacity: usize) -> (Producer<T>, Consumer<T>) {
+    let cap = capacity.max(2).next_power_of_two();
+    let ring = Arc::new(Ring {
+        head: Padded(AtomicUsize::new(0)),
+        tail: Padded(AtomicUsize::new(0)),
+        mask: cap - 1,
+        slots: (0..cap).map(|_| UnsafeCell::new(MaybeUninit::uninit())).collect(),
+    });
+    (
+        Producer { ring: Arc::clone(&ring), head_cache: 0 },
+        Consumer { ring, tail_cache: 0 },
+    )
+}
+
+impl<T> Producer<T> {
+    /// Add an item, giving it back if the ring is full.
+    pub fn push(&mut self, t: T) -> Result<(), T> {
+        let r = &*self.ring;
+        let tail = r.tail.0.load(Ordering::Relaxed);
+        if tail.wrapping_sub(self.head_cache) > r.mask {
+            self.head_cache = r.head.0.load(Ordering::Acquire);
+            if tail.wrapping_sub(self.head_cache) > r.mask {
+                return Err(t);
+            }
+        }
+        unsafe { (*r.slots[tail & r.mask].get()).write(t) };
+        r.tail.0.store(tail.wrapping_add(1), Ordering::Release);
+        Ok(())
+    }
+}
+
+impl<T> Consumer<T> {
+    pub fn pop(&mut self) -> Option<T> {
+        let r = &*self.ring;
+        let head = r.head.0.load(Ordering::Relaxed);
+        if head == self.tail_cache {
+            self.tail_cache = r.tail.0.load(Ordering::Acquire);
+            if head == self.tail_cache {
+                return None;
+            }
+        }
+        let t = unsafe { (*r.slots[head & r.mask].get()).assume_init_read() };
+        r.head.0.store(head.wrapping_add(1), Ordering::Release);
+        Some(t)
+    }
+
+    pub fn is_empty(&self) -> bool {
+        let r = &*self.ring;
+        r.head.0.load(Ordering::Relaxed) == r.tail.0.load(Ordering::Acquire)
+    }
+
+    /// True once the Producer has been dropped, nothing more will ever arrive
+    /// after what is already in the ring.
+    pub fn is_abandoned(&self) -> bool {
+        Arc::strong_count(&self.ring) == 1
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::channel;
+    use std::sync::Arc;
+
+    #[test]
+    fn test_push_pop() {
+        let (mut p, mut c) = channel(3);
+        assert!(c.is_empty());
+        for i in 0..4 {
+            assert_eq!(p.push(i), Ok(()));
+        }
+        assert_eq!(p.push(4), Err(4));
+        for round in 0..10 {
+            assert_eq!(c.pop(), Some(round));
+            assert_eq!(p.push(round + 4), Ok(()));
+        }
+        for i in 10..14 {
+            assert_eq!(c.pop(), Some(i));
+        }
+        assert_eq!(c.pop(), None);
+        assert!(!c.is_abandoned());
+        drop(p);
+        assert!(c.is_abandoned());
+    }
+
+    #[test]
+    fn test_drop_unread() {
+        let item = Arc::new(());
+        let (mut p, c) = channel(8);
+        for _ in 0..5 {
+            p.push(Arc::clone(&item)).unwrap();
+        }
+        assert_eq!(Arc::strong_count(&item), 6);
+        drop(p);
+        drop(c);
+        assert_eq!(Arc::strong_count(&item), 1);
+    }
+
+    #[test]
+    fn test_threads() {
+        const COUNT: u64 = 100_000;
+        let (mut p, mut c) = channel(64);
+        let t = std::thread::spawn(move || {
+            for i in 0..COUNT {
+                let mut v = i;
+                while let Err(back) = p.push(v) {
+                    v = back;
+                    std::thread::yield_now();
+                }
+            }
+        });
+        let mut expect = 0;
+        while expect < COUNT {
+            match c.pop() {
+                Some(v) => {
+                    assert_eq!(v, expect);
+                    expect += 1;
+                }
+                None => std::thread::yield_now(),
+            }
+        }
+        t.join().unwrap();
+        assert_eq!(c.pop(), None);
+    }
+}
@@ -0,0 +1,263 @@
+//! How many threads and socket workers cjdns runs, and on which CPUs.
+//!
+//! The runtime threads and their CPU placement must be known before the tokio
+//! runtime is built, so they are read from the environment. cjdroute sets these
+//! variables from the "runtime" block of cjdroute.conf before it spawns the
+//! core. Worker counts can be changed at any time, they apply to interfaces
+//! which are created afterwards.
+//!
+//! Pinned threads allocate from the NUMA node of the CPU they are pinned to
+//! (the kernel places pages where they are first touched), so restricting the
+//! threads to one node also keeps the packet buffers on that node.
+
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+
+use eyre::{bail, Result};
+use once_cell::sync::OnceCell;
+
+/// Number of tokio worker threads, 0 or unset for automatic.
+pub const ENV_THREADS: &str = "CJDNS_RUNTIME_THREADS";
+/// If non-zero, each runtime thread is pinned to a single CPU.
+pub const ENV_PIN_THREADS: &str = "CJDNS_PIN_THREADS";
+/// Keep runtime threads on the CPUs of this NUMA node.
+pub const ENV_NUMA_NODE: &str = "CJDNS_NUMA_NODE";
+
+/// Never automatically start more runtime threads than this, past this point
+/// they mostly contend for the GCL.
+const MAX_AUTO_THREADS: usize = 8;
+
+#[derive(Clone, Debug)]
+pub struct Topology {
+    pub runtime_threads: usize,
+    pub pin_threads: bool,
+    pub numa_node: Option<u32>,
+    /// CPUs which runtime threads may run on, empty if unrestricted
+    pub cpus: Vec<usize>,
+}
+
+static TOPOLOGY: OnceCell<Topology> = OnceCell::new();
+
+/// 0 means automatic.
+static SOCKET_WORKERS: AtomicUsize = AtomicUsize::new(0);
+static UDP_WORKERS: AtomicUsize = AtomicUsize::new(0);
+static IO_URING: AtomicBool = AtomicBool::new(false);
+
+const WORKER_PREFIX: &str = "cjdns-worker-";
+
+fn env_num(name: &str) -> Option<i64> {
+    let v = std::env::var(name).ok()?;
+    match v.trim().parse() {
+        Ok(n) => Some(n),
+        Err(_) => {
+            log::warn!("Ignoring {name}={v}, not a number");
+            None
+        }
+    }
+}
+
+impl Topology {
+    fn from_env() -> Self {
+        let numa_node = env_num(ENV_NUMA_NODE).filter(|n| *n >= 0).map(|n| n as u32);
+        let cpus = match numa_node {
+            Some(node) => match numa_node_cpus(node) {
+                Ok(cpus) => cpus,
+                Err(e) => {
+                    log::warn!("Not restricting threads to NUMA node {node}: {e}");
+                    Vec::new()
+                }
+            },
+            None => Vec::new(),
+        };
+        let pin_threads = env_num(ENV_PIN_THREADS).unwrap_or(0) != 0;
+        let available = if cpus.is_empty() { num_cpus::get() } else { cpus.len() };
+        let runtime_threads = match env_num(ENV_THREADS) {
+            Some(n) if n > 0 => n as usize,
+            _ => available.clamp(2, MAX_AUTO_THREADS),
+        };
+        Self { runtime_threads, pin_threads, numa_node, cpus }
+    }
+
+    /// CPUs to choose from when pinning, all of them if unrestricted.
+    fn pin_cpus(&self) -> Vec<usize> {
+        if self.cpus.is_empty() {
+            (0..num_cpus::get()).collect()
+        } else {
+            self.cpus.clone()
+        }
+    }
+}
+
+/// Get the topology, reading it from the environment the first time.
+pub fn get() -> &'static Topology {
+    TOPOLOGY.get_or_init(Topology::from_env)
+}
+
+/// Thread names for a runtime with `workers` async workers, for thread_name_fn().
+/// Each runtime gets its own count. build() starts every worker before it returns
+/// and blocking threads can only be asked for through the runtime once it has been
+/// built, so the first `workers` names are the workers' and the rest go to the
+/// blocking pool, which is where C runs. A worker's name carries its index.
+pub fn runtime_thread_namer(workers: usize) -> impl Fn() -> String + Send + Sync + 'static {
+    let named = AtomicUsize::new(0);
+    move || {
+        let i = named.fetch_add(1, Ordering::Relaxed);
+        if i < workers {
+            format!("{WORKER_PREFIX}{i}")
+        } else {
+            "cjdns-blocking".to_owned()
+        }
+    }
+}
+
+/// Index of the current thread if it is an async worker named by runtime_thread_namer().
+fn worker_index() -> Option<usize> {
+    std::thread::current().name()?.strip_prefix(WORKER_PREFIX)?.parse().ok()
+}
+
+/// Called at the start of every runtime thread to place it according to the topology.
+/// Worker N is pinned to the Nth CPU, threads of the blocking pool, such as the one
+/// which runs C, are kept to the node's CPUs but otherwise left to the scheduler so
+/// that they do not pile onto a worker's CPU.
+pub fn place_current_thread() {
+    let t = get();
+    let res = match worker_index() {
+        Some(i) if t.pin_threads => {
+            let cpus = t.pin_cpus();
+            set_affinity(&[cpus[i % cpus.len()]])
+        }
+        _ if !t.cpus.is_empty() => set_affinity(&t.cpus),
+        _ => return,
+    };
+    if let Err(e) = res {
+        log::warn!("{e}");
+    }
+}
+
+/// Set the number of send and receive workers for each new SocketIface, 0 for automatic.
+pub fn set_socket_workers(n: usize) {
+    SOCKET_WORKERS.store(n, Ordering::Relaxed);
+}
+
+/// Set the number of send and receive workers for each new UDPAddrIface, 0 for automatic.
+pub fn set_udp_workers(n: usize) {
+    UDP_WORKERS.store(n, Ordering::Relaxed);
+}
+
+/// Have the workers of each new SocketIface use io_uring rather than epoll, where the
+/// kernel supports it, see interface::uring.
+pub fn set_io_uring(on: bool) {
+    IO_URING.store(on, Ordering::Relaxed);
+}
+
+pub fn io_uring() -> bool {
+    IO_URING.load(Ordering::Relaxed)
+}
+
+/// Workers of each kind for a new SocketIface, by default half of the runtime
+/// threads because typically one interface is receiving while another is sending.
+pub fn socket_workers() -> usize {
+    match SOCKET_WORKERS.load(Ordering::Relaxed) {
+        0 => (get().runtime_threads / 2).max(1),
+        n => n,
+    }
+}
+
+/// Workers of each kind for a new UDPAddrIface.
+pub fn udp_workers() -> usize {
+    match UDP_WORKERS.load(Ordering::Relaxed) {
+        0 => (get().runtime_threads / 2).max(2),
+        n => n,
+    }
+}
+
+/// Parse a kernel cpulist such as "0-3,8,10-11".
+pub fn parse_cpulist(s: &str) -> Result<Vec<usize>> {
+    let mut out = Vec::new();
+    for part in s.trim().split(',').filter(|p| !p.is_empty()) {
+        match part.split_once('-') {
+            Some((a, b)) => {
+                let (a, b): (usize, usize) = (a.parse()?, b.parse()?);
+                if b < a {
+                    bail!("Invalid CPU range {part}");
+                }
+                out.extend(a..=b);
+            }
+            None => out.push(part.parse()?),
+        }
+    }
+    Ok(out)
+}
+
+#[cfg(target_os = "linux")]
+fn numa_node_cpus(node: u32) -> Result<Vec<usize>> {
+    let path = format!("/sys/devices/system/node/node{node}/cpulist");
+    let cpus = parse_cpulist(&std::fs::read_to_string(&path)?)?;
+    if cpus.is_empty() {
+        bail!("{path} lists no CPUs");
+    }
+    Ok(cpus)
+}
+
+#[cfg(not(target_os = "linux"))]
+fn numa_node_cpus(_node: u32) -> Result<Vec<usize>> {
+    bail!("NUMA placement is only supported on Linux");
+}
+
+/// Restrict the current thread to `cpus`.
+#[cfg(target_os = "linux")]
+pub fn set_affinity(cpus: &[usize]) -> Result<()> {
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        for cpu in cpus {
+            libc::CPU_SET(*cpu, &mut set);
+        }
+        if libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set) != 0 {
+            bail!("Unable to set thread affinity to CPUs {:?}: {}", cpus, std::io::Error::last_os_error());
+        }
+    }
+    Ok(())
+}
+
+#[cfg(not(target_os = "linux"))]
+pub fn set_affinity(cpus: &[usize]) -> Result<()> {
+    bail!("Unable to set thread affinity to CPUs {:?}: only supported on Linux", cpus);
+}
+
+#[cfg(test)]
+mod tests {
+    use super::{get, parse_cpulist, runtime_thread_namer, worker_index, WORKER_PREFIX};
+
+    #[test]
+    fn test_parse_cpulist() {
+        assert_eq!(parse_cpulist("0").unwrap(), vec![0]);
+        assert_eq!(parse_cpulist("0-3,8,10-11\n").unwrap(), vec![0, 1, 2, 3, 8, 10, 11]);
+        assert_eq!(parse_cpulist("").unwrap(), Vec::<usize>::new());
+        assert!(parse_cpulist("3-1").is_err());
+        assert!(parse_cpulist("x").is_err());
+    }
+
+    #[test]
+    fn test_runtime_thread_names() {
+        // Twice, each runtime names its own workers
+        for _ in 0..2 {
+            let workers = get().runtime_threads;
+            let rt = tokio::runtime::Builder::new_multi_thread()
+                .worker_threads(workers)
+                .thread_name_fn(runtime_thread_namer(workers))
+                .build()
+                .unwrap();
+            let name = || std::thread::current().name().unwrap_or("").to_owned();
+            rt.block_on(async {
+                let blocking = tokio::task::spawn_blocking(name).await.unwrap();
+                assert_eq!(blocking, "cjdns-blocking");
+                assert_eq!(tokio::task::spawn_blocking(worker_index).await.unwrap(), None);
+                for _ in 0..8 {
+                    let worker = tokio::spawn(async move { name() }).await.unwrap();
+                    assert!(worker.starts_with(WORKER_PREFIX), "{}", worker);
+                    let i = tokio::spawn(async { worker_index() }).await.unwrap();
+                    assert!(i.unwrap() < workers);
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,103 @@
+//! Heap allocations made by Message, counted with a global allocator. This is a
+//! test binary of its own so that the counting allocator is not installed under
+//! every other test in the crate. It needs the test-util feature:
+//! cargo test --features test-util --test message_allocations
+
+use std::alloc::{GlobalAlloc, Layout, System};
+use std::cell::Cell;
+use std::time::Instant;
+
+use cjdns_sys::for_tests::{allocator, c_packet, cffi, Allocator, FileLine, Message};
+
+/// Counts heap allocations made by the current thread, so tests running in
+/// parallel do not disturb each other.
+struct CountingAlloc;
+thread_local! {
+    static ALLOCS: Cell<u64> = const { Cell::new(0) };
+}
+unsafe impl GlobalAlloc for CountingAlloc {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        let _ = ALLOCS.try_with(|c| c.set(c.get() + 1));
+        System.alloc(layout)
+    }
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        System.dealloc(ptr, layout)
+    }
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        let _ = ALLOCS.try_with(|c| c.set(c.get() + 1));
+        System.realloc(ptr, layout, new_size)
+    }
+}
+#[global_allocator]
+static GLOBAL: CountingAlloc = CountingAlloc;
+
+fn count_allocs(f: impl FnOnce()) -> u64 {
+    let before = ALLOCS.with(|c| c.get());
+    f();
+    ALLOCS.with(|c| c.get()) - before
+}
+
+macro_rules! file_line {
+    () => {
+        FileLine { file_s: Some(file!()), file_c: None, line: line!() as usize }
+    };
+}
+
+fn new_alloc() -> Allocator {
+    Allocator::owned(Allocator::new(file_line!()))
+}
+
+#[test]
+fn test_from_c_message_no_alloc() {
+    let root = new_alloc();
+    let (mut c_alloc, c_msg) = c_packet(&root);
+    let n = count_allocs(|| {
+        let mut msg = Message::from_c_message(c_msg);
+        msg.push(1_u32).unwrap();
+        drop(msg);
+    });
+    assert_eq!(n, 0);
+    c_alloc.free(&file_line!());
+}
+
+/// Heap allocations per packet to hand a C message to Rust and back, and to
+/// make a new message in Rust, before (adopting into a new allocator tree)
+/// and after (holding the allocator).
+#[test]
+#[ignore]
+fn bench_message_allocations() {
+    // cargo test --release --features test-util --test message_allocations -- --ignored --nocapture
+    const ROUNDS: u64 = 100_000;
+    let root = new_alloc();
+    let per_packet = |name: &str, f: &mut dyn FnMut()| {
+        let t0 = Instant::now();
+        let n = count_allocs(|| (0..ROUNDS).for_each(|_| f()));
+        println!("{name}: {:.1} allocations/packet, {:?}/packet",
+            n as f64 / ROUNDS as f64, t0.elapsed() / ROUNDS as u32);
+    };
+    per_packet("from_c_message, adopt (before)", &mut || {
+        let (mut c_alloc, c_msg) = c_packet(&root);
+        let wrapper = new_alloc();
+        wrapper.adopt_alloc(allocator::rs(unsafe { (*c_msg)._alloc }));
+        c_alloc.free(&file_line!());
+        drop(wrapper);
+    });
+    per_packet("from_c_message, hold (after)", &mut || {
+        let (mut c_alloc, c_msg) = c_packet(&root);
+        let msg = Message::from_c_message(c_msg);
+        c_alloc.free(&file_line!());
+        drop(msg);
+    });
+    per_packet("  of which the C packet itself", &mut || {
+        let (mut c_alloc, _) = c_packet(&root);
+        c_alloc.free(&file_line!());
+    });
+    per_packet("Message::new, root and child (before)", &mut || {
+        let alloc = new_alloc();
+        let mut child = allocator::rs(alloc.child(file_line!()));
+        let _ = unsafe { cffi::Message_new_fromRust(0, 2048, child.c()) };
+    });
+    per_packet("Message::new, held (after)", &mut || {
+        drop(Message::new(2048));
+    });
+}
@@ -18,6 +18,7 @@
 #include "exception/Err.h"
 #include "interface/addressable/AddrIface.h"
 #include "memory/Allocator.h"
+#include "rust/cjdns_sys/Rffi.h"
 #include "util/Linker.h"
 Linker_require("util/events/libuv/UDPAddrIface.c")
 
@@ -46,11 +47,75 @@ Err_DEFUN UDPAddrIface_new(
     struct Sockaddr* addr,
     struct Allocator* alloc);
 
+/**
+ * Like UDPAddrIface_new() but if shards is more than 1 then that many sockets are bound
+ * to the address using SO_REUSEPORT, each one with its own receive worker(s). The kernel
+ * keeps each peer on one of them. If shards is 0 then there is one per receive worker.
+ */
+Err_DEFUN UDPAddrIface_newShards(
+    struct UDPAddrIface** out,
+    struct Sockaddr* addr,
+    int shards,
+    struct Allocator* alloc);
+
 int UDPAddrIface_setDSCP(struct UDPAddrIface* iface, uint8_t dscp);
 
 int UDPAddrIface_setBroadcast(struct UDPAddrIface* iface, bool enable);
 
-int UDPAddrIface_getFd(struct UDPAddrIface*);
+/** The fd of one of the shards, -1 if there is no such shard. */
+int UDPAddrIface_getFd(struct UDPAddrIface*, int shard);
+
+int UDPAddrIface_shardCount(struct UDPAddrIface*);
+
+/** Output a list with a dict of counters for each shard. */
+Err_DEFUN UDPAddrIface_shardStats(
+    Object_t** out,
+    struct UDPAddrIface* iface,
+    Allocator_t* alloc);
+
+/**
+ * Let the socket workers switch transit traffic themselves, see Rffi_SwitchFastPath_new().
+ *
+ * @param iface the UDP interface.
+ * @param fp the switch fast path of the InterfaceController.
+ * @param ifNum the number of this interface in the InterfaceController.
+ */
+void UDPAddrIface_setFastPath(struct UDPAddrIface* iface, Rffi_SwitchFastPath_t* fp, int ifNum);
+
+/**
+ * Turn UDP segmentation offload (GSO) and receive offload (GRO) on or off, these are
+ * off by default and can only be turned on if the kernel supports them (Linux only).
+ *
+ * @param out set to a dict of gsoSupported, gso, groSupported and gro.
+ * @param iface the UDP interface.
+ * @param gso 1 to turn GSO on, 0 to turn it off, -1 to leave it as it is.
+ * @param gro 1 to turn GRO on, 0 to turn it off, -1 to leave it as it is.
+ * @param alloc the allocator for the output.
+ */
+Err_DEFUN UDPAddrIface_offload(
+    Object_t** out,
+    struct UDPAddrIface* iface,
+    int gso,
+    int gro,
+    Allocator_t* alloc);
+
+/**
+ * Take the datagrams to this socket from a device using AF_XDP (Linux only), the
+ * socket is still used for sending and receives whatever the XDP program passes on,
+ * such as fragments. Off by default.
+ *
+ * @param out set to a dict of xdp, native and queues.
+ * @param iface the UDP interface.
+ * @param device the name of the network device which the datagrams arrive on.
+ * @param mode as for ETHInterface_new(), 0 (ETHInterface_XDP_OFF) detaches the program.
+ * @param alloc the allocator for the output.
+ */
+Err_DEFUN UDPAddrIface_xdp(
+    Object_t** out,
+    struct UDPAddrIface* iface,
+    const char* device,
+    int mode,
+    Allocator_t* alloc);
 
 Err_DEFUN UDPAddrIface_workerStates(
     Object_t** out,
@@ -31,10 +31,25 @@ int UDPAddrIface_setDSCP(struct UDPAddrIface* iface, uint8_t dscp)
     return Rffi_udpIfaceSetDscp(ifp->internal->pvt, dscp);
 }
 
-int UDPAddrIface_getFd(struct UDPAddrIface* iface)
+int UDPAddrIface_getFd(struct UDPAddrIface* iface, int shard)
 {
     struct UDPAddrIface_pvt* ifp = Identity_check((struct UDPAddrIface_pvt*)iface);
-    return Rffi_udpIfaceGetFd(ifp->internal->pvt);
+    return Rffi_udpIfaceGetFd(ifp->internal->pvt, shard);
+}
+
+int UDPAddrIface_shardCount(struct UDPAddrIface* iface)
+{
+    struct UDPAddrIface_pvt* ifp = Identity_check((struct UDPAddrIface_pvt*)iface);
+    return Rffi_udpIfaceShardCount(ifp->internal->pvt);
+}
+
+Err_DEFUN UDPAddrIface_shardStats(
+    Object_t** out,
+    struct UDPAddrIface* iface,
+    Allocator_t* alloc)
+{
+    struct UDPAddrIface_pvt* ifp = Identity_check((struct UDPAddrIface_pvt*)iface);
+    return Rffi_udpIfaceShardStats(out, ifp->internal->pvt, alloc);
 }
 
 int UDPAddrIface_setBroadcast(struct UDPAddrIface* iface, bool enable)
@@ -43,6 +58,34 @@ int UDPAddrIface_setBroadcast(struct UDPAddrIface* iface, bool enable)
     return (int) Rffi_udpIfaceSetBroadcast(ifp->internal->pvt, enable);
 }
 
+void UDPAddrIface_setFastPath(struct UDPAddrIface* iface, Rffi_SwitchFastPath_t* fp, int ifNum)
+{
+    struct UDPAddrIface_pvt* ifp = Identity_check((struct UDPAddrIface_pvt*)iface);
+    Rffi_udpIfaceSetFastPath(ifp->internal->pvt, fp, ifNum);
+}
+
+Err_DEFUN UDPAddrIface_offload(
+    Object_t** out,
+    struct UDPAddrIface* iface,
+    int gso,
+    int gro,
+    Allocator_t* alloc)
+{
+    struct UDPAddrIface_pvt* ifp = Identity_check((struct UDPAddrIface_pvt*)iface);
+    return Rffi_udpIfaceOffload(out, ifp->internal->pvt, gso, gro, alloc);
+}
+
+Err_DEFUN UDPAddrIface_xdp(
+    Object_t** out,
+    struct UDPAddrIface* iface,
+    const char* device,
+    int mode,
+    Allocator_t* alloc)
+{
+    struct UDPAddrIface_pvt* ifp = Identity_check((struct UDPAddrIface_pvt*)iface);
+    return Rffi_udpIfaceXdp(out, ifp->internal->pvt, device, mode, alloc);
+}
+
 Err_DEFUN UDPAddrIface_workerStates(
     Object_t** out,
     struct UDPAddrIface* iface,
@@ -52,13 +95,14 @@ Err_DEFUN UDPAddrIface_workerStates(
     return Rffi_udpIface_worker_states(out, ifp->internal->pvt, alloc);
 }
 
-Err_DEFUN UDPAddrIface_new(
+Err_DEFUN UDPAddrIface_newShards(
     struct UDPAddrIface** outP,
     struct Sockaddr* addr,
+    int shards,
     struct Allocator* userAlloc)
 {
     Rffi_UDPIface* internal = NULL;
-    Err(Rffi_udpIfaceNew(&internal, addr, userAlloc));
+    Err(Rffi_udpIfaceNew(&internal, addr, shards, userAlloc));
     struct UDPAddrIface_pvt* out =
         Allocator_calloc(userAlloc, sizeof(struct UDPAddrIface_pvt), 1);
     out->pub.generic.iface = internal->iface;
@@ -68,4 +112,12 @@ Err_DEFUN UDPAddrIface_new(
     Identity_set(out);
     *outP = &out->pub;
     return NULL;
-}
\ No newline at end of file
+}
+
+Err_DEFUN UDPAddrIface_new(
+    struct UDPAddrIface** outP,
+    struct Sockaddr* addr,
+    struct Allocator* userAlloc)
+{
+    return UDPAddrIface_newShards(outP, addr, 1, userAlloc);
+}
@@ -0,0 +1,51 @@
+/* vim: set expandtab ts=4 sw=4: */
+/*
+ * You may redistribute this program and/or modify it under the terms of
+ * the GNU General Public License as published by the Free Software Foundation,
+ * either version 3 of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "memory/Allocator.h"
+#include "util/Assert.h"
+
+struct Entry
+{
+    int num;
+};
+
+#define ArrayList_TYPE struct Entry
+#define ArrayList_NAME OfEntries
+#include "util/ArrayList.h"
+
+// Enough that realloc is quadratic if it searches all of the allocations.
+#define ENTRIES 100000
+
+int main()
+{
+    struct Allocator* alloc = Allocator_new(1<<20);
+    struct ArrayList_OfEntries* list = ArrayList_OfEntries_new(alloc);
+
+    // Each entry is allocated from the same allocator as the list's backing store.
+    for (int i = 0; i < ENTRIES; i++) {
+        struct Entry* e = Allocator_calloc(alloc, sizeof(struct Entry), 1);
+        e->num = i;
+        Assert_true(ArrayList_OfEntries_add(list, e) == i);
+    }
+    Assert_true(list->length == ENTRIES);
+    for (int i = 0; i < ENTRIES; i++) {
+        Assert_true(ArrayList_OfEntries_get(list, i)->num == i);
+    }
+    Assert_true(ArrayList_OfEntries_pop(list)->num == ENTRIES - 1);
+    Assert_true(ArrayList_OfEntries_shift(list)->num == 0);
+    Assert_true(list->length == ENTRIES - 2);
+
+    Allocator_free(alloc);
+    return 0;
+}
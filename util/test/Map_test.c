@@ -22,11 +22,39 @@
 #define Map_ENABLE_HANDLES
 #include "util/Map.h"
 
+#define Map_NAME OfLongPtrsByHandle
+#define Map_VALUE_TYPE uint64_t*
+#define Map_ENABLE_HANDLES
+#include "util/Map.h"
+
 #include <stdio.h>
 #include <stdbool.h>
 
 #define CYCLES 1
 
+// Enough that building the map is quadratic if realloc searches all of the allocations.
+#define LARGE_SIZE 100000
+
+static void large(struct Allocator* mainAlloc)
+{
+    struct Allocator* alloc = Allocator_child(mainAlloc);
+    struct Map_OfLongPtrsByHandle* map = Map_OfLongPtrsByHandle_new(alloc);
+
+    // Each value is allocated from the same allocator as the map, the map grows by 10 at a time.
+    for (uint32_t i = 0; i < LARGE_SIZE; i++) {
+        uint64_t* val = Allocator_malloc(alloc, sizeof(uint64_t));
+        *val = i;
+        Assert_true(Map_OfLongPtrsByHandle_put(&val, map) == (int) i);
+    }
+    Assert_true(map->count == LARGE_SIZE);
+    for (uint32_t i = 0; i < LARGE_SIZE; i += 997) {
+        int index = Map_OfLongPtrsByHandle_indexForHandle(map->handles[i], map);
+        Assert_true(index == (int) i);
+        Assert_true(*map->values[index] == i);
+    }
+    Allocator_free(alloc);
+}
+
 int main()
 {
     struct Allocator* mainAlloc = Allocator_new(20000);
@@ -70,6 +98,7 @@ int main()
         }
         Allocator_free(alloc);
     }
+    large(mainAlloc);
     Allocator_free(mainAlloc);
     return 0;
 }
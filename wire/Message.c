@@ -14,11 +14,11 @@
  */
 #include "wire/Message.h"
 
-Message_t* Message_new(uint32_t messageLength,
-                                          uint32_t amountOfPadding,
-                                          struct Allocator* alloc)
+static Message_t* wrap(uint8_t* buff,
+                       uint32_t messageLength,
+                       uint32_t amountOfPadding,
+                       struct Allocator* alloc)
 {
-    uint8_t* buff = Allocator_malloc(alloc, messageLength + amountOfPadding);
     Message_t* out = Allocator_calloc(alloc, sizeof(struct Message), 1);
     out->_ad = buff;
     out->_adLen = 0;
@@ -29,6 +29,22 @@ Message_t* Message_new(uint32_t messageLength,
     return out;
 }
 
+Message_t* Message_new(uint32_t messageLength,
+                                          uint32_t amountOfPadding,
+                                          struct Allocator* alloc)
+{
+    uint8_t* buff = Allocator_malloc(alloc, messageLength + amountOfPadding);
+    return wrap(buff, messageLength, amountOfPadding, alloc);
+}
+
+Message_t* Message_newPooled(uint32_t messageLength,
+                             uint32_t amountOfPadding,
+                             struct Allocator* alloc)
+{
+    uint8_t* buff = Allocator_mallocPooled(alloc, messageLength + amountOfPadding);
+    return wrap(buff, messageLength, amountOfPadding, alloc);
+}
+
 struct Message* Message_new_fromRust(uint32_t messageLength,
                                           uint32_t amountOfPadding,
                                           struct Allocator* alloc)
@@ -36,6 +52,13 @@ struct Message* Message_new_fromRust(uint32_t messageLength,
     return Message_new(messageLength, amountOfPadding, alloc);
 }
 
+struct Message* Message_newPooled_fromRust(uint32_t messageLength,
+                                           uint32_t amountOfPadding,
+                                           struct Allocator* alloc)
+{
+    return Message_newPooled(messageLength, amountOfPadding, alloc);
+}
+
 void Message_setAssociatedFd(Message_t* msg, int fd)
 {
     if (fd == -1) {
@@ -76,4 +99,17 @@ Message_t* Message_clone(Message_t* toClone, struct Allocator* alloc)
         ._capacity = toClone->_capacity,
         ._alloc = alloc
     }));
-}
\ No newline at end of file
+}
+
+Message_t* Message_slice(Message_t* msg, uint32_t length, struct Allocator* alloc)
+{
+    Assert_true(length <= (uint32_t)msg->_length);
+    Message_t* out = Allocator_calloc(alloc, sizeof(struct Message), 1);
+    out->_ad = msg->_ad;
+    out->_adLen = 0;
+    out->_msgbytes = msg->_msgbytes;
+    out->_length = out->_capacity = length;
+    out->_padding = msg->_padding;
+    out->_alloc = alloc;
+    return out;
+}
@@ -102,12 +102,31 @@ struct Message* Message_new_fromRust(uint32_t messageLength,
                                           uint32_t amountOfPadding,
                                           struct Allocator* alloc);
 
+/**
+ * Same as Message_new() but the buffer comes from the packet buffer pool,
+ * see Allocator_mallocPooled(). Use this on receive paths.
+ */
+struct Message* Message_newPooled(uint32_t messageLength,
+                                  uint32_t amountOfPadding,
+                                  struct Allocator* alloc);
+
+struct Message* Message_newPooled_fromRust(uint32_t messageLength,
+                                           uint32_t amountOfPadding,
+                                           struct Allocator* alloc);
+
 void Message_setAssociatedFd(struct Message* msg, int fd);
 
 int Message_getAssociatedFd(struct Message* msg);
 
 struct Message* Message_clone(struct Message* toClone, struct Allocator* alloc);
 
+/**
+ * A message of the first length bytes of msg which shares its buffer rather than copying,
+ * everything in front of them becomes padding and nothing after them can be reached.
+ * It is only valid for as long as the buffer of msg is.
+ */
+struct Message* Message_slice(struct Message* msg, uint32_t length, struct Allocator* alloc);
+
 static inline Err_DEFUN Message_peakBytes(uint8_t** out, struct Message* msg, int32_t len)
 {
     if (len > msg->_length) {